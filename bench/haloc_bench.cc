@@ -0,0 +1,152 @@
+/**
+ * @file haloc_bench.cc
+ *
+ * @brief Microbenchmarks of the hashing and the database scan (Google
+ * Benchmark). Run with --benchmark_filter=<regex> to select them; the 1M
+ * entry databases need about 1 GB (float32 rows).
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "libhaloc/haloc.h"
+
+namespace {
+
+constexpr int kNumProj = 2;
+constexpr int kMaxDesc = 1024;
+constexpr int kDescDim = 128;
+constexpr int kHashDim = kNumProj*kDescDim;
+
+/**
+ * @brief      Gives access to the hash level API of the detector.
+ */
+class BenchHaloc : public haloc::Haloc {
+ public:
+  using haloc::Haloc::Haloc;
+  using haloc::Haloc::getBestCandidates;
+  using haloc::Haloc::insertHash;
+};
+
+cv::Mat randomDescriptors(const int &rows, std::mt19937 &rng) {
+  std::uniform_real_distribution<float> dist(0.0, 1.0);
+  cv::Mat desc(rows, kDescDim, CV_32F);
+  for (int r=0; r < rows; r++) {
+    float *row = desc.ptr<float>(r);
+    for (int c=0; c < kDescDim; c++) row[c] = dist(rng);
+  }
+  return desc;
+}
+
+std::vector<float> randomHash(std::mt19937 &rng) {
+  // Around 0.5, as the real hashes
+  std::normal_distribution<float> dist(0.5, 0.05);
+  std::vector<float> hash(kHashDim);
+  for (auto &h : hash) h = dist(rng);
+  return hash;
+}
+
+const haloc::Hash& sharedHash() {
+  static const haloc::Hash hash(kNumProj, kMaxDesc);
+  return hash;
+}
+
+/**
+ * @brief      Store of random hashes, built once per size and precision.
+ */
+const haloc::HashStore& sharedStore(const size_t &rows, const haloc::HashPrecision &precision) {
+  static std::map<std::pair<size_t, int>, std::unique_ptr<haloc::HashStore>> stores;
+  auto &store = stores[{rows, static_cast<int>(precision)}];
+  if (!store) {
+    std::mt19937 rng(1);
+    store = std::make_unique<haloc::HashStore>(precision);
+    store->reserve(rows);
+    for (size_t i=0; i < rows; i++) store->insert(i, randomHash(rng));
+  }
+  return *store;
+}
+
+/**
+ * @brief      Detector with random hashes, built once per size.
+ */
+BenchHaloc& sharedHaloc(const size_t &rows) {
+  static std::map<size_t, std::unique_ptr<BenchHaloc>> instances;
+  auto &haloc = instances[rows];
+  if (!haloc) {
+    std::mt19937 rng(1);
+    haloc::Config config;
+    config.num_proj = kNumProj;
+    config.max_desc = kMaxDesc;
+    haloc = std::make_unique<BenchHaloc>(config);
+    for (size_t i=0; i < rows; i++) haloc->insertHash(i, randomHash(rng));
+  }
+  return *haloc;
+}
+
+void BM_CalcHash(benchmark::State &state) {
+  std::mt19937 rng(1);
+  const cv::Mat desc = randomDescriptors(state.range(0), rng);
+  const auto &hash = sharedHash();
+  std::vector<float> out;
+  for (auto _ : state) {
+    hash.calcHash(desc, out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations()*desc.rows);
+}
+BENCHMARK(BM_CalcHash)->Arg(256)->Arg(kMaxDesc)->Arg(4*kMaxDesc);
+
+void BM_CalcSimilarity(benchmark::State &state) {
+  std::mt19937 rng(1);
+  const auto a = randomHash(rng);
+  const auto b = randomHash(rng);
+  const auto &hash = sharedHash();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash.calcSimilarity(a, b));
+  }
+}
+BENCHMARK(BM_CalcSimilarity);
+
+// Distances of a query to every stored hash (the full similarity scan)
+void BM_StoreDistances(benchmark::State &state) {
+  const auto precision = static_cast<haloc::HashPrecision>(state.range(1));
+  const auto &store = sharedStore(state.range(0), precision);
+  std::mt19937 rng(2);
+  const auto query = randomHash(rng);
+  std::vector<float> out;
+  for (auto _ : state) {
+    store.distances(query, out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations()*store.size());
+  state.SetBytesProcessed(state.iterations()*store.size()*store.rowBytes());
+}
+BENCHMARK(BM_StoreDistances)
+  ->ArgsProduct({{1000, 100000, 1000000}, {0, 1, 2}})
+  ->ArgNames({"entries", "precision"})
+  ->Unit(benchmark::kMicrosecond);
+
+void BM_GetBestCandidates(benchmark::State &state) {
+  auto &haloc = sharedHaloc(state.range(0));
+  std::mt19937 rng(2);
+  const auto query = randomHash(rng);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(haloc.getBestCandidates(query, 3));
+  }
+  state.SetItemsProcessed(state.iterations()*haloc.size());
+}
+BENCHMARK(BM_GetBestCandidates)
+  ->Arg(1000)->Arg(100000)->Arg(1000000)
+  ->ArgName("entries")
+  ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,173 @@
+/**
+ * @file haloc_recall.cc
+ *
+ * @brief Recall@K harness: runs a dataset through an exact float32 detector
+ * (the baseline) and through a detector with the options under test, and
+ * reports their recall against ground-truth loop pairs and the agreement of
+ * the test candidates with the baseline ones (haloc::recall()).
+ *
+ * Usage: haloc_recall <image_list> <loop_pairs> [options]
+ *   image_list   One image path per line, the image id is the line number (from 0)
+ *   loop_pairs   One "i j" pair of image ids per line, images that close a loop
+ * Options:
+ *   --k <n>            Candidates per query (5)
+ *   --ignore <n>       Previous images ignored by every query (50)
+ *   --num_proj <n>     Projections (2)
+ *   --max_desc <n>     Maximum descriptors (1024)
+ *   --precision <p>    Store precision of the test: f32, f16 or int8 (f32)
+ *   --binary <r>       Test with binary hashes, re-ranking r*K matches
+ *   --ann              Test with the approximate index (from the first image)
+ *   --width <w>        Test with the images downscaled to this width
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "libhaloc/haloc.h"
+
+namespace {
+
+struct Run {
+  std::vector<std::vector<haloc::Candidate>> candidates;  //!> Candidates of every image
+  double seconds = 0.0;                                   //!> Total processing time
+};
+
+Run run(
+    haloc::Haloc &haloc,
+    const std::vector<std::string> &images,
+    const int &k,
+    const int &ignore) {
+  Run result;
+  result.candidates.resize(images.size());
+  for (size_t i=0; i < images.size(); i++) {
+    const cv::Mat image = cv::imread(images[i], cv::IMREAD_GRAYSCALE);
+    haloc::IgnoreFilter filter;
+    filter.addRange(i > static_cast<size_t>(ignore) ? i - ignore : 0, i + 1);
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto candidates = haloc.processWithScores(i, image, k, filter);
+    result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (candidates) result.candidates[i] = *candidates;
+  }
+  return result;
+}
+
+/**
+ * @brief      Fraction of the queries with a reachable ground-truth loop (an
+ *             older, not ignored image) that get one in their candidates.
+ */
+double groundTruthRecall(
+    const Run &r,
+    const std::vector<std::set<uint>> &loops,
+    const int &ignore) {
+  size_t queries = 0;
+  size_t hits = 0;
+  for (size_t i=0; i < loops.size(); i++) {
+    const bool reachable = std::any_of(loops[i].begin(), loops[i].end(), [&](const uint &j) {
+      return j + ignore < i;
+    });
+    if (!reachable) continue;
+    queries++;
+    for (const auto &c : r.candidates[i]) {
+      if (loops[i].count(c.id) > 0) {
+        hits++;
+        break;
+      }
+    }
+  }
+  return queries == 0 ? 1.0 : static_cast<double>(hits) / queries;
+}
+
+void report(const std::string &name, const Run &r, const double &gt_recall, const size_t &num_images) {
+  std::cout << std::left << std::setw(10) << name
+            << " recall@K " << std::fixed << std::setprecision(3) << gt_recall
+            << "  mean process " << std::setprecision(2) << 1000.0*r.seconds / std::max<size_t>(1, num_images)
+            << " ms" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <image_list> <loop_pairs> [--k n] [--ignore n] [--num_proj n]"
+              << " [--max_desc n] [--precision f32|f16|int8] [--binary r] [--ann] [--width w]" << std::endl;
+    return 1;
+  }
+
+  int k = 5;
+  int ignore = 50;
+  haloc::Config baseline;
+  haloc::Config test;
+  for (int a=3; a < argc; a++) {
+    const std::string arg = argv[a];
+    const bool has_value = a + 1 < argc;
+    if (arg == "--k" && has_value) {
+      k = std::atoi(argv[++a]);
+    } else if (arg == "--ignore" && has_value) {
+      ignore = std::atoi(argv[++a]);
+    } else if (arg == "--num_proj" && has_value) {
+      baseline.num_proj = std::atoi(argv[++a]);
+    } else if (arg == "--max_desc" && has_value) {
+      baseline.max_desc = std::atoi(argv[++a]);
+    } else if (arg == "--precision" && has_value) {
+      const std::string p = argv[++a];
+      test.store_precision = p == "f16" ? haloc::HashPrecision::kFloat16 :
+                             p == "int8" ? haloc::HashPrecision::kInt8 : haloc::HashPrecision::kFloat32;
+    } else if (arg == "--binary" && has_value) {
+      test.use_binary = true;
+      test.binary_rerank = std::atoi(argv[++a]);
+    } else if (arg == "--ann") {
+      test.use_ann = true;
+      test.ann_min_size = 0;
+    } else if (arg == "--width" && has_value) {
+      test.extraction.target_width = std::atoi(argv[++a]);
+    } else {
+      std::cerr << "[haloc_recall]: ERROR -> Unknown option " << arg << "." << std::endl;
+      return 1;
+    }
+  }
+  test.num_proj = baseline.num_proj;
+  test.max_desc = baseline.max_desc;
+
+  // The dataset
+  std::vector<std::string> images;
+  std::ifstream image_list(argv[1]);
+  for (std::string line; std::getline(image_list, line); ) {
+    if (!line.empty()) images.push_back(line);
+  }
+  std::vector<std::set<uint>> loops(images.size());
+  std::ifstream loop_pairs(argv[2]);
+  for (uint i, j; loop_pairs >> i >> j; ) {
+    if (i >= images.size() || j >= images.size()) continue;
+    loops[i].insert(j);
+    loops[j].insert(i);
+  }
+  if (images.empty()) {
+    std::cerr << "[haloc_recall]: ERROR -> No images in " << argv[1] << "." << std::endl;
+    return 1;
+  }
+
+  haloc::Haloc baseline_haloc(baseline);
+  const Run reference = run(baseline_haloc, images, k, ignore);
+  haloc::Haloc test_haloc(test);
+  const Run result = run(test_haloc, images, k, ignore);
+
+  std::cout << images.size() << " images, K = " << k << std::endl;
+  report("baseline", reference, groundTruthRecall(reference, loops, ignore), images.size());
+  report("test", result, groundTruthRecall(result, loops, ignore), images.size());
+  std::cout << "agreement with the baseline " << std::setprecision(3)
+            << haloc::recall(reference.candidates, result.candidates) << std::endl;
+  return 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file aligned_allocator.h
+ *
+ * @brief Allocator that returns cache-line aligned blocks, used by the SIMD kernels.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace haloc {
+
+/**
+ * @brief      Standard allocator returning memory aligned to Alignment bytes.
+ *
+ * @tparam     T          The value type
+ * @tparam     Alignment  The alignment in bytes (power of two)
+ */
+template <typename T, std::size_t Alignment = 64>
+class AlignedAllocator {
+ public:
+  using value_type = T;
+
+  template <typename U>
+  struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+  AlignedAllocator() noexcept = default;
+
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+  T* allocate(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+  }
+
+  void deallocate(T *p, std::size_t) noexcept {
+    ::operator delete(p, std::align_val_t{Alignment});
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept {return true;}
+
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment> &) const noexcept {return false;}
+};
+
+//! Vector whose storage is aligned to a cache line
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+}  // namespace haloc
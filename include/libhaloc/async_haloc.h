@@ -0,0 +1,208 @@
+/**
+ * @file async_haloc.h
+ *
+ * @brief Asynchronous, pipelined front-end of the loop closure detector.
+ *
+ * The frames go through four stages, each one with its own thread(s) and a
+ * bounded lock-free input queue: prepare (decode / gray conversion) ->
+ * extract -> hash -> insert and query. Submitting a frame only queues it, so
+ * the caller (e.g. a camera callback) is never blocked by the extraction or the
+ * database scan, and the stages of consecutive frames run at the same time.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "libhaloc/bounded_queue.h"
+#include "libhaloc/haloc.h"
+
+namespace haloc {
+
+/**
+ * @brief      What to do when the queue of a stage is full.
+ */
+enum class DropPolicy {
+  kBlock,         //!> Wait for room (the caller latency then depends on the pipeline)
+  kDropOldest     //!> Drop the oldest queued frame (the caller is never blocked)
+};
+
+/**
+ * @brief      Pipeline parameters.
+ */
+struct AsyncParams {
+  std::size_t queue_size = 4;                       //!> Capacity of every stage queue (rounded up to a power of two)
+  DropPolicy drop_policy = DropPolicy::kDropOldest; //!> Policy of every stage queue
+  std::size_t extract_threads = 1;                  //!> Threads of the extraction stage (0 = all the cores but the other stages). With more than one, the frames may reach the database out of order.
+};
+
+/**
+ * @brief      Outcome of a submitted frame.
+ */
+enum class AsyncStatus {
+  kDone,          //!> Inserted and queried
+  kDropped,       //!> Dropped by a full queue
+  kFailed         //!> No descriptors, invalid image or rejected by the database
+};
+
+/**
+ * @brief      Result of a submitted frame.
+ */
+struct AsyncResult {
+  uint id = 0;                                      //!> The image identifier
+  AsyncStatus status = AsyncStatus::kFailed;        //!> The outcome
+  Status error = Status::kOk;                       //!> Why the frame failed or got no candidates
+  std::optional<std::vector<Candidate>> candidates; //!> The candidates, sorted from best to worst (as processWithScores())
+};
+
+class AsyncHaloc {
+ public:
+  //! Called with the result of every frame, from a pipeline thread
+  using Callback = std::function<void(const AsyncResult &)>;
+
+  /**
+   * @brief      Class constructor. Starts the pipeline threads.
+   *
+   * @param[in]  config  The configuration of the detector
+   * @param[in]  params  The pipeline parameters
+   */
+  explicit AsyncHaloc(const Config &config, const AsyncParams &params = AsyncParams());
+
+  /**
+   * @brief      Class destructor. The queued frames are completed first.
+   */
+  ~AsyncHaloc();
+
+  AsyncHaloc(const AsyncHaloc &) = delete;
+  AsyncHaloc& operator=(const AsyncHaloc &) = delete;
+
+  /**
+   * @brief      Queues a frame: it is inserted in the database and its loop
+   *             closure candidates are computed. The image is not copied, so
+   *             its pixels must not be modified until the frame is completed
+   *             (pass image.clone() if the buffer is reused).
+   *
+   * @param[in]  image_id          The unique image identifier
+   * @param[in]  image             The image
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore
+   * @param[in]  callback          Optional, called with the result
+   *
+   * @return     The future result
+   */
+  std::future<AsyncResult> submit(
+    const uint &image_id,
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {},
+    const Callback &callback = nullptr);
+
+  /**
+   * @brief      Same as submit(), for an encoded image (e.g. a JPEG of a
+   *             compressed image topic), decoded by the first stage.
+   *
+   * @param[in]  image_id          The unique image identifier
+   * @param[in]  data              The encoded image
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore
+   * @param[in]  callback          Optional, called with the result
+   *
+   * @return     The future result
+   */
+  std::future<AsyncResult> submitEncoded(
+    const uint &image_id,
+    std::vector<uchar> data,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {},
+    const Callback &callback = nullptr);
+
+  /**
+   * @brief      Waits until every submitted frame is completed.
+   */
+  void flush();
+
+  /**
+   * @brief      The detector. It must only be used while no frame is pending
+   *             (e.g. after flush()), the pipeline does not lock it.
+   *
+   * @return     The detector
+   */
+  inline Haloc& haloc() {return haloc_;}
+
+  inline std::size_t pending() const {return in_flight_.load(std::memory_order_acquire);}
+  inline std::size_t dropped() const {return dropped_.load(std::memory_order_relaxed);}
+
+ protected:
+  /**
+   * @brief      A frame going through the pipeline.
+   */
+  struct Job {
+    uint id;                                //!> The image identifier
+    int num_candidates;                     //!> The number of candidates to return
+    IgnoreFilter ignore;                    //!> The images to ignore
+    Callback callback;                      //!> Optional result callback
+    std::promise<AsyncResult> promise;      //!> The future result
+    std::vector<uchar> encoded;             //!> Encoded image (submitEncoded())
+    cv::Mat image;                          //!> The image
+    std::vector<cv::KeyPoint> kps;          //!> The keypoints
+    cv::Mat desc;                           //!> The descriptors
+    std::vector<float> hash;                //!> The hash
+  };
+  using JobPtr = std::unique_ptr<Job>;
+  using Queue = BoundedQueue<JobPtr>;
+
+  /**
+   * @brief      Creates a job and queues it in the first stage.
+   */
+  std::future<AsyncResult> enqueue(JobPtr job);
+
+  /**
+   * @brief      Queues a job, applying the drop policy if the queue is full.
+   */
+  void push(Queue &queue, JobPtr &job);
+
+  /**
+   * @brief      Waits for a job.
+   *
+   * @return     False if the pipeline is stopping and the queue is empty.
+   */
+  bool pop(Queue &queue, JobPtr &job);
+
+  /**
+   * @brief      Completes a job: sets its result and calls its callback.
+   *             The failures are reported in the result, not logged, so a
+   *             sequence without features does not write on every frame.
+   */
+  void complete(JobPtr job, const AsyncStatus &status, const Status &error = Status::kOk,
+                std::optional<std::vector<Candidate>> candidates = std::nullopt);
+
+  void prepareStage();                                      //!> Decode and gray conversion
+  void extractStage(std::unique_ptr<DescriptorExtractor> extractor);  //!> Keypoints and descriptors
+  void hashStage();                                         //!> Hash of the descriptors
+  void queryStage();                                        //!> Insertion and query (the only stage using the database)
+
+ private:
+  Haloc haloc_;                             //!> The detector
+  AsyncParams params_;                      //!> Pipeline parameters
+  Queue prepare_queue_;                     //!> Input of the prepare stage
+  Queue extract_queue_;                     //!> Input of the extraction stage
+  Queue hash_queue_;                        //!> Input of the hash stage
+  Queue query_queue_;                       //!> Input of the query stage
+  std::atomic<bool> stop_{false};           //!> True when destroying the pipeline
+  std::atomic<std::size_t> in_flight_{0};   //!> Frames submitted and not completed
+  std::atomic<std::size_t> dropped_{0};     //!> Frames dropped by a full queue
+  std::vector<std::thread> threads_;        //!> Pipeline threads
+};
+
+}  // namespace haloc
@@ -0,0 +1,118 @@
+/**
+ * @file binary_store.h
+ *
+ * @brief Contiguous storage for the binary image hashes.
+ *
+ * Every row is the sign-bit code of a hash (one bit per element, packed in
+ * 64-bit words), so the store needs 32 times less memory than the float
+ * hashes and is compared with popcount.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "libhaloc/aligned_allocator.h"
+
+namespace haloc {
+
+//! Binary hash: one bit per hash element, packed in 64-bit words
+using BinaryHash = std::vector<uint64_t>;
+
+class BinaryStore {
+ public:
+  /**
+   * @brief      Class constructor.
+   */
+  BinaryStore() = default;
+
+  /**
+   * @brief      Inserts (or replaces) the binary hash of an image. The first
+   *             hash fixes the number of words of the store.
+   *
+   * @param[in]  id    The image identifier
+   * @param[in]  hash  The binary hash
+   *
+   * @return     False if the hash is empty or its size does not match the store.
+   */
+  bool insert(const uint &id, const BinaryHash &hash);
+
+  /**
+   * @brief      Removes the hash of an image in O(1) (the last row is moved
+   *             to its place).
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     False if the image is not stored.
+   */
+  bool erase(const uint &id);
+
+  /**
+   * @brief      Releases the memory of the erased rows.
+   */
+  void compact();
+
+  /**
+   * @brief      Reserves memory for a number of hashes.
+   *
+   * @param[in]  num_hashes  The number of hashes
+   */
+  void reserve(const std::size_t &num_hashes);
+
+  /**
+   * @brief      Removes all the hashes.
+   */
+  void clear();
+
+  /**
+   * @brief      Computes the Hamming distance between the query and a block of rows.
+   *
+   * @param[in]  query  The query (words() elements)
+   * @param[in]  begin  The first row
+   * @param[in]  count  The number of rows
+   * @param[out] out    The distances, in bits (count elements)
+   */
+  void distances(
+    const uint64_t *query,
+    const std::size_t &begin,
+    const std::size_t &count,
+    uint32_t *out) const;
+
+  /**
+   * @brief      Determines if an image is stored.
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     True if stored.
+   */
+  inline bool contains(const uint &id) const {return index_.count(id) > 0;}
+
+  /**
+   * @brief      Bytes used by the hashes and ids.
+   *
+   * @return     The number of bytes
+   */
+  inline std::size_t bytes() const {return ids_.size()*(words_*sizeof(uint64_t) + sizeof(uint));}
+
+  inline bool empty() const {return ids_.empty();}
+  inline std::size_t size() const {return ids_.size();}
+  inline std::size_t words() const {return words_;}
+  inline const uint64_t* row(const std::size_t &i) const {return data_.data() + i*words_;}
+  inline uint id(const std::size_t &i) const {return ids_[i];}
+
+ private:
+  std::size_t words_ = 0;                             //!> Words per row
+  AlignedVector<uint64_t> data_;                      //!> Row-major binary hashes
+  std::vector<uint> ids_;                             //!> Image id of every row
+  std::unordered_map<uint, std::size_t> index_;       //!> Row of every image id
+};
+
+}  // namespace haloc
@@ -0,0 +1,115 @@
+/**
+ * @file bounded_queue.h
+ *
+ * @brief Bounded lock-free multi-producer multi-consumer queue.
+ *
+ * A ring of cells with one sequence counter each (D. Vyukov's bounded MPMC
+ * queue): producers and consumers claim a position with a single CAS and never
+ * wait for each other, and a full or empty queue is reported instead of
+ * blocking, so the caller decides what to do (wait, drop...).
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace haloc {
+
+template <typename T>
+class BoundedQueue {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  capacity  The maximum number of elements (rounded up to a
+   *                       power of two, at least 2)
+   */
+  explicit BoundedQueue(const std::size_t &capacity) {
+    std::size_t size = 2;
+    while (size < capacity) size *= 2;
+    cells_.reset(new Cell[size]);
+    mask_ = size - 1;
+    for (std::size_t i=0; i < size; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue& operator=(const BoundedQueue &) = delete;
+
+  /**
+   * @brief      Appends an element, if there is room.
+   *
+   * @param      value  The element, moved from only if it is queued
+   *
+   * @return     False if the queue is full.
+   */
+  bool tryPush(T &value) {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief      Removes the oldest element, if any.
+   *
+   * @param[out] value  The element
+   *
+   * @return     False if the queue is empty.
+   */
+  bool tryPop(T &value) {
+    std::size_t pos = head_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(cell->value);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  inline std::size_t capacity() const {return mask_ + 1;}
+
+ private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;    //!> Position the cell is ready for
+    T value;                              //!> The element
+  };
+
+  std::unique_ptr<Cell[]> cells_;                     //!> The ring
+  std::size_t mask_ = 0;                              //!> Capacity - 1
+  alignas(64) std::atomic<std::size_t> head_{0};      //!> Next position to pop
+  alignas(64) std::atomic<std::size_t> tail_{0};      //!> Next position to push
+};
+
+}  // namespace haloc
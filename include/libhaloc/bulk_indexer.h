@@ -0,0 +1,126 @@
+/**
+ * @file bulk_indexer.h
+ *
+ * @brief Offline construction of a hash database from image files.
+ *
+ * A reader thread loads the encoded files ahead of the workers (bounded
+ * lock-free queue), so the disk I/O overlaps the computation. Every worker
+ * decodes and extracts its images with its own extractor and hashes them in
+ * batches (Hash::calcHashBatch()). The hashes are bitwise the ones of
+ * Haloc::insert() and are inserted in the order of the list, so the database
+ * does not depend on the number of workers, and save() writes the file read
+ * by Haloc::load().
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "libhaloc/haloc.h"
+
+namespace haloc {
+
+/**
+ * @brief      An image to index.
+ */
+struct IndexEntry {
+  uint id;                //!> The image identifier
+  std::string path;       //!> The image file
+};
+
+/**
+ * @brief      Parameters of the bulk indexer.
+ */
+struct BulkIndexParams {
+  std::size_t workers = 0;                  //!> Decoding, extraction and hashing threads (0 = one per core)
+  std::size_t batch_size = 32;              //!> Images extracted before they are hashed and handed over
+  std::size_t read_ahead = 64;              //!> Encoded files read ahead of the workers (rounded up to a power of two)
+  int imread_flags = cv::IMREAD_GRAYSCALE;  //!> Flags of cv::imdecode()
+};
+
+/**
+ * @brief      Outcome of BulkIndexer::index().
+ */
+struct BulkIndexReport {
+  std::size_t indexed = 0;                          //!> Images inserted in the database
+  std::vector<std::pair<uint, Status>> failed;      //!> The images that could not be inserted, and why
+  double seconds = 0.0;                             //!> Wall time
+};
+
+class BulkIndexer {
+ public:
+  //! Called from a worker thread with the number of images done and the total
+  using Progress = std::function<void(const std::size_t &, const std::size_t &)>;
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  config  The configuration of the detector (of the database)
+   * @param[in]  params  The indexer parameters
+   */
+  explicit BulkIndexer(const Config &config, const BulkIndexParams &params = BulkIndexParams());
+
+  /**
+   * @brief      Indexes a list of images. It can be called several times, the
+   *             images are added to the database.
+   *
+   * @param[in]  entries   The images
+   * @param[in]  progress  Optional, called after every inserted batch
+   *
+   * @return     The report
+   */
+  BulkIndexReport index(const std::vector<IndexEntry> &entries, const Progress &progress = nullptr);
+
+  /**
+   * @brief      Saves the database (see Haloc::save()).
+   *
+   * @param[in]  filename  The file
+   *
+   * @return     True if the database has been saved.
+   */
+  inline bool save(const std::string &filename) {return haloc_.save(filename);}
+
+  /**
+   * @brief      The detector that holds the database. It must not be used
+   *             during index().
+   *
+   * @return     The detector
+   */
+  inline Haloc& haloc() {return haloc_;}
+
+  /**
+   * @brief      Lists the images of a directory (by extension), sorted by
+   *             name and numbered from first_id.
+   *
+   * @param[in]  directory  The directory
+   * @param[in]  first_id   The identifier of the first image
+   *
+   * @return     The images (empty if the directory cannot be read)
+   */
+  static std::vector<IndexEntry> listDirectory(const std::string &directory, const uint &first_id = 0);
+
+  /**
+   * @brief      Reads a list of images: one "path" or "id path" per line.
+   *             Without an id, the image identifier is the line number (from 0).
+   *
+   * @param[in]  filename  The list file
+   *
+   * @return     The images (empty if the file cannot be read)
+   */
+  static std::vector<IndexEntry> listFile(const std::string &filename);
+
+ private:
+  Haloc haloc_;                 //!> The detector that holds the database
+  BulkIndexParams params_;      //!> Parameters
+};
+
+}  // namespace haloc
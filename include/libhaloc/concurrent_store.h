@@ -0,0 +1,310 @@
+/**
+ * @file concurrent_store.h
+ *
+ * @brief Hash store for one writer and many lock-free readers (e.g. a mapping
+ * thread inserting keyframes while several relocalization threads query).
+ *
+ * The rows are appended to an arena of chunks that never move: chunk k holds
+ * first_chunk*2^k rows, so a fixed directory of chunk pointers covers any
+ * size and no row is ever reallocated. Every insert or erase is a new version
+ * of the store: a row records the version that added it and the one that
+ * erased it, and the writer publishes the version with a release store once
+ * the row is complete. A query acquires the version once (its snapshot) and
+ * only sees the rows added at or before it and not erased at or before it, so
+ * the later inserts, erases and replacements do not change what it sees. No
+ * lock is taken, and an insert never waits for the running queries.
+ *
+ * A replacement erases the old row and appends the new one in the same
+ * version, so a query sees exactly one of them. The rows are never modified
+ * in place: the erased and replaced rows keep their memory until compact()
+ * copies the stored images to a new arena of chunks. The queries register in
+ * one of two reader epochs (a shared counter, no lock), so the old arena is
+ * released once the queries that may read it are done. The rows are float32
+ * (see HashStore for the compact encodings and the persistent file).
+ *
+ * This store is standalone: Haloc keeps its own HashStore, which needs a
+ * single thread (or Haloc::processAsync()) to insert and query. Use this one
+ * with Hash::calcHash() when the inserts and the queries run on different
+ * threads.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "libhaloc/aligned_allocator.h"
+#include "libhaloc/hash_store.h"
+#include "libhaloc/ignore_filter.h"
+#include "libhaloc/scan.h"
+#include "libhaloc/status.h"
+#include "libhaloc/top_k.h"
+
+namespace haloc {
+
+class ConcurrentHashStore {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  first_chunk  Rows of the first chunk (rounded up to a power of
+   *                          two), the next ones double it
+   */
+  explicit ConcurrentHashStore(const std::size_t &first_chunk = 1024);
+
+  /**
+   * @brief      Class destructor.
+   */
+  ~ConcurrentHashStore();
+
+  ConcurrentHashStore(const ConcurrentHashStore &) = delete;
+  ConcurrentHashStore& operator=(const ConcurrentHashStore &) = delete;
+
+  /**
+   * @brief      Inserts (or replaces) the hash of an image. The first hash
+   *             fixes the dimension of the store. The writers are serialized,
+   *             the running queries are not blocked.
+   *
+   * @param[in]  id    The image identifier
+   * @param[in]  hash  The image hash
+   *
+   * @return     kOk, or kSizeMismatch if the hash is empty or its size does
+   *             not match the store.
+   */
+  Status insert(const uint &id, const std::vector<float> &hash);
+
+  /**
+   * @brief      Removes the hash of an image. The snapshots taken before keep
+   *             seeing it (until compact()).
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     False if the image is not stored.
+   */
+  bool erase(const uint &id);
+
+  /**
+   * @brief      Releases the memory of the erased and replaced rows: the rows
+   *             still visible after oldest_snapshot are copied to new chunks,
+   *             which replace the current ones for the next queries. The old
+   *             chunks are freed once the running queries are done. The
+   *             writers (not the queries) wait for the copy and for them.
+   *             Without compactions the store grows with every replacement,
+   *             until insert() returns kInvalidArgument (kMaxChunks).
+   *
+   * @param[in]  oldest_snapshot  The oldest snapshot the queries still use
+   *                              (kLatest = the current version). The older
+   *                              ones lose the rows erased since them.
+   */
+  void compact(const uint64_t &oldest_snapshot = kLatest);
+
+  /**
+   * @brief      Determines if an image is stored (takes the writer lock).
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     True if stored.
+   */
+  bool contains(const uint &id) const;
+
+  /**
+   * @brief      The current version of the store, without locking. Passed to
+   *             query() it makes several queries see the same content, even if
+   *             images are inserted, erased or replaced in between.
+   *
+   * @return     The snapshot
+   */
+  inline uint64_t snapshot() const {return version_.load(std::memory_order_acquire);}
+
+  /**
+   * @brief      Number of rows, including the erased ones (without locking).
+   *
+   * @return     The number of rows
+   */
+  std::size_t rows() const;
+
+  /**
+   * @brief      Number of erased and replaced rows, released by compact()
+   *             (takes the writer lock).
+   *
+   * @return     The number of rows
+   */
+  std::size_t deadRows() const;
+
+  /**
+   * @brief      Number of stored images (takes the writer lock).
+   *
+   * @return     The number of images
+   */
+  std::size_t size() const;
+
+  inline bool empty() const {return rows() == 0;}
+
+  /**
+   * @brief      Gets the best candidates of a hash, without locking. The
+   *             images of a snapshot are scanned (by default the current one
+   *             when the query starts), the concurrent changes are not seen.
+   *
+   * @param[in]  hash              The query hash
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore
+   * @param[in]  snapshot          The snapshot to scan (a previous snapshot())
+   * @param[in]  params            Options of the scan (early abandon, the
+   *                                blocks are compared in their natural order)
+   *
+   * @return     The candidates (L2 distance), sorted from best to worst, or
+   *             kSizeMismatch if the hash does not match the store.
+   */
+  Result<std::vector<Candidate>> query(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {},
+    const uint64_t &snapshot = kLatest,
+    const ScanParams &params = ScanParams()) const;
+
+  /**
+   * @brief      Saves the stored images to a HashStore file (see
+   *             HashStore::save(), it can be loaded by Haloc::load()).
+   *
+   * @param[in]  filename  The file
+   * @param[in]  info      The parameters of the hashes
+   *
+   * @return     True if the store has been saved.
+   */
+  bool save(const std::string &filename, const HashStoreInfo &info) const;
+
+  //! Hash dimension (0 while the store is empty)
+  inline std::size_t dim() const {return empty() ? 0 : dim_;}
+
+  //! Bytes of the allocated chunks (takes the writer lock)
+  std::size_t bytes() const;
+
+  //! Maximum number of chunks (first_chunk*(2^kMaxChunks - 1) rows)
+  static constexpr std::size_t kMaxChunks = 40;
+
+  //! Snapshot of query() that means the current version
+  static constexpr uint64_t kLatest = std::numeric_limits<uint64_t>::max();
+
+ protected:
+  /**
+   * @brief      A block of rows, allocated once.
+   */
+  struct Chunk {
+    AlignedVector<float> rows;                      //!> Row-major hashes (stride_ elements each, zero padding)
+    std::vector<uint> ids;                          //!> Image id of every row
+    std::vector<uint64_t> added;                    //!> Version that added every row
+    std::unique_ptr<std::atomic<uint64_t>[]> erased;  //!> Version that erased every row (kLatest = stored)
+  };
+
+  /**
+   * @brief      The chunks of the rows, replaced by compact().
+   */
+  struct Arena {
+    Arena();
+    ~Arena();
+
+    std::array<std::atomic<Chunk*>, kMaxChunks> chunks;  //!> The chunks (owned, never moved)
+    std::atomic<std::size_t> size{0};                    //!> Published rows (published before their version)
+  };
+
+  /**
+   * @brief      Registers a query in the current reader epoch while it reads
+   *             an arena, so compact() does not release it.
+   */
+  class ReadGuard {
+   public:
+    explicit ReadGuard(const ConcurrentHashStore &store);
+    ~ReadGuard();
+
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard& operator=(const ReadGuard &) = delete;
+
+   private:
+    const ConcurrentHashStore &store_;  //!> The store
+    std::size_t slot_;                  //!> Reader counter of the epoch
+  };
+
+  /**
+   * @brief      Determines if a row belongs to a snapshot.
+   *
+   * @param[in]  chunk     The chunk of the row
+   * @param[in]  offset    The row in the chunk
+   * @param[in]  snapshot  The snapshot
+   *
+   * @return     True if it was added and not erased at the snapshot.
+   */
+  inline static bool visible(const Chunk &chunk, const std::size_t &offset, const uint64_t &snapshot) {
+    return chunk.added[offset] <= snapshot && chunk.erased[offset].load(std::memory_order_acquire) > snapshot;
+  }
+
+  /**
+   * @brief      Chunk and row in the chunk of a row.
+   *
+   * @param[in]  r       The row
+   * @param[out] chunk   The chunk
+   * @param[out] offset  The row in the chunk
+   */
+  inline void locate(const std::size_t &r, std::size_t &chunk, std::size_t &offset) const {
+    chunk = 0;
+    std::size_t q = r / first_chunk_ + 1;
+    while (q >>= 1) chunk++;
+    offset = r - first_chunk_*((std::size_t{1} << chunk) - 1);
+  }
+
+  //! Rows of a chunk
+  inline std::size_t chunkRows(const std::size_t &chunk) const {return first_chunk_ << chunk;}
+
+  /**
+   * @brief      Appends a row to an arena (writer side, the row is not
+   *             published).
+   *
+   * @param      arena   The arena
+   * @param[in]  id      The image identifier
+   * @param[in]  row     The hash (dim_ elements)
+   * @param[in]  added   Version that added it
+   * @param[in]  erased  Version that erased it (kLatest = stored)
+   * @param[out] r       The row
+   *
+   * @return     False if the arena is full (kMaxChunks).
+   */
+  bool append(
+    Arena &arena,
+    const uint &id,
+    const float *row,
+    const uint64_t &added,
+    const uint64_t &erased,
+    std::size_t &r) const;
+
+  /**
+   * @brief      Waits until the queries that may read a replaced arena are
+   *             done (two epoch flips).
+   */
+  void waitForReaders() const;
+
+ private:
+  std::size_t first_chunk_;                               //!> Rows of the first chunk
+  std::size_t dim_ = 0;                                   //!> Hash dimension (written before the first row is published, then fixed)
+  std::size_t stride_ = 0;                                //!> Row stride (dim_ rounded up to HashStore::kRowAlignment)
+  std::atomic<Arena*> arena_;                             //!> The current chunks (owned)
+  std::atomic<uint64_t> version_{0};                      //!> Inserts and erases so far
+  std::unordered_map<uint, std::size_t> index_;           //!> Row of every stored image (writer side)
+  std::size_t dead_rows_ = 0;                             //!> Erased and replaced rows of the arena (writer side)
+  mutable std::atomic<uint64_t> epoch_{0};                //!> Reader epoch (flipped by compact())
+  mutable std::array<std::atomic<std::size_t>, 2> readers_;  //!> Running queries of the even and odd epochs
+  mutable std::mutex writer_mutex_;                       //!> Serializes the writers (never taken by the queries)
+};
+
+}  // namespace haloc
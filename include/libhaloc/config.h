@@ -0,0 +1,81 @@
+/**
+ * @file config.h
+ *
+ * @brief Configuration of the loop closure detector.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libhaloc/descriptor_store.h"
+#include "libhaloc/extractor.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_store.h"
+#include "libhaloc/hnsw.h"
+#include "libhaloc/retention.h"
+#include "libhaloc/scan.h"
+#include "libhaloc/temporal_cache.h"
+#include "libhaloc/stats.h"
+#include "libhaloc/thread_pool.h"
+
+namespace haloc {
+
+struct Config {
+  int num_proj = 2;                           //!> The number of projections
+  int max_desc = 1024;                        //!> The maximum number of descriptors
+  uint32_t seed = Hash::kDefaultSeed;         //!> Seed of the projection basis (same seed = comparable hashes)
+  std::string basis_file;                     //!> Optional basis file: loaded if it exists, created otherwise
+
+  // Features
+  std::shared_ptr<DescriptorExtractor> extractor;  //!> Descriptor extractor (nullptr = the one of descriptor, with max_desc features)
+  DescriptorType descriptor = DescriptorType::kSift;  //!> Default extractor: SIFT, or ORB / AKAZE (binary, much cheaper)
+  int desc_dim = 0;                           //!> Columns of the descriptors, e.g. 256 for SuperPoint (0 = the ones of the default extractor, any with a custom one)
+  SubsampleParams subsample;                  //!> Selection of the descriptors hashed when an image has more than max_desc
+  ExtractionParams extraction;                //!> Optional ROI / downscaling of the images before the extraction (the biggest latency lever on large images)
+  int grid_cols = 0;                          //!> Default extractor: columns of the adaptive detection grid (0 = no grid)
+  int grid_rows = 0;                          //!> Default extractor: rows of the adaptive detection grid (0 = no grid)
+
+  // Storage
+  HashPrecision store_precision = HashPrecision::kFloat32;   //!> Encoding of the stored hashes (float16 / int8 use 1/2 / 1/4 of the memory)
+  size_t int8_calibration_size = 256;         //!> Hashes used to calibrate the int8 quantization
+  bool keep_descriptors = false;              //!> Keep the descriptors of the stored images, so Haloc::rebuild() can rehash them with another basis
+  DescriptorPrecision descriptor_precision = DescriptorPrecision::kFloat32;  //!> Encoding of the kept descriptors (kUInt8 is lossless for SIFT, kFloat16 for the -1/+1 binary descriptors)
+
+  // Retention (bounded memory)
+  size_t max_entries = 0;                     //!> Maximum number of images in the database (0 = unbounded)
+  RetentionPolicy retention = RetentionPolicy::kOldest;  //!> Image evicted when the database is full
+  std::function<std::vector<uint>(const uint &)> decimate;  //!> Optional: called after every insert with the new image id, returns the images to erase (e.g. spatially redundant). It must not call the Haloc instance.
+  size_t compact_interval = 1024;             //!> Erased images between automatic compactions (0 = only Haloc::compact())
+
+  // Binary hashes
+  bool use_binary = false;                    //!> Scan sign-bit hashes (Hash::binarize()) with the Hamming distance
+  size_t binary_rerank = 4;                   //!> The best binary_rerank*K binary matches are re-ranked with the float distance (0 = binary only, float hashes are not stored)
+
+  // Instrumentation (only with HALOC_ENABLE_STATS)
+  std::function<void(const CallStats &)> stats_callback;  //!> Optional: called at the end of every query with its stage latencies
+
+  // Parallelism
+  std::shared_ptr<ThreadPool> thread_pool;    //!> Optional pool used to split the database scan (nullptr = single thread)
+  size_t min_rows_per_task = 8192;            //!> Minimum number of stored hashes scanned by each task
+
+  // Exact scan
+  ScanParams scan;                            //!> Early abandon of the rows that cannot enter the top-K (same candidates as the full scan)
+  TemporalParams temporal;                    //!> Seed every query with the candidates of the previous one (consecutive frames)
+
+  // Approximate search (the exact scan is still used for small databases,
+  // for the batch queries and as fallback)
+  bool use_ann = false;                       //!> Index the hashes in an HNSW graph
+  HnswIndex::Params ann;                      //!> Graph parameters (ann.ef_search is the recall/latency knob)
+  size_t ann_min_size = 10000;                //!> Exact scan while the database is smaller than this
+  size_t ann_rerank = 4;                      //!> The graph returns ann_rerank*K candidates, re-ranked with the exact distance
+};
+
+}  // namespace haloc
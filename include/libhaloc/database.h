@@ -0,0 +1,178 @@
+/**
+ * @file database.h
+ *
+ * @brief Hash database made of several named shards (e.g. one per robot or
+ * session of a multi-robot map).
+ *
+ * Every shard is an independent HashStore, so a whole shard can be attached
+ * from a store file (memory-mapped, no rehashing) or detached at once. All the
+ * shards share one projection basis, which is checked when they are attached,
+ * so the hashes stay comparable. The queries scan the selected shards in
+ * parallel and merge their candidates into a global top-K.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_store.h"
+#include "libhaloc/ignore_filter.h"
+#include "libhaloc/status.h"
+#include "libhaloc/thread_pool.h"
+#include "libhaloc/top_k.h"
+
+namespace haloc {
+
+/**
+ * @brief      A candidate of a database query: the shard, the image id in the
+ *             shard and its hash distance to the query.
+ */
+struct ShardCandidate {
+  std::string shard;
+  uint id;
+  float score;
+};
+
+class Database {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash               The projection basis shared by all the shards
+   * @param[in]  thread_pool        Optional pool used to scan the shards in parallel
+   * @param[in]  min_rows_per_task  Minimum number of stored hashes scanned by
+   *                                each task (large shards are split)
+   */
+  explicit Database(
+    const std::shared_ptr<const Hash> &hash,
+    const std::shared_ptr<ThreadPool> &thread_pool = nullptr,
+    const std::size_t &min_rows_per_task = 8192);
+
+  /**
+   * @brief      Creates an empty shard.
+   *
+   * @param[in]  name       The shard name
+   * @param[in]  precision  The encoding of its hashes
+   *
+   * @return     False if the shard already exists.
+   */
+  bool create(const std::string &name, const HashPrecision &precision = HashPrecision::kFloat32);
+
+  /**
+   * @brief      Attaches a store file (Haloc::save() or save()) as a shard.
+   *
+   * @param[in]  name      The shard name
+   * @param[in]  filename  The store file
+   * @param[in]  use_mmap  Map the file instead of reading it
+   *
+   * @return     False if the shard exists, the file cannot be loaded or its
+   *             hashes were computed with another projection basis.
+   */
+  bool attach(const std::string &name, const std::string &filename, const bool &use_mmap = true);
+
+  /**
+   * @brief      Removes a shard.
+   *
+   * @param[in]  name  The shard name
+   *
+   * @return     False if the shard does not exist.
+   */
+  bool detach(const std::string &name);
+
+  /**
+   * @brief      Saves a shard to a store file.
+   *
+   * @param[in]  name      The shard name
+   * @param[in]  filename  The file
+   *
+   * @return     True if the shard has been saved.
+   */
+  bool save(const std::string &name, const std::string &filename) const;
+
+  /**
+   * @brief      Inserts (or replaces) the hash of an image in a shard.
+   *
+   * @param[in]  name  The shard name
+   * @param[in]  id    The image identifier (unique in the shard)
+   * @param[in]  hash  The hash, computed with hash()
+   *
+   * @return     kOk, kUnknownShard or kSizeMismatch
+   */
+  Status insert(const std::string &name, const uint &id, const std::vector<float> &hash);
+
+  /**
+   * @brief      Removes the hash of an image from a shard.
+   *
+   * @param[in]  name  The shard name
+   * @param[in]  id    The image identifier
+   *
+   * @return     False if the image is not stored.
+   */
+  bool erase(const std::string &name, const uint &id);
+
+  /**
+   * @brief      Gets the best candidates of a hash among several shards.
+   *
+   * @param[in]  hash              The query hash
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  shards            The shards to query (empty = all)
+   * @param[in]  images_to_ignore  The images to ignore, applied to the ids of
+   *                               every queried shard
+   *
+   * @return     The candidates, sorted from best to worst (ties by shard name
+   *             and id), kUnknownShard if a selected shard does not exist or
+   *             kSizeMismatch if the hash does not match a non-empty shard
+   */
+  Result<std::vector<ShardCandidate>> query(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const std::vector<std::string> &shards = {},
+    const IgnoreFilter &images_to_ignore = {}) const;
+
+  /**
+   * @brief      The names of the shards.
+   *
+   * @return     The names, sorted
+   */
+  std::vector<std::string> shards() const;
+
+  /**
+   * @brief      Number of hashes, in one shard or in all of them.
+   *
+   * @param[in]  name  The shard name (empty = all the shards)
+   *
+   * @return     The number of hashes (0 if the shard does not exist)
+   */
+  std::size_t size(const std::string &name = "") const;
+
+  bool contains(const std::string &name) const;
+
+  inline const Hash& hash() const {return *hash_;}
+
+ protected:
+  /**
+   * @brief      The parameters of the hashes of the shards.
+   *
+   * @param[in]  store  The store of a shard
+   *
+   * @return     The parameters
+   */
+  HashStoreInfo storeInfo(const HashStore &store) const;
+
+ private:
+  std::shared_ptr<const Hash> hash_;                          //!> Shared projection basis
+  std::shared_ptr<ThreadPool> thread_pool_;                   //!> Optional pool
+  std::size_t min_rows_per_task_;                             //!> Minimum rows scanned by each task
+  std::map<std::string, std::unique_ptr<HashStore>> shards_;  //!> The shards, by name
+  mutable std::shared_mutex mutex_;                           //!> Queries share it, the shard changes are exclusive
+};
+
+}  // namespace haloc
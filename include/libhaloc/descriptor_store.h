@@ -0,0 +1,114 @@
+/**
+ * @file descriptor_store.h
+ *
+ * @brief Side store of the descriptors (and keypoints) of the stored images.
+ *
+ * The hash of an image only depends on its descriptors and on the projection
+ * basis, so keeping the descriptors allows rehashing the whole database with
+ * another num_proj / max_desc / seed (Haloc::rebuild()) without extracting the
+ * features again. The descriptors can be kept in half precision or as bytes
+ * (lossless for SIFT, whose elements are integers in [0, 255], and for the
+ * binary descriptors).
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace haloc {
+
+/**
+ * @brief      Encoding of the kept descriptors.
+ */
+enum class DescriptorPrecision {
+  kFloat32,     //!> 4 bytes per element, exact
+  kFloat16,     //!> 2 bytes per element
+  kUInt8        //!> 1 byte per element, rounded and clamped to [0, 255]
+};
+
+class DescriptorStore {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  precision  The encoding of the descriptors
+   */
+  explicit DescriptorStore(const DescriptorPrecision &precision = DescriptorPrecision::kFloat32);
+
+  /**
+   * @brief      Inserts (or replaces) the descriptors of an image.
+   *
+   * @param[in]  id    The image identifier
+   * @param[in]  desc  The descriptors (one per row, any depth)
+   * @param[in]  kps   Their keypoints (can be empty, only used to subsample)
+   *
+   * @return     False if the descriptors are empty or their length does not
+   *             match the stored ones.
+   */
+  bool insert(const uint &id, const cv::Mat &desc, const std::vector<cv::KeyPoint> &kps);
+
+  /**
+   * @brief      Removes the descriptors of an image.
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     False if the image is not stored.
+   */
+  bool erase(const uint &id);
+
+  /**
+   * @brief      Decodes the descriptors of an image.
+   *
+   * @param[in]  id    The image identifier
+   * @param[out] desc  The descriptors (CV_32F, reused if the size is the same)
+   * @param[out] kps   Their keypoints
+   *
+   * @return     False if the image is not stored.
+   */
+  bool get(const uint &id, cv::Mat &desc, std::vector<cv::KeyPoint> &kps) const;
+
+  void clear();
+
+  inline bool contains(const uint &id) const {return entries_.count(id) > 0;}
+  inline std::size_t size() const {return entries_.size();}
+  inline bool empty() const {return entries_.empty();}
+  inline int cols() const {return cols_;}
+  inline DescriptorPrecision precision() const {return precision_;}
+
+  /**
+   * @brief      Memory used by the descriptors and the keypoints.
+   *
+   * @return     The number of bytes
+   */
+  inline std::size_t bytes() const {return bytes_;}
+
+ private:
+  /**
+   * @brief      The kept data of an image.
+   */
+  struct Entry {
+    int rows = 0;                         //!> Number of descriptors
+    std::vector<uint8_t> data;            //!> Encoded descriptors (row-major)
+    std::vector<cv::KeyPoint> kps;        //!> Keypoints (empty or one per row)
+  };
+
+  /**
+   * @brief      Bytes used by an entry.
+   */
+  std::size_t entryBytes(const Entry &entry) const;
+
+  DescriptorPrecision precision_;                 //!> Encoding
+  int cols_ = 0;                                  //!> Descriptor length (set by the first insert)
+  std::size_t bytes_ = 0;                         //!> Memory used
+  std::unordered_map<uint, Entry> entries_;       //!> The kept data, by image id
+};
+
+}  // namespace haloc
@@ -0,0 +1,263 @@
+/**
+ * @file distance.h
+ *
+ * @brief Vectorized distance kernels used to compare hashes.
+ *
+ * The best implementation for the running CPU (AVX-512, AVX2, NEON or plain
+ * scalar code) is selected once at runtime. The float kernels are also
+ * compiled for the usual row lengths (see l2DistanceSpecialized()), fully
+ * unrolled and without length checks; the other lengths use the dynamic
+ * kernels.
+ *
+ * The squared variants skip the square root: the scan ranks the rows on
+ * squared distances (the order is the same) and only takes the root of the
+ * selected candidates.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace haloc {
+
+//! Elements per block of the bounded kernels (one AVX-512 register)
+constexpr std::size_t kDistanceBlock = 16;
+
+/**
+ * @brief      Euclidean distance between two float vectors.
+ *
+ * @param[in]  a     The vector a
+ * @param[in]  b     The vector b
+ * @param[in]  dim   The number of elements of both vectors
+ *
+ * @return     The L2 distance
+ */
+float l2Distance(const float *a, const float *b, const std::size_t &dim);
+
+/**
+ * @brief      Squared Euclidean distance between two float vectors.
+ */
+float squaredL2Distance(const float *a, const float *b, const std::size_t &dim);
+
+/**
+ * @brief      Euclidean distance between one query and a block of rows.
+ *
+ * @param[in]  query     The query vector (dim elements)
+ * @param[in]  rows      The row-major matrix of vectors
+ * @param[in]  num_rows  The number of rows
+ * @param[in]  dim       The number of elements to compare per row
+ * @param[in]  stride    The distance (in floats) between two consecutive rows
+ * @param[out] out       The distances (num_rows elements)
+ */
+void l2DistanceBatch(
+  const float *query,
+  const float *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Squared Euclidean distance between one query and a block of rows
+ *             (see l2DistanceBatch()).
+ */
+void squaredL2DistanceBatch(
+  const float *query,
+  const float *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Squared Euclidean distance between one query and a block of rows,
+ *             abandoning a row as soon as its partial distance exceeds a bound
+ *             (e.g. the K-th best distance found so far). The rows are compared
+ *             by blocks of kDistanceBlock elements, in the given order, so the
+ *             blocks that contribute the most can be compared first.
+ *
+ * @param[in]  query       The query vector (stride elements)
+ * @param[in]  rows        The row-major matrix of vectors
+ * @param[in]  num_rows    The number of rows
+ * @param[in]  stride      The distance (in floats) between two consecutive rows,
+ *                         a multiple of kDistanceBlock (the padding must be zero
+ *                         in the query or in the rows)
+ * @param[in]  blocks      The order of the blocks (indices of kDistanceBlock elements)
+ * @param[in]  num_blocks  The number of blocks to compare
+ * @param[in]  bound       The bound
+ * @param[out] out         The squared distances (num_rows elements). The rows
+ *                         within the bound get the same value as with
+ *                         squaredL2DistanceBlock() (dim = stride), the rows over
+ *                         it a partial distance, also over it.
+ */
+void squaredL2DistanceBounded(
+  const float *query,
+  const float *rows,
+  const std::size_t &num_rows,
+  const std::size_t &stride,
+  const uint16_t *blocks,
+  const std::size_t &num_blocks,
+  const float &bound,
+  float *out);
+
+/**
+ * @brief      Euclidean distance between a set of queries and a block of rows.
+ *             The rows are processed in tiles that stay in cache while all the
+ *             queries are compared with them.
+ *
+ * @param[in]  queries      The row-major matrix of queries
+ * @param[in]  num_queries  The number of queries
+ * @param[in]  rows         The row-major matrix of vectors
+ * @param[in]  num_rows     The number of rows
+ * @param[in]  dim          The number of elements to compare per row
+ * @param[in]  stride       The distance (in floats) between two consecutive rows
+ *                          (of both matrices)
+ * @param[out] out          The distances (num_queries x num_rows, row-major)
+ */
+void l2DistanceBlock(
+  const float *queries,
+  const std::size_t &num_queries,
+  const float *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Squared Euclidean distance between a set of queries and a block
+ *             of rows (see l2DistanceBlock()).
+ */
+void squaredL2DistanceBlock(
+  const float *queries,
+  const std::size_t &num_queries,
+  const float *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Asymmetric Euclidean distance between a float query and a block
+ *             of half-precision (IEEE 754 binary16) rows.
+ *
+ * @param[in]  query     The query vector (dim elements)
+ * @param[in]  rows      The row-major matrix of half-precision vectors
+ * @param[in]  num_rows  The number of rows
+ * @param[in]  dim       The number of elements to compare per row
+ * @param[in]  stride    The distance (in elements) between two consecutive rows
+ * @param[out] out       The distances (num_rows elements)
+ */
+void l2DistanceBatchF16(
+  const float *query,
+  const uint16_t *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Squared asymmetric Euclidean distance between a float query and a
+ *             block of half-precision rows (see l2DistanceBatchF16()).
+ */
+void squaredL2DistanceBatchF16(
+  const float *query,
+  const uint16_t *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Asymmetric Euclidean distance between a float query and a block
+ *             of int8 rows quantized per dimension as x = offset + scale*code.
+ *             The query must be given in code units, t = (q - offset) / scale,
+ *             with weights w = scale^2, so that |q - x|^2 = sum w*(t - code)^2.
+ *
+ * @param[in]  query     The query in code units (dim elements)
+ * @param[in]  weights   The weights (dim elements)
+ * @param[in]  rows      The row-major matrix of codes
+ * @param[in]  num_rows  The number of rows
+ * @param[in]  dim       The number of elements to compare per row
+ * @param[in]  stride    The distance (in elements) between two consecutive rows
+ * @param[out] out       The distances (num_rows elements)
+ */
+void l2DistanceBatchI8(
+  const float *query,
+  const float *weights,
+  const int8_t *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Squared asymmetric Euclidean distance between a float query and a
+ *             block of int8 rows (see l2DistanceBatchI8()).
+ */
+void squaredL2DistanceBatchI8(
+  const float *query,
+  const float *weights,
+  const int8_t *rows,
+  const std::size_t &num_rows,
+  const std::size_t &dim,
+  const std::size_t &stride,
+  float *out);
+
+/**
+ * @brief      Hamming distance between a binary query and a block of binary
+ *             rows (population count of the xor).
+ *
+ * @param[in]  query     The query (words 64-bit words)
+ * @param[in]  rows      The row-major matrix of binary codes
+ * @param[in]  num_rows  The number of rows
+ * @param[in]  words     The number of 64-bit words per row
+ * @param[out] out       The distances, in bits (num_rows elements)
+ */
+void hammingDistanceBatch(
+  const uint64_t *query,
+  const uint64_t *rows,
+  const std::size_t &num_rows,
+  const std::size_t &words,
+  uint32_t *out);
+
+/**
+ * @brief      Converts a float to half precision (round to nearest even).
+ *
+ * @param[in]  x     The value
+ *
+ * @return     The binary16 bits
+ */
+uint16_t floatToHalf(const float &x);
+
+/**
+ * @brief      Converts a half-precision value to float.
+ *
+ * @param[in]  h     The binary16 bits
+ *
+ * @return     The value
+ */
+float halfToFloat(const uint16_t &h);
+
+/**
+ * @brief      Whether the float kernels have a version compiled for a row
+ *             length (128, 256, 384 and 512 elements, i.e. 1 to 4 projections
+ *             of 128-D descriptors such as SIFT).
+ *
+ * @param[in]  dim   The number of elements per row (HashStore::stride())
+ *
+ * @return     True if the specialized version is used
+ */
+bool l2DistanceSpecialized(const std::size_t &dim);
+
+/**
+ * @brief      Name of the kernel selected for this CPU (e.g. "avx2").
+ *
+ * @return     The kernel name
+ */
+const char* distanceKernelName();
+
+}  // namespace haloc
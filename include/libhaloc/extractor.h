@@ -0,0 +1,364 @@
+/**
+ * @file extractor.h
+ *
+ * @brief Feature extractors used to compute the descriptors that are hashed.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv_modules.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace haloc {
+
+/**
+ * @brief      Reduction of the image before the extraction. Loop closure does
+ *             not need full-resolution features, and the extraction time
+ *             grows with the number of pixels. The steps are applied in order:
+ *             ROI crop, pyramid levels and resize to the target width.
+ */
+struct ExtractionParams {
+  cv::Rect roi;                 //!> Region of the image used (empty = the whole image, outside the image = no descriptors)
+  int pyramid_levels = 0;       //!> Number of cv::pyrDown applied (each one halves the size)
+  int target_width = 0;         //!> Images wider than this are downscaled to it, keeping the aspect ratio (0 = no resize)
+
+  /**
+   * @brief      Determines if the image is modified.
+   *
+   * @return     True if any reduction is set.
+   */
+  inline bool enabled() const {
+    return roi.area() != 0 || pyramid_levels > 0 || target_width > 0;
+  }
+};
+
+/**
+ * @brief      Descriptor families of the built-in extractors (see makeExtractor()).
+ */
+enum class DescriptorType {
+  kSift,          //!> SIFT, 128 floats
+  kOrb,           //!> ORB, 256 bits unpacked to -1/+1
+  kAkaze          //!> AKAZE (MLDB), 486 bits in 61 bytes, unpacked to -1/+1 (486 columns)
+};
+
+/**
+ * @brief      Interface of the descriptor extractors. Implementations must
+ *             return floating-point descriptors (CV_32F, one per row). Binary
+ *             descriptors are unpacked to one float per bit, -1 or +1
+ *             (unpackBinaryDescriptors()), so they are zero-mean like the
+ *             projection basis expects.
+ */
+class DescriptorExtractor {
+ public:
+  /**
+   * @brief      Class destructor.
+   */
+  virtual ~DescriptorExtractor() = default;
+
+  /**
+   * @brief      Detects the keypoints and computes their descriptors.
+   *
+   * @param[in]  image  The image
+   * @param[out] kps    The keypoints
+   * @param[out] desc   The descriptors (CV_32F, one row per keypoint)
+   */
+  virtual void compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) = 0;
+
+  /**
+   * @brief      Creates an independent extractor with the same settings, used
+   *             to extract from several threads at once.
+   *
+   * @return     The new extractor
+   */
+  virtual std::unique_ptr<DescriptorExtractor> clone() const = 0;
+
+  /**
+   * @brief      Determines if the extractor needs the image (false when the
+   *             descriptors are provided by other means).
+   *
+   * @return     True if the image is used.
+   */
+  virtual bool needsImage() const {return true;}
+};
+
+/**
+ * @brief      Extractor based on any OpenCV cv::Feature2D. The binary
+ *             descriptors (Hamming norm, e.g. ORB, AKAZE or BRISK) are
+ *             unpacked to -1/+1 per bit, the other non-float ones are
+ *             converted to CV_32F.
+ *
+ * With a grid, the detection limit is adaptive: the detector keypoints are
+ * reduced to the strongest ones of every grid cell (see
+ * SubsampleStrategy::kSpatial) before computing the descriptors, so they stay
+ * well spread over the image. Without a grid, the detectors that have no
+ * detection limit (retain_best) keep the max_features strongest keypoints
+ * before computing the descriptors.
+ */
+class Feature2DExtractor : public DescriptorExtractor {
+ public:
+  using Factory = std::function<cv::Ptr<cv::Feature2D>()>;
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  factory       Creates the detector (called again for every clone)
+   * @param[in]  max_features  With a grid or retain_best: the maximum number of descriptors
+   * @param[in]  grid_cols     Columns of the grid (0 = no grid)
+   * @param[in]  grid_rows     Rows of the grid (0 = no grid)
+   * @param[in]  desc_bits     Bits of the binary descriptors (0 = all the
+   *                           bits of their bytes, see unpackBinaryDescriptors())
+   * @param[in]  retain_best   Without a grid, detect and keep the max_features
+   *                           strongest keypoints before describing them (for
+   *                           the detectors without a detection limit)
+   */
+  explicit Feature2DExtractor(
+    const Factory &factory,
+    const int &max_features = 0,
+    const int &grid_cols = 0,
+    const int &grid_rows = 0,
+    const int &desc_bits = 0,
+    const bool &retain_best = false);
+
+  void compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) override;
+
+  std::unique_ptr<DescriptorExtractor> clone() const override;
+
+ private:
+  Factory factory_;                 //!> Detector factory
+  cv::Ptr<cv::Feature2D> feature_;  //!> Detector
+  int max_features_;                //!> Maximum number of descriptors (with a grid or retain_best_)
+  int grid_cols_;                   //!> Columns of the grid
+  int grid_rows_;                   //!> Rows of the grid
+  int desc_bits_;                   //!> Bits of the binary descriptors (0 = all)
+  bool retain_best_;                //!> Keep the strongest keypoints without a grid
+  std::vector<cv::KeyPoint> detected_;  //!> Keypoints found by the detector (with a grid)
+  std::vector<int> selected_;       //!> Detected keypoints kept (with a grid)
+};
+
+/**
+ * @brief      SIFT extractor (the default one).
+ */
+class SiftExtractor : public Feature2DExtractor {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  max_desc   The maximum number of descriptors
+   * @param[in]  grid_cols  Columns of the adaptive detection grid (0 = no grid)
+   * @param[in]  grid_rows  Rows of the adaptive detection grid (0 = no grid)
+   */
+  explicit SiftExtractor(
+    const int &max_desc,
+    const int &grid_cols = 0,
+    const int &grid_rows = 0);
+
+  //! With a grid, SIFT detects this many times max_desc keypoints to choose from
+  static constexpr int kGridOversampling = 2;
+};
+
+/**
+ * @brief      ORB extractor: 32 byte binary descriptors, hashed as 256 columns.
+ *             Much cheaper than SIFT on embedded targets.
+ */
+class OrbExtractor : public Feature2DExtractor {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  max_desc   The maximum number of descriptors
+   * @param[in]  grid_cols  Columns of the adaptive detection grid (0 = no grid)
+   * @param[in]  grid_rows  Rows of the adaptive detection grid (0 = no grid)
+   */
+  explicit OrbExtractor(
+    const int &max_desc,
+    const int &grid_cols = 0,
+    const int &grid_rows = 0);
+
+  //! With a grid, ORB detects this many times max_desc keypoints to choose from
+  static constexpr int kGridOversampling = 2;
+};
+
+/**
+ * @brief      AKAZE extractor: 486 bit binary (MLDB) descriptors in 61 bytes,
+ *             hashed as 486 columns (the 2 padding bits of the last byte are
+ *             dropped). AKAZE has no detection limit, so the max_desc
+ *             strongest keypoints are kept before they are described.
+ */
+class AkazeExtractor : public Feature2DExtractor {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  max_desc   The maximum number of descriptors
+   * @param[in]  grid_cols  Columns of the adaptive detection grid (0 = no grid)
+   * @param[in]  grid_rows  Rows of the adaptive detection grid (0 = no grid)
+   */
+  explicit AkazeExtractor(
+    const int &max_desc,
+    const int &grid_cols = 0,
+    const int &grid_rows = 0);
+
+  //! Bits of the MLDB descriptors (the last of their 61 bytes has 2 padding bits)
+  static constexpr int kDescriptorBits = 486;
+};
+
+/**
+ * @brief      Creates the built-in extractor of a descriptor family.
+ *
+ * @param[in]  type       The descriptor family
+ * @param[in]  max_desc   The maximum number of descriptors
+ * @param[in]  grid_cols  Columns of the adaptive detection grid (0 = no grid)
+ * @param[in]  grid_rows  Rows of the adaptive detection grid (0 = no grid)
+ *
+ * @return     The extractor
+ */
+std::shared_ptr<DescriptorExtractor> makeExtractor(
+  const DescriptorType &type,
+  const int &max_desc,
+  const int &grid_cols = 0,
+  const int &grid_rows = 0);
+
+/**
+ * @brief      Number of columns of the (unpacked) descriptors of a family.
+ *
+ * @param[in]  type  The descriptor family
+ *
+ * @return     The descriptor dimension
+ */
+int descriptorDim(const DescriptorType &type);
+
+/**
+ * @brief      Runs another extractor on a reduced image (see
+ *             ExtractionParams). The keypoints are returned in the coordinates
+ *             of the original image.
+ */
+class ScaledExtractor : public DescriptorExtractor {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  extractor  The extractor run on the reduced image
+   * @param[in]  params     The reduction
+   */
+  ScaledExtractor(
+    const std::shared_ptr<DescriptorExtractor> &extractor,
+    const ExtractionParams &params);
+
+  void compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) override;
+
+  std::unique_ptr<DescriptorExtractor> clone() const override;
+
+  bool needsImage() const override {return extractor_->needsImage();}
+
+ private:
+  std::shared_ptr<DescriptorExtractor> extractor_;  //!> The wrapped extractor
+  ExtractionParams params_;         //!> The reduction
+  cv::Mat pyramid_[2];              //!> Reused buffers of the pyramid levels
+  cv::Mat scaled_;                  //!> Reused buffer of the reduced image
+};
+
+/**
+ * @brief      Extractor that returns descriptors computed elsewhere (e.g. by a
+ *             visual odometry frontend), so no extraction is done. The image is
+ *             ignored.
+ */
+class PrecomputedExtractor : public DescriptorExtractor {
+ public:
+  /**
+   * @brief      Sets the descriptors returned by the next calls to compute().
+   *
+   * @param[in]  desc  The descriptors (converted to CV_32F if needed)
+   * @param[in]  kps   The keypoints (optional)
+   */
+  void set(const cv::Mat &desc, const std::vector<cv::KeyPoint> &kps = {});
+
+  /**
+   * @brief      Sets binary descriptors (CV_8U, e.g. the ORB features of a
+   *             visual odometry frontend), unpacked to -1/+1 per bit.
+   *
+   * @param[in]  desc  The binary descriptors
+   * @param[in]  kps   The keypoints (optional)
+   * @param[in]  bits  Bits of every descriptor (0 = all the bits of its bytes,
+   *                   AkazeExtractor::kDescriptorBits for AKAZE)
+   */
+  void setBinary(const cv::Mat &desc, const std::vector<cv::KeyPoint> &kps = {}, const int &bits = 0);
+
+  void compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) override;
+
+  std::unique_ptr<DescriptorExtractor> clone() const override;
+
+  bool needsImage() const override {return false;}
+
+ private:
+  cv::Mat desc_;                    //!> The descriptors
+  std::vector<cv::KeyPoint> kps_;   //!> The keypoints
+};
+
+#ifdef HAVE_OPENCV_CUDAFEATURES2D
+/**
+ * @brief      ORB extractor running on the GPU (cv::cuda::ORB). The binary
+ *             descriptors are unpacked to one float per bit (-1 or +1), i.e.
+ *             256 columns per descriptor, like OrbExtractor.
+ */
+class CudaOrbExtractor : public DescriptorExtractor {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  max_desc  The maximum number of descriptors
+   */
+  explicit CudaOrbExtractor(const int &max_desc);
+
+  void compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) override;
+
+  std::unique_ptr<DescriptorExtractor> clone() const override;
+
+ private:
+  int max_desc_;                    //!> The maximum number of descriptors
+  cv::Ptr<cv::Feature2D> orb_;      //!> The cv::cuda::ORB detector
+};
+#endif
+
+/**
+ * @brief      Unpacks binary descriptors (CV_8U) into one float per bit. When
+ *             the descriptors have fewer bits than their bytes, the unused
+ *             high bits of the last byte are dropped (OpenCV fills the bytes
+ *             from the least significant bit).
+ *
+ * @param[in]  binary  The binary descriptors
+ * @param[out] desc    The float descriptors (bits columns)
+ * @param[in]  zero    Value for the bits set to 0
+ * @param[in]  one     Value for the bits set to 1
+ * @param[in]  bits    Bits of every descriptor (0 = binary.cols*8)
+ */
+void unpackBinaryDescriptors(
+  const cv::Mat &binary,
+  cv::Mat &desc,
+  const float &zero = 0.0,
+  const float &one = 1.0,
+  const int &bits = 0);
+
+}  // namespace haloc
@@ -0,0 +1,146 @@
+/**
+ * @file gpu_backend.h
+ *
+ * @brief OpenCL backend (through cv::UMat) for hashing and similarity search.
+ *
+ * The hashes are kept resident on the device. A query uploads one hash (or its
+ * descriptors, when the projection also runs on the device) and downloads the
+ * K best candidates. Built as the separate haloc_gpu library (CMake option
+ * HALOC_WITH_OPENCL).
+ *
+ * The distances are computed as |x|^2 - 2 x.q + |q|^2 with one GEMM, so they
+ * may differ from the CPU scan in the last bits. The query image is not
+ * discarded automatically: insert it after querying, or ignore it.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_store.h"
+#include "libhaloc/top_k.h"
+
+namespace haloc {
+
+class GpuBackend {
+ public:
+  /**
+   * @brief      Class constructor. Uploads the projection basis.
+   *
+   * @param[in]  hash  The hash calculator whose basis is used
+   */
+  explicit GpuBackend(const Hash &hash);
+
+  /**
+   * @brief      Class destructor.
+   */
+  ~GpuBackend() = default;
+
+  /**
+   * @brief      Determines if an OpenCL device is available. Otherwise, OpenCV
+   *             runs the same operations on the CPU.
+   *
+   * @return     True if available.
+   */
+  static bool available();
+
+  /**
+   * @brief      Projects the descriptors on the device (same result as
+   *             Hash::calcHash()).
+   *
+   * @param[in]  desc  The descriptors (CV_32F, at most max_desc rows)
+   *
+   * @return     The hash, as a 1 x dim device matrix (empty on error)
+   */
+  cv::UMat calcHash(const cv::Mat &desc) const;
+
+  /**
+   * @brief      Appends a hash computed on the host.
+   *
+   * @param[in]  id    The image identifier (must not be stored yet)
+   * @param[in]  hash  The hash
+   *
+   * @return     True if the hash has been stored.
+   */
+  bool insert(const uint &id, const std::vector<float> &hash);
+
+  /**
+   * @brief      Appends a hash that is already on the device.
+   *
+   * @param[in]  id    The image identifier (must not be stored yet)
+   * @param[in]  hash  The hash (1 x dim)
+   *
+   * @return     True if the hash has been stored.
+   */
+  bool insert(const uint &id, const cv::UMat &hash);
+
+  /**
+   * @brief      Uploads all the hashes of a store.
+   *
+   * @param[in]  store  The store
+   *
+   * @return     True if the hashes have been uploaded.
+   */
+  bool upload(const HashStore &store);
+
+  /**
+   * @brief      Best candidates of a hash computed on the host.
+   *
+   * @param[in]  hash              The hash
+   * @param[in]  num_candidates    The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore
+   *
+   * @return     The best candidates, sorted from best to worst
+   */
+  std::vector<Candidate> query(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const std::set<uint> &images_to_ignore = {}) const;
+
+  /**
+   * @brief      Best candidates of a hash that is on the device.
+   *
+   * @param[in]  hash              The hash (1 x dim)
+   * @param[in]  num_candidates    The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore
+   *
+   * @return     The best candidates, sorted from best to worst
+   */
+  std::vector<Candidate> query(
+    const cv::UMat &hash,
+    const int &num_candidates,
+    const std::set<uint> &images_to_ignore = {}) const;
+
+  inline size_t size() const {return ids_.size();}
+  inline size_t dim() const {return dim_;}
+
+ protected:
+  /**
+   * @brief      Makes room for one more row (doubling the device buffers).
+   *
+   * @param[in]  dim   The hash dimension
+   *
+   * @return     False if the dimension does not match the stored hashes.
+   */
+  bool grow(const size_t &dim);
+
+ private:
+  int num_proj_;                                //!> The number of projections
+  int max_desc_;                                //!> The maximum number of descriptors
+  cv::UMat basis_;                              //!> Projection basis (num_proj x max_desc)
+  cv::UMat rows_;                               //!> Hashes (capacity x dim)
+  cv::UMat sq_norms_;                           //!> Squared norm of every hash (capacity x 1)
+  size_t dim_;                                  //!> Hash dimension
+  std::vector<uint> ids_;                       //!> Image id of every row
+  std::unordered_map<uint, size_t> index_;      //!> Row of every image id
+};
+
+}  // namespace haloc
@@ -9,14 +9,37 @@
 
 #pragma once
 
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d/features2d.hpp>
 
+#include "libhaloc/config.h"
+#include "libhaloc/descriptor_store.h"
 #include "libhaloc/hash.h"
+#include "libhaloc/hash_store.h"
+#include "libhaloc/ignore_filter.h"
+#include "libhaloc/scan.h"
+#include "libhaloc/span.h"
+#include "libhaloc/status.h"
+#include "libhaloc/temporal_cache.h"
+#include "libhaloc/top_k.h"
 
 namespace haloc {
 
+class AsyncHaloc;
+class BulkIndexer;
+
 class Haloc {
+  friend class AsyncHaloc;   // Runs the extraction, hashing and query stages separately
+  friend class BulkIndexer;  // Extracts and hashes with its own workers, inserts in order
+
  public:
   /**
    * @brief      Class constructor.
@@ -26,10 +49,17 @@ class Haloc {
    */
   Haloc(const int &num_proj, const int &max_desc);
 
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  config  The configuration (projections, descriptors, thread pool...)
+   */
+  explicit Haloc(const Config &config);
+
   /**
    * @brief      Class destructor.
    */
-  ~Haloc() = default;
+  ~Haloc();
 
   /**
    * @brief      Process the image to get the loop closure candidates
@@ -37,15 +67,297 @@ class Haloc {
    * @param[in]  image_id          The unique image identifier
    * @param[in]  image             The image
    * @param[in]  num_candidates    The number of candidates to return
-   * @param[in]  images_to_ignore  The images to ignore (vector of image ids)
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The candidates, or why there are none (kEmptyImage,
+   *             kNoDescriptors, kSizeMismatch or kNoCandidates)
+   */
+  Result<std::vector<uint>> process(
+    const uint &image_id,
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Same as processWithScores(), but the candidates are written to
+   *             a buffer of the caller. The hash and the scan buffers are
+   *             reused between calls, so the query does not allocate once they
+   *             have grown (with the exact scan and no thread pool; the feature
+   *             extractor and the insertion in the database may still do).
+   *
+   * @param[in]  image_id          The unique image identifier
+   * @param[in]  image             The image
+   * @param[out] candidates        The candidates, sorted from best to worst
+   *                               (its size is the number of candidates)
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The number of candidates written, or why there are none
+   */
+  Result<size_t> process(
+    const uint &image_id,
+    const cv::Mat &image,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Same as process(), but the candidates are returned together with
+   *             their hash distance so they can be thresholded by the caller.
+   *
+   * @param[in]  image_id          The unique image identifier
+   * @param[in]  image             The image
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The candidates, sorted from best to worst
+   */
+  Result<std::vector<Candidate>> processWithScores(
+    const uint &image_id,
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Asynchronous version of process(). The descriptors and the hash
+   *             are computed in the calling thread and the database scan is
+   *             queued on the thread pool, so the caller can extract the next
+   *             frame while the current one is being compared. Consecutive calls
+   *             are serialized: a frame is only inserted once the scan of the
+   *             previous frame has finished. Without thread pool the scan runs
+   *             synchronously. Config::stats_callback is then called from the
+   *             pool thread, with the stages of both threads.
+   *
+   * @param[in]  image_id          The unique image identifier
+   * @param[in]  image             The image
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
    *
-   * @return     The candidates
+   * @return     The future candidates
    */
-  std::optional<std::vector<uint>> process(
+  std::shared_future<Result<std::vector<uint>>> processAsync(
     const uint &image_id,
     const cv::Mat &image,
     const int &num_candidates,
-    const std::set<uint> &images_to_ignore = {});
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Insert an image in the database, without querying it.
+   *
+   * @param[in]  image_id  The unique image identifier
+   * @param[in]  image     The image
+   *
+   * @return     kOk if the image has been inserted, otherwise why it has not
+   *             (kEmptyImage, kNoDescriptors or kSizeMismatch)
+   */
+  Status insert(const uint &image_id, const cv::Mat &image);
+
+  /**
+   * @brief      Query the database with an image, without inserting it.
+   *
+   * @param[in]  image             The image
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The candidates, sorted from best to worst
+   */
+  Result<std::vector<Candidate>> query(
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Same as query(), but the candidates are written to a buffer of
+   *             the caller (no allocation in steady state, see process()).
+   *
+   * @param[in]  image             The image
+   * @param[out] candidates        The candidates, sorted from best to worst
+   *                               (its size is the number of candidates)
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The number of candidates written, or why there are none
+   */
+  Result<size_t> query(
+    const cv::Mat &image,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Insert a batch of images in the database. The descriptors are
+   *             extracted in parallel when a thread pool is configured.
+   *
+   * @param[in]  image_ids  The unique image identifiers
+   * @param[in]  images     The images (same size as image_ids)
+   *
+   * @return     The number of images inserted
+   */
+  size_t insertBatch(
+    const std::vector<uint> &image_ids,
+    const std::vector<cv::Mat> &images);
+
+  /**
+   * @brief      Query the database with a batch of images. The database is
+   *             scanned only once for all the queries.
+   *
+   * @param[in]  images            The images
+   * @param[in]  num_candidates    The number of candidates to return per image
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The candidates of every image, sorted from best to worst (empty
+   *             when the image could not be hashed or there are no candidates)
+   */
+  std::vector<std::vector<Candidate>> queryBatch(
+    const std::vector<cv::Mat> &images,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Same as process(), but with descriptors computed by the caller,
+   *             so no feature extraction is done.
+   *
+   * @param[in]  image_id          The unique image identifier
+   * @param[in]  desc              The descriptors (one per row)
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The candidates, sorted from best to worst
+   */
+  Result<std::vector<Candidate>> processDescriptors(
+    const uint &image_id,
+    const cv::Mat &desc,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Same as insert(), but with descriptors computed by the caller.
+   *
+   * @param[in]  image_id  The unique image identifier
+   * @param[in]  desc      The descriptors (one per row)
+   *
+   * @return     kOk if the image has been inserted, otherwise why it has not
+   */
+  Status insertDescriptors(const uint &image_id, const cv::Mat &desc);
+
+  /**
+   * @brief      Same as query(), but with descriptors computed by the caller.
+   *
+   * @param[in]  desc              The descriptors (one per row)
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The candidates, sorted from best to worst
+   */
+  Result<std::vector<Candidate>> queryDescriptors(
+    const cv::Mat &desc,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Remove an image from the database.
+   *
+   * @param[in]  image_id  The image identifier
+   *
+   * @return     False if the image is not stored.
+   */
+  bool erase(const uint &image_id);
+
+  /**
+   * @brief      Compact the database after erasing images: the hashes are
+   *             sorted by id again and the approximate index is rebuilt. It is
+   *             also done every Config::compact_interval erased images.
+   */
+  void compact();
+
+  /**
+   * @brief      Save the database of hashes to a file (see HashStore::save()).
+   *
+   * @param[in]  filename  The file
+   *
+   * @return     True if the database has been saved.
+   */
+  bool save(const std::string &filename);
+
+  /**
+   * @brief      Load a database saved with save(), replacing the current one.
+   *             The file must have been created with the same projection basis
+   *             and descriptor width, otherwise the current database is kept.
+   *             A detector without a descriptor width (custom extractor and
+   *             desc_dim = 0) adopts the one of the file.
+   *
+   * @param[in]  filename  The file
+   * @param[in]  use_mmap  Map the file (read-only, shared pages) instead of reading it
+   *
+   * @return     True if the database has been loaded.
+   */
+  bool load(const std::string &filename, const bool &use_mmap = true);
+
+  /**
+   * @brief      Rehash every stored image with a new projection basis, from its
+   *             kept descriptors (Config::keep_descriptors), without extracting
+   *             the features again (e.g. to sweep num_proj). The images are
+   *             rehashed in parallel when a thread pool is configured. The
+   *             feature extractor is not changed.
+   *
+   * @param[in]  num_proj  The new number of projections
+   * @param[in]  max_desc  The new maximum number of descriptors
+   * @param[in]  seed      The seed of the new basis
+   *
+   * @return     kOk, kInvalidArgument if num_proj or max_desc are not
+   *             positive, kMissingDescriptors if the descriptors of a stored
+   *             image were not kept, or the status of the image that could not
+   *             be rehashed (the database is then not modified)
+   */
+  Status rebuild(const int &num_proj, const int &max_desc, const uint32_t &seed);
+
+  /**
+   * @brief      Same as rebuild(), keeping the seed of the current basis.
+   */
+  Status rebuild(const int &num_proj, const int &max_desc);
+
+  /**
+   * @brief      Set the size of the candidate list of the approximate search
+   *             (larger = better recall, slower). Only used with Config::use_ann.
+   *
+   * @param[in]  ef    The size of the candidate list
+   */
+  void setAnnEfSearch(const size_t &ef);
+
+  /**
+   * @brief      Latency histograms of the stages (extraction, subsampling,
+   *             projection, scan, top-K), keypoints per image and size of the
+   *             database. The histograms are only filled when the library is
+   *             built with HALOC_ENABLE_STATS.
+   *
+   * @return     The statistics
+   */
+  StatsSnapshot stats() const;
+
+  /**
+   * @brief      Empties the histograms.
+   */
+  void resetStats();
+
+  /**
+   * @brief      Number of images stored in the database.
+   *
+   * @return     The number of images
+   */
+  inline size_t size() const {
+    return binary_store_ && hash_store_.empty() ? binary_store_->size() : hash_store_.size();
+  }
+
+  /**
+   * @brief      The kept descriptors (only with Config::keep_descriptors).
+   *
+   * @return     The descriptor store (nullptr if they are not kept)
+   */
+  inline const DescriptorStore* descriptors() const {return descriptor_store_.get();}
+
+  /**
+   * @brief      Cache of the previous query (Config::temporal), e.g. to read
+   *             the number of reused selections.
+   *
+   * @return     The cache
+   */
+  inline const TemporalCache& temporalCache() const {return temporal_;}
 
  protected:
   /**
@@ -55,36 +367,347 @@ class Haloc {
    * 
    * @return    The descriptors
    */
-  cv::Mat calcDesc(const cv::Mat &image);
+  const cv::Mat& calcDesc(const cv::Mat &image);
+
+  /**
+   * @brief      Calculate the hash of the image into a reused vector.
+   *
+   * @param[in]  image  The image
+   * @param[out] hash   The hash
+   *
+   * @return     kEmptyImage or kNoDescriptors on error (the hash is left empty)
+   */
+  Status calcImageHash(const cv::Mat &image, std::vector<float> &hash);
+
+  /**
+   * @brief      Calculate the hash of a set of descriptors.
+   *
+   * @param[in]  desc  The descriptors
+   * @param[out] hash  The hash
+   *
+   * @return     kNoDescriptors on error (the hash is left empty)
+   */
+  Status calcDescHash(const cv::Mat &desc, std::vector<float> &hash) const;
+
+  /**
+   * @brief      Check that a query hash can be compared with the stored ones.
+   *             The stored hashes are validated when inserted, so the scans do
+   *             not check them again.
+   *
+   * @param[in]  hash  The query hash
+   *
+   * @return     kSizeMismatch if its size is not the one of the stored hashes
+   */
+  Status checkQuery(const std::vector<float> &hash) const;
+
+  /**
+   * @brief      Calculate the hashes of a batch of images, in parallel when a
+   *             thread pool is configured.
+   *
+   * @param[in]  images  The images
+   * @param      descs   Optional, filled with the descriptors of every image
+   * @param      kps     Optional, filled with the keypoints of every image
+   *
+   * @return     The hash of every image (empty on error)
+   */
+  std::vector<std::vector<float>> calcImageHashBatch(
+    const std::vector<cv::Mat> &images,
+    std::vector<cv::Mat> *descs = nullptr,
+    std::vector<std::vector<cv::KeyPoint>> *kps = nullptr);
+
+  /**
+   * @brief      Store a hash and get its loop closure candidates.
+   *
+   * @param[in]  image_id          The unique image identifier
+   * @param[in]  hash              The hash
+   * @param[in]  desc              The descriptors of the hash (see insertHash())
+   * @param[in]  kps               Their keypoints
+   * @param[in]  num_candidates    The number of candidates to return
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The candidates, sorted from best to worst (kSizeMismatch or kNoCandidates)
+   */
+  Result<std::vector<Candidate>> processHash(
+    const uint &image_id,
+    const std::vector<float> &hash,
+    const cv::Mat &desc,
+    const std::vector<cv::KeyPoint> &kps,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore);
+
+  /**
+   * @brief      Store a hash.
+   *
+   * @param[in]  image_id  The unique image identifier
+   * @param[in]  hash      The hash
+   *
+   * @return     kOk, or kSizeMismatch if its size is not the one of the stored hashes
+   */
+  Status insertHash(const uint &image_id, const std::vector<float> &hash);
+
+  /**
+   * @brief      Store a hash and, with Config::keep_descriptors, the
+   *             descriptors it was computed from.
+   *
+   * @param[in]  image_id  The unique image identifier
+   * @param[in]  hash      The hash
+   * @param[in]  desc      The descriptors
+   * @param[in]  kps       Their keypoints (can be empty)
+   *
+   * @return     kOk, or kSizeMismatch if its size is not the one of the stored hashes
+   */
+  Status insertHash(
+    const uint &image_id,
+    const std::vector<float> &hash,
+    const cv::Mat &desc,
+    const std::vector<cv::KeyPoint> &kps);
+
+  /**
+   * @brief      Remove a hash (the pending scan must be finished).
+   *
+   * @param[in]  image_id  The image identifier
+   *
+   * @return     False if the image is not stored.
+   */
+  bool eraseHash(const uint &image_id);
 
   /**
-   * @brief      Calculate the similarities between the hash and the rest of the images
+   * @brief      Apply the retention policy after inserting an image.
+   *
+   * @param[in]  image_id  The inserted image
+   */
+  void applyRetention(const uint &image_id);
+
+  /**
+   * @brief      Evict images until the database fits in Config::max_entries.
+   */
+  void evictToMaxEntries();
+
+  /**
+   * @brief      Mark the candidates as matched (least recently matched policy).
+   *
+   * @param[in]  candidates  The candidates
+   * @param[in]  count       The number of candidates
+   */
+  void touchCandidates(const Candidate *candidates, const size_t &count);
+
+  /**
+   * @brief      Rebuild the retention order from the hash store.
+   */
+  void rebuildRecency();
+
+  /**
+   * @brief      Get the best candidates. The hash is compared with the stored
+   *             images block by block and only the best candidates are kept, so
+   *             the similarities of the whole database are never materialized.
    * 
    * @param[in]  hash              The current hash
-   * @param[in]  images_to_ignore  The images to ignore (vector of image ids)
+   * @param[in]  num_candidates    The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
    * 
-   * @return     The similarities
+   * @return     The best candidates, sorted from best to worst
    */
-  std::map<uint, float> calcSimilarities(
+  std::vector<Candidate> getBestCandidates(
     const std::vector<float> &hash,
-    const std::set<uint> &images_to_ignore = {});
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
 
   /**
-   * @brief      Get the best candidates
-   * 
-   * @param[in]  similarities    The similarities
-   * @param[in]  num_candidates  The number of candidates
-   * 
-   * @return     The best candidates
+   * @brief      Get the best candidates into a buffer of the caller.
+   *
+   * @param[in]  hash              The current hash
+   * @param[out] candidates        The candidates (its size is the number of candidates)
+   * @param[in]  images_to_ignore  The images to ignore
+   *
+   * @return     The number of candidates written
+   */
+  size_t getBestCandidates(
+    const std::vector<float> &hash,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore);
+
+  /**
+   * @brief      Body of getBestCandidates(), which also reports the call.
+   *
+   * @param[in]  hash              The current hash
+   * @param[out] candidates        The candidates (its size is the number of candidates)
+   * @param[in]  images_to_ignore  The images to ignore
+   *
+   * @return     The number of candidates written
+   */
+  size_t findCandidates(
+    const std::vector<float> &hash,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore);
+
+  /**
+   * @brief      Search of findCandidates() (ANN, binary or exact scan), without
+   *             the temporal cache.
+   *
+   * @param[in]  hash              The current hash
+   * @param[out] candidates        The candidates (its size is the number of candidates)
+   * @param[in]  images_to_ignore  The images to ignore
+   *
+   * @return     The number of candidates written
+   */
+  size_t searchCandidates(
+    const std::vector<float> &hash,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore);
+
+  /**
+   * @brief      Passes the stage latencies of a call to Config::stats_callback.
+   *
+   * @param[in]  call  The call statistics (Stats::current() when the whole
+   *                   call ran in this thread)
+   */
+  void reportCall(CallStats &call);
+
+  /**
+   * @brief      Get the best candidates of several hashes with a single scan of
+   *             the database.
+   *
+   * @param[in]  hashes            The hashes (empty hashes get no candidates)
+   * @param[in]  num_candidates    The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The best candidates of every hash, sorted from best to worst
+   */
+  std::vector<std::vector<Candidate>> getBestCandidates(
+    const std::vector<std::vector<float>> &hashes,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore = {});
+
+  /**
+   * @brief      Get the best candidates from the approximate index, re-ranked
+   *             with the exact distance.
+   *
+   * @param[in]  hash              The current hash
+   * @param[in]  num_candidates    The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The best candidates, sorted from best to worst (may be fewer
+   *             than num_candidates)
+   */
+  std::vector<Candidate> getAnnCandidates(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore);
+
+  /**
+   * @brief      Get the best candidates with a Hamming scan of the binary
+   *             hashes, re-ranked with the float distance when
+   *             Config::binary_rerank is set.
+   *
+   * @param[in]  hash              The current hash
+   * @param[in]  num_candidates    The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   *
+   * @return     The best candidates, sorted from best to worst. Without
+   *             re-ranking the score is the Hamming distance.
+   */
+  std::vector<Candidate> getBinaryCandidates(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) const;
+
+  /**
+   * @brief      Rebuild the approximate index from the hash store.
+   */
+  void rebuildAnnIndex();
+
+  /**
+   * @brief      Rebuild the binary hashes from the hash store.
+   */
+  void rebuildBinaryStore();
+
+  /**
+   * @brief      Scan the whole store, split in tasks when a thread pool is
+   *             configured.
+   *
+   * @param[in]  queries           The prepared hashes (row-major, HashStore::preparedSize() each)
+   * @param[in]  num_queries       The number of hashes
+   * @param[in]  num_candidates    The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore
+   * @param      top_k             The selections (one per hash, reset here)
+   * @param[in]  limit             Known bound of the K-th best squared distance (TopK::setLimit())
+   */
+  void scanStore(
+    const float *queries,
+    const size_t &num_queries,
+    const size_t &num_candidates,
+    const IgnoreFilter &images_to_ignore,
+    TopK *top_k,
+    const float &limit = std::numeric_limits<float>::infinity());
+
+  /**
+   * @brief      Scan a range of the stored hashes.
+   *
+   * @param[in]  queries           The hashes, padded to the store stride (row-major)
+   * @param[in]  num_queries       The number of hashes
+   * @param[in]  begin             The first row
+   * @param[in]  end               The last row (not included)
+   * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+   * @param      top_k             The selections to update (one per hash)
+   */
+  void scanRange(
+    const float *queries,
+    const size_t &num_queries,
+    const size_t &begin,
+    const size_t &end,
+    const IgnoreFilter &images_to_ignore,
+    TopK *top_k) const;
+
+  /**
+   * @brief      Parameters written to the header of the database files.
+   *
+   * @return     The parameters of the current hashes
+   */
+  HashStoreInfo storeInfo() const;
+
+  /**
+   * @brief      Columns of the hashed descriptors: Config::desc_dim, or the
+   *             ones of the default extractor (0 = any, custom extractor).
+   *
+   * @return     The descriptor dimension
+   */
+  int descriptorDim() const;
+
+  /**
+   * @brief      Wait until the scan queued by processAsync() (if any) finishes.
+   */
+  void waitPendingScan();
+
+  /**
+   * @brief      Buffers reused by the queries, so the steady state does not
+   *             allocate.
    */
-  std::vector<uint> getBestCandidates(
-    std::map<uint, float> &similarities,
-    const int &num_candidates);
+  struct Workspace {
+    cv::Mat desc;                                 //!> Descriptors of the last image
+    std::vector<cv::KeyPoint> kps;                //!> Keypoints of the last image
+    std::vector<float> hash;                      //!> Hash of the last image
+    AlignedVector<float> prepared;                //!> Prepared query
+    AlignedVector<float> queries;                 //!> Prepared queries of the scan
+    std::vector<TopK> top_k;                      //!> Selection of every query
+    std::vector<TopK> partial;                    //!> Selections of the other scan tasks
+    std::vector<Candidate> searched;              //!> Wider selection of the temporal cache
+    std::vector<std::future<void>> tasks;         //!> Scan tasks
+  };
 
  private:
-  cv::Ptr<cv::SIFT> sift_;                            //! < SIFT detector
-  std::unique_ptr<haloc::Hash> hash_;                 //! < For the hashes generation
-  std::map<uint, std::vector<float>> hashes_table_;   //! < To store the hashes of the images. Format: <image_id, hash>
+  Config config_;                                     //! < Configuration
+  std::shared_ptr<DescriptorExtractor> extractor_;    //! < Feature extractor
+  std::unique_ptr<haloc::Hash> hash_;                 //! < For the hashes generation (shared by the worker threads)
+  haloc::HashStore hash_store_;                       //! < To store the hashes of the images (contiguous rows + image ids)
+  std::unique_ptr<HnswIndex> ann_index_;              //! < Approximate index (only with Config::use_ann)
+  std::unique_ptr<BinaryStore> binary_store_;         //! < Binary hashes (only with Config::use_binary)
+  std::unique_ptr<DescriptorStore> descriptor_store_; //! < Kept descriptors (only with Config::keep_descriptors)
+  RecencyTracker recency_;                            //! < Retention order (only with Config::max_entries)
+  TemporalCache temporal_;                            //! < Previous query (only with Config::temporal)
+  size_t erased_since_compact_ = 0;                   //! < Images erased since the last compaction
+  Workspace workspace_;                               //! < Reused buffers
+  mutable Stats stats_;                               //! < Stage latencies (only with HALOC_ENABLE_STATS)
+  std::shared_future<Result<std::vector<uint>>> pending_scan_;  //! < Scan queued by processAsync()
 };
 
 }  // namespace haloc
@@ -9,14 +9,29 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
 #include <Eigen/Eigen>
 #include <Eigen/Dense>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/eigen.hpp>
 
+#include "libhaloc/binary_store.h"
+#include "libhaloc/stats.h"
+#include "libhaloc/status.h"
+#include "libhaloc/subsample.h"
+
 namespace haloc {
 
+//! Row-major projection basis (num_proj x max_desc)
+using ProjectionMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
 class Hash {
  public:
   /**
@@ -24,8 +39,17 @@ class Hash {
    * 
    * @param[in]  num_proj  The number of projections
    * @param[in]  max_desc  The maximum number of descriptors
+   * @param[in]  seed      The seed of the projection basis. Two instances with
+   *                       the same parameters and seed produce the same hashes.
+   * @param[in]  lazy_init When false (default) the projection basis is generated
+   *                       here, so no hash pays for it. When true it is generated
+   *                       by init() or by the first calcHash() (thread-safe).
    */
-  Hash(const int &num_proj, const int &max_desc);
+  Hash(
+    const int &num_proj,
+    const int &max_desc,
+    const uint32_t &seed = kDefaultSeed,
+    const bool &lazy_init = false);
 
   /**
    * @brief      Class destructor.
@@ -33,13 +57,92 @@ class Hash {
   ~Hash() = default;
 
   /**
-   * @brief      Calculates the image hash
+   * @brief      Init the hash calculator (generates the projection basis). It
+   *             is safe to call it from several threads, the basis is generated
+   *             only once.
+   */
+  void init() const;
+
+  /**
+   * @brief      Calculates the image hash. The descriptors (rows x cols) are
+   *             projected onto the basis with a single matrix product and the
+   *             hash is laid out projection by projection:
+   *             hash[i*cols + n] = mean_m((r_i[m]*desc(m, n) + 1) / 2)
+   *
+   * @param[in]  desc      The floating-point descriptors.
+   *
+   * @return     The image hash (num_proj*cols elements).
+   *
+   * This method is reentrant: one instance can be shared by several threads.
+   */
+  std::vector<float> calcHash(const cv::Mat &desc) const;
+
+  /**
+   * @brief      Calculates the image hash into a reused vector (no allocation
+   *             once its capacity is enough).
+   *
+   * @param[in]  desc      The floating-point descriptors.
+   * @param[out] hash      The image hash (num_proj*cols elements).
+   *
+   * @return     kNoDescriptors if the descriptor matrix is empty, kSizeMismatch
+   *             if its columns are not descDim() (hash is left empty).
+   */
+  Status calcHash(const cv::Mat &desc, std::vector<float> &hash) const;
+
+  /**
+   * @brief      Calculates the image hash, using the keypoints to select the
+   *             descriptors when there are more than max_desc (see
+   *             setSubsampling()).
+   *
+   * @param[in]  desc      The floating-point descriptors.
+   * @param[in]  kps       The keypoints of the descriptors (can be empty)
+   * @param[out] hash      The image hash (num_proj*cols elements).
+   *
+   * @return     kNoDescriptors if the descriptor matrix is empty, kSizeMismatch
+   *             if its columns are not descDim() (hash is left empty).
+   */
+  Status calcHash(
+    const cv::Mat &desc,
+    const std::vector<cv::KeyPoint> &kps,
+    std::vector<float> &hash) const;
+
+  /**
+   * @brief      Calculates the hashes of a batch of images. Every image is
+   *             projected with its own product, so the hashes are bitwise the
+   *             ones of calcHash(), whatever the other images of the batch.
+   *
+   * @param[in]  descs     The floating-point descriptors of every image.
+   * @param[in]  kps       Their keypoints (empty, or one vector per image)
+   * @param[out] hashes    The image hashes (empty on error).
+   *
+   * @return     The status of every image (see calcHash()).
+   */
+  std::vector<Status> calcHashBatch(
+    const std::vector<cv::Mat> &descs,
+    const std::vector<std::vector<cv::KeyPoint>> &kps,
+    std::vector<std::vector<float>> &hashes) const;
+
+  /**
+   * @brief      Calculates the binary image hash: calcHash() reduced to one
+   *             bit per element (see binarize()).
    *
    * @param[in]  desc      The floating-point descriptors.
    *
-   * @return     The image hash.
+   * @return     The binary hash (empty if the hash cannot be computed).
    */
-  std::vector<float> calcHash(const cv::Mat &desc);
+  BinaryHash calcBinaryHash(const cv::Mat &desc) const;
+
+  /**
+   * @brief      Binarizes a hash. Every element is thresholded around the mean
+   *             of its projection (the mean of the num_proj-th part of the
+   *             hash it belongs to), so the code does not depend on the
+   *             magnitude of the descriptors. Bit k is hash element k.
+   *
+   * @param[in]  hash  The hash, from calcHash()
+   *
+   * @return     The binary hash (ceil(hash.size() / 64) words, unused bits are zero)
+   */
+  BinaryHash binarize(const std::vector<float> &hash) const;
 
   /**
    * @brief      Compute the similarity between two hashes. The smallest, the more similar.
@@ -47,39 +150,115 @@ class Hash {
    * @param[in]  hash_1  The hash 1.
    * @param[in]  hash_2  The hash 2.
    *
-   * @return     similarity value (the smallest, the better)
+   * @return     similarity value (the smallest, the better), or kSizeMismatch
+   *             if the hashes have different sizes
    */
-  float calcSimilarity(
+  Result<float> calcSimilarity(
     const std::vector<float> &hash_1,
-    const std::vector<float> &hash_2);
+    const std::vector<float> &hash_2) const;
 
- protected:
   /**
-   * @brief      Determines if class is initialized.
+   * @brief      Saves the projection basis to a binary file.
    *
-   * @return     True if initialized, False otherwise.
+   * @param[in]  filename  The file
+   *
+   * @return     True if the basis has been saved.
+   */
+  bool saveBasis(const std::string &filename) const;
+
+  /**
+   * @brief      Loads the projection basis from a file written by saveBasis(),
+   *             skipping its generation. The number of projections and
+   *             descriptors of the file must match the ones of this instance.
+   *
+   * @param[in]  filename  The file
+   *
+   * @return     True if the basis has been loaded.
+   *
+   * This must not be called while other threads are computing hashes.
    */
-  inline bool isInitialized() const {return initialized_;}
+  bool loadBasis(const std::string &filename);
 
   /**
-   * @brief      Init the hash calculator.
+   * @brief      64-bit fingerprint (FNV-1a) of the projection basis. Hashes are
+   *             only comparable when computed with the same fingerprint.
+   *
+   * @return     The fingerprint
+   */
+  uint64_t basisFingerprint() const;
+
+  /**
+   * @brief      The projection basis (num_proj x max_desc).
+   *
+   * @return     The basis
+   */
+  inline const ProjectionMatrix& basis() const {
+    if (!isInitialized()) init();
+    return r_;
+  }
+
+  /**
+   * @brief      Sets how the descriptors are selected when an image has more
+   *             than max_desc. Hashes computed with different strategies are
+   *             not comparable. This must not be called while other threads
+   *             are computing hashes.
+   *
+   * @param[in]  params  The selection parameters
+   */
+  inline void setSubsampling(const SubsampleParams &params) {subsample_ = params;}
+  inline const SubsampleParams& subsampling() const {return subsample_;}
+
+  /**
+   * @brief      Sets the number of columns of the descriptors (e.g. 128 for
+   *             SIFT, 256 for ORB or SuperPoint, see descriptorDim()). The
+   *             hashes have num_proj*desc_dim elements, and the descriptors of
+   *             another size are rejected (kSizeMismatch) instead of producing
+   *             hashes that cannot be compared. This must not be called while
+   *             other threads are computing hashes.
+   *
+   * @param[in]  desc_dim  The descriptor dimension (0 = any)
+   */
+  inline void setDescriptorDim(const int &desc_dim) {desc_dim_ = desc_dim;}
+  inline int descDim() const {return desc_dim_;}
+
+  /**
+   * @brief      Sets where the subsampling and projection latencies are
+   *             recorded (only with HALOC_ENABLE_STATS).
+   *
+   * @param      stats  The collector (nullptr = none), it must outlive this instance
+   */
+  inline void setStats(Stats *stats) {stats_ = stats;}
+
+  inline int numProj() const {return num_proj_;}
+  inline int maxDesc() const {return max_desc_;}
+  inline uint32_t seed() const {return seed_;}
+
+  //! Seed used when none is given
+  static constexpr uint32_t kDefaultSeed = std::mt19937::default_seed;
+
+ protected:
+  /**
+   * @brief      Determines if class is initialized.
+   *
+   * @return     True if initialized, False otherwise.
    */
-  void init();
+  inline bool isInitialized() const {return initialized_.load(std::memory_order_acquire);}
 
   /**
    * @brief      Initializes the random vectors for projections.
    */
-  void initProjections();
+  void initProjections() const;
 
   /**
-   * @brief      Calculates a random vector.
+   * @brief      Calculates a random vector, uniform in [0, 1), from the raw
+   *             output of the generator of this instance (the same with every
+   *             standard library).
    *
    * @param[in]  size  The size.
-   * @param[in]  seed  The seed.
    *
    * @return     The random vector.
    */
-  std::vector<float> computeRandomVector(const int &size, const int &seed);
+  std::vector<float> computeRandomVector(const int &size) const;
 
   /**
    * @brief      Makes a vector unitary.
@@ -88,13 +267,19 @@ class Hash {
    *
    * @return     The output unit vector.
    */
-  std::vector<float> unitVector(const std::vector<float> &x);
+  std::vector<float> unitVector(const std::vector<float> &x) const;
 
  private:
-  bool initialized_;                     //!> True when class has been initialized
+  mutable std::once_flag init_flag_;     //!> Guards the generation of the basis
+  mutable std::atomic<bool> initialized_;  //!> True when class has been initialized
   int num_proj_;                         //!> The number of projections
   int max_desc_;                         //!> The maximum number of descriptors
-  std::vector< std::vector<float> > r_;  //!> Vector of random values
+  uint32_t seed_;                        //!> The seed of the projection basis
+  int desc_dim_ = 0;                     //!> Columns of the descriptors (0 = any)
+  SubsampleParams subsample_;            //!> Selection of the descriptors when there are more than max_desc_
+  Stats *stats_ = nullptr;               //!> Optional latency collector
+  mutable std::mt19937 rng_;             //!> Random generator of the projection basis
+  mutable ProjectionMatrix r_;           //!> Orthogonal random vectors, one per row (written once, under init_flag_)
 };
 
 }  // namespace haloc
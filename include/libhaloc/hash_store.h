@@ -0,0 +1,459 @@
+/**
+ * @file hash_store.h
+ *
+ * @brief Contiguous storage for the image hashes.
+ *
+ * All the hashes live in a single aligned, row-major buffer (one row per
+ * image, padded to a multiple of 16 elements) with a parallel array of image
+ * ids. This keeps the similarity scan a linear walk over memory.
+ *
+ * The rows can be stored as float32, float16 or int8. The compact encodings
+ * are compared asymmetrically: the query stays in float and only the stored
+ * rows are quantized. The int8 encoding uses a per-dimension affine
+ * quantization, x = offset + scale*code, calibrated on the first hashes
+ * (which are kept in float32 until then).
+ *
+ * The store can be saved to a versioned binary file and loaded back, either
+ * by reading it or by memory-mapping it (read-only, pages shared between
+ * processes). A mapped store is copied to memory the first time it is
+ * modified.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "libhaloc/aligned_allocator.h"
+#include "libhaloc/distance.h"
+
+namespace haloc {
+
+/**
+ * @brief      Parameters of the hashes saved in a store file. They allow to
+ *             check that the hashes of a file are comparable with the hashes
+ *             computed by the running process.
+ */
+struct HashStoreInfo {
+  int32_t num_proj = 0;       //!> The number of projections
+  int32_t max_desc = 0;       //!> The maximum number of descriptors
+  int32_t desc_dim = 0;       //!> The dimension of the descriptors
+  uint32_t seed = 0;          //!> The seed of the projection basis
+  uint64_t basis_hash = 0;    //!> Fingerprint of the projection basis (Hash::basisFingerprint())
+};
+
+/**
+ * @brief      Encoding of the stored rows.
+ */
+enum class HashPrecision : uint32_t {
+  kFloat32 = 0,   //!> 4 bytes per element, exact
+  kFloat16 = 1,   //!> 2 bytes per element, ~3 significant digits
+  kInt8 = 2       //!> 1 byte per element, per-dimension affine quantization
+};
+
+class HashStore {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  precision         The encoding of the rows
+   * @param[in]  calibration_size  For int8: the number of hashes used to
+   *                               calibrate the quantization
+   */
+  explicit HashStore(
+    const HashPrecision &precision = HashPrecision::kFloat32,
+    const std::size_t &calibration_size = 256);
+
+  /**
+   * @brief      Class destructor.
+   */
+  ~HashStore();
+
+  HashStore(const HashStore &) = delete;
+  HashStore& operator=(const HashStore &) = delete;
+
+  /**
+   * @brief      Saves the store to a binary file. Layout (native endianness):
+   *             header, image ids (uint32), the rows (stride() elements each,
+   *             in the current encoding) and, for int8, the quantization
+   *             offsets and scales (float32). The sections are aligned to 64
+   *             bytes. The file is written to filename.tmp, synced and renamed
+   *             over filename, so a store mapped from filename can be saved
+   *             back to it and a failed save keeps the previous file.
+   *
+   * @param[in]  filename  The file
+   * @param[in]  info      The parameters of the hashes
+   *
+   * @return     True if the store has been saved.
+   */
+  bool save(const std::string &filename, const HashStoreInfo &info) const;
+
+  /**
+   * @brief      Reads the parameters of the hashes of a store file, without
+   *             loading it.
+   *
+   * @param[in]  filename  The file
+   * @param[out] info      The parameters of the hashes
+   *
+   * @return     True if the file is a valid store.
+   */
+  static bool readInfo(const std::string &filename, HashStoreInfo &info);
+
+  /**
+   * @brief      Loads a store saved with save(), replacing the current content.
+   *             The store takes the precision of the file. If the file cannot
+   *             be loaded the current content is kept.
+   *
+   * @param[in]  filename  The file
+   * @param[out] info      The parameters of the hashes
+   * @param[in]  use_mmap  Map the file instead of reading it. Opening is then
+   *                       almost free and the pages are shared between processes.
+   *
+   * @return     True if the store has been loaded.
+   */
+  bool load(const std::string &filename, HashStoreInfo &info, const bool &use_mmap = true);
+
+  /**
+   * @brief      Determines if the rows are memory-mapped from a file.
+   *
+   * @return     True if mapped.
+   */
+  inline bool isMapped() const {return mapping_ != nullptr;}
+
+  /**
+   * @brief      Inserts (or replaces) the hash of an image. The first hash
+   *             fixes the dimension of the store.
+   *
+   * @param[in]  id    The image identifier
+   * @param[in]  hash  The image hash
+   *
+   * @return     False if the hash is empty or its size does not match the store.
+   */
+  bool insert(const uint &id, const std::vector<float> &hash);
+
+  /**
+   * @brief      Removes the hash of an image in O(1): the last row is moved to
+   *             its place, so the rows are no longer sorted by id (see
+   *             compact()).
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     False if the image is not stored.
+   */
+  bool erase(const uint &id);
+
+  /**
+   * @brief      Sorts the rows by id again (so the ignored ranges can be
+   *             skipped) and releases the memory of the erased rows.
+   */
+  void compact();
+
+  /**
+   * @brief      Calibrates the int8 quantization with the current hashes and
+   *             encodes them. It is done automatically once the calibration
+   *             size is reached; this forces it earlier.
+   *
+   * @return     True if the rows are int8 encoded.
+   */
+  bool calibrate();
+
+  /**
+   * @brief      Reserves memory for a number of hashes.
+   *
+   * @param[in]  num_hashes  The number of hashes
+   */
+  void reserve(const std::size_t &num_hashes);
+
+  /**
+   * @brief      Removes all the hashes (the dimension is reset as well).
+   */
+  void clear();
+
+  /**
+   * @brief      Bytes used by the hashes and ids (mapped or in memory).
+   *
+   * @return     The number of bytes
+   */
+  std::size_t bytes() const;
+
+  /**
+   * @brief      Computes the L2 distance between the query and every stored hash.
+   *
+   * @param[in]  query  The query hash (dim() elements)
+   * @param[out] out    The distances, in row order (size() elements)
+   */
+  void distances(const std::vector<float> &query, std::vector<float> &out) const;
+
+  /**
+   * @brief      Computes the L2 distance between a prepared query and a block
+   *             of rows.
+   *
+   * @param[in]  prepared  The query, prepared with prepareQuery()
+   * @param[in]  begin     The first row
+   * @param[in]  count     The number of rows
+   * @param[out] out       The distances (count elements)
+   */
+  void distances(
+    const float *prepared,
+    const std::size_t &begin,
+    const std::size_t &count,
+    float *out) const;
+
+  /**
+   * @brief      Computes the L2 distance between several prepared queries and
+   *             a block of rows.
+   *
+   * @param[in]  prepared     The queries, preparedSize() floats each
+   * @param[in]  num_queries  The number of queries
+   * @param[in]  begin        The first row
+   * @param[in]  count        The number of rows
+   * @param[out] out          The distances (num_queries x count, row-major)
+   */
+  void distances(
+    const float *prepared,
+    const std::size_t &num_queries,
+    const std::size_t &begin,
+    const std::size_t &count,
+    float *out) const;
+
+  /**
+   * @brief      Computes the squared L2 distance between several prepared
+   *             queries and a block of rows (the scan ranks on squared
+   *             distances, see distances()).
+   *
+   * @param[in]  prepared     The queries, preparedSize() floats each
+   * @param[in]  num_queries  The number of queries
+   * @param[in]  begin        The first row
+   * @param[in]  count        The number of rows
+   * @param[out] out          The squared distances (num_queries x count, row-major)
+   */
+  void squaredDistances(
+    const float *prepared,
+    const std::size_t &num_queries,
+    const std::size_t &begin,
+    const std::size_t &count,
+    float *out) const;
+
+  /**
+   * @brief      Computes the squared L2 distance between a prepared query and a
+   *             block of rows, abandoning the rows whose partial distance
+   *             exceeds the bound (squaredL2DistanceBounded()). Only the
+   *             float32 rows are abandoned, the other encodings are compared
+   *             in full.
+   *
+   * @param[in]  prepared  The query, prepared with prepareQuery()
+   * @param[in]  begin     The first row
+   * @param[in]  count     The number of rows
+   * @param[in]  blocks    The order of the blocks (numBlocks() elements, e.g. blockOrder())
+   * @param[in]  bound     The bound (squared)
+   * @param[out] out       The squared distances (count elements, over the bound
+   *                       for the abandoned rows)
+   */
+  void squaredDistancesBounded(
+    const float *prepared,
+    const std::size_t &begin,
+    const std::size_t &count,
+    const uint16_t *blocks,
+    const float &bound,
+    float *out) const;
+
+  /**
+   * @brief      Order of the blocks of kDistanceBlock elements by decreasing
+   *             variance of the stored hashes, estimated on a sample of the
+   *             rows. Comparing the most variable elements first lets the
+   *             bounded scan reject the rows sooner. It is computed lazily and
+   *             again whenever the store has doubled its size.
+   *
+   * @return     The block indices (numBlocks() elements)
+   */
+  std::shared_ptr<const std::vector<uint16_t>> blockOrder() const;
+
+  //! Number of blocks of kDistanceBlock elements per row
+  inline std::size_t numBlocks() const {return stride_ / kDistanceBlock;}
+
+  /**
+   * @brief      Computes the L2 distance between a prepared query and a row.
+   *
+   * @param[in]  prepared  The query, prepared with prepareQuery()
+   * @param[in]  r         The row
+   *
+   * @return     The distance
+   */
+  float distance(const float *prepared, const std::size_t &r) const;
+
+  /**
+   * @brief      Decodes a row to float.
+   *
+   * @param[in]  r     The row
+   * @param[out] out   The hash, padded to the stride (stride() elements)
+   */
+  void decode(const std::size_t &r, float *out) const;
+
+  /**
+   * @brief      Returns the row of an image.
+   *
+   * @param[in]  id    The image identifier
+   * @param[out] r     The row
+   *
+   * @return     False if the image is not stored.
+   */
+  bool rowOf(const uint &id, std::size_t &r) const;
+
+  /**
+   * @brief      Returns the hash of an image, only for float32 stores (the
+   *             other encodings go through rowOf() and decode()).
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     Pointer to the stored row, nullptr if the image is not stored
+   *             or the rows are not float32.
+   */
+  const float* find(const uint &id) const;
+
+  /**
+   * @brief      Determines if an image is stored.
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     True if stored.
+   */
+  bool contains(const uint &id) const;
+
+  inline bool empty() const {return size_ == 0;}
+  inline std::size_t size() const {return size_;}
+  inline std::size_t dim() const {return dim_;}
+  inline std::size_t stride() const {return stride_;}
+  inline std::size_t rowBytes() const {return row_bytes_;}
+  inline HashPrecision precision() const {return precision_;}
+  inline HashPrecision encoding() const {return encoding_;}
+  inline const uint8_t* rowData(const std::size_t &i) const {return rows_ + i*row_bytes_;}
+  inline const uint* ids() const {return row_ids_;}
+  inline bool idsSorted() const {return ids_sorted_;}
+  inline uint id(const std::size_t &i) const {return row_ids_[i];}
+
+  /**
+   * @brief      Counter of the changes of the existing rows (replacement,
+   *             erase, compaction, calibration, clear or load). Appending rows
+   *             does not change it, so a cache of a previous scan stays valid
+   *             for the rows up to the size it saw.
+   *
+   * @return     The epoch
+   */
+  inline uint64_t epoch() const {return epoch_;}
+
+  //! Row padding, in elements (one AVX-512 register)
+  static constexpr std::size_t kRowAlignment = 16;
+  static_assert(kRowAlignment % kDistanceBlock == 0, "The rows must hold whole distance blocks");
+
+  /**
+   * @brief      Bytes per element of an encoding.
+   *
+   * @param[in]  precision  The encoding
+   *
+   * @return     The number of bytes
+   */
+  static std::size_t elementSize(const HashPrecision &precision);
+
+  /**
+   * @brief      Number of floats of a prepared query: stride() for float32 and
+   *             float16, 2*stride() (codes and weights) for int8.
+   *
+   * @return     The number of floats
+   */
+  inline std::size_t preparedSize() const {
+    return encoding_ == HashPrecision::kInt8 ? 2*stride_ : stride_;
+  }
+
+  /**
+   * @brief      Prepares a query for the current encoding: pads it to the row
+   *             stride and, for int8, expresses it in code units with the
+   *             per-dimension weights. It must be prepared again if the store
+   *             is calibrated.
+   *
+   * @param[in]  query     The query hash
+   * @param[out] prepared  The prepared query (preparedSize() floats)
+   */
+  void prepareQuery(const std::vector<float> &query, AlignedVector<float> &prepared) const;
+
+  /**
+   * @brief      Prepares a query given as dim() floats.
+   *
+   * @param[in]  query     The query hash
+   * @param[out] prepared  The prepared query (preparedSize() floats)
+   */
+  void prepareQuery(const float *query, AlignedVector<float> &prepared) const;
+
+ protected:
+  /**
+   * @brief      Copies a mapped store to memory and releases the mapping.
+   */
+  void materialize();
+
+  /**
+   * @brief      Releases the mapping, if any.
+   */
+  void unmap();
+
+  /**
+   * @brief      Points the row and id views to the owned buffers.
+   */
+  void updateViews();
+
+  /**
+   * @brief      Builds the id to row index (lazily, it is not needed to scan).
+   */
+  void ensureIndex() const;
+
+  /**
+   * @brief      Sets the encoding of the rows (the store must be empty).
+   *
+   * @param[in]  encoding  The encoding
+   */
+  void setEncoding(const HashPrecision &encoding);
+
+  /**
+   * @brief      Encodes a hash into a row.
+   *
+   * @param[in]  hash  The hash (dim() elements)
+   * @param[out] dst   The row (rowBytes() bytes, the padding is left untouched)
+   */
+  void encode(const float *hash, uint8_t *dst) const;
+
+ private:
+  HashPrecision precision_;                       //!> Requested encoding
+  HashPrecision encoding_;                        //!> Current encoding (int8 stores are float32 until calibrated)
+  std::size_t calibration_size_;                  //!> Hashes used to calibrate the int8 quantization
+  std::size_t dim_ = 0;                           //!> Hash dimension
+  std::size_t stride_ = 0;                        //!> Row stride (dim_ rounded up to kRowAlignment)
+  std::size_t row_bytes_ = 0;                     //!> Bytes per row
+  std::size_t size_ = 0;                          //!> Number of rows
+  bool ids_sorted_ = true;                        //!> The ids of the rows are increasing (ignored ranges can be skipped)
+  uint64_t epoch_ = 0;                            //!> Changes of the existing rows (see epoch())
+  AlignedVector<uint8_t> data_;                   //!> Row-major hashes (when not mapped)
+  std::vector<uint> ids_;                         //!> Image id of every row (when not mapped)
+  AlignedVector<float> offset_;                   //!> Int8 quantization offset of every element
+  AlignedVector<float> scale_;                    //!> Int8 quantization scale of every element
+  const uint8_t *rows_ = nullptr;                 //!> View of the rows (owned or mapped)
+  const uint *row_ids_ = nullptr;                 //!> View of the ids (owned or mapped)
+  void *mapping_ = nullptr;                       //!> Mapped file, if any
+  std::size_t mapping_size_ = 0;                  //!> Size of the mapped file
+  mutable std::unordered_map<uint, std::size_t> index_;   //!> Row of every image id
+  mutable std::atomic<bool> index_ready_{true};   //!> False until the index of a loaded store is built
+  mutable std::mutex index_mutex_;                //!> Guards the lazy construction of the index
+  mutable std::shared_ptr<const std::vector<uint16_t>> block_order_;  //!> Blocks by decreasing variance (lazy)
+  mutable std::size_t block_order_rows_ = 0;      //!> Rows when block_order_ was computed
+  mutable std::mutex block_order_mutex_;          //!> Guards block_order_
+};
+
+}  // namespace haloc
@@ -0,0 +1,154 @@
+/**
+ * @file hnsw.h
+ *
+ * @brief Approximate nearest neighbour index (HNSW graph) over the stored
+ *        hashes, so queries do not need to scan the whole database.
+ *
+ * The graph only stores the image ids; the hashes are read from the store.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "libhaloc/hash_store.h"
+#include "libhaloc/top_k.h"
+
+namespace haloc {
+
+class HnswIndex {
+ public:
+  struct Params {
+    size_t m = 16;                  //!> Links per node (2*m at the bottom layer)
+    size_t ef_construction = 100;   //!> Candidate list size while inserting
+    size_t ef_search = 64;          //!> Candidate list size while searching: the recall/latency knob
+    uint32_t seed = 42;             //!> Seed of the level generator
+  };
+
+  //! Returns true for the image ids that can be returned by a search
+  using Filter = std::function<bool(const uint &)>;
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  store   The store with the hashes (must outlive the index)
+   * @param[in]  params  The parameters
+   */
+  HnswIndex(const HashStore &store, const Params &params);
+
+  /**
+   * @brief      Adds an image to the graph. Its hash must already be in the store.
+   *
+   * @param[in]  id    The image identifier
+   *
+   * @return     False if the image is not in the store or already indexed.
+   */
+  bool add(const uint &id);
+
+  /**
+   * @brief      Removes an image from the results. The node is kept to route
+   *             the searches.
+   *
+   * @param[in]  id    The image identifier
+   */
+  void remove(const uint &id);
+
+  /**
+   * @brief      Removes all the nodes.
+   */
+  void clear();
+
+  /**
+   * @brief      Approximate K nearest neighbours.
+   *
+   * @param[in]  query   The query, prepared with HashStore::prepareQuery()
+   * @param[in]  k       The number of neighbours
+   * @param[in]  filter  Optional filter of the results
+   * @param[in]  seeds   Optional extra entry points of the bottom layer (image
+   *                     ids, e.g. the candidates of the previous query), so the
+   *                     search starts next to the answer
+   *
+   * @return     The neighbours, sorted from best to worst (may be fewer than k)
+   */
+  std::vector<Candidate> search(
+    const float *query,
+    const size_t &k,
+    const Filter &filter = nullptr,
+    const std::vector<uint> &seeds = {}) const;
+
+  inline void setEfSearch(const size_t &ef) {params_.ef_search = ef;}
+  inline size_t size() const {return nodes_.size();}
+  inline bool contains(const uint &id) const {return labels_.count(id) > 0;}
+
+ protected:
+  struct Node {
+    uint label;                                   //!> Image id
+    bool deleted;                                 //!> Excluded from the results
+    std::vector<std::vector<uint32_t>> links;     //!> Neighbours of every layer
+  };
+
+  //! (distance, node) pairs
+  using Scored = std::pair<float, uint32_t>;
+
+  /**
+   * @brief      Distance between the (prepared) query and a node.
+   */
+  float distance(const float *query, const uint32_t &node) const;
+
+  /**
+   * @brief      Prepares the stored hash of a node as a query.
+   *
+   * @param[in]  node      The node
+   * @param[out] prepared  The prepared query
+   */
+  void prepareNode(const uint32_t &node, AlignedVector<float> &prepared) const;
+
+  /**
+   * @brief      Best-first search in one layer.
+   *
+   * @param[in]  query  The query
+   * @param[in]  entry  The entry points
+   * @param[in]  ef     The size of the candidate list
+   * @param[in]  layer  The layer
+   *
+   * @return     The ef closest nodes found (unsorted)
+   */
+  std::vector<Scored> searchLayer(
+    const float *query,
+    const std::vector<Scored> &entry,
+    const size_t &ef,
+    const int &layer) const;
+
+  /**
+   * @brief      Neighbour selection heuristic (keeps diverse neighbours).
+   *
+   * @param[in]  candidates  The candidates
+   * @param[in]  m           The maximum number of neighbours
+   *
+   * @return     The selected nodes
+   */
+  std::vector<uint32_t> selectNeighbors(std::vector<Scored> candidates, const size_t &m) const;
+
+  /**
+   * @brief      Adds a link, pruning the neighbour list if it is full.
+   */
+  void link(const uint32_t &from, const uint32_t &to, const int &layer);
+
+ private:
+  const HashStore &store_;                        //!> The hashes
+  Params params_;                                 //!> The parameters
+  std::vector<Node> nodes_;                       //!> The graph
+  std::unordered_map<uint, uint32_t> labels_;     //!> Node of every image id
+  std::mt19937 rng_;                              //!> Level generator
+  int max_level_;                                 //!> Top layer
+  uint32_t entry_;                                //!> Entry point (node of the top layer)
+};
+
+}  // namespace haloc
@@ -0,0 +1,147 @@
+/**
+ * @file ignore_filter.h
+ *
+ * @brief Images excluded from a query.
+ *
+ * The exclusions are id ranges, a bitset over dense ids and/or a predicate.
+ * A set of ids is converted to ranges, so the usual "ignore the last N
+ * images" costs a single range. When the ids of the store are sorted, the
+ * ranges are skipped during the scan instead of tested row by row.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace haloc {
+
+class IgnoreFilter {
+ public:
+  //! Ignored id range [first, second) (64-bit, so the largest id fits)
+  using Range = std::pair<uint64_t, uint64_t>;
+
+  //! Returns true if the image must be ignored
+  using Predicate = std::function<bool(const uint &)>;
+
+  /**
+   * @brief      Class constructor (nothing is ignored).
+   */
+  IgnoreFilter() = default;
+
+  /**
+   * @brief      Ignores a set of images. Consecutive ids are merged in ranges.
+   *
+   * @param[in]  ids   The image ids
+   */
+  IgnoreFilter(const std::set<uint> &ids);
+
+  /**
+   * @brief      Ignores a list of images.
+   *
+   * @param[in]  ids   The image ids
+   */
+  IgnoreFilter(std::initializer_list<uint> ids);
+
+  /**
+   * @brief      Ignores the images with lo <= id < hi.
+   *
+   * @param[in]  lo    The first id
+   * @param[in]  hi    The last id (not included)
+   *
+   * @return     This filter
+   */
+  IgnoreFilter& addRange(const uint &lo, const uint &hi);
+
+  /**
+   * @brief      Ignores an image.
+   *
+   * @param[in]  id    The image id
+   *
+   * @return     This filter
+   */
+  IgnoreFilter& addId(const uint &id);
+
+  /**
+   * @brief      Ignores the images whose bit is set (bit id % 64 of word
+   *             id / 64). The bitset is shared, so it can be kept and updated
+   *             by the caller between frames.
+   *
+   * @param[in]  bits  The bitset
+   *
+   * @return     This filter
+   */
+  IgnoreFilter& setBitset(const std::shared_ptr<const std::vector<uint64_t>> &bits);
+
+  /**
+   * @brief      Ignores the images for which the predicate returns true.
+   *
+   * @param[in]  predicate  The predicate
+   *
+   * @return     This filter
+   */
+  IgnoreFilter& setPredicate(const Predicate &predicate);
+
+  /**
+   * @brief      Determines if an image is ignored.
+   *
+   * @param[in]  id    The image id
+   *
+   * @return     True if ignored.
+   */
+  bool ignored(const uint &id) const;
+
+  /**
+   * @brief      Determines if an image is ignored by the bitset or the
+   *             predicate (the ranges are not tested).
+   *
+   * @param[in]  id    The image id
+   *
+   * @return     True if ignored.
+   */
+  bool ignoredByTest(const uint &id) const;
+
+  /**
+   * @brief      Splits a block of rows in the sub-blocks that are not ignored
+   *             by the ranges. The ids of the rows must be sorted.
+   *
+   * @param[in]  ids    The sorted ids of the store
+   * @param[in]  begin  The first row
+   * @param[in]  end    The last row (not included)
+   * @param[out] rows   The row intervals [first, second) to scan
+   */
+  void rowIntervals(
+    const uint *ids,
+    const std::size_t &begin,
+    const std::size_t &end,
+    std::vector<std::pair<std::size_t, std::size_t>> &rows) const;
+
+  inline bool empty() const {return ranges_.empty() && !hasTest();}
+  inline bool hasTest() const {return bits_ || predicate_;}
+  inline const std::vector<Range>& ranges() const {return ranges_;}
+
+ protected:
+  /**
+   * @brief      Inserts a range, merging it with the overlapping or adjacent ones.
+   *
+   * @param[in]  r     The range
+   */
+  void insertRange(Range r);
+
+ private:
+  std::vector<Range> ranges_;                         //!> Sorted, disjoint, non-adjacent ranges
+  std::shared_ptr<const std::vector<uint64_t>> bits_; //!> Ignored dense ids
+  Predicate predicate_;                               //!> Ignored by the caller
+};
+
+}  // namespace haloc
@@ -0,0 +1,99 @@
+/**
+ * @file retention.h
+ *
+ * @brief Retention policies of the hash database (bounded memory).
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/types.h>
+
+namespace haloc {
+
+/**
+ * @brief      Image evicted when the database is full.
+ */
+enum class RetentionPolicy {
+  kOldest,                //!> The oldest inserted image (sliding window)
+  kLeastRecentlyMatched   //!> The image returned as candidate (or inserted) the longest ago
+};
+
+/**
+ * @brief      Orders the stored images by the last time they were used.
+ */
+class RecencyTracker {
+ public:
+  /**
+   * @brief      Marks an image as used now (it is added if needed).
+   *
+   * @param[in]  id    The image id
+   */
+  inline void touch(const uint &id) {
+    tick_++;
+    const auto it = ticks_.find(id);
+    if (it != ticks_.end()) {
+      order_.erase({it->second, id});
+      it->second = tick_;
+    } else {
+      ticks_.emplace(id, tick_);
+    }
+    order_.insert({tick_, id});
+  }
+
+  /**
+   * @brief      Marks an image as used now, only if it is tracked.
+   *
+   * @param[in]  id    The image id
+   */
+  inline void refresh(const uint &id) {
+    if (ticks_.count(id) > 0) touch(id);
+  }
+
+  /**
+   * @brief      Stops tracking an image.
+   *
+   * @param[in]  id    The image id
+   */
+  inline void erase(const uint &id) {
+    const auto it = ticks_.find(id);
+    if (it == ticks_.end()) return;
+    order_.erase({it->second, id});
+    ticks_.erase(it);
+  }
+
+  /**
+   * @brief      The image used the longest ago.
+   *
+   * @param[out] id    The image id
+   *
+   * @return     False if no image is tracked.
+   */
+  inline bool oldest(uint &id) const {
+    if (order_.empty()) return false;
+    id = order_.begin()->second;
+    return true;
+  }
+
+  inline void clear() {
+    ticks_.clear();
+    order_.clear();
+  }
+
+  inline std::size_t size() const {return ticks_.size();}
+
+ private:
+  uint64_t tick_ = 0;                           //!> Logical clock
+  std::unordered_map<uint, uint64_t> ticks_;    //!> Last use of every image
+  std::set<std::pair<uint64_t, uint>> order_;   //!> Images by last use
+};
+
+}  // namespace haloc
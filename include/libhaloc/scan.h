@@ -0,0 +1,70 @@
+/**
+ * @file scan.h
+ *
+ * @brief Exact scan of a hash store: the distances of a block of rows to a set
+ * of queries, folded into one top-K selection per query.
+ *
+ * The rows are ranked on squared distances (same order, no square root per
+ * row), and squaredToDistance() converts the selected candidates. With a single
+ * query over float32 rows the scan can also abandon a row as soon as its
+ * partial distance exceeds the K-th best one (ScanParams::early_abandon): the
+ * selection is the same as the one of the full scan.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include "libhaloc/hash_store.h"
+#include "libhaloc/ignore_filter.h"
+#include "libhaloc/top_k.h"
+
+namespace haloc {
+
+/**
+ * @brief      Parameters of the exact scan.
+ */
+struct ScanParams {
+  bool early_abandon = true;      //!> Abandon the rows whose partial distance exceeds the K-th best (one query, float32 rows)
+  bool variance_order = true;     //!> Compare the blocks of elements with the largest variance first (HashStore::blockOrder())
+};
+
+/**
+ * @brief      Scans a range of the rows of a store.
+ *
+ * @param[in]  store             The store
+ * @param[in]  queries           The queries, prepared with HashStore::prepareQuery() (row-major)
+ * @param[in]  num_queries       The number of queries
+ * @param[in]  begin             The first row
+ * @param[in]  end               The last row (not included)
+ * @param[in]  images_to_ignore  The images to ignore (ids, id ranges, bitset or predicate)
+ * @param      top_k             The selections to update (one per query). Their
+ *                               scores are squared distances.
+ * @param[in]  params            The scan parameters
+ */
+void scanRows(
+  const HashStore &store,
+  const float *queries,
+  const std::size_t &num_queries,
+  const std::size_t &begin,
+  const std::size_t &end,
+  const IgnoreFilter &images_to_ignore,
+  TopK *top_k,
+  const ScanParams &params = ScanParams());
+
+/**
+ * @brief      Converts the scores of the candidates of a scan (squared
+ *             distances) to L2 distances.
+ *
+ * @param      candidates  The candidates
+ * @param[in]  n           The number of candidates
+ */
+inline void squaredToDistance(Candidate *candidates, const std::size_t &n) {
+  for (std::size_t i=0; i < n; i++) candidates[i].score = std::sqrt(candidates[i].score);
+}
+
+}  // namespace haloc
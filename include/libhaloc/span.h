@@ -0,0 +1,54 @@
+/**
+ * @file span.h
+ *
+ * @brief Non-owning view of a contiguous array (std::span is C++20).
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace haloc {
+
+template <typename T>
+class Span {
+ public:
+  Span() = default;
+  Span(T *data, const std::size_t &size) : data_{data}, size_{size} {}
+
+  template <typename A>
+  Span(std::vector<T, A> &v) : data_{v.data()}, size_{v.size()} {}
+
+  template <std::size_t N>
+  Span(std::array<T, N> &a) : data_{a.data()}, size_{N} {}
+
+  template <std::size_t N>
+  Span(T (&a)[N]) : data_{a}, size_{N} {}
+
+  inline T* data() const {return data_;}
+  inline std::size_t size() const {return size_;}
+  inline bool empty() const {return size_ == 0;}
+  inline T& operator[](const std::size_t &i) const {return data_[i];}
+  inline T* begin() const {return data_;}
+  inline T* end() const {return data_ + size_;}
+
+  /**
+   * @brief      View of the first elements.
+   *
+   * @param[in]  count  The number of elements
+   *
+   * @return     The view
+   */
+  inline Span first(const std::size_t &count) const {return Span(data_, count < size_ ? count : size_);}
+
+ private:
+  T *data_ = nullptr;         //!> First element
+  std::size_t size_ = 0;      //!> Number of elements
+};
+
+}  // namespace haloc
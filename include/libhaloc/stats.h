@@ -0,0 +1,263 @@
+/**
+ * @file stats.h
+ *
+ * @brief Optional instrumentation: latency histograms of the processing
+ * stages, the number of keypoints and the size of the database.
+ *
+ * The samples are only taken when the library is built with
+ * HALOC_ENABLE_STATS (CMake option of the same name). Otherwise the timing
+ * macros expand to nothing and the histograms stay empty, so the
+ * instrumentation costs nothing. The API is always available, so the callers
+ * do not need to be built differently.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace haloc {
+
+/**
+ * @brief      Instrumented stages.
+ */
+enum class Stage : std::size_t {
+  kExtraction = 0,  //!> Keypoint detection and description
+  kSubsampling,     //!> Selection of the descriptors (only when there are more than max_desc)
+  kProjection,      //!> Projection of the descriptors onto the basis
+  kScan,            //!> Database scan (exact, binary or approximate)
+  kTopK,            //!> Final selection and sorting of the candidates
+  kNumStages
+};
+
+constexpr std::size_t kNumStages = static_cast<std::size_t>(Stage::kNumStages);
+
+/**
+ * @brief      Name of a stage (e.g. for metric labels).
+ *
+ * @param[in]  stage  The stage
+ *
+ * @return     The name
+ */
+inline const char* stageName(const Stage &stage) {
+  static constexpr const char *kNames[kNumStages] = {"extraction", "subsampling", "projection", "scan", "top_k"};
+  return static_cast<std::size_t>(stage) < kNumStages ? kNames[static_cast<std::size_t>(stage)] : "unknown";
+}
+
+/**
+ * @brief      Copy of the content of a histogram.
+ */
+struct HistogramSnapshot {
+  static constexpr std::size_t kBuckets = 48;   //!> Bucket b counts the values in [2^(b-1), 2^b) (bucket 0: value 0)
+
+  std::array<uint64_t, kBuckets> buckets{};     //!> Number of values of every bucket
+  uint64_t count = 0;                           //!> Number of values
+  uint64_t sum = 0;                             //!> Sum of the values
+  uint64_t max = 0;                             //!> Largest value
+
+  /**
+   * @brief      Upper bound of a bucket (exclusive), e.g. the "le" label of a
+   *             Prometheus histogram.
+   *
+   * @param[in]  b     The bucket
+   *
+   * @return     The bound
+   */
+  static inline uint64_t upperBound(const std::size_t &b) {
+    return b + 1 >= 64 ? UINT64_MAX : (uint64_t{1} << b);
+  }
+
+  inline double mean() const {return count == 0 ? 0.0 : static_cast<double>(sum) / count;}
+
+  /**
+   * @brief      Approximate quantile: the upper bound of the bucket that holds it.
+   *
+   * @param[in]  q     The quantile, in [0, 1]
+   *
+   * @return     The value
+   */
+  inline uint64_t quantile(const double &q) const {
+    const uint64_t rank = static_cast<uint64_t>(q*count);
+    uint64_t seen = 0;
+    for (std::size_t b=0; b < kBuckets; b++) {
+      seen += buckets[b];
+      if (seen > rank) return std::min(max, upperBound(b));
+    }
+    return max;
+  }
+};
+
+/**
+ * @brief      Histogram with power of two buckets. Recording is a few relaxed
+ *             atomic additions, so it can be fed from several threads.
+ */
+class Histogram {
+ public:
+  /**
+   * @brief      Records a value.
+   *
+   * @param[in]  value  The value (e.g. nanoseconds)
+   */
+  inline void record(const uint64_t &value) {
+    std::size_t b = 0;
+    if (value > 0) b = std::min<std::size_t>(HistogramSnapshot::kBuckets - 1, 64 - __builtin_clzll(value));
+    buckets_[b].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+  }
+
+  inline HistogramSnapshot snapshot() const {
+    HistogramSnapshot s;
+    for (std::size_t b=0; b < HistogramSnapshot::kBuckets; b++) {
+      s.buckets[b] = buckets_[b].load(std::memory_order_relaxed);
+    }
+    s.count = count_.load(std::memory_order_relaxed);
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+  inline void reset() {
+    for (auto &b : buckets_) b.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::array<std::atomic<uint64_t>, HistogramSnapshot::kBuckets> buckets_{};  //!> Bucket counts
+  std::atomic<uint64_t> count_{0};      //!> Number of values
+  std::atomic<uint64_t> sum_{0};        //!> Sum of the values
+  std::atomic<uint64_t> max_{0};        //!> Largest value
+};
+
+/**
+ * @brief      Stage latencies of one call (process(), query()...).
+ */
+struct CallStats {
+  std::array<uint64_t, kNumStages> ns{};  //!> Nanoseconds spent in every stage
+  std::size_t keypoints = 0;              //!> Keypoints of the image
+  std::size_t entries = 0;                //!> Images in the database after the call
+};
+
+/**
+ * @brief      Aggregated statistics.
+ */
+struct StatsSnapshot {
+  std::array<HistogramSnapshot, kNumStages> stages;   //!> Latency of every stage, in nanoseconds
+  HistogramSnapshot keypoints;                        //!> Keypoints per image
+  std::size_t entries = 0;                            //!> Images in the database
+  std::size_t bytes = 0;                              //!> Bytes used by the stored hashes
+
+  inline const HistogramSnapshot& stage(const Stage &s) const {return stages[static_cast<std::size_t>(s)];}
+};
+
+/**
+ * @brief      Collector of the statistics of a detector.
+ */
+class Stats {
+ public:
+  //! True if the library records the samples (HALOC_ENABLE_STATS)
+#ifdef HALOC_ENABLE_STATS
+  static constexpr bool kEnabled = true;
+#else
+  static constexpr bool kEnabled = false;
+#endif
+
+  inline void record(const Stage &stage, const uint64_t &ns) {
+    stages_[static_cast<std::size_t>(stage)].record(ns);
+    current().ns[static_cast<std::size_t>(stage)] += ns;
+  }
+
+  inline void recordKeypoints(const std::size_t &n) {
+    keypoints_.record(n);
+    current().keypoints = n;
+  }
+
+  /**
+   * @brief      The stage latencies of the call running in this thread (since
+   *             the last beginCall()).
+   *
+   * @return     The call statistics
+   */
+  static inline CallStats& current() {
+    thread_local CallStats call;
+    return call;
+  }
+
+  static inline void beginCall() {current() = CallStats();}
+
+  /**
+   * @brief      Copy of the histograms (the database fields are left to the owner).
+   *
+   * @return     The snapshot
+   */
+  inline StatsSnapshot snapshot() const {
+    StatsSnapshot s;
+    for (std::size_t i=0; i < kNumStages; i++) s.stages[i] = stages_[i].snapshot();
+    s.keypoints = keypoints_.snapshot();
+    return s;
+  }
+
+  inline void reset() {
+    for (auto &h : stages_) h.reset();
+    keypoints_.reset();
+  }
+
+ private:
+  std::array<Histogram, kNumStages> stages_;  //!> Latency of every stage
+  Histogram keypoints_;                       //!> Keypoints per image
+};
+
+/**
+ * @brief      Records the lifetime of the scope as the latency of a stage.
+ */
+class StageTimer {
+ public:
+  StageTimer(Stats *stats, const Stage &stage) :
+    stats_{stats},
+    stage_{stage},
+    start_{std::chrono::steady_clock::now()} {}
+
+  ~StageTimer() {
+    if (!stats_) return;
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    stats_->record(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  StageTimer(const StageTimer &) = delete;
+  StageTimer& operator=(const StageTimer &) = delete;
+
+ private:
+  Stats *stats_;                                      //!> Destination (nullptr = none)
+  Stage stage_;                                       //!> The stage
+  std::chrono::steady_clock::time_point start_;       //!> Start of the scope
+};
+
+}  // namespace haloc
+
+#ifdef HALOC_ENABLE_STATS
+#define HALOC_STATS_CONCAT_(a, b) a##b
+#define HALOC_STATS_CONCAT(a, b) HALOC_STATS_CONCAT_(a, b)
+//! Times the rest of the enclosing scope as a stage
+#define HALOC_STATS_SCOPE(stats, stage) \
+  ::haloc::StageTimer HALOC_STATS_CONCAT(haloc_stage_timer_, __LINE__)(stats, stage)
+//! Records the number of keypoints of an image
+#define HALOC_STATS_KEYPOINTS(stats, n) do {if (stats) (stats)->recordKeypoints(n);} while (0)
+//! Starts the statistics of a call in this thread
+#define HALOC_STATS_BEGIN_CALL() ::haloc::Stats::beginCall()
+#else
+#define HALOC_STATS_SCOPE(stats, stage) do {} while (0)
+#define HALOC_STATS_KEYPOINTS(stats, n) do {} while (0)
+#define HALOC_STATS_BEGIN_CALL() do {} while (0)
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file status.h
+ *
+ * @brief Status codes and a value-or-status result (std::expected is C++23).
+ *
+ * The per-image failures (an image without features, a hash of another size,
+ * a query without candidates) are returned as codes instead of being printed,
+ * so a feature-poor sequence does not write to stderr on every frame.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <optional>
+#include <utility>
+
+namespace haloc {
+
+/**
+ * @brief      Outcome of an operation.
+ */
+enum class Status {
+  kOk = 0,              //!> Success
+  kEmptyImage,          //!> The image is empty
+  kNoDescriptors,       //!> No descriptors could be extracted
+  kSizeMismatch,        //!> The hash size does not match the stored hashes
+  kNoCandidates,        //!> The query did not return any candidate
+  kUnknownShard,        //!> The database shard does not exist
+  kMissingDescriptors,  //!> The descriptors of a stored image were not kept (Config::keep_descriptors)
+  kInvalidArgument      //!> Inconsistent arguments (e.g. sizes of the inputs)
+};
+
+/**
+ * @brief      Description of a status (e.g. for the logs of the caller).
+ *
+ * @param[in]  status  The status
+ *
+ * @return     The description
+ */
+inline const char* statusMessage(const Status &status) {
+  switch (status) {
+    case Status::kOk: return "Success";
+    case Status::kEmptyImage: return "The image is empty";
+    case Status::kNoDescriptors: return "No descriptors could be extracted";
+    case Status::kSizeMismatch: return "The hash size does not match the stored hashes";
+    case Status::kNoCandidates: return "No candidates found";
+    case Status::kUnknownShard: return "The shard does not exist";
+    case Status::kMissingDescriptors: return "The descriptors of a stored image were not kept";
+    case Status::kInvalidArgument: return "Invalid argument";
+  }
+  return "Unknown status";
+}
+
+/**
+ * @brief      A value or the status that prevented computing it. It can be used
+ *             as the std::optional it replaces (has_value(), operator bool,
+ *             operator*), and status() tells why there is no value.
+ */
+template <typename T>
+class Result {
+ public:
+  Result(const T &value) : value_{value} {}
+  Result(T &&value) : value_{std::move(value)} {}
+
+  /**
+   * @brief      An error (kOk is not an error: it is stored as kInvalidArgument).
+   *
+   * @param[in]  status  The status
+   */
+  Result(const Status &status) : status_{status == Status::kOk ? Status::kInvalidArgument : status} {}
+
+  inline bool has_value() const {return value_.has_value();}
+  inline bool ok() const {return value_.has_value();}
+  inline explicit operator bool() const {return value_.has_value();}
+  inline Status status() const {return status_;}
+
+  //! The value (throws std::bad_optional_access on error)
+  inline T& value() & {return value_.value();}
+  inline const T& value() const & {return value_.value();}
+  inline T&& value() && {return std::move(value_).value();}
+
+  inline T& operator*() & {return *value_;}
+  inline const T& operator*() const & {return *value_;}
+  inline T&& operator*() && {return std::move(*value_);}
+  inline T* operator->() {return &*value_;}
+  inline const T* operator->() const {return &*value_;}
+
+  template <typename U>
+  inline T value_or(U &&other) const & {return value_.value_or(std::forward<U>(other));}
+
+ private:
+  std::optional<T> value_;          //!> The value (empty on error)
+  Status status_ = Status::kOk;     //!> Why there is no value
+};
+
+}  // namespace haloc
@@ -0,0 +1,62 @@
+/**
+ * @file subsample.h
+ *
+ * @brief Deterministic selection of the descriptors hashed when an image has
+ * more than the maximum number of descriptors.
+ *
+ * The selection is a list of row indices into the descriptor matrix, so the
+ * descriptors are never copied: the projection reads the rows through it.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace haloc {
+
+/**
+ * @brief      How the descriptors are selected.
+ */
+enum class SubsampleStrategy {
+  kReservoir,     //!> Uniform random sample, seeded (the same descriptors always give the same sample)
+  kTopResponse,   //!> The keypoints with the strongest response
+  kSpatial        //!> The strongest keypoints of every cell of a grid, so the whole image is covered
+};
+
+/**
+ * @brief      Parameters of the descriptor selection.
+ */
+struct SubsampleParams {
+  SubsampleStrategy strategy = SubsampleStrategy::kReservoir;  //!> The strategy
+  int grid_cols = 4;            //!> kSpatial: columns of the grid (over the bounding box of the keypoints)
+  int grid_rows = 4;            //!> kSpatial: rows of the grid
+};
+
+/**
+ * @brief      Selects max_rows of num_rows descriptors. The strategies that
+ *             need the keypoints fall back to kReservoir when there is not one
+ *             keypoint per descriptor. Ties are resolved by index, so the
+ *             selection is reproducible.
+ *
+ * @param[in]  num_rows  The number of descriptors
+ * @param[in]  max_rows  The number of descriptors to select
+ * @param[in]  kps       The keypoints of the descriptors (can be empty)
+ * @param[in]  params    The strategy
+ * @param[in]  seed      The seed of kReservoir
+ * @param[out] indices   The selected rows, in increasing order (min(num_rows, max_rows) elements)
+ */
+void subsampleDescriptors(
+  const int &num_rows,
+  const int &max_rows,
+  const std::vector<cv::KeyPoint> &kps,
+  const SubsampleParams &params,
+  const uint32_t &seed,
+  std::vector<int> &indices);
+
+}  // namespace haloc
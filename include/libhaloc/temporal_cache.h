@@ -0,0 +1,157 @@
+/**
+ * @file temporal_cache.h
+ *
+ * @brief Cache of the last query, for the consecutive frames of a moving
+ * robot (very similar hashes and candidates).
+ *
+ * Every query seeds its selection with the candidates of the previous one
+ * and the rows next to them (the images taken just before and after): K of
+ * them give an upper bound of the K-th best distance, so the early-abandon
+ * scan (ScanParams) rejects most rows from the first block, and the ANN
+ * search starts next to the answer. Seeding never changes the candidates.
+ *
+ * When the hash moved less than epsilon since the last searched query, its
+ * candidates are re-scored (together with the images inserted since) instead
+ * of searching the database. The searched queries keep reserve*K
+ * candidates: if the hash moved by delta, the rows out of that selection are
+ * at least at its last distance minus delta, so a re-scored K-th distance
+ * under that bound proves the reused selection is the one of the search
+ * (unless TemporalParams::verify is disabled). The images ignored by the
+ * searched query and not by the new one (e.g. the ones leaving a sliding
+ * window of ignored ids) are scored too. A search that ignored images with a
+ * bitset or a predicate is never reused, what they ignored is not known.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "libhaloc/hash_store.h"
+#include "libhaloc/ignore_filter.h"
+#include "libhaloc/span.h"
+#include "libhaloc/top_k.h"
+
+namespace haloc {
+
+/**
+ * @brief      Parameters of the temporal cache.
+ */
+struct TemporalParams {
+  bool enabled = false;         //!> Seed every query with the candidates of the previous one
+  std::size_t neighbours = 1;   //!> Rows before and after every previous candidate also used as seeds
+  float epsilon = 0.0f;         //!> Reuse the previous candidates when the hash moved less than this (L2, 0 = always search)
+  std::size_t reserve = 2;      //!> The searched queries keep reserve*K candidates, so the reused selections can be verified
+  bool verify = true;           //!> Only reuse a selection that is provably the one of the search
+};
+
+class TemporalCache {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  params  The parameters
+   */
+  explicit TemporalCache(const TemporalParams &params = TemporalParams()) : params_{params} {}
+
+  /**
+   * @brief      Reuses the selection of the last searched query if the hash
+   *             moved less than epsilon (re-scored, with the rows appended
+   *             since and the ones the searched query ignored).
+   *
+   * @param[in]  store             The store
+   * @param[in]  prepared          The query, prepared with HashStore::prepareQuery()
+   * @param[in]  hash              The query hash
+   * @param[in]  images_to_ignore  The images to ignore
+   * @param[out] out               The candidates (K = out.size())
+   *
+   * @return     The number of candidates written, 0 if the database has to be
+   *             searched.
+   */
+  std::size_t reuse(
+    const HashStore &store,
+    const float *prepared,
+    const std::vector<float> &hash,
+    const IgnoreFilter &images_to_ignore,
+    Span<Candidate> out);
+
+  /**
+   * @brief      Upper bound of the K-th best squared distance, from the
+   *             previous candidates and their neighbouring rows (for
+   *             TopK::setLimit()).
+   *
+   * @param[in]  store             The store
+   * @param[in]  prepared          The query, prepared with HashStore::prepareQuery()
+   * @param[in]  k                 The number of candidates
+   * @param[in]  images_to_ignore  The images to ignore
+   *
+   * @return     The bound, +inf if there are less than K seeds.
+   */
+  float limit(
+    const HashStore &store,
+    const float *prepared,
+    const std::size_t &k,
+    const IgnoreFilter &images_to_ignore) const;
+
+  /**
+   * @brief      Ids of the previous candidates (entry points of the ANN search).
+   *
+   * @return     The ids
+   */
+  std::vector<uint> seeds() const;
+
+  /**
+   * @brief      Number of candidates a searched query has to keep.
+   *
+   * @param[in]  k     The number of candidates requested
+   *
+   * @return     reserve*K
+   */
+  inline std::size_t searchSize(const std::size_t &k) const {return k*std::max<std::size_t>(1, params_.reserve);}
+
+  /**
+   * @brief      Records the result of a searched query.
+   *
+   * @param[in]  store             The store (after the query)
+   * @param[in]  hash              The query hash
+   * @param[in]  images_to_ignore  The images ignored by the query
+   * @param[in]  candidates        The candidates, L2 scores sorted from best to worst
+   * @param[in]  n                 The number of candidates
+   * @param[in]  k                 The number of candidates searched (searchSize())
+   */
+  void update(
+    const HashStore &store,
+    const std::vector<float> &hash,
+    const IgnoreFilter &images_to_ignore,
+    const Candidate *candidates,
+    const std::size_t &n,
+    const std::size_t &k);
+
+  void clear();
+
+  inline const TemporalParams& params() const {return params_;}
+
+  //! Number of queries answered with a reused selection
+  inline std::size_t hits() const {return hits_;}
+
+ private:
+  TemporalParams params_;                 //!> Parameters
+  std::vector<float> hash_;               //!> Last searched hash (empty = none)
+  std::vector<Candidate> candidates_;     //!> Its candidates (L2 scores, best first)
+  std::vector<IgnoreFilter::Range> ignored_;  //!> Its ignored id ranges
+  bool ignored_test_ = false;             //!> It ignored images with a bitset or a predicate
+  std::vector<IgnoreFilter::Range> unignored_;  //!> Ranges ignored by the search and not by the reuse
+  std::size_t k_ = 0;                     //!> Number of candidates searched
+  std::size_t rows_ = 0;                  //!> Rows of the store at the search
+  uint64_t epoch_ = 0;                    //!> HashStore::epoch() at the search
+  std::size_t hits_ = 0;                  //!> Reused selections
+};
+
+}  // namespace haloc
@@ -0,0 +1,102 @@
+/**
+ * @file thread_pool.h
+ *
+ * @brief Fixed-size pool of worker threads.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace haloc {
+
+class ThreadPool {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  num_threads  The number of worker threads (0 = one per core)
+   */
+  explicit ThreadPool(const size_t &num_threads = 0);
+
+  /**
+   * @brief      Class destructor. Pending tasks are completed before joining.
+   */
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool& operator=(const ThreadPool &) = delete;
+
+  /**
+   * @brief      Queues a task.
+   *
+   * @param[in]  f     The task
+   *
+   * @return     The future result of the task
+   */
+  template <typename F>
+  auto submit(F &&f) -> std::future<decltype(f())> {
+    using R = decltype(f());
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    std::future<R> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace([task]() {(*task)();});
+    }
+    cv_.notify_one();
+    return result;
+  }
+
+  /**
+   * @brief      Waits for a future. Meanwhile the calling thread runs queued
+   *             tasks, so a task may wait for its own sub-tasks without
+   *             starving the pool.
+   *
+   * @param[in]  f     The future
+   */
+  template <typename T>
+  void wait(const std::future<T> &f) {
+    while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      if (!runPendingTask()) f.wait_for(std::chrono::microseconds(50));
+    }
+  }
+
+  /**
+   * @brief      Number of worker threads.
+   *
+   * @return     The number of threads
+   */
+  inline size_t size() const {return workers_.size();}
+
+ protected:
+  /**
+   * @brief      Runs one queued task in the calling thread, if any.
+   *
+   * @return     True if a task was run.
+   */
+  bool runPendingTask();
+
+  /**
+   * @brief      Worker loop.
+   */
+  void work();
+
+ private:
+  std::vector<std::thread> workers_;          //!> Worker threads
+  std::queue<std::function<void()>> tasks_;   //!> Queued tasks
+  std::mutex mutex_;                          //!> Protects tasks_ and stop_
+  std::condition_variable cv_;                //!> Signals new tasks
+  bool stop_;                                 //!> True when destroying the pool
+};
+
+}  // namespace haloc
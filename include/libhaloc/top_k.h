@@ -0,0 +1,179 @@
+/**
+ * @file top_k.h
+ *
+ * @brief Streaming selection of the K best (smallest score) candidates.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace haloc {
+
+/**
+ * @brief      A loop closure candidate: image id and its hash distance to the
+ *             query (the smallest, the more similar).
+ */
+struct Candidate {
+  uint id;
+  float score;
+};
+
+/**
+ * @brief      Strict ordering of the candidates: by score and then by id, so
+ *             that ties are always resolved the same way.
+ */
+inline bool operator<(const Candidate &a, const Candidate &b) {
+  return a.score < b.score || (a.score == b.score && a.id < b.id);
+}
+
+inline bool operator==(const Candidate &a, const Candidate &b) {
+  return a.id == b.id && a.score == b.score;
+}
+
+/**
+ * @brief      Keeps the K best candidates of a stream in a bounded max-heap.
+ *             Every push is O(log K) and no more than K candidates are stored.
+ */
+class TopK {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  k     The number of candidates to keep
+   */
+  explicit TopK(const std::size_t &k = 0) : k_{k} {heap_.reserve(k);}
+
+  /**
+   * @brief      Restarts the selection.
+   *
+   * @param[in]  k     The number of candidates to keep
+   */
+  inline void reset(const std::size_t &k) {
+    k_ = k;
+    limit_ = std::numeric_limits<float>::infinity();
+    heap_.clear();
+    heap_.reserve(k);
+  }
+
+  /**
+   * @brief      Rejects the candidates with a larger score, even when the
+   *             selection is not full. Used when the K-th best score is known
+   *             to be at most the limit (e.g. K candidates with smaller scores
+   *             exist), so the scan can abandon rows from its first block.
+   *
+   * @param[in]  limit  The largest score accepted
+   */
+  inline void setLimit(const float &limit) {limit_ = limit;}
+
+  /**
+   * @brief      Offers a candidate to the selection.
+   *
+   * @param[in]  c     The candidate
+   */
+  inline void push(const Candidate &c) {
+    if (c.score > limit_) return;
+    if (heap_.size() < k_) {
+      heap_.push_back(c);
+      std::push_heap(heap_.begin(), heap_.end());
+    } else if (k_ > 0 && c < heap_.front()) {
+      std::pop_heap(heap_.begin(), heap_.end());
+      heap_.back() = c;
+      std::push_heap(heap_.begin(), heap_.end());
+    }
+  }
+
+  /**
+   * @brief      Merges another selection into this one.
+   *
+   * @param[in]  other  The other selection
+   */
+  inline void merge(const TopK &other) {
+    for (const auto &c : other.heap_) push(c);
+  }
+
+  /**
+   * @brief      Score a new candidate has to beat to enter the selection.
+   *
+   * @return     The score of the K-th best candidate or the limit (+inf by
+   *             default) if not full.
+   */
+  inline float bound() const {
+    return full() && k_ > 0 ? heap_.front().score : limit_;
+  }
+
+  inline bool full() const {return heap_.size() >= k_;}
+  inline std::size_t size() const {return heap_.size();}
+  inline std::size_t capacity() const {return k_;}
+
+  /**
+   * @brief      Extracts the selected candidates, from best to worst. The
+   *             selection is left empty.
+   *
+   * @return     The sorted candidates
+   */
+  inline std::vector<Candidate> sorted() {
+    std::sort_heap(heap_.begin(), heap_.end());
+    std::vector<Candidate> out;
+    out.swap(heap_);
+    return out;
+  }
+
+  /**
+   * @brief      Copies the selected candidates, from best to worst, without
+   *             allocating. The selection is left empty (its memory is kept).
+   *
+   * @param[out] out   The candidates (at least size() elements)
+   *
+   * @return     The number of candidates
+   */
+  inline std::size_t sortedInto(Candidate *out) {
+    std::sort_heap(heap_.begin(), heap_.end());
+    const std::size_t n = heap_.size();
+    std::copy(heap_.begin(), heap_.end(), out);
+    heap_.clear();
+    return n;
+  }
+
+ private:
+  std::size_t k_;                 //!> Number of candidates to keep
+  float limit_ = std::numeric_limits<float>::infinity();   //!> Largest score accepted
+  std::vector<Candidate> heap_;   //!> Max-heap, the worst candidate on top
+};
+
+/**
+ * @brief      Recall of approximate results (e.g. a quantized store or the ANN
+ *             index) against exact ones: the fraction of the reference ids
+ *             found in the results of the same query.
+ *
+ * @param[in]  reference  The exact candidates of every query
+ * @param[in]  results    The approximate candidates of every query
+ *
+ * @return     The recall, in [0, 1] (1 if there is no reference candidate)
+ */
+inline double recall(
+    const std::vector<std::vector<Candidate>> &reference,
+    const std::vector<std::vector<Candidate>> &results) {
+  std::size_t found = 0;
+  std::size_t total = 0;
+  for (std::size_t q=0; q < reference.size(); q++) {
+    total += reference[q].size();
+    if (q >= results.size()) continue;
+    for (const auto &r : reference[q]) {
+      const auto it = std::find_if(results[q].begin(), results[q].end(),
+                                   [&](const Candidate &c) {return c.id == r.id;});
+      if (it != results[q].end()) found++;
+    }
+  }
+  return total == 0 ? 1.0 : static_cast<double>(found) / total;
+}
+
+}  // namespace haloc
@@ -0,0 +1,226 @@
+/**
+ * @file async_haloc.cc
+ *
+ * @brief Asynchronous, pipelined front-end of the loop closure detector.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "libhaloc/async_haloc.h"
+
+namespace haloc {
+
+namespace {
+
+/**
+ * @brief      Waits a little before retrying a full or empty queue: first
+ *             yields, then sleeps, so an idle pipeline does not burn a core.
+ */
+void backoff(int &spins) {
+  if (++spins < 64) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+}  // namespace
+
+AsyncHaloc::AsyncHaloc(const Config &config, const AsyncParams &params) :
+    haloc_{config},
+    params_{params},
+    prepare_queue_{params.queue_size},
+    extract_queue_{params.queue_size},
+    hash_queue_{params.queue_size},
+    query_queue_{params.queue_size} {
+  // The other stages use one thread each
+  size_t extract_threads = params_.extract_threads;
+  if (extract_threads == 0) {
+    const size_t cores = std::thread::hardware_concurrency();
+    extract_threads = cores > 4 ? cores - 3 : 1;
+  }
+
+  threads_.emplace_back(&AsyncHaloc::prepareStage, this);
+  for (size_t t=0; t < extract_threads; t++) {
+    threads_.emplace_back(&AsyncHaloc::extractStage, this, haloc_.extractor_->clone());
+  }
+  threads_.emplace_back(&AsyncHaloc::hashStage, this);
+  threads_.emplace_back(&AsyncHaloc::queryStage, this);
+}
+
+AsyncHaloc::~AsyncHaloc() {
+  flush();
+  stop_.store(true, std::memory_order_release);
+  for (auto &t : threads_) t.join();
+}
+
+std::future<AsyncResult> AsyncHaloc::submit(
+    const uint &image_id,
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore,
+    const Callback &callback) {
+  auto job = std::make_unique<Job>();
+  job->id = image_id;
+  job->num_candidates = num_candidates;
+  job->ignore = images_to_ignore;
+  job->callback = callback;
+  job->image = image;
+  return enqueue(std::move(job));
+}
+
+std::future<AsyncResult> AsyncHaloc::submitEncoded(
+    const uint &image_id,
+    std::vector<uchar> data,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore,
+    const Callback &callback) {
+  auto job = std::make_unique<Job>();
+  job->id = image_id;
+  job->num_candidates = num_candidates;
+  job->ignore = images_to_ignore;
+  job->callback = callback;
+  job->encoded = std::move(data);
+  return enqueue(std::move(job));
+}
+
+void AsyncHaloc::flush() {
+  int spins = 0;
+  while (in_flight_.load(std::memory_order_acquire) > 0) backoff(spins);
+}
+
+std::future<AsyncResult> AsyncHaloc::enqueue(JobPtr job) {
+  auto result = job->promise.get_future();
+  in_flight_.fetch_add(1, std::memory_order_acq_rel);
+  push(prepare_queue_, job);
+  return result;
+}
+
+void AsyncHaloc::push(Queue &queue, JobPtr &job) {
+  int spins = 0;
+  while (!queue.tryPush(job)) {
+    JobPtr oldest;
+    if (params_.drop_policy == DropPolicy::kDropOldest && queue.tryPop(oldest)) {
+      complete(std::move(oldest), AsyncStatus::kDropped);
+    } else {
+      backoff(spins);
+    }
+  }
+}
+
+bool AsyncHaloc::pop(Queue &queue, JobPtr &job) {
+  int spins = 0;
+  while (!queue.tryPop(job)) {
+    if (stop_.load(std::memory_order_acquire)) return false;
+    backoff(spins);
+  }
+  return true;
+}
+
+void AsyncHaloc::complete(
+    JobPtr job,
+    const AsyncStatus &status,
+    const Status &error,
+    std::optional<std::vector<Candidate>> candidates) {
+  AsyncResult result;
+  result.id = job->id;
+  result.status = status;
+  result.error = error;
+  result.candidates = std::move(candidates);
+  if (status == AsyncStatus::kDropped) dropped_.fetch_add(1, std::memory_order_relaxed);
+
+  if (job->callback) job->callback(result);
+  job->promise.set_value(std::move(result));
+  in_flight_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void AsyncHaloc::prepareStage() {
+  JobPtr job;
+  while (pop(prepare_queue_, job)) {
+    try {
+      if (!job->encoded.empty()) {
+        job->image = cv::imdecode(job->encoded, cv::IMREAD_GRAYSCALE);
+        job->encoded.clear();
+      } else if (job->image.channels() == 3 || job->image.channels() == 4) {
+        cv::Mat gray;
+        cv::cvtColor(job->image, gray, job->image.channels() == 3 ? cv::COLOR_BGR2GRAY : cv::COLOR_BGRA2GRAY);
+        job->image = gray;
+      }
+    } catch (const cv::Exception &e) {
+      std::cerr << "[AsyncHaloc]: ERROR -> Cannot prepare image " << job->id << ": " << e.what() << std::endl;
+      job->image.release();
+    }
+    if (job->image.empty() && haloc_.extractor_->needsImage()) {
+      complete(std::move(job), AsyncStatus::kFailed, Status::kEmptyImage);
+      continue;
+    }
+    push(extract_queue_, job);
+  }
+}
+
+void AsyncHaloc::extractStage(std::unique_ptr<DescriptorExtractor> extractor) {
+  JobPtr job;
+  while (pop(extract_queue_, job)) {
+    try {
+      HALOC_STATS_SCOPE(&haloc_.stats_, Stage::kExtraction);
+      extractor->compute(job->image, job->kps, job->desc);
+    } catch (const cv::Exception &e) {
+      std::cerr << "[AsyncHaloc]: ERROR -> Cannot extract image " << job->id << ": " << e.what() << std::endl;
+      job->desc.release();
+    }
+    job->image.release();
+    HALOC_STATS_KEYPOINTS(&haloc_.stats_, job->kps.size());
+    if (job->desc.rows == 0) {
+      complete(std::move(job), AsyncStatus::kFailed, Status::kNoDescriptors);
+      continue;
+    }
+    push(hash_queue_, job);
+  }
+}
+
+void AsyncHaloc::hashStage() {
+  // The hash calculator is reentrant, it is shared with the detector
+  JobPtr job;
+  while (pop(hash_queue_, job)) {
+    const Status status = haloc_.hash_->calcHash(job->desc, job->kps, job->hash);
+    if (!haloc_.descriptor_store_) {
+      job->desc.release();
+      job->kps.clear();
+    }
+    if (status != Status::kOk) {
+      complete(std::move(job), AsyncStatus::kFailed, status);
+      continue;
+    }
+    push(query_queue_, job);
+  }
+}
+
+void AsyncHaloc::queryStage() {
+  JobPtr job;
+  while (pop(query_queue_, job)) {
+    const Status status = haloc_.insertHash(job->id, job->hash, job->desc, job->kps);
+    job->desc.release();
+    job->kps.clear();
+    if (status != Status::kOk) {
+      complete(std::move(job), AsyncStatus::kFailed, status);
+      continue;
+    }
+    auto candidates = haloc_.getBestCandidates(job->hash, job->num_candidates, job->ignore);
+    if (candidates.empty()) {
+      complete(std::move(job), AsyncStatus::kDone, Status::kNoCandidates);
+      continue;
+    }
+    haloc_.touchCandidates(candidates.data(), candidates.size());
+    complete(std::move(job), AsyncStatus::kDone, Status::kOk, std::move(candidates));
+  }
+}
+
+}  // namespace haloc
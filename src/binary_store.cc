@@ -0,0 +1,83 @@
+/**
+ * @file binary_store.cc
+ *
+ * @brief Contiguous storage for the binary image hashes.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+
+#include "libhaloc/binary_store.h"
+#include "libhaloc/distance.h"
+
+namespace haloc {
+
+bool BinaryStore::insert(const uint &id, const BinaryHash &hash) {
+  if (hash.empty()) return false;
+
+  // The first hash fixes the size
+  if (words_ == 0) words_ = hash.size();
+  if (hash.size() != words_) return false;
+
+  // Replace or append the row
+  std::size_t r;
+  const auto it = index_.find(id);
+  if (it != index_.end()) {
+    r = it->second;
+  } else {
+    r = ids_.size();
+    ids_.push_back(id);
+    data_.resize(data_.size() + words_);
+    index_[id] = r;
+  }
+  std::copy(hash.begin(), hash.end(), data_.begin() + r*words_);
+  return true;
+}
+
+bool BinaryStore::erase(const uint &id) {
+  const auto it = index_.find(id);
+  if (it == index_.end()) return false;
+
+  // Move the last row to the erased one
+  const std::size_t r = it->second;
+  const std::size_t last = ids_.size() - 1;
+  index_.erase(it);
+  if (r != last) {
+    std::copy(data_.begin() + last*words_, data_.begin() + (last + 1)*words_, data_.begin() + r*words_);
+    ids_[r] = ids_[last];
+    index_[ids_[r]] = r;
+  }
+  ids_.pop_back();
+  data_.resize(last*words_);
+  return true;
+}
+
+void BinaryStore::compact() {
+  data_.shrink_to_fit();
+  ids_.shrink_to_fit();
+}
+
+void BinaryStore::reserve(const std::size_t &num_hashes) {
+  ids_.reserve(num_hashes);
+  index_.reserve(num_hashes);
+  if (words_ > 0) data_.reserve(num_hashes*words_);
+}
+
+void BinaryStore::clear() {
+  words_ = 0;
+  data_.clear();
+  ids_.clear();
+  index_.clear();
+}
+
+void BinaryStore::distances(
+    const uint64_t *query,
+    const std::size_t &begin,
+    const std::size_t &count,
+    uint32_t *out) const {
+  hammingDistanceBatch(query, row(begin), count, words_, out);
+}
+
+}  // namespace haloc
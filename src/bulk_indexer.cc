@@ -0,0 +1,272 @@
+/**
+ * @file bulk_indexer.cc
+ *
+ * @brief Offline construction of a hash database from image files.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "libhaloc/bounded_queue.h"
+#include "libhaloc/bulk_indexer.h"
+
+namespace haloc {
+
+namespace {
+
+//! Extensions listed by BulkIndexer::listDirectory() (lower case)
+const char *kImageExtensions[] = {".bmp", ".jpeg", ".jpg", ".pgm", ".png", ".ppm", ".tif", ".tiff"};
+
+/**
+ * @brief      An encoded image, read by the reader thread.
+ */
+struct EncodedImage {
+  std::size_t index;            //!> Position in the list
+  std::vector<uchar> data;      //!> The file contents (empty if it cannot be read)
+};
+using EncodedPtr = std::unique_ptr<EncodedImage>;
+
+/**
+ * @brief      The result of an image, until it is inserted.
+ */
+struct Indexed {
+  bool ready = false;                 //!> Hashed (or failed)
+  Status status = Status::kOk;        //!> Why it failed
+  std::vector<float> hash;            //!> The hash
+  cv::Mat desc;                       //!> The descriptors (only if the detector keeps them)
+  std::vector<cv::KeyPoint> kps;      //!> Their keypoints
+};
+
+/**
+ * @brief      Waits a little before retrying a full or empty queue: first
+ *             yields, then sleeps, so an idle thread does not burn a core.
+ */
+void backoff(int &spins) {
+  if (++spins < 64) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+bool readFile(const std::string &path, std::vector<uchar> &data) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) return false;
+  const std::streamsize size = file.tellg();
+  if (size <= 0) return false;
+  data.resize(size);
+  file.seekg(0);
+  return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), size));
+}
+
+}  // namespace
+
+BulkIndexer::BulkIndexer(const Config &config, const BulkIndexParams &params) :
+    haloc_{config},
+    params_{params} {}
+
+BulkIndexReport BulkIndexer::index(const std::vector<IndexEntry> &entries, const Progress &progress) {
+  const auto start = std::chrono::steady_clock::now();
+  BulkIndexReport report;
+  if (entries.empty()) return report;
+
+  size_t workers = params_.workers;
+  if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+  workers = std::min(workers, entries.size());
+  const size_t batch_size = std::max<size_t>(1, params_.batch_size);
+  const bool keep_descriptors = static_cast<bool>(haloc_.descriptor_store_);
+
+  // The reader only loads the files, the workers decode them
+  BoundedQueue<EncodedPtr> queue(std::max<size_t>(params_.read_ahead, workers));
+  std::atomic<bool> read_done{false};
+  std::thread reader([&]() {
+    for (size_t i=0; i < entries.size(); i++) {
+      auto image = std::make_unique<EncodedImage>();
+      image->index = i;
+      if (!readFile(entries[i].path, image->data)) image->data.clear();
+      int spins = 0;
+      while (!queue.tryPush(image)) backoff(spins);
+    }
+    read_done.store(true, std::memory_order_release);
+  });
+
+  // The hashes are inserted in the order of the list, as soon as all the
+  // previous ones are ready
+  std::mutex mutex;
+  std::vector<Indexed> results(entries.size());
+  size_t next = 0;
+  const auto publish = [&]() {
+    while (next < entries.size() && results[next].ready) {
+      Indexed &r = results[next];
+      if (r.status == Status::kOk) {
+        r.status = haloc_.insertHash(entries[next].id, r.hash, r.desc, r.kps);
+      }
+      if (r.status == Status::kOk) {
+        report.indexed++;
+      } else {
+        report.failed.emplace_back(entries[next].id, r.status);
+      }
+      r = Indexed{true};
+      next++;
+    }
+    if (progress) progress(next, entries.size());
+  };
+
+  const auto work = [&](std::unique_ptr<DescriptorExtractor> extractor) {
+    std::vector<size_t> indices;
+    std::vector<Status> prepared;
+    std::vector<cv::Mat> descs;
+    std::vector<std::vector<cv::KeyPoint>> kps;
+    std::vector<std::vector<float>> hashes;
+
+    // Hashes the pending images and hands them over
+    const auto flush = [&]() {
+      if (indices.empty()) return;
+      const auto status = haloc_.hash_->calcHashBatch(descs, kps, hashes);
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t b=0; b < indices.size(); b++) {
+        Indexed &r = results[indices[b]];
+        r.status = prepared[b] != Status::kOk ? prepared[b] : status[b];
+        r.hash = std::move(hashes[b]);
+        if (keep_descriptors) {
+          r.desc = descs[b];
+          r.kps = std::move(kps[b]);
+        }
+        r.ready = true;
+      }
+      publish();
+      indices.clear();
+      prepared.clear();
+      descs.clear();
+      kps.clear();
+    };
+
+    EncodedPtr encoded;
+    int spins = 0;
+    for (;;) {
+      if (!queue.tryPop(encoded)) {
+        if (!read_done.load(std::memory_order_acquire)) {
+          backoff(spins);
+          continue;
+        }
+        if (!queue.tryPop(encoded)) break;
+      }
+      spins = 0;
+
+      cv::Mat image;
+      try {
+        if (!encoded->data.empty()) image = cv::imdecode(encoded->data, params_.imread_flags);
+        if (image.channels() == 3 || image.channels() == 4) {
+          cv::Mat gray;
+          cv::cvtColor(image, gray, image.channels() == 3 ? cv::COLOR_BGR2GRAY : cv::COLOR_BGRA2GRAY);
+          image = gray;
+        }
+      } catch (const cv::Exception &e) {
+        std::cerr << "[BulkIndexer]: ERROR -> Cannot decode " << entries[encoded->index].path
+                  << ": " << e.what() << std::endl;
+        image.release();
+      }
+
+      indices.push_back(encoded->index);
+      prepared.push_back(image.empty() && extractor->needsImage() ? Status::kEmptyImage : Status::kOk);
+      descs.emplace_back();
+      kps.emplace_back();
+      encoded.reset();
+      if (prepared.back() == Status::kOk) {
+        try {
+          HALOC_STATS_SCOPE(&haloc_.stats_, Stage::kExtraction);
+          extractor->compute(image, kps.back(), descs.back());
+        } catch (const cv::Exception &e) {
+          std::cerr << "[BulkIndexer]: ERROR -> Cannot extract " << entries[indices.back()].path
+                    << ": " << e.what() << std::endl;
+          descs.back().release();
+        }
+        HALOC_STATS_KEYPOINTS(&haloc_.stats_, kps.back().size());
+      }
+      if (indices.size() >= batch_size) flush();
+    }
+    flush();
+  };
+
+  // One extractor per worker (the extractors are not shared between threads)
+  std::vector<std::thread> threads;
+  for (size_t t=1; t < workers; t++) {
+    threads.emplace_back(work, haloc_.extractor_->clone());
+  }
+  work(haloc_.extractor_->clone());
+  for (auto &t : threads) t.join();
+  reader.join();
+
+  report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return report;
+}
+
+std::vector<IndexEntry> BulkIndexer::listDirectory(const std::string &directory, const uint &first_id) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> paths;
+  std::error_code error;
+  for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+    if (!it->is_regular_file(error)) continue;
+    std::string extension = it->path().extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](const unsigned char &c) {return std::tolower(c);});
+    if (std::find(std::begin(kImageExtensions), std::end(kImageExtensions), extension) != std::end(kImageExtensions)) {
+      paths.push_back(it->path().string());
+    }
+  }
+  if (error) {
+    std::cerr << "[BulkIndexer]: ERROR -> Cannot read the directory " << directory << ": "
+              << error.message() << std::endl;
+    return {};
+  }
+  std::sort(paths.begin(), paths.end());
+
+  std::vector<IndexEntry> entries;
+  entries.reserve(paths.size());
+  for (size_t i=0; i < paths.size(); i++) {
+    entries.push_back({static_cast<uint>(first_id + i), paths[i]});
+  }
+  return entries;
+}
+
+std::vector<IndexEntry> BulkIndexer::listFile(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    std::cerr << "[BulkIndexer]: ERROR -> Cannot open " << filename << "." << std::endl;
+    return {};
+  }
+
+  std::vector<IndexEntry> entries;
+  for (std::string line; std::getline(file, line); ) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+
+    // "id path" when the first word is a number followed by a path
+    const size_t space = line.find_first_of(" \t");
+    const bool has_id = space != std::string::npos && space > 0 &&
+      std::all_of(line.begin(), line.begin() + space, [](const unsigned char &c) {return std::isdigit(c);});
+    const size_t path_begin = has_id ? line.find_first_not_of(" \t", space) : 0;
+    if (has_id && path_begin != std::string::npos) {
+      entries.push_back({static_cast<uint>(std::stoul(line.substr(0, space))), line.substr(path_begin)});
+    } else {
+      entries.push_back({static_cast<uint>(entries.size()), line});
+    }
+  }
+  return entries;
+}
+
+}  // namespace haloc
@@ -0,0 +1,285 @@
+/**
+ * @file concurrent_store.cc
+ *
+ * @brief Hash store for one writer and many lock-free readers.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <thread>
+
+#include "libhaloc/concurrent_store.h"
+#include "libhaloc/distance.h"
+
+namespace haloc {
+
+ConcurrentHashStore::Arena::Arena() {
+  for (auto &c : chunks) c.store(nullptr, std::memory_order_relaxed);
+}
+
+ConcurrentHashStore::Arena::~Arena() {
+  for (auto &c : chunks) delete c.load(std::memory_order_relaxed);
+}
+
+ConcurrentHashStore::ReadGuard::ReadGuard(const ConcurrentHashStore &store) : store_{store} {
+  // Registered in the epoch that is still current after registering, so a
+  // compact() that flips it waits for this query
+  while (true) {
+    const uint64_t epoch = store_.epoch_.load();
+    slot_ = epoch & 1;
+    store_.readers_[slot_].fetch_add(1);
+    if (store_.epoch_.load() == epoch) break;
+    store_.readers_[slot_].fetch_sub(1);
+  }
+}
+
+ConcurrentHashStore::ReadGuard::~ReadGuard() {
+  store_.readers_[slot_].fetch_sub(1, std::memory_order_release);
+}
+
+ConcurrentHashStore::ConcurrentHashStore(const std::size_t &first_chunk) :
+  first_chunk_{1},
+  arena_{new Arena} {
+  while (first_chunk_ < first_chunk) first_chunk_ *= 2;
+  for (auto &r : readers_) r.store(0, std::memory_order_relaxed);
+}
+
+ConcurrentHashStore::~ConcurrentHashStore() {
+  delete arena_.load(std::memory_order_relaxed);
+}
+
+bool ConcurrentHashStore::append(
+    Arena &arena,
+    const uint &id,
+    const float *row,
+    const uint64_t &added,
+    const uint64_t &erased,
+    std::size_t &r) const {
+  r = arena.size.load(std::memory_order_relaxed);
+  std::size_t c, offset;
+  locate(r, c, offset);
+  if (c >= kMaxChunks) return false;
+  Chunk *chunk = arena.chunks[c].load(std::memory_order_relaxed);
+  if (!chunk) {
+    chunk = new Chunk;
+    chunk->rows.assign(chunkRows(c)*stride_, 0.0f);
+    chunk->ids.assign(chunkRows(c), 0);
+    chunk->added.assign(chunkRows(c), kLatest);
+    chunk->erased.reset(new std::atomic<uint64_t>[chunkRows(c)]);
+    for (std::size_t i=0; i < chunkRows(c); i++) chunk->erased[i].store(kLatest, std::memory_order_relaxed);
+    arena.chunks[c].store(chunk, std::memory_order_release);
+  }
+  std::copy(row, row + dim_, chunk->rows.begin() + offset*stride_);
+  chunk->ids[offset] = id;
+  chunk->added[offset] = added;
+  chunk->erased[offset].store(erased, std::memory_order_relaxed);
+  return true;
+}
+
+Status ConcurrentHashStore::insert(const uint &id, const std::vector<float> &hash) {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  Arena &arena = *arena_.load(std::memory_order_relaxed);
+
+  // The first hash fixes the dimension (no query reads it before a row is
+  // published, and it is never changed after)
+  if (hash.empty() || (dim_ > 0 && hash.size() != dim_)) return Status::kSizeMismatch;
+  if (dim_ == 0) {
+    dim_ = hash.size();
+    stride_ = (dim_ + HashStore::kRowAlignment - 1) / HashStore::kRowAlignment * HashStore::kRowAlignment;
+  }
+
+  // Fill the row and publish it. A replaced image is erased in the same
+  // version, so a query sees either the old row or the new one
+  const uint64_t version = version_.load(std::memory_order_relaxed) + 1;
+  std::size_t r;
+  if (!append(arena, id, hash.data(), version, kLatest, r)) return Status::kInvalidArgument;
+  const auto it = index_.find(id);
+  if (it != index_.end()) {
+    std::size_t old_chunk, old_offset;
+    locate(it->second, old_chunk, old_offset);
+    arena.chunks[old_chunk].load(std::memory_order_relaxed)->erased[old_offset].store(
+      version, std::memory_order_release);
+    dead_rows_++;
+  }
+  index_[id] = r;
+  arena.size.store(r + 1, std::memory_order_release);
+  version_.store(version, std::memory_order_release);
+  return Status::kOk;
+}
+
+bool ConcurrentHashStore::erase(const uint &id) {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  const auto it = index_.find(id);
+  if (it == index_.end()) return false;
+  const uint64_t version = version_.load(std::memory_order_relaxed) + 1;
+  std::size_t c, offset;
+  locate(it->second, c, offset);
+  arena_.load(std::memory_order_relaxed)->chunks[c].load(std::memory_order_relaxed)->erased[offset].store(
+    version, std::memory_order_release);
+  index_.erase(it);
+  dead_rows_++;
+  version_.store(version, std::memory_order_release);
+  return true;
+}
+
+void ConcurrentHashStore::compact(const uint64_t &oldest_snapshot) {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  Arena *old = arena_.load(std::memory_order_relaxed);
+  const uint64_t oldest = std::min(oldest_snapshot, version_.load(std::memory_order_relaxed));
+
+  // Copy the rows still visible after the oldest snapshot, in the same order
+  // and with the same versions, so the snapshots from oldest on are unchanged
+  auto arena = std::make_unique<Arena>();
+  std::unordered_map<uint, std::size_t> index;
+  index.reserve(index_.size());
+  std::size_t dead_rows = 0;
+  const std::size_t n = old->size.load(std::memory_order_relaxed);
+  for (std::size_t c=0, begin=0; begin < n; begin += chunkRows(c), c++) {
+    const Chunk *chunk = old->chunks[c].load(std::memory_order_relaxed);
+    const std::size_t count = std::min(chunkRows(c), n - begin);
+    for (std::size_t i=0; i < count; i++) {
+      const uint64_t erased = chunk->erased[i].load(std::memory_order_relaxed);
+      if (erased <= oldest) continue;
+      std::size_t r;
+      append(*arena, chunk->ids[i], chunk->rows.data() + i*stride_, chunk->added[i], erased, r);
+      arena->size.store(r + 1, std::memory_order_relaxed);
+      if (erased == kLatest) {
+        index[chunk->ids[i]] = r;
+      } else {
+        dead_rows++;
+      }
+    }
+  }
+
+  // The next queries read the new arena, the old one is released once the
+  // queries that may still read it are done
+  arena_.store(arena.release(), std::memory_order_release);
+  index_ = std::move(index);
+  dead_rows_ = dead_rows;
+  waitForReaders();
+  delete old;
+}
+
+void ConcurrentHashStore::waitForReaders() const {
+  for (int flip=0; flip < 2; flip++) {
+    const uint64_t epoch = epoch_.fetch_add(1);
+    while (readers_[epoch & 1].load() != 0) std::this_thread::yield();
+  }
+}
+
+bool ConcurrentHashStore::contains(const uint &id) const {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  return index_.count(id) > 0;
+}
+
+std::size_t ConcurrentHashStore::size() const {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  return index_.size();
+}
+
+std::size_t ConcurrentHashStore::rows() const {
+  ReadGuard guard(*this);
+  return arena_.load(std::memory_order_acquire)->size.load(std::memory_order_acquire);
+}
+
+std::size_t ConcurrentHashStore::deadRows() const {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  return dead_rows_;
+}
+
+Result<std::vector<Candidate>> ConcurrentHashStore::query(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore,
+    const uint64_t &snapshot,
+    const ScanParams &params) const {
+  // The rows are published before their version, so the rows of the snapshot
+  // (and the dimension) are the ones before n. The arena is read after the
+  // version: a compacted one also holds the rows of the snapshot.
+  ReadGuard guard(*this);
+  const uint64_t current = this->snapshot();
+  const uint64_t version = std::min(snapshot, current);
+  const Arena &arena = *arena_.load(std::memory_order_acquire);
+  const std::size_t n = arena.size.load(std::memory_order_acquire);
+  if (version == 0 || n == 0 || num_candidates <= 0) return std::vector<Candidate>();
+  if (hash.size() != dim_) return Status::kSizeMismatch;
+
+  thread_local AlignedVector<float> prepared;
+  prepared.assign(stride_, 0.0f);
+  std::copy(hash.begin(), hash.end(), prepared.begin());
+  thread_local std::vector<uint16_t> blocks;
+  blocks.resize(stride_ / kDistanceBlock);
+  std::iota(blocks.begin(), blocks.end(), 0);
+
+  // Chunk by chunk, in blocks of rows that stay in cache
+  constexpr std::size_t kBlockSize = 256;
+  thread_local std::vector<float> distances;
+  distances.resize(kBlockSize);
+  TopK top_k(num_candidates);
+  for (std::size_t c=0, begin=0; begin < n; begin += chunkRows(c), c++) {
+    const Chunk *chunk = arena.chunks[c].load(std::memory_order_acquire);
+    const std::size_t count = std::min(chunkRows(c), n - begin);
+    for (std::size_t b=0; b < count; b += kBlockSize) {
+      const std::size_t num_rows = std::min(kBlockSize, count - b);
+      const float *rows = chunk->rows.data() + b*stride_;
+      const float bound = params.early_abandon ? top_k.bound() : std::numeric_limits<float>::infinity();
+      if (bound < std::numeric_limits<float>::infinity()) {
+        squaredL2DistanceBounded(prepared.data(), rows, num_rows, stride_, blocks.data(), blocks.size(),
+                                 bound, distances.data());
+      } else {
+        squaredL2DistanceBlock(prepared.data(), 1, rows, num_rows, stride_, stride_, distances.data());
+      }
+
+      for (std::size_t i=0; i < num_rows; i++) {
+        // Discard the rows out of the snapshot, the ignored images and bad matches
+        if (!visible(*chunk, b + i, version)) continue;
+        const uint id = chunk->ids[b + i];
+        if (distances[i] <= 0.0 || images_to_ignore.ignored(id)) continue;
+        top_k.push({id, distances[i]});
+      }
+    }
+  }
+
+  auto candidates = top_k.sorted();
+  squaredToDistance(candidates.data(), candidates.size());
+  return candidates;
+}
+
+bool ConcurrentHashStore::save(const std::string &filename, const HashStoreInfo &info) const {
+  HashStore store;
+  {
+    ReadGuard guard(*this);
+    const uint64_t version = snapshot();
+    const Arena &arena = *arena_.load(std::memory_order_acquire);
+    const std::size_t n = arena.size.load(std::memory_order_acquire);
+    store.reserve(n);
+    std::vector<float> hash(dim_);
+    for (std::size_t c=0, begin=0; begin < n; begin += chunkRows(c), c++) {
+      const Chunk *chunk = arena.chunks[c].load(std::memory_order_acquire);
+      const std::size_t count = std::min(chunkRows(c), n - begin);
+      for (std::size_t i=0; i < count; i++) {
+        if (!visible(*chunk, i, version)) continue;
+        const float *row = chunk->rows.data() + i*stride_;
+        std::copy(row, row + dim_, hash.begin());
+        store.insert(chunk->ids[i], hash);
+      }
+    }
+  }
+  return store.save(filename, info);
+}
+
+std::size_t ConcurrentHashStore::bytes() const {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  const Arena &arena = *arena_.load(std::memory_order_relaxed);
+  std::size_t total = 0;
+  for (std::size_t c=0; c < kMaxChunks; c++) {
+    if (!arena.chunks[c].load(std::memory_order_relaxed)) break;
+    total += chunkRows(c)*(stride_*sizeof(float) + sizeof(uint) + 2*sizeof(uint64_t));
+  }
+  return total;
+}
+
+}  // namespace haloc
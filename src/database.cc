@@ -0,0 +1,215 @@
+/**
+ * @file database.cc
+ *
+ * @brief Hash database made of several named shards (e.g. one per robot or
+ * session of a multi-robot map).
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <mutex>
+
+#include "libhaloc/database.h"
+#include "libhaloc/scan.h"
+
+namespace haloc {
+
+Database::Database(
+    const std::shared_ptr<const Hash> &hash,
+    const std::shared_ptr<ThreadPool> &thread_pool,
+    const std::size_t &min_rows_per_task) :
+  hash_{hash},
+  thread_pool_{thread_pool},
+  min_rows_per_task_{std::max<std::size_t>(1, min_rows_per_task)} {}
+
+bool Database::create(const std::string &name, const HashPrecision &precision) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (shards_.count(name) > 0) {
+    std::cerr << "[Database]: ERROR -> The shard " << name << " already exists." << std::endl;
+    return false;
+  }
+  shards_[name] = std::make_unique<HashStore>(precision);
+  return true;
+}
+
+bool Database::attach(const std::string &name, const std::string &filename, const bool &use_mmap) {
+  if (contains(name)) {
+    std::cerr << "[Database]: ERROR -> The shard " << name << " already exists." << std::endl;
+    return false;
+  }
+
+  // Load the file without blocking the queries
+  auto store = std::make_unique<HashStore>();
+  HashStoreInfo info;
+  if (!store->load(filename, info, use_mmap)) return false;
+
+  // The stored hashes must be comparable with the ones of the other shards
+  const HashStoreInfo expected = storeInfo(*store);
+  if (info.num_proj != expected.num_proj ||
+      info.max_desc != expected.max_desc ||
+      info.basis_hash != expected.basis_hash) {
+    std::cerr << "[Database]: ERROR -> The shard " << filename
+              << " was created with a different projection basis." << std::endl;
+    return false;
+  }
+  if (info.desc_dim > 0 && info.desc_dim != expected.desc_dim) {
+    std::cerr << "[Database]: ERROR -> The shard " << filename << " was created with descriptors of "
+              << info.desc_dim << " elements, expected " << expected.desc_dim << "." << std::endl;
+    return false;
+  }
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (!shards_.emplace(name, std::move(store)).second) {
+    std::cerr << "[Database]: ERROR -> The shard " << name << " already exists." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Database::detach(const std::string &name) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  return shards_.erase(name) > 0;
+}
+
+bool Database::save(const std::string &name, const std::string &filename) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  const auto it = shards_.find(name);
+  if (it == shards_.end()) {
+    std::cerr << "[Database]: ERROR -> The shard " << name << " does not exist." << std::endl;
+    return false;
+  }
+  return it->second->save(filename, storeInfo(*it->second));
+}
+
+Status Database::insert(const std::string &name, const uint &id, const std::vector<float> &hash) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  const auto it = shards_.find(name);
+  if (it == shards_.end()) return Status::kUnknownShard;
+  return it->second->insert(id, hash) ? Status::kOk : Status::kSizeMismatch;
+}
+
+bool Database::erase(const std::string &name, const uint &id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  const auto it = shards_.find(name);
+  return it != shards_.end() && it->second->erase(id);
+}
+
+Result<std::vector<ShardCandidate>> Database::query(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const std::vector<std::string> &shards,
+    const IgnoreFilter &images_to_ignore) const {
+  if (hash.empty()) return Status::kSizeMismatch;
+  if (num_candidates <= 0) return std::vector<ShardCandidate>();
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+
+  // The selected shards
+  std::vector<const std::pair<const std::string, std::unique_ptr<HashStore>>*> selected;
+  if (shards.empty()) {
+    for (const auto &shard : shards_) selected.push_back(&shard);
+  } else {
+    for (const auto &name : shards) {
+      const auto it = shards_.find(name);
+      if (it == shards_.end()) return Status::kUnknownShard;
+      if (std::find(selected.begin(), selected.end(), &*it) == selected.end()) selected.push_back(&*it);
+    }
+  }
+
+  // Split them into tasks (several per shard if it is large)
+  struct Task {
+    std::size_t shard;
+    std::size_t begin;
+    std::size_t end;
+  };
+  std::vector<Task> tasks;
+  for (std::size_t s=0; s < selected.size(); s++) {
+    // The rows were validated on insert: only the query is checked
+    const HashStore &store = *selected[s]->second;
+    if (store.empty()) continue;
+    if (store.dim() != hash.size()) return Status::kSizeMismatch;
+    const std::size_t rows = store.size();
+    const std::size_t chunk = thread_pool_ ? min_rows_per_task_ : rows;
+    for (std::size_t b=0; b < rows; b += chunk) tasks.push_back({s, b, std::min(rows, b + chunk)});
+  }
+  if (tasks.empty()) return std::vector<ShardCandidate>();
+
+  // Scan the tasks: the first one in this thread, the rest on the pool
+  std::vector<TopK> top_k(tasks.size(), TopK(num_candidates));
+  const auto scan = [&](const std::size_t &t) {
+    thread_local AlignedVector<float> prepared;
+    const HashStore &store = *selected[tasks[t].shard]->second;
+    store.prepareQuery(hash, prepared);
+    scanRows(store, prepared.data(), 1, tasks[t].begin, tasks[t].end, images_to_ignore, &top_k[t]);
+  };
+  std::vector<std::future<void>> futures;
+  if (thread_pool_) {
+    for (std::size_t t=1; t < tasks.size(); t++) {
+      futures.push_back(thread_pool_->submit([&scan, t]() {scan(t);}));
+    }
+  }
+  scan(0);
+  if (!thread_pool_) {
+    for (std::size_t t=1; t < tasks.size(); t++) scan(t);
+  }
+  for (const auto &f : futures) thread_pool_->wait(f);
+
+  // Global top-K: merge the tasks of every shard, then the shards
+  std::vector<ShardCandidate> candidates;
+  for (std::size_t t=0; t < tasks.size(); ) {
+    std::size_t next = t + 1;
+    while (next < tasks.size() && tasks[next].shard == tasks[t].shard) top_k[t].merge(top_k[next++]);
+    for (const auto &c : top_k[t].sorted()) {
+      candidates.push_back({selected[tasks[t].shard]->first, c.id, std::sqrt(c.score)});
+    }
+    t = next;
+  }
+  const auto better = [](const ShardCandidate &a, const ShardCandidate &b) {
+    if (a.score != b.score) return a.score < b.score;
+    if (a.shard != b.shard) return a.shard < b.shard;
+    return a.id < b.id;
+  };
+  const std::size_t k = std::min(candidates.size(), static_cast<std::size_t>(num_candidates));
+  std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), better);
+  candidates.resize(k);
+  return candidates;
+}
+
+std::vector<std::string> Database::shards() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<std::string> names;
+  for (const auto &shard : shards_) names.push_back(shard.first);
+  return names;
+}
+
+std::size_t Database::size(const std::string &name) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  if (name.empty()) {
+    std::size_t total = 0;
+    for (const auto &shard : shards_) total += shard.second->size();
+    return total;
+  }
+  const auto it = shards_.find(name);
+  return it == shards_.end() ? 0 : it->second->size();
+}
+
+bool Database::contains(const std::string &name) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return shards_.count(name) > 0;
+}
+
+HashStoreInfo Database::storeInfo(const HashStore &store) const {
+  HashStoreInfo info;
+  info.num_proj = hash_->numProj();
+  info.max_desc = hash_->maxDesc();
+  info.desc_dim = hash_->descDim() > 0 ? hash_->descDim() : store.dim() / std::max(1, hash_->numProj());
+  info.seed = hash_->seed();
+  info.basis_hash = hash_->basisFingerprint();
+  return info;
+}
+
+}  // namespace haloc
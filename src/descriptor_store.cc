@@ -0,0 +1,125 @@
+/**
+ * @file descriptor_store.cc
+ *
+ * @brief Side store of the descriptors (and keypoints) of the stored images.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "libhaloc/descriptor_store.h"
+#include "libhaloc/distance.h"
+
+namespace haloc {
+
+namespace {
+
+std::size_t elementSize(const DescriptorPrecision &precision) {
+  switch (precision) {
+    case DescriptorPrecision::kFloat16: return sizeof(uint16_t);
+    case DescriptorPrecision::kUInt8: return sizeof(uint8_t);
+    default: return sizeof(float);
+  }
+}
+
+}  // namespace
+
+DescriptorStore::DescriptorStore(const DescriptorPrecision &precision) :
+  precision_{precision} {}
+
+bool DescriptorStore::insert(const uint &id, const cv::Mat &desc, const std::vector<cv::KeyPoint> &kps) {
+  if (desc.rows == 0 || desc.cols == 0) return false;
+
+  // The first descriptors fix the length
+  if (cols_ == 0) cols_ = desc.cols;
+  if (desc.cols != cols_) return false;
+
+  cv::Mat converted;
+  const cv::Mat *d_mat = &desc;
+  if (desc.type() != CV_32F) {
+    desc.convertTo(converted, CV_32F);
+    d_mat = &converted;
+  }
+
+  // Replace or add the entry
+  Entry &entry = entries_[id];
+  bytes_ -= entryBytes(entry);
+  entry.rows = d_mat->rows;
+  entry.data.resize(static_cast<std::size_t>(entry.rows)*cols_*elementSize(precision_));
+  entry.kps.assign(kps.begin(), kps.end());
+  if (entry.kps.size() != static_cast<std::size_t>(entry.rows)) entry.kps.clear();
+
+  for (int r=0; r < entry.rows; r++) {
+    const float *src = d_mat->ptr<float>(r);
+    uint8_t *dst = entry.data.data() + static_cast<std::size_t>(r)*cols_*elementSize(precision_);
+    switch (precision_) {
+      case DescriptorPrecision::kFloat16: {
+        uint16_t *h = reinterpret_cast<uint16_t*>(dst);
+        for (int c=0; c < cols_; c++) h[c] = floatToHalf(src[c]);
+        break;
+      }
+      case DescriptorPrecision::kUInt8: {
+        // Out of range values saturate
+        for (int c=0; c < cols_; c++) {
+          dst[c] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, std::nearbyint(src[c]))));
+        }
+        break;
+      }
+      default:
+        std::memcpy(dst, src, cols_*sizeof(float));
+    }
+  }
+  bytes_ += entryBytes(entry);
+  return true;
+}
+
+bool DescriptorStore::erase(const uint &id) {
+  const auto it = entries_.find(id);
+  if (it == entries_.end()) return false;
+  bytes_ -= entryBytes(it->second);
+  entries_.erase(it);
+  return true;
+}
+
+bool DescriptorStore::get(const uint &id, cv::Mat &desc, std::vector<cv::KeyPoint> &kps) const {
+  const auto it = entries_.find(id);
+  if (it == entries_.end()) return false;
+  const Entry &entry = it->second;
+
+  desc.create(entry.rows, cols_, CV_32F);
+  for (int r=0; r < entry.rows; r++) {
+    const uint8_t *src = entry.data.data() + static_cast<std::size_t>(r)*cols_*elementSize(precision_);
+    float *dst = desc.ptr<float>(r);
+    switch (precision_) {
+      case DescriptorPrecision::kFloat16: {
+        const uint16_t *h = reinterpret_cast<const uint16_t*>(src);
+        for (int c=0; c < cols_; c++) dst[c] = halfToFloat(h[c]);
+        break;
+      }
+      case DescriptorPrecision::kUInt8: {
+        for (int c=0; c < cols_; c++) dst[c] = src[c];
+        break;
+      }
+      default:
+        std::memcpy(dst, src, cols_*sizeof(float));
+    }
+  }
+  kps = entry.kps;
+  return true;
+}
+
+void DescriptorStore::clear() {
+  entries_.clear();
+  cols_ = 0;
+  bytes_ = 0;
+}
+
+std::size_t DescriptorStore::entryBytes(const Entry &entry) const {
+  return entry.data.size() + entry.kps.size()*sizeof(cv::KeyPoint);
+}
+
+}  // namespace haloc
@@ -0,0 +1,718 @@
+/**
+ * @file distance.cc
+ *
+ * @brief Vectorized distance kernels used to compare hashes.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "libhaloc/distance.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HALOC_X86_DISPATCH
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define HALOC_NEON
+#include <arm_neon.h>
+#endif
+
+namespace haloc {
+
+namespace {
+
+using SquaredL2Fn = float (*)(const float *, const float *, std::size_t);
+using SquaredL2F16Fn = float (*)(const float *, const uint16_t *, std::size_t);
+using SquaredL2I8Fn = float (*)(const float *, const float *, const int8_t *, std::size_t);
+using HammingFn = uint32_t (*)(const uint64_t *, const uint64_t *, std::size_t);
+using SquaredL2BatchFn = void (*)(const float *, const float *, std::size_t, std::size_t, float *);
+using SquaredL2BoundedFn = void (*)(const float *, const float *, std::size_t, std::size_t,
+                                   const uint16_t *, std::size_t, float, float *);
+
+//! Row lengths with a kernel specialized at compile time (num_proj = 1..4 with
+//! 128-D descriptors, already multiples of the row alignment). The others use
+//! the dynamic kernel.
+constexpr std::size_t kFixedDims[] = {128, 256, 384, 512};
+constexpr std::size_t kNumFixedDims = sizeof(kFixedDims) / sizeof(kFixedDims[0]);
+
+//! The bounded kernels compare the partial distance with the bound every
+//! kBoundCheckBlocks blocks (64 elements): a horizontal sum per block would
+//! cost more than the elements it saves
+constexpr std::size_t kBoundCheckBlocks = 4;
+
+uint32_t hammingScalar(const uint64_t *a, const uint64_t *b, std::size_t words) {
+  uint32_t sum = 0;
+  for (std::size_t i=0; i < words; i++) sum += __builtin_popcountll(a[i] ^ b[i]);
+  return sum;
+}
+
+float squaredL2Scalar(const float *a, const float *b, std::size_t dim) {
+  float sum = 0.0;
+  for (std::size_t i=0; i < dim; i++) {
+    const float d = a[i] - b[i];
+    sum += d*d;
+  }
+  return sum;
+}
+
+float squaredL2F16Scalar(const float *a, const uint16_t *b, std::size_t dim) {
+  float sum = 0.0;
+  for (std::size_t i=0; i < dim; i++) {
+    const float d = a[i] - halfToFloat(b[i]);
+    sum += d*d;
+  }
+  return sum;
+}
+
+float squaredL2I8Scalar(const float *t, const float *w, const int8_t *c, std::size_t dim) {
+  float sum = 0.0;
+  for (std::size_t i=0; i < dim; i++) {
+    const float d = t[i] - static_cast<float>(c[i]);
+    sum += w[i]*d*d;
+  }
+  return sum;
+}
+
+// The fixed-length batches inline the kernel with a constant length: the
+// loops are fully unrolled and the tails disappear. They are templates of the
+// length (and not of the kernel) because the target of the kernel must match
+// the one of the function it is inlined into.
+
+template <std::size_t Dim>
+__attribute__((flatten))
+void squaredL2BatchScalar(const float *query, const float *rows, std::size_t num_rows, std::size_t stride, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) out[i] = squaredL2Scalar(query, rows + i*stride, Dim);
+}
+
+void squaredL2BoundedScalar(const float *query, const float *rows, std::size_t num_rows, std::size_t stride,
+                            const uint16_t *blocks, std::size_t num_blocks, float bound, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) {
+    const float *row = rows + i*stride;
+    float sum = 0.0;
+    for (std::size_t b=0; b < num_blocks && sum <= bound; ) {
+      const std::size_t stop = std::min(num_blocks, b + kBoundCheckBlocks);
+      for (; b < stop; b++) {
+        const std::size_t o = blocks[b]*kDistanceBlock;
+        sum += squaredL2Scalar(query + o, row + o, kDistanceBlock);
+      }
+    }
+    out[i] = sum;
+  }
+}
+
+#ifdef HALOC_X86_DISPATCH
+
+__attribute__((target("popcnt")))
+uint32_t hammingPopcnt(const uint64_t *a, const uint64_t *b, std::size_t words) {
+  uint32_t sum = 0;
+  for (std::size_t i=0; i < words; i++) sum += __builtin_popcountll(a[i] ^ b[i]);
+  return sum;
+}
+
+__attribute__((target("avx2,fma")))
+float squaredL2Avx2(const float *a, const float *b, std::size_t dim) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= dim; i += 16) {
+    const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+    acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+  }
+  for (; i + 8 <= dim; i += 8) {
+    const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  const __m128 lo = _mm256_castps256_ps128(acc0);
+  const __m128 hi = _mm256_extractf128_ps(acc0, 1);
+  __m128 s = _mm_add_ps(lo, hi);
+  s = _mm_hadd_ps(s, s);
+  s = _mm_hadd_ps(s, s);
+  return _mm_cvtss_f32(s) + squaredL2Scalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx512f")))
+float squaredL2Avx512(const float *a, const float *b, std::size_t dim) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 32 <= dim; i += 32) {
+    const __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    const __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+  }
+  if (i + 16 <= dim) {
+    const __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    i += 16;
+  }
+  if (i < dim) {
+    // Masked tail, so that no scalar loop is needed
+    const __mmask16 mask = static_cast<__mmask16>((1u << (dim - i)) - 1u);
+    const __m512 d0 = _mm512_sub_ps(
+      _mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+    acc1 = _mm512_fmadd_ps(d0, d0, acc1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+template <std::size_t Dim>
+__attribute__((target("avx2,fma"), flatten))
+void squaredL2BatchAvx2(const float *query, const float *rows, std::size_t num_rows, std::size_t stride, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) out[i] = squaredL2Avx2(query, rows + i*stride, Dim);
+}
+
+template <std::size_t Dim>
+__attribute__((target("avx512f"), flatten))
+void squaredL2BatchAvx512(const float *query, const float *rows, std::size_t num_rows, std::size_t stride, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) out[i] = squaredL2Avx512(query, rows + i*stride, Dim);
+}
+
+__attribute__((target("avx2")))
+inline float hsum256(const __m256 &v) {
+  const __m128 lo = _mm256_castps256_ps128(v);
+  const __m128 hi = _mm256_extractf128_ps(v, 1);
+  __m128 s = _mm_add_ps(lo, hi);
+  s = _mm_hadd_ps(s, s);
+  s = _mm_hadd_ps(s, s);
+  return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+float squaredL2F16Avx2(const float *a, const uint16_t *b, std::size_t dim) {
+  __m256 acc = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    const __m256 x = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+    const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), x);
+    acc = _mm256_fmadd_ps(d, d, acc);
+  }
+  return hsum256(acc) + squaredL2F16Scalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx2,fma")))
+float squaredL2I8Avx2(const float *t, const float *w, const int8_t *c, std::size_t dim) {
+  __m256 acc = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    const __m128i c8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(c + i));
+    const __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(c8));
+    const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(t + i), x);
+    acc = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(w + i), d), d, acc);
+  }
+  return hsum256(acc) + squaredL2I8Scalar(t + i, w + i, c + i, dim - i);
+}
+
+__attribute__((target("avx512f")))
+float squaredL2F16Avx512(const float *a, const uint16_t *b, std::size_t dim) {
+  __m512 acc = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= dim; i += 16) {
+    const __m512 x = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+    const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), x);
+    acc = _mm512_fmadd_ps(d, d, acc);
+  }
+  return _mm512_reduce_add_ps(acc) + squaredL2F16Scalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx512f")))
+float squaredL2I8Avx512(const float *t, const float *w, const int8_t *c, std::size_t dim) {
+  __m512 acc = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= dim; i += 16) {
+    const __m128i c8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+    const __m512 x = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(c8));
+    const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(t + i), x);
+    acc = _mm512_fmadd_ps(_mm512_mul_ps(_mm512_loadu_ps(w + i), d), d, acc);
+  }
+  return _mm512_reduce_add_ps(acc) + squaredL2I8Scalar(t + i, w + i, c + i, dim - i);
+}
+
+__attribute__((target("avx2,fma")))
+void squaredL2BoundedAvx2(const float *query, const float *rows, std::size_t num_rows, std::size_t stride,
+                          const uint16_t *blocks, std::size_t num_blocks, float bound, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) {
+    const float *row = rows + i*stride;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    float sum = 0.0;
+    for (std::size_t b=0; b < num_blocks && sum <= bound; ) {
+      const std::size_t stop = std::min(num_blocks, b + kBoundCheckBlocks);
+      for (; b < stop; b++) {
+        const std::size_t o = blocks[b]*kDistanceBlock;
+        const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(query + o), _mm256_loadu_ps(row + o));
+        const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(query + o + 8), _mm256_loadu_ps(row + o + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+      }
+      sum = hsum256(_mm256_add_ps(acc0, acc1));
+    }
+    out[i] = sum;
+  }
+}
+
+__attribute__((target("avx512f")))
+void squaredL2BoundedAvx512(const float *query, const float *rows, std::size_t num_rows, std::size_t stride,
+                            const uint16_t *blocks, std::size_t num_blocks, float bound, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) {
+    const float *row = rows + i*stride;
+    __m512 acc = _mm512_setzero_ps();
+    float sum = 0.0;
+    for (std::size_t b=0; b < num_blocks && sum <= bound; ) {
+      const std::size_t stop = std::min(num_blocks, b + kBoundCheckBlocks);
+      for (; b < stop; b++) {
+        const std::size_t o = blocks[b]*kDistanceBlock;
+        const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(query + o), _mm512_loadu_ps(row + o));
+        acc = _mm512_fmadd_ps(d, d, acc);
+      }
+      sum = _mm512_reduce_add_ps(acc);
+    }
+    out[i] = sum;
+  }
+}
+
+struct KernelSet {
+  SquaredL2Fn f32;
+  SquaredL2F16Fn f16;
+  SquaredL2I8Fn i8;
+  SquaredL2BatchFn fixed[kNumFixedDims];   //!> Batches of the kFixedDims lengths
+  SquaredL2BoundedFn bounded;
+};
+
+KernelSet selectKernels(const char **name) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    *name = "avx512";
+    return {squaredL2Avx512, squaredL2F16Avx512, squaredL2I8Avx512,
+            {squaredL2BatchAvx512<128>, squaredL2BatchAvx512<256>, squaredL2BatchAvx512<384>, squaredL2BatchAvx512<512>},
+            squaredL2BoundedAvx512};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    *name = "avx2";
+    const bool f16c = __builtin_cpu_supports("f16c");
+    return {squaredL2Avx2, f16c ? squaredL2F16Avx2 : squaredL2F16Scalar, squaredL2I8Avx2,
+            {squaredL2BatchAvx2<128>, squaredL2BatchAvx2<256>, squaredL2BatchAvx2<384>, squaredL2BatchAvx2<512>},
+            squaredL2BoundedAvx2};
+  }
+  *name = "scalar";
+  return {squaredL2Scalar, squaredL2F16Scalar, squaredL2I8Scalar,
+          {squaredL2BatchScalar<128>, squaredL2BatchScalar<256>, squaredL2BatchScalar<384>, squaredL2BatchScalar<512>},
+          squaredL2BoundedScalar};
+}
+
+#elif defined(HALOC_NEON)
+
+float squaredL2Neon(const float *a, const float *b, std::size_t dim) {
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  std::size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    const float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+    const float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    acc0 = vmlaq_f32(acc0, d0, d0);
+    acc1 = vmlaq_f32(acc1, d1, d1);
+  }
+  acc0 = vaddq_f32(acc0, acc1);
+  float lanes[4];
+  vst1q_f32(lanes, acc0);
+  const float sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  return sum + squaredL2Scalar(a + i, b + i, dim - i);
+}
+
+template <std::size_t Dim>
+__attribute__((flatten))
+void squaredL2BatchNeon(const float *query, const float *rows, std::size_t num_rows, std::size_t stride, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) out[i] = squaredL2Neon(query, rows + i*stride, Dim);
+}
+
+#if defined(__aarch64__)
+float squaredL2F16Neon(const float *a, const uint16_t *b, std::size_t dim) {
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  std::size_t i = 0;
+  for (; i + 4 <= dim; i += 4) {
+    const float32x4_t x = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(b + i)));
+    const float32x4_t d = vsubq_f32(vld1q_f32(a + i), x);
+    acc = vfmaq_f32(acc, d, d);
+  }
+  return vaddvq_f32(acc) + squaredL2F16Scalar(a + i, b + i, dim - i);
+}
+#endif
+
+float squaredL2I8Neon(const float *t, const float *w, const int8_t *c, std::size_t dim) {
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  std::size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    const int16x8_t c16 = vmovl_s8(vld1_s8(c + i));
+    const float32x4_t x0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(c16)));
+    const float32x4_t x1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(c16)));
+    const float32x4_t d0 = vsubq_f32(vld1q_f32(t + i), x0);
+    const float32x4_t d1 = vsubq_f32(vld1q_f32(t + i + 4), x1);
+    acc = vmlaq_f32(acc, vmulq_f32(vld1q_f32(w + i), d0), d0);
+    acc = vmlaq_f32(acc, vmulq_f32(vld1q_f32(w + i + 4), d1), d1);
+  }
+  float lanes[4];
+  vst1q_f32(lanes, acc);
+  const float sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  return sum + squaredL2I8Scalar(t + i, w + i, c + i, dim - i);
+}
+
+void squaredL2BoundedNeon(const float *query, const float *rows, std::size_t num_rows, std::size_t stride,
+                          const uint16_t *blocks, std::size_t num_blocks, float bound, float *out) {
+  for (std::size_t i=0; i < num_rows; i++) {
+    const float *row = rows + i*stride;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float sum = 0.0;
+    for (std::size_t b=0; b < num_blocks && sum <= bound; ) {
+      const std::size_t stop = std::min(num_blocks, b + kBoundCheckBlocks);
+      for (; b < stop; b++) {
+        const float *q = query + blocks[b]*kDistanceBlock;
+        const float *r = row + blocks[b]*kDistanceBlock;
+        for (std::size_t k=0; k < kDistanceBlock; k += 8) {
+          const float32x4_t d0 = vsubq_f32(vld1q_f32(q + k), vld1q_f32(r + k));
+          const float32x4_t d1 = vsubq_f32(vld1q_f32(q + k + 4), vld1q_f32(r + k + 4));
+          acc0 = vmlaq_f32(acc0, d0, d0);
+          acc1 = vmlaq_f32(acc1, d1, d1);
+        }
+      }
+      float lanes[4];
+      vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+      sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    out[i] = sum;
+  }
+}
+
+struct KernelSet {
+  SquaredL2Fn f32;
+  SquaredL2F16Fn f16;
+  SquaredL2I8Fn i8;
+  SquaredL2BatchFn fixed[kNumFixedDims];   //!> Batches of the kFixedDims lengths
+  SquaredL2BoundedFn bounded;
+};
+
+KernelSet selectKernels(const char **name) {
+  *name = "neon";
+#if defined(__aarch64__)
+  return {squaredL2Neon, squaredL2F16Neon, squaredL2I8Neon,
+          {squaredL2BatchNeon<128>, squaredL2BatchNeon<256>, squaredL2BatchNeon<384>, squaredL2BatchNeon<512>},
+          squaredL2BoundedNeon};
+#else
+  return {squaredL2Neon, squaredL2F16Scalar, squaredL2I8Neon,
+          {squaredL2BatchNeon<128>, squaredL2BatchNeon<256>, squaredL2BatchNeon<384>, squaredL2BatchNeon<512>},
+          squaredL2BoundedNeon};
+#endif
+}
+
+#else
+
+struct KernelSet {
+  SquaredL2Fn f32;
+  SquaredL2F16Fn f16;
+  SquaredL2I8Fn i8;
+  SquaredL2BatchFn fixed[kNumFixedDims];   //!> Batches of the kFixedDims lengths
+  SquaredL2BoundedFn bounded;
+};
+
+KernelSet selectKernels(const char **name) {
+  *name = "scalar";
+  return {squaredL2Scalar, squaredL2F16Scalar, squaredL2I8Scalar,
+          {squaredL2BatchScalar<128>, squaredL2BatchScalar<256>, squaredL2BatchScalar<384>, squaredL2BatchScalar<512>},
+          squaredL2BoundedScalar};
+}
+
+#endif
+
+struct Kernel {
+  Kernel() {
+    const KernelSet set = selectKernels(&name);
+    fn = set.f32;
+    f16 = set.f16;
+    i8 = set.i8;
+    std::copy(set.fixed, set.fixed + kNumFixedDims, fixed);
+    bounded = set.bounded;
+#ifdef HALOC_X86_DISPATCH
+    hamming = __builtin_cpu_supports("popcnt") ? hammingPopcnt : hammingScalar;
+#else
+    hamming = hammingScalar;
+#endif
+  }
+  SquaredL2Fn fn;
+  SquaredL2F16Fn f16;
+  SquaredL2I8Fn i8;
+  SquaredL2BatchFn fixed[kNumFixedDims];
+  SquaredL2BoundedFn bounded;
+  HammingFn hamming;
+  const char *name;
+};
+
+const Kernel& kernel() {
+  static const Kernel k;
+  return k;
+}
+
+/**
+ * @brief      The kernel specialized for a row length, if any.
+ *
+ * @param[in]  dim   The number of elements per row
+ *
+ * @return     The batch kernel (nullptr = use the dynamic one)
+ */
+SquaredL2BatchFn fixedBatch(const std::size_t &dim) {
+  for (std::size_t i=0; i < kNumFixedDims; i++) {
+    if (kFixedDims[i] == dim) return kernel().fixed[i];
+  }
+  return nullptr;
+}
+
+void sqrtInPlace(float *values, const std::size_t &n) {
+  for (std::size_t i=0; i < n; i++) values[i] = std::sqrt(values[i]);
+}
+
+}  // namespace
+
+float l2Distance(const float *a, const float *b, const std::size_t &dim) {
+  return std::sqrt(kernel().fn(a, b, dim));
+}
+
+float squaredL2Distance(const float *a, const float *b, const std::size_t &dim) {
+  return kernel().fn(a, b, dim);
+}
+
+void l2DistanceBatch(
+    const float *query,
+    const float *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  squaredL2DistanceBatch(query, rows, num_rows, dim, stride, out);
+  sqrtInPlace(out, num_rows);
+}
+
+void squaredL2DistanceBatch(
+    const float *query,
+    const float *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  if (const SquaredL2BatchFn batch = fixedBatch(dim)) {
+    batch(query, rows, num_rows, stride, out);
+    return;
+  }
+  const SquaredL2Fn fn = kernel().fn;
+  for (std::size_t i=0; i < num_rows; i++) {
+    out[i] = fn(query, rows + i*stride, dim);
+  }
+}
+
+void squaredL2DistanceBounded(
+    const float *query,
+    const float *rows,
+    const std::size_t &num_rows,
+    const std::size_t &stride,
+    const uint16_t *blocks,
+    const std::size_t &num_blocks,
+    const float &bound,
+    float *out) {
+  // The partial sums follow the order of the blocks, so they are only used to
+  // abandon the rows. The rows within the bound are compared again with the
+  // kernel of squaredL2DistanceBlock(): every returned score is the one of the
+  // full scan. The bound is widened by the worst rounding error of the two
+  // sums, so no row within it is abandoned.
+  const std::size_t dim = num_blocks*kDistanceBlock;
+  const float slack = 1.0f + 2.0f*dim*std::numeric_limits<float>::epsilon();
+  const float widened = bound*slack;
+  kernel().bounded(query, rows, num_rows, stride, blocks, num_blocks, widened, out);
+
+  const SquaredL2BatchFn batch = fixedBatch(dim);
+  const SquaredL2Fn fn = kernel().fn;
+  for (std::size_t i=0; i < num_rows; i++) {
+    if (out[i] > widened) continue;
+    if (batch) {
+      batch(query, rows + i*stride, 1, stride, out + i);
+    } else {
+      out[i] = fn(query, rows + i*stride, dim);
+    }
+  }
+}
+
+void l2DistanceBlock(
+    const float *queries,
+    const std::size_t &num_queries,
+    const float *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  squaredL2DistanceBlock(queries, num_queries, rows, num_rows, dim, stride, out);
+  sqrtInPlace(out, num_queries*num_rows);
+}
+
+void squaredL2DistanceBlock(
+    const float *queries,
+    const std::size_t &num_queries,
+    const float *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  // Tiles of ~32KB of rows
+  constexpr std::size_t kTileBytes = 32*1024;
+  const std::size_t tile = std::max<std::size_t>(1, kTileBytes / (stride*sizeof(float)));
+
+  const SquaredL2BatchFn batch = fixedBatch(dim);
+  const SquaredL2Fn fn = kernel().fn;
+  for (std::size_t r0=0; r0 < num_rows; r0 += tile) {
+    const std::size_t r1 = std::min(num_rows, r0 + tile);
+    for (std::size_t q=0; q < num_queries; q++) {
+      const float *query = queries + q*stride;
+      float *q_out = out + q*num_rows;
+      if (batch) {
+        batch(query, rows + r0*stride, r1 - r0, stride, q_out + r0);
+        continue;
+      }
+      for (std::size_t r=r0; r < r1; r++) {
+        q_out[r] = fn(query, rows + r*stride, dim);
+      }
+    }
+  }
+}
+
+void l2DistanceBatchF16(
+    const float *query,
+    const uint16_t *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  squaredL2DistanceBatchF16(query, rows, num_rows, dim, stride, out);
+  sqrtInPlace(out, num_rows);
+}
+
+void squaredL2DistanceBatchF16(
+    const float *query,
+    const uint16_t *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  const SquaredL2F16Fn fn = kernel().f16;
+  for (std::size_t i=0; i < num_rows; i++) {
+    out[i] = fn(query, rows + i*stride, dim);
+  }
+}
+
+void l2DistanceBatchI8(
+    const float *query,
+    const float *weights,
+    const int8_t *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  squaredL2DistanceBatchI8(query, weights, rows, num_rows, dim, stride, out);
+  sqrtInPlace(out, num_rows);
+}
+
+void squaredL2DistanceBatchI8(
+    const float *query,
+    const float *weights,
+    const int8_t *rows,
+    const std::size_t &num_rows,
+    const std::size_t &dim,
+    const std::size_t &stride,
+    float *out) {
+  const SquaredL2I8Fn fn = kernel().i8;
+  for (std::size_t i=0; i < num_rows; i++) {
+    out[i] = fn(query, weights, rows + i*stride, dim);
+  }
+}
+
+void hammingDistanceBatch(
+    const uint64_t *query,
+    const uint64_t *rows,
+    const std::size_t &num_rows,
+    const std::size_t &words,
+    uint32_t *out) {
+  const HammingFn fn = kernel().hamming;
+  for (std::size_t i=0; i < num_rows; i++) {
+    out[i] = fn(query, rows + i*words, words);
+  }
+}
+
+uint16_t floatToHalf(const float &x) {
+  uint32_t f;
+  std::memcpy(&f, &x, sizeof(f));
+  const uint32_t sign = (f >> 16) & 0x8000u;
+  const uint32_t abs = f & 0x7fffffffu;
+
+  // NaN and infinity
+  if (abs >= 0x7f800000u) {
+    return static_cast<uint16_t>(sign | 0x7c00u | (abs > 0x7f800000u ? 0x200u : 0u));
+  }
+  // Overflow
+  if (abs >= 0x477ff000u) return static_cast<uint16_t>(sign | 0x7c00u);
+  // Subnormal (or zero)
+  if (abs < 0x38800000u) {
+    const uint32_t shift = 126 - (abs >> 23);
+    if (shift > 24) return static_cast<uint16_t>(sign);
+    const uint32_t mant = (abs & 0x7fffffu) | 0x800000u;
+    uint32_t h = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1u);
+    const uint32_t half = 1u << (shift - 1);
+    if (rem > half || (rem == half && (h & 1u))) h++;
+    return static_cast<uint16_t>(sign | h);
+  }
+  // Normal: rebias the exponent and round to nearest even
+  uint32_t h = ((abs - 0x38000000u) >> 13);
+  const uint32_t rem = abs & 0x1fffu;
+  if (rem > 0x1000u || (rem == 0x1000u && (h & 1u))) h++;
+  return static_cast<uint16_t>(sign | h);
+}
+
+float halfToFloat(const uint16_t &h) {
+  const uint32_t sign = (static_cast<uint32_t>(h) & 0x8000u) << 16;
+  const uint32_t exp = (h >> 10) & 0x1fu;
+  uint32_t mant = h & 0x3ffu;
+  uint32_t f;
+  if (exp == 0) {
+    if (mant == 0) {
+      f = sign;
+    } else {
+      // Subnormal: normalize it
+      int e = -1;
+      do {
+        e++;
+        mant <<= 1;
+      } while ((mant & 0x400u) == 0);
+      f = sign | ((112 - e) << 23) | ((mant & 0x3ffu) << 13);
+    }
+  } else if (exp == 0x1f) {
+    f = sign | 0x7f800000u | (mant << 13);
+  } else {
+    f = sign | ((exp + 112) << 23) | (mant << 13);
+  }
+  float x;
+  std::memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+bool l2DistanceSpecialized(const std::size_t &dim) {
+  return fixedBatch(dim) != nullptr;
+}
+
+const char* distanceKernelName() {
+  return kernel().name;
+}
+
+}  // namespace haloc
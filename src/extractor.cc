@@ -0,0 +1,264 @@
+/**
+ * @file extractor.cc
+ *
+ * @brief Feature extractors used to compute the descriptors that are hashed.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "libhaloc/extractor.h"
+#include "libhaloc/subsample.h"
+
+#ifdef HAVE_OPENCV_CUDAFEATURES2D
+#include <opencv2/cudafeatures2d.hpp>
+#endif
+
+namespace haloc {
+
+Feature2DExtractor::Feature2DExtractor(
+    const Factory &factory,
+    const int &max_features,
+    const int &grid_cols,
+    const int &grid_rows,
+    const int &desc_bits,
+    const bool &retain_best) :
+  factory_{factory},
+  feature_{factory()},
+  max_features_{max_features},
+  grid_cols_{grid_cols},
+  grid_rows_{grid_rows},
+  desc_bits_{desc_bits},
+  retain_best_{retain_best} {}
+
+void Feature2DExtractor::compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) {
+  kps.clear();
+  if (max_features_ > 0 && grid_cols_ > 0 && grid_rows_ > 0) {
+    // Keep the strongest keypoints of every cell and describe only those
+    SubsampleParams grid;
+    grid.strategy = SubsampleStrategy::kSpatial;
+    grid.grid_cols = grid_cols_;
+    grid.grid_rows = grid_rows_;
+    feature_->detect(image, detected_);
+    subsampleDescriptors(static_cast<int>(detected_.size()), max_features_, detected_, grid, 0, selected_);
+    for (const auto &i : selected_) kps.push_back(detected_[i]);
+    feature_->compute(image, kps, desc);
+  } else if (max_features_ > 0 && retain_best_) {
+    // Describe only the strongest keypoints (retainBest keeps the ties with
+    // the weakest one, the first max_features_ are the strongest)
+    feature_->detect(image, kps);
+    cv::KeyPointsFilter::retainBest(kps, max_features_);
+    if (kps.size() > static_cast<std::size_t>(max_features_)) kps.resize(max_features_);
+    feature_->compute(image, kps, desc);
+  } else {
+    feature_->detectAndCompute(image, cv::noArray(), kps, desc);
+  }
+  if (desc.empty() || desc.type() == CV_32F) return;
+  if (desc.type() == CV_8U && feature_->defaultNorm() == cv::NORM_HAMMING) {
+    const cv::Mat binary = desc;
+    unpackBinaryDescriptors(binary, desc, -1.0, 1.0, desc_bits_);
+  } else {
+    desc.convertTo(desc, CV_32F);
+  }
+}
+
+std::unique_ptr<DescriptorExtractor> Feature2DExtractor::clone() const {
+  return std::make_unique<Feature2DExtractor>(factory_, max_features_, grid_cols_, grid_rows_, desc_bits_, retain_best_);
+}
+
+SiftExtractor::SiftExtractor(
+    const int &max_desc,
+    const int &grid_cols,
+    const int &grid_rows) :
+  // For some reason, SIFT returns max_desc+1 descriptors (or even more)
+  Feature2DExtractor([max_desc, grid = grid_cols > 0 && grid_rows > 0]() {
+                       return cv::SIFT::create(grid ? kGridOversampling*max_desc : max_desc - 5);
+                     }, max_desc - 5, grid_cols, grid_rows) {}
+
+OrbExtractor::OrbExtractor(
+    const int &max_desc,
+    const int &grid_cols,
+    const int &grid_rows) :
+  Feature2DExtractor([max_desc, grid = grid_cols > 0 && grid_rows > 0]() {
+                       return cv::ORB::create(grid ? kGridOversampling*max_desc : max_desc);
+                     }, max_desc, grid_cols, grid_rows) {}
+
+AkazeExtractor::AkazeExtractor(
+    const int &max_desc,
+    const int &grid_cols,
+    const int &grid_rows) :
+  Feature2DExtractor([]() {return cv::AKAZE::create();}, max_desc, grid_cols, grid_rows, kDescriptorBits, true) {}
+
+std::shared_ptr<DescriptorExtractor> makeExtractor(
+    const DescriptorType &type,
+    const int &max_desc,
+    const int &grid_cols,
+    const int &grid_rows) {
+  switch (type) {
+    case DescriptorType::kOrb: return std::make_shared<OrbExtractor>(max_desc, grid_cols, grid_rows);
+    case DescriptorType::kAkaze: return std::make_shared<AkazeExtractor>(max_desc, grid_cols, grid_rows);
+    default: return std::make_shared<SiftExtractor>(max_desc, grid_cols, grid_rows);
+  }
+}
+
+int descriptorDim(const DescriptorType &type) {
+  switch (type) {
+    case DescriptorType::kOrb: return 32*8;
+    case DescriptorType::kAkaze: return AkazeExtractor::kDescriptorBits;
+    default: return 128;
+  }
+}
+
+ScaledExtractor::ScaledExtractor(
+    const std::shared_ptr<DescriptorExtractor> &extractor,
+    const ExtractionParams &params) :
+  extractor_{extractor},
+  params_{params} {
+  // Only the shape is checked here, the image size is not known yet
+  if (params_.roi.width < 0 || params_.roi.height < 0) {
+    std::cerr << "[ScaledExtractor]: ERROR -> Invalid ROI, no descriptors will be extracted." << std::endl;
+  }
+}
+
+void ScaledExtractor::compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) {
+  if (image.empty()) {
+    extractor_->compute(image, kps, desc);
+    return;
+  }
+
+  // Crop (only the header, no copy)
+  cv::Rect roi(0, 0, image.cols, image.rows);
+  if (params_.roi.area() != 0) roi = roi & params_.roi;
+  if (roi.area() == 0) {
+    // Not logged on every frame: the empty result is reported as Status::kNoDescriptors
+    kps.clear();
+    desc.release();
+    return;
+  }
+  cv::Mat reduced = image(roi);
+
+  // Pyramid levels, alternating two buffers so they are reused between images
+  for (int l=0; l < params_.pyramid_levels && reduced.cols > 1 && reduced.rows > 1; l++) {
+    cv::Mat &level = pyramid_[l % 2];
+    cv::pyrDown(reduced, level);
+    reduced = level;
+  }
+
+  // Resize to the target width
+  if (params_.target_width > 0 && reduced.cols > params_.target_width) {
+    const double f = static_cast<double>(params_.target_width) / reduced.cols;
+    const cv::Size size(params_.target_width, std::max(1, static_cast<int>(std::lround(reduced.rows*f))));
+    cv::resize(reduced, scaled_, size, 0, 0, cv::INTER_AREA);
+    reduced = scaled_;
+  }
+
+  extractor_->compute(reduced, kps, desc);
+
+  // Back to the coordinates of the original image (pixel centers)
+  const float sx = static_cast<float>(roi.width) / reduced.cols;
+  const float sy = static_cast<float>(roi.height) / reduced.rows;
+  for (auto &kp : kps) {
+    kp.pt.x = (kp.pt.x + 0.5f)*sx - 0.5f + roi.x;
+    kp.pt.y = (kp.pt.y + 0.5f)*sy - 0.5f + roi.y;
+    kp.size *= sx;
+  }
+}
+
+std::unique_ptr<DescriptorExtractor> ScaledExtractor::clone() const {
+  return std::make_unique<ScaledExtractor>(std::shared_ptr<DescriptorExtractor>(extractor_->clone()), params_);
+}
+
+void PrecomputedExtractor::set(const cv::Mat &desc, const std::vector<cv::KeyPoint> &kps) {
+  if (desc.type() == CV_32F) {
+    desc_ = desc;
+  } else {
+    desc.convertTo(desc_, CV_32F);
+  }
+  kps_ = kps;
+}
+
+void PrecomputedExtractor::setBinary(
+    const cv::Mat &desc,
+    const std::vector<cv::KeyPoint> &kps,
+    const int &bits) {
+  // A new matrix: the previous one may be shared with the returned descriptors
+  cv::Mat unpacked;
+  unpackBinaryDescriptors(desc, unpacked, -1.0, 1.0, bits);
+  desc_ = unpacked;
+  kps_ = kps;
+}
+
+void PrecomputedExtractor::compute(
+    const cv::Mat &,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) {
+  kps = kps_;
+  desc = desc_;
+}
+
+std::unique_ptr<DescriptorExtractor> PrecomputedExtractor::clone() const {
+  return std::make_unique<PrecomputedExtractor>(*this);
+}
+
+#ifdef HAVE_OPENCV_CUDAFEATURES2D
+CudaOrbExtractor::CudaOrbExtractor(const int &max_desc) :
+  max_desc_{max_desc},
+  orb_{cv::cuda::ORB::create(max_desc)} {}
+
+void CudaOrbExtractor::compute(
+    const cv::Mat &image,
+    std::vector<cv::KeyPoint> &kps,
+    cv::Mat &desc) {
+  kps.clear();
+  cv::cuda::GpuMat d_image(image);
+  cv::cuda::GpuMat d_desc;
+  orb_->detectAndCompute(d_image, cv::noArray(), kps, d_desc);
+  if (d_desc.empty()) {
+    desc.release();
+    return;
+  }
+  cv::Mat binary;
+  d_desc.download(binary);
+  unpackBinaryDescriptors(binary, desc, -1.0, 1.0);
+}
+
+std::unique_ptr<DescriptorExtractor> CudaOrbExtractor::clone() const {
+  return std::make_unique<CudaOrbExtractor>(max_desc_);
+}
+#endif
+
+void unpackBinaryDescriptors(
+    const cv::Mat &binary,
+    cv::Mat &desc,
+    const float &zero,
+    const float &one,
+    const int &bits) {
+  const int cols = bits > 0 ? std::min(bits, binary.cols*8) : binary.cols*8;
+  desc.create(binary.rows, cols, CV_32F);
+  for (int r=0; r < binary.rows; r++) {
+    const uchar *in = binary.ptr<uchar>(r);
+    float *out = desc.ptr<float>(r);
+    for (int c=0, k=0; k < cols; c++) {
+      // The bits of a byte from the most significant one, only the low ones
+      // of a partial last byte
+      const int used = std::min(8, cols - c*8);
+      for (int b=8 - used; b < 8; b++) {
+        out[k++] = (in[c] >> (7 - b)) & 1 ? one : zero;
+      }
+    }
+  }
+}
+
+}  // namespace haloc
@@ -0,0 +1,170 @@
+/**
+ * @file gpu_backend.cc
+ *
+ * @brief OpenCL backend (through cv::UMat) for hashing and similarity search.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <opencv2/core/eigen.hpp>
+#include <opencv2/core/ocl.hpp>
+
+#include "libhaloc/gpu_backend.h"
+
+namespace haloc {
+
+GpuBackend::GpuBackend(const Hash &hash) :
+  num_proj_{hash.numProj()},
+  max_desc_{hash.maxDesc()},
+  dim_{0} {
+  cv::Mat basis;
+  cv::eigen2cv(hash.basis(), basis);
+  basis.copyTo(basis_);
+}
+
+bool GpuBackend::available() {
+  return cv::ocl::haveOpenCL() && cv::ocl::useOpenCL();
+}
+
+cv::UMat GpuBackend::calcHash(const cv::Mat &desc) const {
+  if (desc.rows == 0 || desc.rows > max_desc_ || desc.type() != CV_32F) {
+    std::cerr << "[GpuBackend]: ERROR -> The descriptors must be CV_32F with 1 to "
+              << max_desc_ << " rows." << std::endl;
+    return cv::UMat();
+  }
+
+  // H = R(:, 0:rows) * D * 0.5/rows + 0.5 (see Hash::calcHash())
+  cv::UMat d_desc;
+  desc.copyTo(d_desc);
+  cv::UMat h;
+  cv::gemm(basis_.colRange(0, desc.rows), d_desc, 0.5 / desc.rows, cv::noArray(), 0.0, h);
+  cv::add(h, cv::Scalar(0.5), h);
+  return h.reshape(1, 1);
+}
+
+bool GpuBackend::insert(const uint &id, const std::vector<float> &hash) {
+  if (hash.empty() || index_.count(id) > 0) return false;
+  const cv::Mat h(1, static_cast<int>(hash.size()), CV_32F, const_cast<float*>(hash.data()));
+  cv::UMat d_hash;
+  h.copyTo(d_hash);
+  return insert(id, d_hash);
+}
+
+bool GpuBackend::insert(const uint &id, const cv::UMat &hash) {
+  if (hash.empty() || hash.rows != 1 || index_.count(id) > 0) return false;
+  if (!grow(hash.cols)) {
+    std::cerr << "[GpuBackend]: ERROR -> The hash size does not match the stored hashes." << std::endl;
+    return false;
+  }
+
+  const int r = static_cast<int>(ids_.size());
+  cv::UMat dst = rows_.row(r);
+  hash.copyTo(dst);
+  sq_norms_.row(r).setTo(cv::Scalar(hash.dot(hash)));
+  index_[id] = ids_.size();
+  ids_.push_back(id);
+  return true;
+}
+
+bool GpuBackend::upload(const HashStore &store) {
+  ids_.clear();
+  index_.clear();
+  rows_.release();
+  sq_norms_.release();
+  dim_ = store.dim();
+  if (store.empty()) return true;
+
+  // The rows are decoded to float32, whatever the encoding of the store
+  const int n = static_cast<int>(store.size());
+  cv::Mat decoded(n, static_cast<int>(store.stride()), CV_32F);
+  for (int i=0; i < n; i++) store.decode(i, decoded.ptr<float>(i));
+  const cv::Mat rows = decoded.colRange(0, static_cast<int>(dim_));
+  cv::Mat sq_norms(n, 1, CV_32F);
+  for (int i=0; i < n; i++) {
+    const cv::Mat r = rows.row(i);
+    sq_norms.at<float>(i, 0) = static_cast<float>(r.dot(r));
+    index_[store.id(i)] = i;
+    ids_.push_back(store.id(i));
+  }
+  rows.copyTo(rows_);
+  sq_norms.copyTo(sq_norms_);
+  return true;
+}
+
+std::vector<Candidate> GpuBackend::query(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const std::set<uint> &images_to_ignore) const {
+  if (hash.size() != dim_) return {};
+  const cv::Mat h(1, static_cast<int>(hash.size()), CV_32F, const_cast<float*>(hash.data()));
+  cv::UMat d_hash;
+  h.copyTo(d_hash);
+  return query(d_hash, num_candidates, images_to_ignore);
+}
+
+std::vector<Candidate> GpuBackend::query(
+    const cv::UMat &hash,
+    const int &num_candidates,
+    const std::set<uint> &images_to_ignore) const {
+  if (ids_.empty() || num_candidates <= 0 || hash.rows != 1 ||
+      static_cast<size_t>(hash.cols) != dim_) {
+    return {};
+  }
+
+  // |x - q|^2 = |x|^2 - 2 x.q + |q|^2. The last term is constant, so it is only
+  // added to the selected candidates
+  const int n = static_cast<int>(ids_.size());
+  cv::UMat dist;
+  cv::gemm(rows_.rowRange(0, n), hash, -2.0, sq_norms_.rowRange(0, n), 1.0, dist, cv::GEMM_2_T);
+  const double q_norm = hash.dot(hash);
+
+  const cv::Scalar inf(std::numeric_limits<float>::infinity());
+  for (const auto &id : images_to_ignore) {
+    const auto it = index_.find(id);
+    if (it != index_.end()) dist.row(static_cast<int>(it->second)).setTo(inf);
+  }
+
+  // Select the K best on the device: each step only downloads one value
+  std::vector<Candidate> candidates;
+  for (int k=0; k < num_candidates && k < n; k++) {
+    double min_val;
+    cv::Point min_loc;
+    cv::minMaxLoc(dist, &min_val, nullptr, &min_loc, nullptr);
+    if (!std::isfinite(min_val)) break;
+    candidates.push_back({ids_[min_loc.y], static_cast<float>(std::sqrt(std::max(0.0, min_val + q_norm)))});
+    dist.row(min_loc.y).setTo(inf);
+  }
+  std::sort(candidates.begin(), candidates.end());
+  return candidates;
+}
+
+bool GpuBackend::grow(const size_t &dim) {
+  if (dim_ == 0) dim_ = dim;
+  if (dim != dim_) return false;
+
+  const int capacity = rows_.empty() ? 0 : rows_.rows;
+  const int size = static_cast<int>(ids_.size());
+  if (size < capacity) return true;
+
+  // Double the device buffers, copying the current rows on the device
+  const int new_capacity = std::max(1024, 2*capacity);
+  cv::UMat rows(new_capacity, static_cast<int>(dim_), CV_32F, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
+  cv::UMat sq_norms(new_capacity, 1, CV_32F, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
+  if (size > 0) {
+    cv::UMat rows_dst = rows.rowRange(0, size);
+    cv::UMat norms_dst = sq_norms.rowRange(0, size);
+    rows_.rowRange(0, size).copyTo(rows_dst);
+    sq_norms_.rowRange(0, size).copyTo(norms_dst);
+  }
+  rows_ = rows;
+  sq_norms_ = sq_norms;
+  return true;
+}
+
+}  // namespace haloc
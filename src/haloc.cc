@@ -7,100 +7,910 @@
  * @date 2018
  */
 
+#include <fstream>
+
 #include "libhaloc/haloc.h"
 
 namespace haloc {
 
+namespace {
+
+std::vector<uint> candidateIds(const std::vector<Candidate> &candidates) {
+  std::vector<uint> ids;
+  ids.reserve(candidates.size());
+  for (const auto &c : candidates) ids.push_back(c.id);
+  return ids;
+}
+
+}  // namespace
+
 Haloc::Haloc(const int &num_proj, const int &max_desc) :
-    hash_{std::make_unique<Hash>(num_proj, max_desc)},
-    sift_{cv::SIFT::create(max_desc - 5)} {}  // For some reason, SIFT returns max_desc+1 descriptors (or even more)
+    Haloc([&]() {
+      Config config;
+      config.num_proj = num_proj;
+      config.max_desc = max_desc;
+      return config;
+    }()) {}
 
-std::optional<std::vector<uint>> Haloc::process(
+Haloc::Haloc(const Config &config) :
+    config_{config},
+    extractor_{config.extractor ? config.extractor :
+               makeExtractor(config.descriptor, config.max_desc, config.grid_cols, config.grid_rows)},
+    hash_{std::make_unique<Hash>(config.num_proj, config.max_desc, config.seed, !config.basis_file.empty())},
+    hash_store_{config.store_precision, config.int8_calibration_size},
+    temporal_{config.temporal} {
+  if (config_.use_ann) {
+    ann_index_ = std::make_unique<HnswIndex>(hash_store_, config_.ann);
+  }
+  if (config_.use_binary) {
+    binary_store_ = std::make_unique<BinaryStore>();
+  }
+  if (config_.keep_descriptors) {
+    descriptor_store_ = std::make_unique<DescriptorStore>(config_.descriptor_precision);
+  }
+  hash_->setSubsampling(config_.subsample);
+  hash_->setDescriptorDim(descriptorDim());
+  hash_->setStats(&stats_);
+  if (config_.extraction.enabled()) {
+    extractor_ = std::make_shared<ScaledExtractor>(extractor_, config_.extraction);
+  }
+
+  // Share the projection basis through a file, so every process hashes identically
+  if (!config_.basis_file.empty()) {
+    if (!std::ifstream(config_.basis_file).good()) {
+      hash_->saveBasis(config_.basis_file);
+    } else if (!hash_->loadBasis(config_.basis_file)) {
+      hash_->init();
+    }
+  }
+}
+
+Haloc::~Haloc() {
+  waitPendingScan();
+}
+
+Result<std::vector<uint>> Haloc::process(
     const uint &image_id,
     const cv::Mat &image,
     const int &num_candidates,
-    const std::set<uint> &images_to_ignore) {
-  // Check if the image is empty
-  if (image.empty()) {
-    std::cerr << "[Haloc]: ERROR -> The image is empty." << std::endl;
-    return std::nullopt;
+    const IgnoreFilter &images_to_ignore) {
+  const auto candidates = processWithScores(image_id, image, num_candidates, images_to_ignore);
+  if (!candidates) return candidates.status();
+  return candidateIds(*candidates);
+}
+
+Result<std::vector<Candidate>> Haloc::processWithScores(
+    const uint &image_id,
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  // Calculate the hash
+  std::vector<float> hash;
+  const Status status = calcImageHash(image, hash);
+  if (status != Status::kOk) return status;
+
+  return processHash(image_id, hash, workspace_.desc, workspace_.kps, num_candidates, images_to_ignore);
+}
+
+Result<std::vector<Candidate>> Haloc::processDescriptors(
+    const uint &image_id,
+    const cv::Mat &desc,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  // Calculate the hash
+  std::vector<float> hash;
+  const Status status = calcDescHash(desc, hash);
+  if (status != Status::kOk) return status;
+
+  return processHash(image_id, hash, desc, {}, num_candidates, images_to_ignore);
+}
+
+Result<std::vector<Candidate>> Haloc::processHash(
+    const uint &image_id,
+    const std::vector<float> &hash,
+    const cv::Mat &desc,
+    const std::vector<cv::KeyPoint> &kps,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  // Store the hash
+  const Status status = insertHash(image_id, hash, desc, kps);
+  if (status != Status::kOk) return status;
+
+  // Compare the hash with the rest of the images and get the best N candidates
+  auto candidates = getBestCandidates(hash, num_candidates, images_to_ignore);
+  if (candidates.empty()) return Status::kNoCandidates;
+  touchCandidates(candidates.data(), candidates.size());
+
+  // Return the candidates
+  return candidates;
+}
+
+Result<size_t> Haloc::process(
+    const uint &image_id,
+    const cv::Mat &image,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore) {
+  // The hash and the scan buffers of the workspace are reused
+  Status status = calcImageHash(image, workspace_.hash);
+  if (status != Status::kOk) return status;
+  status = insertHash(image_id, workspace_.hash, workspace_.desc, workspace_.kps);
+  if (status != Status::kOk) return status;
+
+  const size_t n = getBestCandidates(workspace_.hash, candidates, images_to_ignore);
+  if (n == 0) return Status::kNoCandidates;
+  touchCandidates(candidates.data(), n);
+  return n;
+}
+
+std::shared_future<Result<std::vector<uint>>> Haloc::processAsync(
+    const uint &image_id,
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  using Ids = Result<std::vector<uint>>;
+  const auto ready = [](const Ids &r) {
+    std::promise<Ids> p;
+    p.set_value(r);
+    return p.get_future().share();
+  };
+
+  if (!config_.thread_pool) {
+    return ready(process(image_id, image, num_candidates, images_to_ignore));
   }
 
+  // Extraction and hashing overlap with the scan of the previous frame
+  std::vector<float> hash;
+  Status status = calcImageHash(image, hash);
+  if (status != Status::kOk) return ready(status);
+
+  // The store can only be modified when no scan is running
+  status = insertHash(image_id, hash, workspace_.desc, workspace_.kps);
+  if (status != Status::kOk) return ready(status);
+
+  // The stats of the extraction were recorded in this thread, the ones of the
+  // scan are added to them in the pool thread
+  auto result = config_.thread_pool->submit(
+    [this, hash = std::move(hash), num_candidates, images_to_ignore, call = Stats::current()]() mutable -> Ids {
+      HALOC_STATS_BEGIN_CALL();
+      std::vector<Candidate> candidates(std::max(0, num_candidates));
+      candidates.resize(findCandidates(hash, Span<Candidate>(candidates), images_to_ignore));
+      const CallStats &scan = Stats::current();
+      for (size_t s=0; s < kNumStages; s++) call.ns[s] += scan.ns[s];
+      reportCall(call);
+      if (candidates.empty()) return Status::kNoCandidates;
+      touchCandidates(candidates.data(), candidates.size());
+      return candidateIds(candidates);
+    }).share();
+  pending_scan_ = result;
+  return result;
+}
+
+Status Haloc::insert(const uint &image_id, const cv::Mat &image) {
+  std::vector<float> hash;
+  const Status status = calcImageHash(image, hash);
+  if (status != Status::kOk) return status;
+  return insertHash(image_id, hash, workspace_.desc, workspace_.kps);
+}
+
+Status Haloc::insertDescriptors(const uint &image_id, const cv::Mat &desc) {
+  std::vector<float> hash;
+  const Status status = calcDescHash(desc, hash);
+  if (status != Status::kOk) return status;
+  return insertHash(image_id, hash, desc, {});
+}
+
+Result<std::vector<Candidate>> Haloc::queryDescriptors(
+    const cv::Mat &desc,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  std::vector<float> hash;
+  Status status = calcDescHash(desc, hash);
+  if (status != Status::kOk) return status;
+
+  waitPendingScan();
+  status = checkQuery(hash);
+  if (status != Status::kOk) return status;
+  auto candidates = getBestCandidates(hash, num_candidates, images_to_ignore);
+  if (candidates.empty()) return Status::kNoCandidates;
+  touchCandidates(candidates.data(), candidates.size());
+  return candidates;
+}
+
+Result<std::vector<Candidate>> Haloc::query(
+    const cv::Mat &image,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  std::vector<float> hash;
+  Status status = calcImageHash(image, hash);
+  if (status != Status::kOk) return status;
+
+  waitPendingScan();
+  status = checkQuery(hash);
+  if (status != Status::kOk) return status;
+  auto candidates = getBestCandidates(hash, num_candidates, images_to_ignore);
+  if (candidates.empty()) return Status::kNoCandidates;
+  touchCandidates(candidates.data(), candidates.size());
+  return candidates;
+}
+
+Result<size_t> Haloc::query(
+    const cv::Mat &image,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore) {
+  Status status = calcImageHash(image, workspace_.hash);
+  if (status != Status::kOk) return status;
+
+  waitPendingScan();
+  status = checkQuery(workspace_.hash);
+  if (status != Status::kOk) return status;
+  const size_t n = getBestCandidates(workspace_.hash, candidates, images_to_ignore);
+  if (n == 0) return Status::kNoCandidates;
+  touchCandidates(candidates.data(), n);
+  return n;
+}
+
+size_t Haloc::insertBatch(
+    const std::vector<uint> &image_ids,
+    const std::vector<cv::Mat> &images) {
+  if (image_ids.size() != images.size()) {
+    std::cerr << "[Haloc]: ERROR -> The number of ids and images is different." << std::endl;
+    return 0;
+  }
+
+  // The descriptors are only returned if they are kept
+  std::vector<cv::Mat> descs;
+  std::vector<std::vector<cv::KeyPoint>> kps;
+  const auto hashes = descriptor_store_ ? calcImageHashBatch(images, &descs, &kps) : calcImageHashBatch(images);
+
+  waitPendingScan();
+  hash_store_.reserve(hash_store_.size() + images.size());
+  size_t inserted = 0;
+  for (size_t i=0; i < hashes.size(); i++) {
+    if (hashes[i].empty()) continue;
+    const Status status = descriptor_store_ ?
+      insertHash(image_ids[i], hashes[i], descs[i], kps[i]) : insertHash(image_ids[i], hashes[i]);
+    if (status == Status::kOk) inserted++;
+  }
+  return inserted;
+}
+
+std::vector<std::vector<Candidate>> Haloc::queryBatch(
+    const std::vector<cv::Mat> &images,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  const auto hashes = calcImageHashBatch(images);
+
+  waitPendingScan();
+  auto candidates = getBestCandidates(hashes, num_candidates, images_to_ignore);
+  for (const auto &c : candidates) touchCandidates(c.data(), c.size());
+  return candidates;
+}
+
+bool Haloc::erase(const uint &image_id) {
+  waitPendingScan();
+  return eraseHash(image_id);
+}
+
+void Haloc::compact() {
+  waitPendingScan();
+  hash_store_.compact();
+  if (binary_store_) binary_store_->compact();
+  rebuildAnnIndex();
+  erased_since_compact_ = 0;
+}
+
+bool Haloc::save(const std::string &filename) {
+  waitPendingScan();
+  if (binary_store_ && hash_store_.empty() && !binary_store_->empty()) {
+    std::cerr << "[Haloc]: ERROR -> Binary only databases (binary_rerank = 0) cannot be saved." << std::endl;
+    return false;
+  }
+  return hash_store_.save(filename, storeInfo());
+}
+
+bool Haloc::load(const std::string &filename, const bool &use_mmap) {
+  waitPendingScan();
+
+  // The stored hashes must be comparable with the new ones. This is checked
+  // before loading, so a rejected file leaves the current database untouched.
+  HashStoreInfo info;
+  if (!HashStore::readInfo(filename, info)) return false;
+  const HashStoreInfo expected = storeInfo();
+  if (info.num_proj != expected.num_proj ||
+      info.max_desc != expected.max_desc ||
+      info.basis_hash != expected.basis_hash) {
+    std::cerr << "[Haloc]: ERROR -> The database " << filename
+              << " was created with a different projection basis." << std::endl;
+    return false;
+  }
+  // Without a configured width (custom extractor, desc_dim = 0) and an empty
+  // database, the width of the file is adopted
+  if (info.desc_dim > 0 && expected.desc_dim > 0 && info.desc_dim != expected.desc_dim) {
+    std::cerr << "[Haloc]: ERROR -> The database " << filename << " was created with descriptors of "
+              << info.desc_dim << " elements, expected " << expected.desc_dim << "." << std::endl;
+    return false;
+  }
+  if (!hash_store_.load(filename, info, use_mmap)) return false;
+  if (hash_->descDim() == 0 && info.desc_dim > 0) {
+    hash_->setDescriptorDim(info.desc_dim);
+    config_.desc_dim = info.desc_dim;
+  }
+
+  // The descriptors of the loaded images are not in the file
+  if (descriptor_store_) descriptor_store_->clear();
+  rebuildAnnIndex();
+  rebuildBinaryStore();
+  rebuildRecency();
+  evictToMaxEntries();
+  return true;
+}
+
+Status Haloc::rebuild(const int &num_proj, const int &max_desc) {
+  return rebuild(num_proj, max_desc, hash_->seed());
+}
+
+Status Haloc::rebuild(const int &num_proj, const int &max_desc, const uint32_t &seed) {
+  if (num_proj <= 0 || max_desc <= 0) return Status::kInvalidArgument;
+  waitPendingScan();
+
+  // The stored images, in the order of the rows (sorted by id if they were)
+  std::vector<uint> ids;
+  if (hash_store_.empty() && binary_store_) {
+    for (size_t i=0; i < binary_store_->size(); i++) ids.push_back(binary_store_->id(i));
+  } else {
+    ids.assign(hash_store_.ids(), hash_store_.ids() + hash_store_.size());
+  }
+  for (const auto &id : ids) {
+    if (!descriptor_store_ || !descriptor_store_->contains(id)) return Status::kMissingDescriptors;
+  }
+
+  auto hash = std::make_unique<Hash>(num_proj, max_desc, seed);
+  hash->setSubsampling(config_.subsample);
+  hash->setDescriptorDim(hash_->descDim());
+  hash->setStats(&stats_);
+
+  // Rehash the images (the same matrix product as calcHash() for new images)
+  std::vector<std::vector<float>> hashes(ids.size());
+  std::vector<Status> statuses(ids.size(), Status::kOk);
+  const auto rehash = [&](const size_t &begin, const size_t &end) {
+    cv::Mat desc;
+    std::vector<cv::KeyPoint> kps;
+    for (size_t i=begin; i < end; i++) {
+      descriptor_store_->get(ids[i], desc, kps);
+      statuses[i] = hash->calcHash(desc, kps, hashes[i]);
+    }
+  };
+  if (!config_.thread_pool || ids.size() < 2) {
+    rehash(0, ids.size());
+  } else {
+    const size_t num_tasks = std::min(ids.size(), config_.thread_pool->size());
+    const size_t chunk = (ids.size() + num_tasks - 1) / num_tasks;
+    std::vector<std::future<void>> tasks;
+    for (size_t t=1; t < num_tasks; t++) {
+      tasks.push_back(config_.thread_pool->submit([&, t]() {
+        rehash(t*chunk, std::min(ids.size(), (t + 1)*chunk));
+      }));
+    }
+    rehash(0, std::min(ids.size(), chunk));
+    for (const auto &task : tasks) config_.thread_pool->wait(task);
+  }
+
+  // Every image must have a hash of the same size, otherwise the database is
+  // not modified
+  for (size_t i=0; i < ids.size(); i++) {
+    if (statuses[i] != Status::kOk) return statuses[i];
+    if (hashes[i].size() != hashes[0].size()) return Status::kSizeMismatch;
+  }
+
+  // Replace the basis and the stored hashes (same ids, so the retention order
+  // is kept)
+  hash_ = std::move(hash);
+  config_.num_proj = num_proj;
+  config_.max_desc = max_desc;
+  config_.seed = seed;
+  const bool store_float = !binary_store_ || config_.binary_rerank > 0;
+  hash_store_.clear();
+  if (binary_store_) binary_store_->clear();
+  if (store_float) hash_store_.reserve(ids.size());
+  bool inserted = true;
+  for (size_t i=0; i < ids.size(); i++) {
+    if (store_float) inserted = hash_store_.insert(ids[i], hashes[i]) && inserted;
+    if (binary_store_) inserted = binary_store_->insert(ids[i], hash_->binarize(hashes[i])) && inserted;
+  }
+  rebuildAnnIndex();
+  erased_since_compact_ = 0;
+  return inserted ? Status::kOk : Status::kSizeMismatch;
+}
+
+void Haloc::setAnnEfSearch(const size_t &ef) {
+  config_.ann.ef_search = ef;
+  if (ann_index_) ann_index_->setEfSearch(ef);
+}
+
+void Haloc::rebuildAnnIndex() {
+  if (!ann_index_) return;
+  ann_index_->clear();
+  for (size_t i=0; i < hash_store_.size(); i++) {
+    ann_index_->add(hash_store_.id(i));
+  }
+}
+
+void Haloc::rebuildBinaryStore() {
+  if (!binary_store_) return;
+  binary_store_->clear();
+  binary_store_->reserve(hash_store_.size());
+  std::vector<float> hash(hash_store_.stride());
+  for (size_t i=0; i < hash_store_.size(); i++) {
+    hash_store_.decode(i, hash.data());
+    binary_store_->insert(hash_store_.id(i), hash_->binarize(
+      std::vector<float>(hash.begin(), hash.begin() + hash_store_.dim())));
+  }
+
+  // Binary only: the float hashes are not kept
+  if (config_.binary_rerank == 0) {
+    hash_store_.clear();
+    rebuildAnnIndex();
+  }
+}
+
+void Haloc::rebuildRecency() {
+  recency_.clear();
+  if (config_.max_entries == 0) return;
+
+  // The loaded images are ordered by id
+  std::vector<uint> ids;
+  if (hash_store_.empty() && binary_store_) {
+    for (size_t i=0; i < binary_store_->size(); i++) ids.push_back(binary_store_->id(i));
+  } else {
+    ids.assign(hash_store_.ids(), hash_store_.ids() + hash_store_.size());
+  }
+  std::sort(ids.begin(), ids.end());
+  for (const auto &id : ids) recency_.touch(id);
+}
+
+StatsSnapshot Haloc::stats() const {
+  StatsSnapshot snapshot = stats_.snapshot();
+  snapshot.entries = size();
+  snapshot.bytes = hash_store_.bytes() + (binary_store_ ? binary_store_->bytes() : 0);
+  return snapshot;
+}
+
+void Haloc::resetStats() {
+  stats_.reset();
+}
+
+void Haloc::reportCall(CallStats &call) {
+  if (!Stats::kEnabled || !config_.stats_callback) return;
+  call.entries = size();
+  config_.stats_callback(call);
+}
+
+HashStoreInfo Haloc::storeInfo() const {
+  HashStoreInfo info;
+  info.num_proj = hash_->numProj();
+  info.max_desc = hash_->maxDesc();
+  info.desc_dim = hash_->descDim() > 0 ? hash_->descDim() : hash_store_.dim() / std::max(1, hash_->numProj());
+  info.seed = hash_->seed();
+  info.basis_hash = hash_->basisFingerprint();
+  return info;
+}
+
+int Haloc::descriptorDim() const {
+  if (config_.desc_dim > 0) return config_.desc_dim;
+  return config_.extractor ? 0 : haloc::descriptorDim(config_.descriptor);
+}
+
+const cv::Mat& Haloc::calcDesc(const cv::Mat &image) {
+  // The keypoints and descriptors are reused between images
+  {
+    HALOC_STATS_SCOPE(&stats_, Stage::kExtraction);
+    extractor_->compute(image, workspace_.kps, workspace_.desc);
+  }
+  HALOC_STATS_KEYPOINTS(&stats_, workspace_.kps.size());
+  return workspace_.desc;
+}
+
+Status Haloc::calcImageHash(const cv::Mat &image, std::vector<float> &hash) {
+  HALOC_STATS_BEGIN_CALL();
+  // Check if the image is empty
+  hash.clear();
+  if (image.empty() && extractor_->needsImage()) return Status::kEmptyImage;
+
   // Detect the keypoints and compute the descriptors
-  const auto desc = calcDesc(image);
+  return hash_->calcHash(calcDesc(image), workspace_.kps, hash);
+}
 
-  // Calculate the hash
-  const auto hash = hash_->calcHash(desc);
-  if (hash.empty()) {
-    std::cerr << "[Haloc]: ERROR -> The hash is empty." << std::endl;
-    return std::nullopt;
+Status Haloc::calcDescHash(const cv::Mat &desc, std::vector<float> &hash) const {
+  HALOC_STATS_BEGIN_CALL();
+  return hash_->calcHash(desc, hash);
+}
+
+Status Haloc::checkQuery(const std::vector<float> &hash) const {
+  // Binary only: the binary hashes are compared
+  if (binary_store_ && hash_store_.empty()) {
+    return binary_store_->empty() || hash_->binarize(hash).size() == binary_store_->words() ?
+      Status::kOk : Status::kSizeMismatch;
   }
+  return hash_store_.empty() || hash.size() == hash_store_.dim() ? Status::kOk : Status::kSizeMismatch;
+}
 
-  // Store the hash
-  hashes_table_[image_id] = hash;
+std::vector<std::vector<float>> Haloc::calcImageHashBatch(
+    const std::vector<cv::Mat> &images,
+    std::vector<cv::Mat> *descs,
+    std::vector<std::vector<cv::KeyPoint>> *keypoints) {
+  // The hash calculator is shared by all the tasks (it is reentrant)
+  std::vector<std::vector<float>> hashes(images.size());
+  if (descs) descs->assign(images.size(), cv::Mat());
+  if (keypoints) keypoints->assign(images.size(), {});
+  // Every task extracts its images and then hashes them
+  const auto extract = [&](DescriptorExtractor &extractor, const size_t &begin, const size_t &end) {
+    std::vector<std::vector<cv::KeyPoint>> kps(end - begin);
+    std::vector<cv::Mat> desc(end - begin);
+    for (size_t i=begin; i < end; i++) {
+      if (images[i].empty() && extractor.needsImage()) continue;
+      {
+        HALOC_STATS_SCOPE(&stats_, Stage::kExtraction);
+        extractor.compute(images[i], kps[i - begin], desc[i - begin]);
+      }
+      HALOC_STATS_KEYPOINTS(&stats_, kps[i - begin].size());
+    }
+    std::vector<std::vector<float>> chunk_hashes;
+    hash_->calcHashBatch(desc, kps, chunk_hashes);
+    for (size_t i=begin; i < end; i++) {
+      hashes[i] = std::move(chunk_hashes[i - begin]);
+      if (descs) (*descs)[i] = desc[i - begin].clone();
+      if (keypoints) (*keypoints)[i] = std::move(kps[i - begin]);
+    }
+  };
 
-  // Compare the hash with the rest of the images
-  auto similarities = calcSimilarities(hash, images_to_ignore);
+  if (!config_.thread_pool || images.size() < 2) {
+    extract(*extractor_, 0, images.size());
+    return hashes;
+  }
 
-  // Get the best N candidates
-  const auto candidates = getBestCandidates(similarities, num_candidates);
-  if (candidates.empty()) {
-    std::cerr << "[Haloc]: WARNING -> No candidates found." << std::endl;
-    return std::nullopt;
+  // One extractor per task (the extractors are not shared between threads)
+  const size_t num_tasks = std::min(images.size(), config_.thread_pool->size());
+  const size_t chunk = (images.size() + num_tasks - 1) / num_tasks;
+  std::vector<std::future<void>> tasks;
+  for (size_t t=1; t < num_tasks; t++) {
+    tasks.push_back(config_.thread_pool->submit([&, t]() {
+      const auto extractor = extractor_->clone();
+      extract(*extractor, t*chunk, std::min(images.size(), (t + 1)*chunk));
+    }));
   }
+  extract(*extractor_, 0, std::min(images.size(), chunk));
+  for (const auto &task : tasks) config_.thread_pool->wait(task);
+  return hashes;
+}
 
-  // Return the candidates
+Status Haloc::insertHash(const uint &image_id, const std::vector<float> &hash) {
+  return insertHash(image_id, hash, cv::Mat(), {});
+}
+
+Status Haloc::insertHash(
+    const uint &image_id,
+    const std::vector<float> &hash,
+    const cv::Mat &desc,
+    const std::vector<cv::KeyPoint> &kps) {
+  // The store can only be modified when no scan is running
+  waitPendingScan();
+
+  // The sizes are validated here, once, and before anything is stored: every
+  // stored row has the size of the first one, so the scans compare them
+  // without checking it, and a rejected hash leaves all the stores unchanged
+  if (hash.empty() || (!hash_store_.empty() && hash.size() != hash_store_.dim())) return Status::kSizeMismatch;
+  BinaryHash code;
+  if (binary_store_) {
+    code = hash_->binarize(hash);
+    if (code.empty() || (!binary_store_->empty() && code.size() != binary_store_->words())) {
+      return Status::kSizeMismatch;
+    }
+  }
+
+  // In binary only mode the float hashes are not stored
+  const bool store_float = !binary_store_ || config_.binary_rerank > 0;
+  if (store_float) hash_store_.insert(image_id, hash);
+  if (binary_store_) binary_store_->insert(image_id, code);
+  if (ann_index_ && store_float) ann_index_->add(image_id);
+  if (descriptor_store_ && !descriptor_store_->insert(image_id, desc, kps)) {
+    descriptor_store_->erase(image_id);   // Not rebuildable (e.g. inserted from a hash)
+  }
+  if (config_.max_entries > 0) recency_.touch(image_id);
+  applyRetention(image_id);
+  return Status::kOk;
+}
+
+bool Haloc::eraseHash(const uint &image_id) {
+  const bool erased_float = hash_store_.erase(image_id);
+  const bool erased_binary = binary_store_ && binary_store_->erase(image_id);
+  if (!erased_float && !erased_binary) return false;
+  if (ann_index_) ann_index_->remove(image_id);
+  if (descriptor_store_) descriptor_store_->erase(image_id);
+  recency_.erase(image_id);
+
+  // The swap-removes leave the rows out of order: sort them from time to time.
+  // The approximate index works with ids, so it only needs to be rebuilt to
+  // drop its removed nodes (compact())
+  if (config_.compact_interval > 0 && ++erased_since_compact_ >= config_.compact_interval) {
+    hash_store_.compact();
+    if (binary_store_) binary_store_->compact();
+    erased_since_compact_ = 0;
+  }
+  return true;
+}
+
+void Haloc::applyRetention(const uint &image_id) {
+  if (config_.decimate) {
+    for (const auto &id : config_.decimate(image_id)) eraseHash(id);
+  }
+  evictToMaxEntries();
+}
+
+void Haloc::evictToMaxEntries() {
+  uint oldest;
+  while (config_.max_entries > 0 && size() > config_.max_entries && recency_.oldest(oldest)) {
+    eraseHash(oldest);
+    recency_.erase(oldest);
+  }
+}
+
+void Haloc::touchCandidates(const Candidate *candidates, const size_t &count) {
+  if (config_.max_entries == 0 || config_.retention != RetentionPolicy::kLeastRecentlyMatched) return;
+  for (size_t i=0; i < count; i++) recency_.refresh(candidates[i].id);
+}
+
+void Haloc::waitPendingScan() {
+  if (pending_scan_.valid()) {
+    pending_scan_.wait();
+    pending_scan_ = {};
+  }
+}
+
+std::vector<Candidate> Haloc::getBestCandidates(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  std::vector<Candidate> candidates(std::max(0, num_candidates));
+  candidates.resize(getBestCandidates(hash, Span<Candidate>(candidates), images_to_ignore));
   return candidates;
 }
 
-cv::Mat Haloc::calcDesc(const cv::Mat &image) {
-  cv::Mat desc;
-  std::vector<cv::KeyPoint> kps;
-  sift_->detectAndCompute(image, cv::noArray(), kps, desc);
-  return desc;
+size_t Haloc::getBestCandidates(
+    const std::vector<float> &hash,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore) {
+  const size_t n = findCandidates(hash, candidates, images_to_ignore);
+  reportCall(Stats::current());
+  return n;
 }
 
-std::map<uint, float> Haloc::calcSimilarities(
+size_t Haloc::findCandidates(
     const std::vector<float> &hash,
-    const std::set<uint> &images_to_ignore) {
-  std::map<uint, float> similarities;
-  for (const auto &hash_pair : hashes_table_) {
-    // Check if the image is in the ignore list
-    if (images_to_ignore.find(hash_pair.first) != images_to_ignore.end()) {
-      continue;
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore) {
+  const bool temporal = config_.temporal.enabled && !binary_store_ && !candidates.empty() &&
+                        !hash_store_.empty() && hash.size() == hash_store_.dim();
+  if (!temporal) return searchCandidates(hash, candidates, images_to_ignore);
+
+  // Consecutive queries: reuse the previous selection if the hash barely moved
+  {
+    HALOC_STATS_SCOPE(&stats_, Stage::kScan);
+    hash_store_.prepareQuery(hash, workspace_.queries);
+    const size_t n = temporal_.reuse(hash_store_, workspace_.queries.data(), hash, images_to_ignore, candidates);
+    if (n > 0) return n;
+  }
+  // Search a wider selection, so the next queries can verify a reuse
+  auto &searched = workspace_.searched;
+  searched.resize(temporal_.searchSize(candidates.size()));
+  const size_t n = searchCandidates(hash, Span<Candidate>(searched), images_to_ignore);
+  temporal_.update(hash_store_, hash, images_to_ignore, searched.data(), n, searched.size());
+  return std::copy(searched.begin(), searched.begin() + std::min(n, candidates.size()), candidates.begin()) -
+         candidates.begin();
+}
+
+size_t Haloc::searchCandidates(
+    const std::vector<float> &hash,
+    Span<Candidate> candidates,
+    const IgnoreFilter &images_to_ignore) {
+  if (candidates.empty()) return 0;
+  const int num_candidates = static_cast<int>(candidates.size());
+
+  // Approximate search for large databases. It falls back to the exact scan
+  // when the graph does not return enough candidates (e.g. most of the
+  // neighbours are ignored)
+  if (ann_index_ && hash_store_.size() >= config_.ann_min_size) {
+    const auto found = getAnnCandidates(hash, num_candidates, images_to_ignore);
+    if (found.size() >= candidates.size()) {
+      return std::copy(found.begin(), found.begin() + candidates.size(), candidates.begin()) - candidates.begin();
     }
+  }
+  if (binary_store_) {
+    const auto found = getBinaryCandidates(hash, num_candidates, images_to_ignore);
+    return std::copy(found.begin(), found.end(), candidates.begin()) - candidates.begin();
+  }
+  if (hash_store_.empty() || hash.size() != hash_store_.dim()) return 0;
+
+  // Exact scan, with the buffers of the workspace. The candidates of the
+  // previous query bound the selection from the first block
+  hash_store_.prepareQuery(hash, workspace_.queries);
+  workspace_.top_k.resize(1);
+  const float limit = config_.temporal.enabled ?
+    temporal_.limit(hash_store_, workspace_.queries.data(), candidates.size(), images_to_ignore) :
+    std::numeric_limits<float>::infinity();
+  scanStore(workspace_.queries.data(), 1, candidates.size(), images_to_ignore, workspace_.top_k.data(), limit);
+  HALOC_STATS_SCOPE(&stats_, Stage::kTopK);
+  const size_t n = workspace_.top_k[0].sortedInto(candidates.data());
+  squaredToDistance(candidates.data(), n);
+  return n;
+}
+
+std::vector<Candidate> Haloc::getAnnCandidates(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  HALOC_STATS_SCOPE(&stats_, Stage::kScan);
+  if (hash.size() != hash_store_.dim()) return {};
 
-    // Calculate the similarity
-    const auto similarity = hash_->calcSimilarity(hash, hash_pair.second);
-    if (similarity <= 0.0) continue; // Discard bad matches
+  AlignedVector<float> query;
+  hash_store_.prepareQuery(hash, query);
 
-    // Store the similarity
-    similarities[hash_pair.first] = similarity;
+  HnswIndex::Filter filter;
+  if (!images_to_ignore.empty()) {
+    filter = [&](const uint &id) {return !images_to_ignore.ignored(id);};
   }
+  const size_t k = static_cast<size_t>(num_candidates);
+  const auto found = ann_index_->search(query.data(), k*std::max<size_t>(1, config_.ann_rerank), filter,
+                                       config_.temporal.enabled ? temporal_.seeds() : std::vector<uint>());
 
-  return similarities;
+  // Re-rank with the exact distance
+  TopK top_k(k);
+  size_t r;
+  for (const auto &c : found) {
+    if (!hash_store_.rowOf(c.id, r)) continue;
+    const float distance = hash_store_.distance(query.data(), r);
+    if (distance <= 0.0) continue;  // Discard bad matches
+    top_k.push({c.id, distance});
+  }
+  return top_k.sorted();
+}
+
+std::vector<Candidate> Haloc::getBinaryCandidates(
+    const std::vector<float> &hash,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) const {
+  HALOC_STATS_SCOPE(&stats_, Stage::kScan);
+  if (num_candidates <= 0 || binary_store_->empty()) return {};
+  const BinaryHash code = hash_->binarize(hash);
+  if (code.size() != binary_store_->words()) return {};
+
+  // Hamming scan. When re-ranking, the zero distances are kept (the float
+  // distance discards the bad matches)
+  const size_t k = static_cast<size_t>(num_candidates);
+  const bool rerank = config_.binary_rerank > 0 && hash.size() == hash_store_.dim();
+  TopK binary_top_k(rerank ? k*config_.binary_rerank : k);
+  constexpr size_t kBlockSize = 256;
+  uint32_t distances[kBlockSize];
+  for (size_t b=0; b < binary_store_->size(); b += kBlockSize) {
+    const size_t count = std::min(kBlockSize, binary_store_->size() - b);
+    binary_store_->distances(code.data(), b, count, distances);
+    for (size_t i=0; i < count; i++) {
+      const uint id = binary_store_->id(b + i);
+      if (!images_to_ignore.empty() && images_to_ignore.ignored(id)) continue;
+      if (!rerank && distances[i] == 0) continue;  // Discard bad matches
+      binary_top_k.push({id, static_cast<float>(distances[i])});
+    }
+  }
+  if (!rerank) return binary_top_k.sorted();
+
+  // Re-rank the best binary matches with the float distance
+  AlignedVector<float> query;
+  hash_store_.prepareQuery(hash, query);
+  TopK top_k(k);
+  size_t r;
+  for (const auto &c : binary_top_k.sorted()) {
+    if (!hash_store_.rowOf(c.id, r)) continue;
+    const float distance = hash_store_.distance(query.data(), r);
+    if (distance <= 0.0) continue;  // Discard bad matches
+    top_k.push({c.id, distance});
+  }
+  return top_k.sorted();
 }
 
-std::vector<uint> Haloc::getBestCandidates(
-    std::map<uint, float> &similarities,
-    const int &num_candidates) {
-  // Get the best N candidates
-  std::vector<uint> candidates;
-  while (candidates.size() < num_candidates && !similarities.empty()) {
-    // Get the image with the smallest similarity
-    const auto min_sim = std::min_element(similarities.begin(), similarities.end(),
-      [](const std::pair<int, float> &p1, const std::pair<int, float> &p2) {
-        return p1.second < p2.second;
-      });
+std::vector<std::vector<Candidate>> Haloc::getBestCandidates(
+    const std::vector<std::vector<float>> &hashes,
+    const int &num_candidates,
+    const IgnoreFilter &images_to_ignore) {
+  std::vector<std::vector<Candidate>> candidates(hashes.size());
+  if (binary_store_) {
+    for (size_t q=0; q < hashes.size(); q++) {
+      candidates[q] = getBinaryCandidates(hashes[q], num_candidates, images_to_ignore);
+    }
+    return candidates;
+  }
+  if (num_candidates <= 0 || hash_store_.empty()) return candidates;
 
-    // Store the candidate
-    candidates.push_back(min_sim->first);
+  // Prepare the valid hashes into a single query matrix
+  std::vector<size_t> valid;
+  for (size_t q=0; q < hashes.size(); q++) {
+    if (hashes[q].size() == hash_store_.dim()) valid.push_back(q);
+  }
+  if (valid.empty()) return candidates;
 
-    // Remove the best similarity
-    similarities.erase(min_sim);
+  const size_t stride = hash_store_.preparedSize();
+  workspace_.queries.resize(valid.size()*stride);
+  for (size_t v=0; v < valid.size(); v++) {
+    hash_store_.prepareQuery(hashes[valid[v]], workspace_.prepared);
+    std::copy(workspace_.prepared.begin(), workspace_.prepared.end(), workspace_.queries.begin() + v*stride);
   }
 
+  workspace_.top_k.resize(valid.size());
+  scanStore(workspace_.queries.data(), valid.size(), num_candidates, images_to_ignore, workspace_.top_k.data());
+  HALOC_STATS_SCOPE(&stats_, Stage::kTopK);
+  for (size_t v=0; v < valid.size(); v++) {
+    candidates[valid[v]] = workspace_.top_k[v].sorted();
+    squaredToDistance(candidates[valid[v]].data(), candidates[valid[v]].size());
+  }
   return candidates;
 }
 
+void Haloc::scanStore(
+    const float *queries,
+    const size_t &num_queries,
+    const size_t &num_candidates,
+    const IgnoreFilter &images_to_ignore,
+    TopK *top_k,
+    const float &limit) {
+  HALOC_STATS_SCOPE(&stats_, Stage::kScan);
+  for (size_t q=0; q < num_queries; q++) {
+    top_k[q].reset(num_candidates);
+    top_k[q].setLimit(limit);
+  }
+
+  // Split the store into chunks, and scan the first one in this thread
+  const size_t rows = hash_store_.size();
+  size_t num_tasks = 1;
+  if (config_.thread_pool) {
+    const size_t min_rows = std::max<size_t>(1, config_.min_rows_per_task);
+    num_tasks = std::min(config_.thread_pool->size() + 1, (rows + min_rows - 1) / min_rows);
+    num_tasks = std::max<size_t>(1, num_tasks);
+  }
+  const size_t chunk = (rows + num_tasks - 1) / num_tasks;
+
+  // Selections of the other tasks (reused between scans)
+  auto &partial = workspace_.partial;
+  if (partial.size() < (num_tasks - 1)*num_queries) partial.resize((num_tasks - 1)*num_queries);
+  for (size_t i=0; i < (num_tasks - 1)*num_queries; i++) {
+    partial[i].reset(num_candidates);
+    partial[i].setLimit(limit);
+  }
+
+  auto &tasks = workspace_.tasks;
+  tasks.clear();
+  for (size_t t=1; t < num_tasks; t++) {
+    tasks.push_back(config_.thread_pool->submit([&, t]() {
+      scanRange(queries, num_queries, t*chunk, std::min(rows, (t + 1)*chunk),
+                images_to_ignore, partial.data() + (t - 1)*num_queries);
+    }));
+  }
+  scanRange(queries, num_queries, 0, std::min(rows, chunk), images_to_ignore, top_k);
+
+  // Merge the partial results. The candidate ordering is total, so the result
+  // is the same as the single-threaded one
+  for (size_t t=1; t < num_tasks; t++) {
+    config_.thread_pool->wait(tasks[t - 1]);
+    for (size_t q=0; q < num_queries; q++) top_k[q].merge(partial[(t - 1)*num_queries + q]);
+  }
+  tasks.clear();
+}
+
+void Haloc::scanRange(
+    const float *queries,
+    const size_t &num_queries,
+    const size_t &begin,
+    const size_t &end,
+    const IgnoreFilter &images_to_ignore,
+    TopK *top_k) const {
+  scanRows(hash_store_, queries, num_queries, begin, end, images_to_ignore, top_k, config_.scan);
+}
+
 } // namespace haloc
@@ -7,108 +7,271 @@
  * @date 2018
  */
 
+#include <algorithm>
+#include <fstream>
 #include <numeric>
 #include <iostream>
 
+#include "libhaloc/distance.h"
 #include "libhaloc/hash.h"
 
 namespace haloc {
 
-Hash::Hash(const int &num_proj, const int &max_desc) :
+namespace {
+
+constexpr char kBasisMagic[4] = {'H', 'L', 'C', 'B'};
+constexpr uint32_t kBasisVersion = 1;
+
+}  // namespace
+
+Hash::Hash(
+    const int &num_proj,
+    const int &max_desc,
+    const uint32_t &seed,
+    const bool &lazy_init) :
   initialized_{false},
   num_proj_{num_proj},
-  max_desc_{max_desc} {}
+  max_desc_{max_desc},
+  seed_{seed},
+  rng_{seed} {
+  if (!lazy_init) {
+    init();
+  }
+}
 
-std::vector<float> Hash::calcHash(const cv::Mat &desc) {
-  // Initialize first time
+std::vector<float> Hash::calcHash(const cv::Mat &desc) const {
+  std::vector<float> hash;
+  calcHash(desc, hash);
+  return hash;
+}
+
+Status Hash::calcHash(const cv::Mat &desc, std::vector<float> &hash) const {
+  static const std::vector<cv::KeyPoint> kNoKeypoints;
+  return calcHash(desc, kNoKeypoints, hash);
+}
+
+Status Hash::calcHash(
+    const cv::Mat &desc,
+    const std::vector<cv::KeyPoint> &kps,
+    std::vector<float> &hash) const {
+  // Initialize first time (only if the construction was lazy)
   if (!isInitialized()) {
     init();
   }
 
   // Sanity checks
-  if (desc.rows == 0) {
-    std::cerr << "[Hash]: ERROR -> Descriptor matrix is empty." << std::endl;
-    return std::vector<float>{};
-  }
-
-  // Adjust the number of descriptors (this should never happen, or very rarely)
-  cv::Mat adjusted_desc;
-  if (desc.rows > r_[0].size()) {
-    const auto diff = desc.rows - r_[0].size();
-    // Delete the difference random rows in the descriptor matrix
-    std::vector<int> indices(desc.rows);
-    std::iota(indices.begin(), indices.end(), 0);
-    std::random_shuffle(indices.begin(), indices.end());
-    adjusted_desc = cv::Mat(desc.rows - diff, desc.cols, desc.type());
-    for (int i=0; i < adjusted_desc.rows; i++) {
-      desc.row(indices[i]).copyTo(adjusted_desc.row(i));
-    }
+  hash.clear();
+  if (desc.rows == 0) return Status::kNoDescriptors;
+  if (desc_dim_ > 0 && desc.cols != desc_dim_) return Status::kSizeMismatch;
+
+  cv::Mat converted;
+  const cv::Mat *d_mat = &desc;
+  if (desc.type() != CV_32F) {
+    desc.convertTo(converted, CV_32F);
+    d_mat = &converted;
+  }
+  const int cols = d_mat->cols;
+  hash.resize(r_.rows()*cols);
+  Eigen::Map<ProjectionMatrix> h(hash.data(), r_.rows(), cols);
+
+  if (d_mat->rows <= max_desc_) {
+    HALOC_STATS_SCOPE(stats_, Stage::kProjection);
+
+    // Project the descriptors: H = R(:, 0:rows) * D.
+    // The normalization mean((p + 1) / 2) is folded into the product scale.
+    using DescMap = Eigen::Map<const ProjectionMatrix, Eigen::Unaligned, Eigen::OuterStride<>>;
+    const DescMap d(d_mat->ptr<float>(), d_mat->rows, cols,
+                    Eigen::OuterStride<>(d_mat->step / sizeof(float)));
+    const float scale = 0.5 / static_cast<float>(d_mat->rows);
+    h.noalias() = scale * (r_.leftCols(d_mat->rows) * d);
   } else {
-    adjusted_desc = desc; // No need to adjust
-  }
-
-  // Project the descriptors
-  const float desc_length = static_cast<float>(adjusted_desc.rows);
-  std::vector<float> hash(r_.size()*adjusted_desc.cols);
-  for (uint i=0; i < r_.size(); i++) {
-    for (int n=0; n < adjusted_desc.cols; n++) {
-      float desc_sum = 0.0;
-      for (uint m=0; (m < adjusted_desc.rows) && (m < max_desc_); m++) {
-        const float projected = r_[i][m]*adjusted_desc.at<float>(m, n);
-        const float projected_normalized = (projected + 1.0) / 2.0;
-        desc_sum += projected_normalized;
+    // Too many descriptors (this should be rare): project a selection of them,
+    // reading the rows through the selected indices instead of copying them.
+    // The j-th selected row is projected with the j-th column of the basis.
+    thread_local std::vector<int> indices;
+    {
+      HALOC_STATS_SCOPE(stats_, Stage::kSubsampling);
+      subsampleDescriptors(d_mat->rows, max_desc_, kps, subsample_, seed_, indices);
+    }
+    HALOC_STATS_SCOPE(stats_, Stage::kProjection);
+    h.setZero();
+    for (size_t j=0; j < indices.size(); j++) {
+      const Eigen::Map<const Eigen::RowVectorXf> d(d_mat->ptr<float>(indices[j]), cols);
+      for (int i=0; i < r_.rows(); i++) {
+        h.row(i) += r_(i, j) * d;
       }
-      hash[i*n] = desc_sum / desc_length;
     }
+    h *= 0.5 / static_cast<float>(indices.size());
   }
+  h.array() += 0.5;
 
-  return hash;
+  return Status::kOk;
+}
+
+std::vector<Status> Hash::calcHashBatch(
+    const std::vector<cv::Mat> &descs,
+    const std::vector<std::vector<cv::KeyPoint>> &kps,
+    std::vector<std::vector<float>> &hashes) const {
+  static const std::vector<cv::KeyPoint> kNoKeypoints;
+  if (!isInitialized()) {
+    init();
+  }
+
+  // Every image is projected at its own depth: a product over the padded
+  // batch would change the blocking and the summation order of the GEMM, and
+  // the hash of an image would depend on the other images of its batch
+  std::vector<Status> status(descs.size());
+  hashes.resize(descs.size());
+  for (size_t i=0; i < descs.size(); i++) {
+    status[i] = calcHash(descs[i], kps.empty() ? kNoKeypoints : kps[i], hashes[i]);
+  }
+  return status;
+}
+
+BinaryHash Hash::calcBinaryHash(const cv::Mat &desc) const {
+  const auto hash = calcHash(desc);
+  if (hash.empty()) return BinaryHash{};
+  return binarize(hash);
+}
+
+BinaryHash Hash::binarize(const std::vector<float> &hash) const {
+  BinaryHash code((hash.size() + 63) / 64, 0);
+  const size_t num_proj = static_cast<size_t>(std::max(1, num_proj_));
+  const size_t cols = hash.size() / num_proj;
+  if (cols == 0) return BinaryHash{};
+
+  for (size_t i=0; i < num_proj; i++) {
+    const auto begin = hash.begin() + i*cols;
+    const float mean = std::accumulate(begin, begin + cols, 0.0f) / cols;
+    for (size_t n=0; n < cols; n++) {
+      const size_t k = i*cols + n;
+      if (hash[k] > mean) code[k / 64] |= uint64_t{1} << (k % 64);
+    }
+  }
+  return code;
 }
 
-float Hash::calcSimilarity(
+Result<float> Hash::calcSimilarity(
     const std::vector<float> &hash_a,
-    const std::vector<float> &hash_b) {
+    const std::vector<float> &hash_b) const {
   // Sanity checks
-  if (hash_a.size() != hash_b.size()) {
-    std::cerr << "[Hash:] ERROR -> The hashes have different sizes." << std::endl;
-    return -1.0;
-  }
+  if (hash_a.size() != hash_b.size()) return Status::kSizeMismatch;
 
   // Compute the similarity
-  float sim = 0.0;
-  for (uint i=0; i < hash_a.size(); i++) {
-    sim += pow(hash_a[i] - hash_b[i], 2.0);
+  return l2Distance(hash_a.data(), hash_b.data(), hash_a.size());
+}
+
+bool Hash::saveBasis(const std::string &filename) const {
+  if (!isInitialized()) {
+    init();
+  }
+
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "[Hash]: ERROR -> Cannot open " << filename << " for writing." << std::endl;
+    return false;
+  }
+
+  const int32_t num_proj = num_proj_;
+  const int32_t max_desc = max_desc_;
+  file.write(kBasisMagic, sizeof(kBasisMagic));
+  file.write(reinterpret_cast<const char*>(&kBasisVersion), sizeof(kBasisVersion));
+  file.write(reinterpret_cast<const char*>(&num_proj), sizeof(num_proj));
+  file.write(reinterpret_cast<const char*>(&max_desc), sizeof(max_desc));
+  file.write(reinterpret_cast<const char*>(&seed_), sizeof(seed_));
+  file.write(reinterpret_cast<const char*>(r_.data()), r_.size()*sizeof(float));
+  if (!file) {
+    std::cerr << "[Hash]: ERROR -> Cannot write the basis to " << filename << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Hash::loadBasis(const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "[Hash]: ERROR -> Cannot open " << filename << "." << std::endl;
+    return false;
+  }
+
+  char magic[sizeof(kBasisMagic)];
+  uint32_t version = 0;
+  int32_t num_proj = 0;
+  int32_t max_desc = 0;
+  uint32_t seed = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&version), sizeof(version));
+  file.read(reinterpret_cast<char*>(&num_proj), sizeof(num_proj));
+  file.read(reinterpret_cast<char*>(&max_desc), sizeof(max_desc));
+  file.read(reinterpret_cast<char*>(&seed), sizeof(seed));
+  if (!file || !std::equal(magic, magic + sizeof(magic), kBasisMagic) || version != kBasisVersion) {
+    std::cerr << "[Hash]: ERROR -> " << filename << " is not a valid basis file." << std::endl;
+    return false;
+  }
+  if (num_proj != num_proj_ || max_desc != max_desc_) {
+    std::cerr << "[Hash]: ERROR -> The basis in " << filename << " has " << num_proj
+              << " projections and " << max_desc << " descriptors, expected "
+              << num_proj_ << " and " << max_desc_ << "." << std::endl;
+    return false;
+  }
+
+  ProjectionMatrix r(num_proj_, max_desc_);
+  file.read(reinterpret_cast<char*>(r.data()), r.size()*sizeof(float));
+  if (!file) {
+    std::cerr << "[Hash]: ERROR -> The basis in " << filename << " is truncated." << std::endl;
+    return false;
   }
-  return sqrt(sim);
+
+  // Consume the initialization, so the loaded basis is never overwritten
+  std::call_once(init_flag_, []() {});
+  r_.swap(r);
+  seed_ = seed;
+  initialized_.store(true, std::memory_order_release);
+  return true;
 }
 
-void Hash::init() {
-  initProjections();
-  initialized_ = true;
+uint64_t Hash::basisFingerprint() const {
+  if (!isInitialized()) {
+    init();
+  }
+
+  uint64_t h = 14695981039346656037ull;
+  const auto *bytes = reinterpret_cast<const unsigned char*>(r_.data());
+  for (size_t i=0; i < r_.size()*sizeof(float); i++) {
+    h ^= bytes[i];
+    h *= 1099511628211ull;
+  }
+  return h;
 }
 
-void Hash::initProjections() {
+void Hash::init() const {
+  std::call_once(init_flag_, [this]() {
+    initProjections();
+    initialized_.store(true, std::memory_order_release);
+  });
+}
+
+void Hash::initProjections() const {
   // Initializations
-  const int seed = time(NULL);
-  r_.clear();
+  rng_.seed(seed_);
+  std::vector< std::vector<float> > r;
 
   // The size of the descriptors may vary...
   // But, we limit the number of descriptors per bucket.
 
   // We will generate N-orthogonal vectors creating a linear system of type Ax=b
   // Generate a first random vector
-  const auto r = computeRandomVector(max_desc_, seed);
-  r_.push_back(unitVector(r));
+  r.push_back(unitVector(computeRandomVector(max_desc_)));
 
   // Generate the set of orthogonal vectors
-  for (uint i=1; i < num_proj_; i++) {
+  for (int i=1; i < num_proj_; i++) {
     // Generate a random vector of the correct size
-    auto new_v = computeRandomVector(max_desc_ - i, seed + i);
+    auto new_v = computeRandomVector(max_desc_ - i);
 
     // Get the right terms (b)
-    Eigen::VectorXf b(r_.size());
-    for (uint n=0; n < r_.size(); n++) {
-      auto cur_v = r_[n];
+    Eigen::VectorXf b(r.size());
+    for (uint n=0; n < r.size(); n++) {
+      const auto &cur_v = r[n];
       float sum = 0.0;
       for (uint m=0; m < new_v.size(); m++)
         sum += new_v[m]*cur_v[m];
@@ -117,10 +280,10 @@ void Hash::initProjections() {
 
     // Get the matrix of equations (A)
     Eigen::MatrixXf A(i, i);
-    for (uint n=0; n < r_.size(); n++) {
+    for (uint n=0; n < r.size(); n++) {
       uint k = 0;
-      for (uint m=r_[n].size()-i; m < r_[n].size(); m++) {
-        A(n, k) = r_[n][m];
+      for (uint m=r[n].size()-i; m < r[n].size(); m++) {
+        A(n, k) = r[n][m];
         k++;
       }
     }
@@ -129,29 +292,37 @@ void Hash::initProjections() {
     const Eigen::VectorXf x = A.colPivHouseholderQr().solve(b);
 
     // Add the solutions to the new vector
-    for (uint n=0; n < r_.size(); n++) {
+    for (uint n=0; n < r.size(); n++) {
       new_v.push_back(x(n));
     }
 
     // Push the new vector
-    r_.push_back(unitVector(new_v));
+    r.push_back(unitVector(new_v));
+  }
+
+  // Store the vectors contiguously, one per row
+  r_.resize(num_proj_, max_desc_);
+  for (int i=0; i < num_proj_; i++) {
+    r_.row(i) = Eigen::Map<const Eigen::RowVectorXf>(r[i].data(), max_desc_);
   }
 }
 
-std::vector<float> Hash::computeRandomVector(const int &size, const int &seed) {
+std::vector<float> Hash::computeRandomVector(const int &size) const {
+  // The 24 high bits of the generator, exact in a float: the output of
+  // mt19937 is fixed by the standard, the one of the distributions is not, so
+  // the basis is the same with every standard library
   std::vector<float> h(size);
-  const float rand_max = static_cast<float>(RAND_MAX);
   for (int i=0; i < size; i++) {
-    h[i] = static_cast<float>(rand())/rand_max;
+    h[i] = static_cast<float>(rng_() >> 8) * (1.0f / 16777216.0f);
   }
   return h;
 }
 
-std::vector<float> Hash::unitVector(const std::vector<float> &x) {
+std::vector<float> Hash::unitVector(const std::vector<float> &x) const {
   // Compute the norm
   float sum = 0.0;
   for (uint i=0; i < x.size(); i++)
-    sum += pow(x[i], 2.0);
+    sum += x[i]*x[i];
   float x_norm = sqrt(sum);
 
   // x^ = x/|x|
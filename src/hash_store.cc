@@ -0,0 +1,766 @@
+/**
+ * @file hash_store.cc
+ *
+ * @brief Contiguous storage for the image hashes.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libhaloc/distance.h"
+#include "libhaloc/hash_store.h"
+
+namespace haloc {
+
+namespace {
+
+constexpr char kStoreMagic[8] = {'H', 'A', 'L', 'O', 'C', 'D', 'B', '\0'};
+constexpr uint32_t kStoreVersion = 2;
+constexpr uint64_t kSectionAlignment = 64;
+
+//! Margin added to the calibrated int8 range, so later hashes rarely saturate
+constexpr float kInt8RangeMargin = 0.1f;
+constexpr int kInt8MaxCode = 127;
+
+/**
+ * @brief      On-disk header of the store files. Version 1 files end at
+ *             precision (float32 rows, no quantization parameters).
+ */
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  int32_t num_proj;
+  int32_t max_desc;
+  int32_t desc_dim;
+  uint32_t seed;
+  uint64_t basis_hash;
+  uint64_t count;
+  uint64_t dim;
+  uint64_t stride;
+  uint64_t ids_offset;
+  uint64_t rows_offset;
+  uint32_t precision;
+  uint32_t encoding;
+  uint64_t params_offset;
+};
+
+constexpr uint32_t kHeaderSizeV1 = offsetof(FileHeader, precision);
+
+inline uint64_t alignUp(const uint64_t &x) {
+  return (x + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+}
+
+//! a*b, false if it overflows
+inline bool mulFits(const uint64_t &a, const uint64_t &b, uint64_t &out) {
+  if (a != 0 && b > std::numeric_limits<uint64_t>::max()/a) return false;
+  out = a*b;
+  return true;
+}
+
+//! a+b, false if it overflows
+inline bool addFits(const uint64_t &a, const uint64_t &b, uint64_t &out) {
+  if (b > std::numeric_limits<uint64_t>::max() - a) return false;
+  out = a + b;
+  return true;
+}
+
+/**
+ * @brief      Reads n bytes at an offset. A single pread() returns at most
+ *             ~2 GiB on Linux, so it is repeated until everything is read.
+ *
+ * @param[in]  fd      The file
+ * @param[out] buf     The destination
+ * @param[in]  n       The number of bytes
+ * @param[in]  offset  The offset in the file
+ *
+ * @return     True if the n bytes were read.
+ */
+bool readFully(const int &fd, void *buf, uint64_t n, uint64_t offset) {
+  char *p = static_cast<char*>(buf);
+  while (n > 0) {
+    const ssize_t r = ::pread(fd, p, n, offset);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    p += r;
+    n -= r;
+    offset += r;
+  }
+  return true;
+}
+
+/**
+ * @brief      Writes n bytes, repeating the short writes.
+ *
+ * @param[in]  fd    The file
+ * @param[in]  buf   The source
+ * @param[in]  n     The number of bytes
+ *
+ * @return     True if the n bytes were written.
+ */
+bool writeFully(const int &fd, const void *buf, uint64_t n) {
+  const char *p = static_cast<const char*>(buf);
+  while (n > 0) {
+    const ssize_t w = ::write(fd, p, n);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return false;
+    p += w;
+    n -= w;
+  }
+  return true;
+}
+
+bool validHeader(const FileHeader &h, const uint64_t &file_size) {
+  if (!std::equal(h.magic, h.magic + sizeof(h.magic), kStoreMagic)) return false;
+  if (h.version == 1) {
+    if (h.header_size != kHeaderSizeV1) return false;
+  } else if (h.version != kStoreVersion || h.header_size != sizeof(FileHeader)) {
+    return false;
+  }
+  if (h.encoding > static_cast<uint32_t>(HashPrecision::kInt8) ||
+      h.precision > static_cast<uint32_t>(HashPrecision::kInt8)) {
+    return false;
+  }
+  if (h.stride < h.dim || h.stride % HashStore::kRowAlignment != 0) return false;
+  if (h.ids_offset < h.header_size || h.ids_offset % sizeof(uint32_t) != 0) return false;
+  if (h.rows_offset % kSectionAlignment != 0) return false;
+
+  // The sizes of a corrupt header may overflow, then the mapped views would
+  // read past the end of the file
+  uint64_t ids_bytes, ids_end, row_bytes, rows_bytes, rows_end;
+  if (!mulFits(h.count, sizeof(uint32_t), ids_bytes) || !addFits(h.ids_offset, ids_bytes, ids_end) ||
+      !mulFits(h.stride, HashStore::elementSize(static_cast<HashPrecision>(h.encoding)), row_bytes) ||
+      !mulFits(h.count, row_bytes, rows_bytes) || !addFits(h.rows_offset, rows_bytes, rows_end)) {
+    return false;
+  }
+  if (ids_end > h.rows_offset) return false;
+  if (h.encoding == static_cast<uint32_t>(HashPrecision::kInt8)) {
+    uint64_t params_bytes, params_end;
+    if (h.params_offset < rows_end || !mulFits(h.stride, 2*sizeof(float), params_bytes) ||
+        !addFits(h.params_offset, params_bytes, params_end)) {
+      return false;
+    }
+    return params_end <= file_size;
+  }
+  return rows_end <= file_size;
+}
+
+/**
+ * @brief      Reads and validates the header of a store file.
+ *
+ * @param[in]  fd         The file
+ * @param[out] h          The header
+ * @param[out] file_size  The size of the file
+ *
+ * @return     True if the header is valid.
+ */
+bool readHeader(const int &fd, FileHeader &h, uint64_t &file_size) {
+  struct stat st;
+  if (::fstat(fd, &st) != 0) return false;
+  file_size = static_cast<uint64_t>(st.st_size);
+  return
+    readFully(fd, &h, kHeaderSizeV1, 0) &&
+    (h.version == 1 || readFully(fd, &h, sizeof(h), 0)) &&
+    validHeader(h, file_size);
+}
+
+HashStoreInfo headerInfo(const FileHeader &h) {
+  HashStoreInfo info;
+  info.num_proj = h.num_proj;
+  info.max_desc = h.max_desc;
+  info.desc_dim = h.desc_dim;
+  info.seed = h.seed;
+  info.basis_hash = h.basis_hash;
+  return info;
+}
+
+}  // namespace
+
+HashStore::HashStore(const HashPrecision &precision, const std::size_t &calibration_size) :
+  precision_{precision},
+  encoding_{precision == HashPrecision::kInt8 ? HashPrecision::kFloat32 : precision},
+  calibration_size_{std::max<std::size_t>(1, calibration_size)} {}
+
+HashStore::~HashStore() {
+  unmap();
+}
+
+std::size_t HashStore::elementSize(const HashPrecision &precision) {
+  switch (precision) {
+    case HashPrecision::kFloat16: return sizeof(uint16_t);
+    case HashPrecision::kInt8: return sizeof(int8_t);
+    default: return sizeof(float);
+  }
+}
+
+bool HashStore::insert(const uint &id, const std::vector<float> &hash) {
+  if (hash.empty()) return false;
+
+  // The first hash fixes the dimension
+  if (dim_ == 0) {
+    dim_ = hash.size();
+    stride_ = ((dim_ + kRowAlignment - 1) / kRowAlignment) * kRowAlignment;
+    row_bytes_ = stride_*elementSize(encoding_);
+  }
+  if (hash.size() != dim_) return false;
+
+  // A mapped store is read-only
+  materialize();
+  ensureIndex();
+
+  // Replace or append the row
+  std::size_t r;
+  const auto it = index_.find(id);
+  if (it != index_.end()) {
+    r = it->second;
+    epoch_++;
+  } else {
+    r = ids_.size();
+    if (r > 0 && id < ids_.back()) ids_sorted_ = false;
+    ids_.push_back(id);
+    data_.resize(data_.size() + row_bytes_, 0);
+    index_[id] = r;
+    size_ = ids_.size();
+  }
+  encode(hash.data(), data_.data() + r*row_bytes_);
+  updateViews();
+
+  // The int8 quantization is calibrated once there are enough hashes
+  if (precision_ == HashPrecision::kInt8 && encoding_ != HashPrecision::kInt8 &&
+      size_ >= calibration_size_) {
+    calibrate();
+  }
+  return true;
+}
+
+bool HashStore::erase(const uint &id) {
+  materialize();
+  ensureIndex();
+  const auto it = index_.find(id);
+  if (it == index_.end()) return false;
+
+  // Move the last row to the erased one
+  epoch_++;
+  const std::size_t r = it->second;
+  const std::size_t last = size_ - 1;
+  index_.erase(it);
+  if (r != last) {
+    std::copy(data_.begin() + last*row_bytes_, data_.begin() + size_*row_bytes_,
+              data_.begin() + r*row_bytes_);
+    ids_[r] = ids_[last];
+    index_[ids_[r]] = r;
+    ids_sorted_ = false;
+  }
+  ids_.pop_back();
+  data_.resize(last*row_bytes_);
+  size_ = last;
+  updateViews();
+  return true;
+}
+
+void HashStore::compact() {
+  materialize();
+  if (!ids_sorted_) {
+    // Sort the rows by id
+    std::vector<std::size_t> order(size_);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [this](const std::size_t &a, const std::size_t &b) {return ids_[a] < ids_[b];});
+    AlignedVector<uint8_t> data(size_*row_bytes_);
+    std::vector<uint> ids(size_);
+    for (std::size_t i=0; i < size_; i++) {
+      std::copy(data_.begin() + order[i]*row_bytes_, data_.begin() + (order[i] + 1)*row_bytes_,
+                data.begin() + i*row_bytes_);
+      ids[i] = ids_[order[i]];
+      index_[ids[i]] = i;
+    }
+    data_.swap(data);
+    ids_.swap(ids);
+    ids_sorted_ = true;
+    epoch_++;
+  }
+  data_.shrink_to_fit();
+  ids_.shrink_to_fit();
+  updateViews();
+}
+
+bool HashStore::calibrate() {
+  if (precision_ != HashPrecision::kInt8) return false;
+  if (encoding_ == HashPrecision::kInt8) return true;
+  if (empty()) return false;
+  materialize();
+
+  // Range of every dimension
+  std::vector<float> lo(dim_, std::numeric_limits<float>::max());
+  std::vector<float> hi(dim_, std::numeric_limits<float>::lowest());
+  for (std::size_t i=0; i < size_; i++) {
+    const float *r = reinterpret_cast<const float*>(rowData(i));
+    for (std::size_t d=0; d < dim_; d++) {
+      lo[d] = std::min(lo[d], r[d]);
+      hi[d] = std::max(hi[d], r[d]);
+    }
+  }
+
+  // x = offset + scale*code, code in [-127, 127]. The padding decodes to zero
+  offset_.assign(stride_, 0.0f);
+  scale_.assign(stride_, 1.0f);
+  for (std::size_t d=0; d < dim_; d++) {
+    const float half_range = 0.5f*(hi[d] - lo[d])*(1.0f + kInt8RangeMargin);
+    offset_[d] = 0.5f*(hi[d] + lo[d]);
+    scale_[d] = std::max(half_range / kInt8MaxCode, std::numeric_limits<float>::min());
+  }
+
+  // Encode the rows
+  const std::size_t old_row_bytes = row_bytes_;
+  AlignedVector<uint8_t> old_data;
+  old_data.swap(data_);
+  encoding_ = HashPrecision::kInt8;
+  row_bytes_ = stride_*elementSize(encoding_);
+  data_.assign(size_*row_bytes_, 0);
+  for (std::size_t i=0; i < size_; i++) {
+    encode(reinterpret_cast<const float*>(old_data.data() + i*old_row_bytes), data_.data() + i*row_bytes_);
+  }
+  epoch_++;
+  updateViews();
+  return true;
+}
+
+void HashStore::encode(const float *hash, uint8_t *dst) const {
+  switch (encoding_) {
+    case HashPrecision::kFloat16: {
+      uint16_t *h = reinterpret_cast<uint16_t*>(dst);
+      for (std::size_t d=0; d < dim_; d++) h[d] = floatToHalf(hash[d]);
+      break;
+    }
+    case HashPrecision::kInt8: {
+      // Out of range values saturate
+      int8_t *c = reinterpret_cast<int8_t*>(dst);
+      for (std::size_t d=0; d < dim_; d++) {
+        const float code = std::nearbyint((hash[d] - offset_[d]) / scale_[d]);
+        c[d] = static_cast<int8_t>(std::min<float>(kInt8MaxCode, std::max<float>(-kInt8MaxCode, code)));
+      }
+      break;
+    }
+    default:
+      std::copy(hash, hash + dim_, reinterpret_cast<float*>(dst));
+  }
+}
+
+void HashStore::decode(const std::size_t &r, float *out) const {
+  const uint8_t *src = rowData(r);
+  switch (encoding_) {
+    case HashPrecision::kFloat16: {
+      const uint16_t *h = reinterpret_cast<const uint16_t*>(src);
+      for (std::size_t d=0; d < stride_; d++) out[d] = halfToFloat(h[d]);
+      break;
+    }
+    case HashPrecision::kInt8: {
+      const int8_t *c = reinterpret_cast<const int8_t*>(src);
+      for (std::size_t d=0; d < stride_; d++) out[d] = offset_[d] + scale_[d]*c[d];
+      break;
+    }
+    default: {
+      const float *f = reinterpret_cast<const float*>(src);
+      std::copy(f, f + stride_, out);
+    }
+  }
+}
+
+void HashStore::reserve(const std::size_t &num_hashes) {
+  materialize();
+  ids_.reserve(num_hashes);
+  index_.reserve(num_hashes);
+  if (row_bytes_ > 0) data_.reserve(num_hashes*row_bytes_);
+  updateViews();
+}
+
+void HashStore::clear() {
+  unmap();
+  dim_ = 0;
+  stride_ = 0;
+  row_bytes_ = 0;
+  size_ = 0;
+  ids_sorted_ = true;
+  epoch_++;
+  data_.clear();
+  ids_.clear();
+  offset_.clear();
+  scale_.clear();
+  index_.clear();
+  index_ready_ = true;
+  {
+    std::lock_guard<std::mutex> lock(block_order_mutex_);
+    block_order_.reset();
+    block_order_rows_ = 0;
+  }
+  setEncoding(precision_ == HashPrecision::kInt8 ? HashPrecision::kFloat32 : precision_);
+  updateViews();
+}
+
+void HashStore::setEncoding(const HashPrecision &encoding) {
+  encoding_ = encoding;
+  row_bytes_ = stride_*elementSize(encoding_);
+}
+
+std::size_t HashStore::bytes() const {
+  return size_*(row_bytes_ + sizeof(uint)) + (offset_.size() + scale_.size())*sizeof(float);
+}
+
+bool HashStore::contains(const uint &id) const {
+  ensureIndex();
+  return index_.count(id) > 0;
+}
+
+void HashStore::prepareQuery(const std::vector<float> &query, AlignedVector<float> &prepared) const {
+  if (query.size() >= dim_) {
+    prepareQuery(query.data(), prepared);
+    return;
+  }
+  std::vector<float> padded(query);
+  padded.resize(dim_, 0.0f);
+  prepareQuery(padded.data(), prepared);
+}
+
+void HashStore::prepareQuery(const float *query, AlignedVector<float> &prepared) const {
+  // The padding of the rows is zero (or has zero weight), so the query can be
+  // compared over the whole stride
+  prepared.assign(preparedSize(), 0.0f);
+  if (encoding_ != HashPrecision::kInt8) {
+    std::copy(query, query + dim_, prepared.begin());
+    return;
+  }
+
+  // |q - x|^2 = sum scale^2 * ((q - offset)/scale - code)^2
+  float *t = prepared.data();
+  float *w = prepared.data() + stride_;
+  for (std::size_t d=0; d < dim_; d++) {
+    t[d] = (query[d] - offset_[d]) / scale_[d];
+    w[d] = scale_[d]*scale_[d];
+  }
+}
+
+void HashStore::distances(const std::vector<float> &query, std::vector<float> &out) const {
+  out.resize(size());
+  if (empty()) return;
+
+  AlignedVector<float> prepared;
+  prepareQuery(query, prepared);
+  distances(prepared.data(), 0, size(), out.data());
+}
+
+void HashStore::distances(
+    const float *prepared,
+    const std::size_t &begin,
+    const std::size_t &count,
+    float *out) const {
+  distances(prepared, 1, begin, count, out);
+}
+
+void HashStore::distances(
+    const float *prepared,
+    const std::size_t &num_queries,
+    const std::size_t &begin,
+    const std::size_t &count,
+    float *out) const {
+  squaredDistances(prepared, num_queries, begin, count, out);
+  for (std::size_t i=0; i < num_queries*count; i++) out[i] = std::sqrt(out[i]);
+}
+
+void HashStore::squaredDistances(
+    const float *prepared,
+    const std::size_t &num_queries,
+    const std::size_t &begin,
+    const std::size_t &count,
+    float *out) const {
+  if (encoding_ == HashPrecision::kFloat32) {
+    squaredL2DistanceBlock(prepared, num_queries, reinterpret_cast<const float*>(rowData(begin)),
+                           count, stride_, stride_, out);
+    return;
+  }
+
+  // The compact rows of a block fit in cache, so they are compared with one
+  // query at a time
+  const std::size_t n = preparedSize();
+  for (std::size_t q=0; q < num_queries; q++) {
+    const float *query = prepared + q*n;
+    if (encoding_ == HashPrecision::kFloat16) {
+      squaredL2DistanceBatchF16(query, reinterpret_cast<const uint16_t*>(rowData(begin)),
+                                count, stride_, stride_, out + q*count);
+    } else {
+      squaredL2DistanceBatchI8(query, query + stride_, reinterpret_cast<const int8_t*>(rowData(begin)),
+                               count, stride_, stride_, out + q*count);
+    }
+  }
+}
+
+void HashStore::squaredDistancesBounded(
+    const float *prepared,
+    const std::size_t &begin,
+    const std::size_t &count,
+    const uint16_t *blocks,
+    const float &bound,
+    float *out) const {
+  if (encoding_ != HashPrecision::kFloat32) {
+    squaredDistances(prepared, 1, begin, count, out);
+    return;
+  }
+  squaredL2DistanceBounded(prepared, reinterpret_cast<const float*>(rowData(begin)),
+                           count, stride_, blocks, numBlocks(), bound, out);
+}
+
+std::shared_ptr<const std::vector<uint16_t>> HashStore::blockOrder() const {
+  std::lock_guard<std::mutex> lock(block_order_mutex_);
+  if (block_order_ && block_order_->size() == numBlocks() && size_ < 2*block_order_rows_) {
+    return block_order_;
+  }
+
+  // Variance of every element over evenly spaced rows
+  constexpr std::size_t kSampleRows = 1024;
+  const std::size_t n = std::min(size_, kSampleRows);
+  std::vector<double> sum(stride_, 0.0);
+  std::vector<double> sum_sq(stride_, 0.0);
+  AlignedVector<float> row(stride_);
+  for (std::size_t s=0; s < n; s++) {
+    decode(s*size_/n, row.data());
+    for (std::size_t d=0; d < stride_; d++) {
+      sum[d] += row[d];
+      sum_sq[d] += static_cast<double>(row[d])*row[d];
+    }
+  }
+  std::vector<double> variance(numBlocks(), 0.0);
+  for (std::size_t d=0; n > 0 && d < stride_; d++) {
+    const double mean = sum[d] / n;
+    variance[d / kDistanceBlock] += sum_sq[d] / n - mean*mean;
+  }
+
+  // Ties (e.g. the padding) keep the natural order
+  std::vector<uint16_t> order(numBlocks());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&variance](const uint16_t &a, const uint16_t &b) {
+    return variance[a] > variance[b];
+  });
+  block_order_ = std::make_shared<const std::vector<uint16_t>>(std::move(order));
+  block_order_rows_ = size_;
+  return block_order_;
+}
+
+float HashStore::distance(const float *prepared, const std::size_t &r) const {
+  float d;
+  distances(prepared, r, 1, &d);
+  return d;
+}
+
+bool HashStore::rowOf(const uint &id, std::size_t &r) const {
+  ensureIndex();
+  const auto it = index_.find(id);
+  if (it == index_.end()) return false;
+  r = it->second;
+  return true;
+}
+
+const float* HashStore::find(const uint &id) const {
+  std::size_t r;
+  if (encoding_ != HashPrecision::kFloat32 || !rowOf(id, r)) return nullptr;
+  return reinterpret_cast<const float*>(rowData(r));
+}
+
+bool HashStore::save(const std::string &filename, const HashStoreInfo &info) const {
+  // Written next to the destination and renamed over it: the rows may be
+  // mapped from the destination itself, and a failed save keeps the old file
+  const std::string tmp = filename + ".tmp";
+  const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "[HashStore]: ERROR -> Cannot open " << tmp << " for writing." << std::endl;
+    return false;
+  }
+
+  FileHeader h{};
+  std::copy(kStoreMagic, kStoreMagic + sizeof(kStoreMagic), h.magic);
+  h.version = kStoreVersion;
+  h.header_size = sizeof(FileHeader);
+  h.num_proj = info.num_proj;
+  h.max_desc = info.max_desc;
+  h.desc_dim = info.desc_dim;
+  h.seed = info.seed;
+  h.basis_hash = info.basis_hash;
+  h.count = size_;
+  h.dim = dim_;
+  h.stride = stride_;
+  h.ids_offset = alignUp(sizeof(FileHeader));
+  h.rows_offset = alignUp(h.ids_offset + size_*sizeof(uint32_t));
+  h.precision = static_cast<uint32_t>(precision_);
+  h.encoding = static_cast<uint32_t>(encoding_);
+  const uint64_t rows_end = h.rows_offset + size_*row_bytes_;
+  h.params_offset = encoding_ == HashPrecision::kInt8 ? alignUp(rows_end) : 0;
+
+  const char zeros[kSectionAlignment] = {};
+  bool ok =
+    writeFully(fd, &h, sizeof(h)) &&
+    writeFully(fd, zeros, h.ids_offset - sizeof(FileHeader)) &&
+    writeFully(fd, row_ids_, size_*sizeof(uint32_t)) &&
+    writeFully(fd, zeros, h.rows_offset - h.ids_offset - size_*sizeof(uint32_t)) &&
+    writeFully(fd, rows_, size_*row_bytes_);
+  if (ok && encoding_ == HashPrecision::kInt8) {
+    ok =
+      writeFully(fd, zeros, h.params_offset - rows_end) &&
+      writeFully(fd, offset_.data(), stride_*sizeof(float)) &&
+      writeFully(fd, scale_.data(), stride_*sizeof(float));
+  }
+  ok = ::fsync(fd) == 0 && ok;
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    std::cerr << "[HashStore]: ERROR -> Cannot write the store to " << filename << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool HashStore::readInfo(const std::string &filename, HashStoreInfo &info) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "[HashStore]: ERROR -> Cannot open " << filename << "." << std::endl;
+    return false;
+  }
+  FileHeader h{};
+  uint64_t file_size = 0;
+  const bool ok = readHeader(fd, h, file_size);
+  ::close(fd);
+  if (!ok) {
+    std::cerr << "[HashStore]: ERROR -> " << filename << " is not a valid hash store." << std::endl;
+    return false;
+  }
+  info = headerInfo(h);
+  return true;
+}
+
+bool HashStore::load(const std::string &filename, HashStoreInfo &info, const bool &use_mmap) {
+  static_assert(sizeof(uint) == sizeof(uint32_t), "Image ids are stored as uint32");
+
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "[HashStore]: ERROR -> Cannot open " << filename << "." << std::endl;
+    return false;
+  }
+  FileHeader h{};
+  uint64_t file_size = 0;
+  if (!readHeader(fd, h, file_size)) {
+    ::close(fd);
+    std::cerr << "[HashStore]: ERROR -> " << filename << " is not a valid hash store." << std::endl;
+    return false;
+  }
+
+  // Everything is read before the current content is replaced, so a failed
+  // load leaves the store untouched
+  const auto encoding = static_cast<HashPrecision>(h.encoding);
+  const std::size_t row_bytes = h.stride*elementSize(encoding);
+  AlignedVector<float> offset, scale;
+  bool loaded = true;
+  if (encoding == HashPrecision::kInt8) {
+    // The quantization parameters are small, they are always read
+    offset.resize(h.stride);
+    scale.resize(h.stride);
+    const uint64_t n = h.stride*sizeof(float);
+    loaded =
+      readFully(fd, offset.data(), n, h.params_offset) &&
+      readFully(fd, scale.data(), n, h.params_offset + n);
+  }
+
+  void *mapping = nullptr;
+  std::vector<uint> ids;
+  AlignedVector<uint8_t> data;
+  if (loaded && use_mmap && file_size > 0) {
+    void *addr = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) mapping = addr;
+  }
+  if (loaded && !mapping) {
+    // Regular read
+    ids.resize(h.count);
+    data.resize(h.count*row_bytes);
+    loaded =
+      readFully(fd, ids.data(), h.count*sizeof(uint), h.ids_offset) &&
+      readFully(fd, data.data(), h.count*row_bytes, h.rows_offset);
+  }
+  ::close(fd);
+
+  if (!loaded) {
+    std::cerr << "[HashStore]: ERROR -> Cannot read " << filename << "." << std::endl;
+    return false;
+  }
+
+  clear();
+  precision_ = static_cast<HashPrecision>(h.precision);
+  dim_ = h.dim;
+  stride_ = h.stride;
+  setEncoding(encoding);
+  size_ = h.count;
+  offset_ = std::move(offset);
+  scale_ = std::move(scale);
+  info = headerInfo(h);
+  if (mapping) {
+    mapping_ = mapping;
+    mapping_size_ = file_size;
+    const char *base = static_cast<const char*>(mapping);
+    row_ids_ = reinterpret_cast<const uint*>(base + h.ids_offset);
+    rows_ = reinterpret_cast<const uint8_t*>(base + h.rows_offset);
+  } else {
+    ids_ = std::move(ids);
+    data_ = std::move(data);
+    updateViews();
+  }
+
+  // The id index is only built if it is needed
+  ids_sorted_ = std::is_sorted(row_ids_, row_ids_ + size_);
+  index_ready_ = size_ == 0;
+  return true;
+}
+
+void HashStore::materialize() {
+  if (!isMapped()) return;
+  ids_.assign(row_ids_, row_ids_ + size_);
+  data_.assign(rows_, rows_ + size_*row_bytes_);
+  unmap();
+  updateViews();
+}
+
+void HashStore::unmap() {
+  if (!isMapped()) return;
+  ::munmap(mapping_, mapping_size_);
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  rows_ = nullptr;
+  row_ids_ = nullptr;
+}
+
+void HashStore::updateViews() {
+  if (isMapped()) return;
+  rows_ = data_.data();
+  row_ids_ = ids_.data();
+}
+
+void HashStore::ensureIndex() const {
+  if (index_ready_.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> lock(index_mutex_);
+  if (index_ready_.load(std::memory_order_relaxed)) return;
+  index_.clear();
+  index_.reserve(size_);
+  for (std::size_t i=0; i < size_; i++) index_[row_ids_[i]] = i;
+  index_ready_.store(true, std::memory_order_release);
+}
+
+}  // namespace haloc
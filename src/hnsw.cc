@@ -0,0 +1,258 @@
+/**
+ * @file hnsw.cc
+ *
+ * @brief Approximate nearest neighbour index (HNSW graph) over the stored
+ *        hashes.
+ *
+ * Malkov and Yashunin, "Efficient and robust approximate nearest neighbor
+ * search using Hierarchical Navigable Small World graphs", 2016.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+#include "libhaloc/hnsw.h"
+
+namespace haloc {
+
+namespace {
+
+/**
+ * @brief      Per-thread visited marks, reused between searches.
+ */
+class Visited {
+ public:
+  void reset(const size_t &n) {
+    if (marks_.size() < n) marks_.resize(n, 0);
+    if (++tag_ == 0) {
+      std::fill(marks_.begin(), marks_.end(), 0);
+      tag_ = 1;
+    }
+  }
+  inline bool visit(const uint32_t &i) {
+    if (marks_[i] == tag_) return false;
+    marks_[i] = tag_;
+    return true;
+  }
+
+ private:
+  std::vector<uint32_t> marks_;
+  uint32_t tag_ = 0;
+};
+
+}  // namespace
+
+HnswIndex::HnswIndex(const HashStore &store, const Params &params) :
+  store_{store},
+  params_{params},
+  rng_{params.seed},
+  max_level_{-1},
+  entry_{0} {
+  params_.m = std::max<size_t>(2, params_.m);
+}
+
+void HnswIndex::clear() {
+  nodes_.clear();
+  labels_.clear();
+  rng_.seed(params_.seed);
+  max_level_ = -1;
+  entry_ = 0;
+}
+
+float HnswIndex::distance(const float *query, const uint32_t &node) const {
+  // The hash of a removed node may be erased from the store
+  std::size_t r = 0;
+  if (!store_.rowOf(nodes_[node].label, r)) return std::numeric_limits<float>::infinity();
+  return store_.distance(query, r);
+}
+
+void HnswIndex::prepareNode(const uint32_t &node, AlignedVector<float> &prepared) const {
+  // The stored row is decoded, so the distances between nodes do not depend
+  // on the encoding of the store
+  std::size_t r = 0;
+  if (!store_.rowOf(nodes_[node].label, r)) {
+    prepared.assign(store_.preparedSize(), std::numeric_limits<float>::infinity());
+    return;
+  }
+  thread_local AlignedVector<float> decoded;
+  decoded.resize(store_.stride());
+  store_.decode(r, decoded.data());
+  store_.prepareQuery(decoded.data(), prepared);
+}
+
+bool HnswIndex::add(const uint &id) {
+  if (!store_.contains(id)) return false;
+
+  // A removed image that is inserted again keeps its old node (the graph is
+  // rebuilt by Haloc::compact())
+  const auto it = labels_.find(id);
+  if (it != labels_.end()) {
+    if (!nodes_[it->second].deleted) return false;
+    nodes_[it->second].deleted = false;
+    return true;
+  }
+
+  // Random level, with exponentially decaying probability
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const double ml = 1.0 / std::log(static_cast<double>(params_.m));
+  const int level = static_cast<int>(-std::log(std::max(1e-12, uniform(rng_))) * ml);
+
+  const uint32_t node = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back({id, false, std::vector<std::vector<uint32_t>>(level + 1)});
+  labels_[id] = node;
+
+  AlignedVector<float> prepared;
+  prepareNode(node, prepared);
+  const float *q = prepared.data();
+
+  if (max_level_ < 0) {
+    max_level_ = level;
+    entry_ = node;
+    return true;
+  }
+
+  // Greedy descent through the layers above the node level
+  std::vector<Scored> ep{{distance(q, entry_), entry_}};
+  for (int l=max_level_; l > level; l--) {
+    const auto w = searchLayer(q, ep, 1, l);
+    ep = {*std::min_element(w.begin(), w.end())};
+  }
+
+  // Connect the node in every layer it belongs to
+  for (int l=std::min(level, max_level_); l >= 0; l--) {
+    auto w = searchLayer(q, ep, params_.ef_construction, l);
+    const auto neighbors = selectNeighbors(w, params_.m);
+    for (const auto &n : neighbors) {
+      link(node, n, l);
+      link(n, node, l);
+    }
+    ep.swap(w);
+  }
+
+  if (level > max_level_) {
+    max_level_ = level;
+    entry_ = node;
+  }
+  return true;
+}
+
+void HnswIndex::remove(const uint &id) {
+  const auto it = labels_.find(id);
+  if (it != labels_.end()) nodes_[it->second].deleted = true;
+}
+
+std::vector<Candidate> HnswIndex::search(
+    const float *query,
+    const size_t &k,
+    const Filter &filter,
+    const std::vector<uint> &seeds) const {
+  if (max_level_ < 0 || k == 0) return {};
+
+  std::vector<Scored> ep{{distance(query, entry_), entry_}};
+  for (int l=max_level_; l > 0; l--) {
+    const auto w = searchLayer(query, ep, 1, l);
+    ep = {*std::min_element(w.begin(), w.end())};
+  }
+  for (const auto &id : seeds) {
+    const auto it = labels_.find(id);
+    if (it != labels_.end()) ep.push_back({distance(query, it->second), it->second});
+  }
+  auto w = searchLayer(query, ep, std::max(k, params_.ef_search), 0);
+  std::sort(w.begin(), w.end());
+
+  std::vector<Candidate> out;
+  for (const auto &s : w) {
+    const Node &n = nodes_[s.second];
+    if (n.deleted || (filter && !filter(n.label))) continue;
+    out.push_back({n.label, s.first});
+    if (out.size() == k) break;
+  }
+  return out;
+}
+
+std::vector<HnswIndex::Scored> HnswIndex::searchLayer(
+    const float *query,
+    const std::vector<Scored> &entry,
+    const size_t &ef,
+    const int &layer) const {
+  thread_local Visited visited;
+  visited.reset(nodes_.size());
+
+  // Min-heap of candidates to expand and max-heap of the best ef found
+  std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>> candidates;
+  std::priority_queue<Scored> best;
+  for (const auto &e : entry) {
+    if (!visited.visit(e.second)) continue;
+    candidates.push(e);
+    best.push(e);
+  }
+  while (best.size() > ef) best.pop();
+
+  while (!candidates.empty()) {
+    const Scored c = candidates.top();
+    if (c.first > best.top().first && best.size() >= ef) break;
+    candidates.pop();
+
+    for (const auto &n : nodes_[c.second].links[layer]) {
+      if (!visited.visit(n)) continue;
+      const float d = distance(query, n);
+      if (best.size() < ef || d < best.top().first) {
+        candidates.push({d, n});
+        best.push({d, n});
+        if (best.size() > ef) best.pop();
+      }
+    }
+  }
+
+  std::vector<Scored> out;
+  out.reserve(best.size());
+  while (!best.empty()) {
+    out.push_back(best.top());
+    best.pop();
+  }
+  return out;
+}
+
+std::vector<uint32_t> HnswIndex::selectNeighbors(std::vector<Scored> candidates, const size_t &m) const {
+  std::sort(candidates.begin(), candidates.end());
+
+  // A candidate is kept if it is closer to the node than to any kept neighbour
+  std::vector<uint32_t> selected;
+  AlignedVector<float> cv;
+  for (const auto &c : candidates) {
+    if (selected.size() >= m) break;
+    prepareNode(c.second, cv);
+    bool keep = true;
+    for (const auto &s : selected) {
+      if (distance(cv.data(), s) < c.first) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) selected.push_back(c.second);
+  }
+  return selected;
+}
+
+void HnswIndex::link(const uint32_t &from, const uint32_t &to, const int &layer) {
+  auto &links = nodes_[from].links[layer];
+  links.push_back(to);
+
+  const size_t max_links = layer == 0 ? 2*params_.m : params_.m;
+  if (links.size() <= max_links) return;
+
+  // Prune the neighbour list
+  AlignedVector<float> fv;
+  prepareNode(from, fv);
+  std::vector<Scored> scored;
+  scored.reserve(links.size());
+  for (const auto &n : links) scored.push_back({distance(fv.data(), n), n});
+  links = selectNeighbors(scored, max_links);
+}
+
+}  // namespace haloc
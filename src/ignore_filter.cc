@@ -0,0 +1,105 @@
+/**
+ * @file ignore_filter.cc
+ *
+ * @brief Images excluded from a query.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+
+#include "libhaloc/ignore_filter.h"
+
+namespace haloc {
+
+IgnoreFilter::IgnoreFilter(const std::set<uint> &ids) {
+  // The set is sorted, so the ranges are built in order
+  for (const auto &id : ids) {
+    if (!ranges_.empty() && ranges_.back().second == id) {
+      ranges_.back().second++;
+    } else {
+      addId(id);
+    }
+  }
+}
+
+IgnoreFilter::IgnoreFilter(std::initializer_list<uint> ids) {
+  for (const auto &id : ids) addId(id);
+}
+
+IgnoreFilter& IgnoreFilter::addRange(const uint &lo, const uint &hi) {
+  if (lo < hi) insertRange({lo, hi});
+  return *this;
+}
+
+IgnoreFilter& IgnoreFilter::addId(const uint &id) {
+  insertRange({id, static_cast<uint64_t>(id) + 1});
+  return *this;
+}
+
+void IgnoreFilter::insertRange(Range r) {
+  // Merge with the overlapping or adjacent ranges
+  auto first = std::lower_bound(ranges_.begin(), ranges_.end(), r,
+    [](const Range &a, const Range &b) {return a.second < b.first;});
+  auto last = first;
+  while (last != ranges_.end() && last->first <= r.second) {
+    r.first = std::min(r.first, last->first);
+    r.second = std::max(r.second, last->second);
+    ++last;
+  }
+  first = ranges_.erase(first, last);
+  ranges_.insert(first, r);
+}
+
+IgnoreFilter& IgnoreFilter::setBitset(const std::shared_ptr<const std::vector<uint64_t>> &bits) {
+  bits_ = bits;
+  return *this;
+}
+
+IgnoreFilter& IgnoreFilter::setPredicate(const Predicate &predicate) {
+  predicate_ = predicate;
+  return *this;
+}
+
+bool IgnoreFilter::ignored(const uint &id) const {
+  if (!ranges_.empty()) {
+    // First range that ends after the id
+    const auto it = std::upper_bound(ranges_.begin(), ranges_.end(), static_cast<uint64_t>(id),
+      [](const uint64_t &i, const Range &r) {return i < r.second;});
+    if (it != ranges_.end() && it->first <= id) return true;
+  }
+  return ignoredByTest(id);
+}
+
+bool IgnoreFilter::ignoredByTest(const uint &id) const {
+  if (bits_) {
+    const std::size_t word = id / 64;
+    if (word < bits_->size() && ((*bits_)[word] >> (id % 64)) & 1) return true;
+  }
+  return predicate_ && predicate_(id);
+}
+
+void IgnoreFilter::rowIntervals(
+    const uint *ids,
+    const std::size_t &begin,
+    const std::size_t &end,
+    std::vector<std::pair<std::size_t, std::size_t>> &rows) const {
+  rows.clear();
+  std::size_t b = begin;
+  for (const auto &r : ranges_) {
+    if (b >= end) break;
+    if (r.second <= ids[b]) continue;
+
+    // Rows of the range
+    const std::size_t lo = std::lower_bound(ids + b, ids + end, r.first,
+      [](const uint &id, const uint64_t &x) {return id < x;}) - ids;
+    const std::size_t hi = std::lower_bound(ids + lo, ids + end, r.second,
+      [](const uint &id, const uint64_t &x) {return id < x;}) - ids;
+    if (lo > b) rows.push_back({b, lo});
+    b = hi;
+  }
+  if (b < end) rows.push_back({b, end});
+}
+
+}  // namespace haloc
@@ -0,0 +1,98 @@
+/**
+ * @file scan.cc
+ *
+ * @brief Exact scan of a hash store: the distances of a block of rows to a set
+ * of queries, folded into one top-K selection per query.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "libhaloc/scan.h"
+
+namespace haloc {
+
+void scanRows(
+    const HashStore &store,
+    const float *queries,
+    const size_t &num_queries,
+    const size_t &begin,
+    const size_t &end,
+    const IgnoreFilter &images_to_ignore,
+    TopK *top_k,
+    const ScanParams &params) {
+  // The ignored ranges of a sorted store are skipped, the rest of the ignored
+  // images are tested row by row. The buffers are reused by every scan of
+  // the thread
+  thread_local std::vector<std::pair<size_t, size_t>> intervals;
+  intervals.clear();
+  bool test_ranges = false;
+  if (images_to_ignore.ranges().empty()) {
+    intervals.push_back({begin, end});
+  } else if (store.idsSorted()) {
+    images_to_ignore.rowIntervals(store.ids(), begin, end, intervals);
+  } else {
+    intervals.push_back({begin, end});
+    test_ranges = true;
+  }
+  const bool test = test_ranges || images_to_ignore.hasTest();
+
+  // The scan works over blocks of rows, so every block is compared with all
+  // the queries while it is in cache
+  constexpr size_t kBlockSize = 256;
+  thread_local std::vector<float> distances;
+  distances.resize(num_queries*kBlockSize);
+
+  // A single query over float32 rows abandons the rows that cannot enter the
+  // selection. The bound is read once per block: it only decreases, so an
+  // older bound abandons less but never drops a candidate
+  const bool bounded = params.early_abandon && num_queries == 1 && store.encoding() == HashPrecision::kFloat32;
+  std::shared_ptr<const std::vector<uint16_t>> order;
+  thread_local std::vector<uint16_t> natural;
+  const uint16_t *blocks = nullptr;
+  if (bounded && params.variance_order) {
+    order = store.blockOrder();
+    blocks = order->data();
+  } else if (bounded) {
+    natural.resize(store.numBlocks());
+    std::iota(natural.begin(), natural.end(), 0);
+    blocks = natural.data();
+  }
+
+  for (const auto &interval : intervals) {
+    for (size_t b=interval.first; b < interval.second; b += kBlockSize) {
+      const size_t count = std::min(kBlockSize, interval.second - b);
+      const float bound = bounded ? top_k[0].bound() : std::numeric_limits<float>::infinity();
+      if (bound < std::numeric_limits<float>::infinity()) {
+        store.squaredDistancesBounded(queries, b, count, blocks, bound, distances.data());
+      } else {
+        store.squaredDistances(queries, num_queries, b, count, distances.data());
+      }
+
+      for (size_t i=0; i < count; i++) {
+        // Check if the image is in the ignore list
+        const uint id = store.id(b + i);
+        if (test && (test_ranges ? images_to_ignore.ignored(id) : images_to_ignore.ignoredByTest(id))) {
+          continue;
+        }
+
+        for (size_t q=0; q < num_queries; q++) {
+          // Discard bad matches
+          const float distance = distances[q*count + i];
+          if (distance <= 0.0) continue;
+
+          top_k[q].push({id, distance});
+        }
+      }
+    }
+  }
+}
+
+}  // namespace haloc
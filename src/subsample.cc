@@ -0,0 +1,145 @@
+/**
+ * @file subsample.cc
+ *
+ * @brief Deterministic selection of the descriptors hashed when an image has
+ * more than the maximum number of descriptors.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+#include "libhaloc/subsample.h"
+
+namespace haloc {
+
+namespace {
+
+/**
+ * @brief      Seeded uniform sample (algorithm R). The index is drawn with a
+ *             multiply-shift of the raw generator output instead of
+ *             std::uniform_int_distribution, whose result depends on the
+ *             standard library.
+ */
+void reservoir(
+    const int &num_rows,
+    const int &max_rows,
+    const uint32_t &seed,
+    std::vector<int> &indices) {
+  indices.resize(max_rows);
+  std::iota(indices.begin(), indices.end(), 0);
+  std::mt19937 rng(seed);
+  for (int i=max_rows; i < num_rows; i++) {
+    const uint64_t j = (static_cast<uint64_t>(rng()) * (i + 1)) >> 32;
+    if (j < static_cast<uint64_t>(max_rows)) indices[j] = i;
+  }
+}
+
+/**
+ * @brief      The strongest keypoints (the index breaks the ties).
+ */
+void topResponse(
+    const int &max_rows,
+    const std::vector<cv::KeyPoint> &kps,
+    std::vector<int> &indices) {
+  indices.resize(kps.size());
+  std::iota(indices.begin(), indices.end(), 0);
+  std::nth_element(indices.begin(), indices.begin() + max_rows, indices.end(),
+                   [&](const int &a, const int &b) {
+    return kps[a].response > kps[b].response || (kps[a].response == kps[b].response && a < b);
+  });
+  indices.resize(max_rows);
+}
+
+/**
+ * @brief      The strongest keypoints of every grid cell, taken round by
+ *             round: first the best of every cell, then the second best... The
+ *             last, incomplete round takes the strongest ones.
+ */
+void spatial(
+    const int &max_rows,
+    const std::vector<cv::KeyPoint> &kps,
+    const SubsampleParams &params,
+    std::vector<int> &indices) {
+  const int grid_cols = std::max(1, params.grid_cols);
+  const int grid_rows = std::max(1, params.grid_rows);
+
+  // Bounding box of the keypoints (the image size is not known here)
+  float min_x = kps[0].pt.x, max_x = kps[0].pt.x;
+  float min_y = kps[0].pt.y, max_y = kps[0].pt.y;
+  for (const auto &kp : kps) {
+    min_x = std::min(min_x, kp.pt.x);
+    max_x = std::max(max_x, kp.pt.x);
+    min_y = std::min(min_y, kp.pt.y);
+    max_y = std::max(max_y, kp.pt.y);
+  }
+  const float cell_w = std::max(max_x - min_x, 1.0f) / grid_cols;
+  const float cell_h = std::max(max_y - min_y, 1.0f) / grid_rows;
+
+  // Cell of every keypoint and its rank inside the cell
+  thread_local std::vector<int> cell;
+  thread_local std::vector<int> rank;
+  const int n = static_cast<int>(kps.size());
+  cell.resize(n);
+  rank.resize(n);
+  for (int i=0; i < n; i++) {
+    const int cx = std::min(grid_cols - 1, static_cast<int>((kps[i].pt.x - min_x) / cell_w));
+    const int cy = std::min(grid_rows - 1, static_cast<int>((kps[i].pt.y - min_y) / cell_h));
+    cell[i] = cy*grid_cols + cx;
+  }
+  const auto stronger = [&](const int &a, const int &b) {
+    return kps[a].response > kps[b].response || (kps[a].response == kps[b].response && a < b);
+  };
+  indices.resize(n);
+  std::iota(indices.begin(), indices.end(), 0);
+  std::sort(indices.begin(), indices.end(), [&](const int &a, const int &b) {
+    return cell[a] < cell[b] || (cell[a] == cell[b] && stronger(a, b));
+  });
+  for (int i=0; i < n; i++) {
+    rank[indices[i]] = (i > 0 && cell[indices[i]] == cell[indices[i - 1]]) ? rank[indices[i - 1]] + 1 : 0;
+  }
+
+  // Lowest ranks first, the strongest inside the same rank
+  std::nth_element(indices.begin(), indices.begin() + max_rows, indices.end(),
+                   [&](const int &a, const int &b) {
+    return rank[a] < rank[b] || (rank[a] == rank[b] && stronger(a, b));
+  });
+  indices.resize(max_rows);
+}
+
+}  // namespace
+
+void subsampleDescriptors(
+    const int &num_rows,
+    const int &max_rows,
+    const std::vector<cv::KeyPoint> &kps,
+    const SubsampleParams &params,
+    const uint32_t &seed,
+    std::vector<int> &indices) {
+  if (max_rows <= 0) {
+    indices.clear();
+    return;
+  }
+  if (num_rows <= max_rows) {
+    indices.resize(std::max(0, num_rows));
+    std::iota(indices.begin(), indices.end(), 0);
+    return;
+  }
+
+  const bool has_kps = static_cast<int>(kps.size()) == num_rows;
+  if (has_kps && params.strategy == SubsampleStrategy::kTopResponse) {
+    topResponse(max_rows, kps, indices);
+  } else if (has_kps && params.strategy == SubsampleStrategy::kSpatial) {
+    spatial(max_rows, kps, params, indices);
+  } else {
+    reservoir(num_rows, max_rows, seed, indices);
+  }
+
+  // Keep the order of the extractor, as when no selection is needed
+  std::sort(indices.begin(), indices.end());
+}
+
+}  // namespace haloc
@@ -0,0 +1,168 @@
+/**
+ * @file temporal_cache.cc
+ *
+ * @brief Cache of the last query, for the consecutive frames of a moving
+ * robot (very similar hashes and candidates).
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "libhaloc/distance.h"
+#include "libhaloc/scan.h"
+#include "libhaloc/temporal_cache.h"
+
+namespace haloc {
+
+namespace {
+
+//! Relative margin of the seeded bound: the scan kernels may round the same
+//! distance differently (e.g. in another order of the elements)
+constexpr float kLimitMargin = 1e-4f;
+
+/**
+ * @brief      The parts of the ranges a that are not in the ranges b (both
+ *             sorted and disjoint).
+ *
+ * @param[in]  a     The ranges
+ * @param[in]  b     The ranges removed
+ * @param[out] out   The difference, sorted and disjoint
+ */
+void subtractRanges(
+    const std::vector<IgnoreFilter::Range> &a,
+    const std::vector<IgnoreFilter::Range> &b,
+    std::vector<IgnoreFilter::Range> &out) {
+  out.clear();
+  auto first = b.begin();
+  for (auto r : a) {
+    while (first != b.end() && first->second <= r.first) ++first;
+    for (auto it = first; it != b.end() && it->first < r.second; ++it) {
+      if (it->first > r.first) out.push_back({r.first, it->first});
+      r.first = std::max(r.first, it->second);
+    }
+    if (r.first < r.second) out.push_back(r);
+  }
+}
+
+}  // namespace
+
+std::size_t TemporalCache::reuse(
+    const HashStore &store,
+    const float *prepared,
+    const std::vector<float> &hash,
+    const IgnoreFilter &images_to_ignore,
+    Span<Candidate> out) {
+  // The searched selection must be full and its rows unchanged
+  if (params_.epsilon <= 0.0f || hash_.empty() || out.empty()) return 0;
+  if (hash.size() != hash_.size() || store.dim() != hash.size() || store.epoch() != epoch_) return 0;
+  if (out.size() > k_ || candidates_.size() < k_ || store.size() < rows_) return 0;
+
+  const float delta = l2Distance(hash.data(), hash_.data(), hash.size());
+  if (delta > params_.epsilon) return 0;
+
+  // The images ignored by the search and not by this query have to be scored
+  // too. Their rows are found by id, so the ids must be sorted.
+  if (ignored_test_) return 0;
+  subtractRanges(ignored_, images_to_ignore.ranges(), unignored_);
+  if (!unignored_.empty() && !store.idsSorted()) return 0;
+
+  // Re-score the previous candidates and scan the rows appended since
+  TopK top_k(out.size());
+  std::size_t r;
+  for (const auto &c : candidates_) {
+    if (images_to_ignore.ignored(c.id) || !store.rowOf(c.id, r)) continue;
+    float distance;
+    store.squaredDistances(prepared, 1, r, 1, &distance);
+    if (distance > 0.0) top_k.push({c.id, distance});
+  }
+  scanRows(store, prepared, 1, rows_, store.size(), images_to_ignore, &top_k);
+  const uint *ids = store.ids();
+  for (const auto &u : unignored_) {
+    const auto lo = std::lower_bound(ids, ids + rows_, u.first,
+      [](const uint &id, const uint64_t &x) {return id < x;});
+    const auto hi = std::lower_bound(lo, ids + rows_, u.second,
+      [](const uint &id, const uint64_t &x) {return id < x;});
+    scanRows(store, prepared, 1, lo - ids, hi - ids, images_to_ignore, &top_k);
+  }
+
+  // The other rows are at least at the last searched distance minus delta.
+  // The searched query stays the reference, so the drift is bounded by epsilon
+  if (params_.verify && !(top_k.full() && std::sqrt(top_k.bound()) <= candidates_.back().score - delta)) return 0;
+
+  const std::size_t n = top_k.sortedInto(out.data());
+  squaredToDistance(out.data(), n);
+  hits_++;
+  return n;
+}
+
+float TemporalCache::limit(
+    const HashStore &store,
+    const float *prepared,
+    const std::size_t &k,
+    const IgnoreFilter &images_to_ignore) const {
+  if (k == 0 || candidates_.size() < k || store.empty()) return std::numeric_limits<float>::infinity();
+
+  // The previous candidates and the rows next to them
+  std::vector<std::size_t> rows;
+  std::size_t r;
+  for (const auto &c : candidates_) {
+    if (!store.rowOf(c.id, r)) continue;
+    const std::size_t lo = r - std::min(r, params_.neighbours);
+    const std::size_t hi = std::min(store.size() - 1, r + params_.neighbours);
+    for (std::size_t x=lo; x <= hi; x++) rows.push_back(x);
+  }
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+  // The K-th best of them bounds the K-th best of the database
+  std::vector<float> distances;
+  distances.reserve(rows.size());
+  for (const auto &x : rows) {
+    if (images_to_ignore.ignored(store.id(x))) continue;
+    float distance;
+    store.squaredDistances(prepared, 1, x, 1, &distance);
+    if (distance > 0.0) distances.push_back(distance);
+  }
+  if (distances.size() < k) return std::numeric_limits<float>::infinity();
+  std::nth_element(distances.begin(), distances.begin() + (k - 1), distances.end());
+  return distances[k - 1]*(1.0f + kLimitMargin);
+}
+
+std::vector<uint> TemporalCache::seeds() const {
+  std::vector<uint> ids;
+  ids.reserve(candidates_.size());
+  for (const auto &c : candidates_) ids.push_back(c.id);
+  return ids;
+}
+
+void TemporalCache::update(
+    const HashStore &store,
+    const std::vector<float> &hash,
+    const IgnoreFilter &images_to_ignore,
+    const Candidate *candidates,
+    const std::size_t &n,
+    const std::size_t &k) {
+  hash_ = hash;
+  candidates_.assign(candidates, candidates + n);
+  ignored_ = images_to_ignore.ranges();
+  ignored_test_ = images_to_ignore.hasTest();
+  k_ = k;
+  rows_ = store.size();
+  epoch_ = store.epoch();
+}
+
+void TemporalCache::clear() {
+  hash_.clear();
+  candidates_.clear();
+  ignored_.clear();
+  ignored_test_ = false;
+  k_ = 0;
+  rows_ = 0;
+  epoch_ = 0;
+}
+
+}  // namespace haloc
@@ -0,0 +1,60 @@
+/**
+ * @file thread_pool.cc
+ *
+ * @brief Fixed-size pool of worker threads.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+
+#include "libhaloc/thread_pool.h"
+
+namespace haloc {
+
+ThreadPool::ThreadPool(const size_t &num_threads) : stop_{false} {
+  size_t n = num_threads;
+  if (n == 0) n = std::max(1u, std::thread::hardware_concurrency());
+  workers_.reserve(n);
+  for (size_t i=0; i < n; i++) {
+    workers_.emplace_back([this]() {work();});
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto &w : workers_) w.join();
+}
+
+bool ThreadPool::runPendingTask() {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tasks_.empty()) return false;
+    task = std::move(tasks_.front());
+    tasks_.pop();
+  }
+  task();
+  return true;
+}
+
+void ThreadPool::work() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() {return stop_ || !tasks_.empty();});
+      if (stop_ && tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
+
+}  // namespace haloc
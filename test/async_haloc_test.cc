@@ -0,0 +1,210 @@
+/**
+ * @file async_haloc_test.cc
+ *
+ * @brief Tests of the asynchronous front-end: the drop policies of the full
+ * queues and the shutdown with queued frames.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/async_haloc.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+// Blocks the extraction stage until opened, so the queues fill up
+struct Gate {
+  void open() {
+    std::lock_guard<std::mutex> lock(mutex);
+    opened = true;
+    cv.notify_all();
+  }
+
+  void wait() {
+    entered++;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] {return opened;});
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool opened = false;
+  std::atomic<int> entered{0};
+};
+
+/**
+ * @brief      Random descriptors seeded by the first pixel of the image (no
+ *             descriptors for a black image), behind a gate.
+ */
+class GatedExtractor : public DescriptorExtractor {
+ public:
+  explicit GatedExtractor(std::shared_ptr<Gate> gate) : gate_(gate) {}
+
+  void compute(const cv::Mat &image, std::vector<cv::KeyPoint> &kps, cv::Mat &desc) override {
+    gate_->wait();
+    kps.clear();
+    desc.release();
+    const int seed = image.at<uchar>(0, 0);
+    if (seed == 0) return;
+    desc.create(50, 128, CV_32F);
+    cv::RNG rng(seed);
+    rng.fill(desc, cv::RNG::UNIFORM, 0.0f, 256.0f);
+  }
+
+  std::unique_ptr<DescriptorExtractor> clone() const override {
+    return std::make_unique<GatedExtractor>(gate_);
+  }
+
+ private:
+  std::shared_ptr<Gate> gate_;
+};
+
+Config gatedConfig(std::shared_ptr<Gate> gate) {
+  Config config;
+  config.num_proj = 2;
+  config.max_desc = 100;
+  config.extractor = std::make_shared<GatedExtractor>(gate);
+  return config;
+}
+
+AsyncParams smallQueues(const DropPolicy &policy) {
+  AsyncParams params;
+  params.queue_size = 2;
+  params.drop_policy = policy;
+  params.extract_threads = 1;
+  return params;
+}
+
+cv::Mat image(const int &value) {
+  return cv::Mat(4, 4, CV_8U, cv::Scalar(value));
+}
+
+void waitFor(const std::atomic<int> &counter, const int &value) {
+  while (counter.load() < value) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+}  // namespace
+
+// With kDropOldest the caller is never blocked: the oldest queued frames are
+// dropped and the newest one always reaches the database
+TEST(AsyncHaloc, DropOldestNeverBlocks) {
+  constexpr int kFrames = 20;
+  auto gate = std::make_shared<Gate>();
+  AsyncHaloc pipeline(gatedConfig(gate), smallQueues(DropPolicy::kDropOldest));
+
+  std::atomic<int> callbacks{0};
+  const auto count = [&callbacks](const AsyncResult &) {callbacks++;};
+  std::vector<std::future<AsyncResult>> results;
+  results.push_back(pipeline.submit(0, image(1), 5, {}, count));
+  waitFor(gate->entered, 1);   // The first frame holds the extraction stage
+  for (uint id=1; id <= kFrames; id++) results.push_back(pipeline.submit(id, image(id + 1), 5, {}, count));
+  EXPECT_GT(pipeline.dropped(), 0u);
+
+  gate->open();
+  pipeline.flush();
+  EXPECT_EQ(pipeline.pending(), 0u);
+  EXPECT_EQ(callbacks.load(), kFrames + 1);
+
+  std::size_t dropped = 0;
+  uint last_done = 0;
+  for (auto &future : results) {
+    const auto result = future.get();
+    if (result.status == AsyncStatus::kDropped) {
+      dropped++;
+      EXPECT_FALSE(result.candidates);
+    } else {
+      ASSERT_EQ(result.status, AsyncStatus::kDone) << result.id;
+      if (result.id > 0) EXPECT_GT(result.id, last_done);   // In order, with one extraction thread
+      last_done = result.id;
+    }
+  }
+  EXPECT_EQ(dropped, pipeline.dropped());
+  EXPECT_EQ(last_done, static_cast<uint>(kFrames));
+  EXPECT_EQ(pipeline.haloc().size(), kFrames + 1 - dropped);
+}
+
+// With kBlock the caller waits for room and every frame is processed
+TEST(AsyncHaloc, BlockKeepsEveryFrame) {
+  constexpr int kFrames = 30;
+  auto gate = std::make_shared<Gate>();
+  AsyncHaloc pipeline(gatedConfig(gate), smallQueues(DropPolicy::kBlock));
+
+  std::atomic<int> submitted{0};
+  std::vector<std::future<AsyncResult>> results(kFrames);
+  std::thread camera([&] {
+    for (int i=0; i < kFrames; i++) {
+      results[i] = pipeline.submit(i, image(i + 1), 5);
+      submitted++;
+    }
+  });
+
+  // The stages and their queues hold fewer frames than submitted
+  waitFor(gate->entered, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_LT(submitted.load(), kFrames);
+
+  gate->open();
+  camera.join();
+  pipeline.flush();
+  EXPECT_EQ(pipeline.dropped(), 0u);
+  for (int i=0; i < kFrames; i++) {
+    const auto result = results[i].get();
+    EXPECT_EQ(result.id, static_cast<uint>(i));
+    ASSERT_EQ(result.status, AsyncStatus::kDone) << i;
+    if (i > 0) {
+      // The frame itself is inserted before the query
+      ASSERT_TRUE(result.candidates) << i;
+      EXPECT_EQ(result.error, Status::kOk);
+    }
+  }
+  EXPECT_EQ(pipeline.haloc().size(), static_cast<std::size_t>(kFrames));
+}
+
+// Destroying the pipeline completes the queued frames, failures included
+TEST(AsyncHaloc, ShutdownCompletesQueuedFrames) {
+  constexpr int kFrames = 10;
+  auto gate = std::make_shared<Gate>();
+  std::atomic<int> callbacks{0};
+  const auto count = [&callbacks](const AsyncResult &) {callbacks++;};
+  std::vector<std::future<AsyncResult>> results;
+  {
+    AsyncHaloc pipeline(gatedConfig(gate), smallQueues(DropPolicy::kBlock));
+    std::thread opener([&gate] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      gate->open();
+    });
+    for (int i=0; i < kFrames; i++) results.push_back(pipeline.submit(i, image(i + 1), 5, {}, count));
+    results.push_back(pipeline.submit(kFrames, image(0), 5, {}, count));      // No descriptors
+    results.push_back(pipeline.submit(kFrames + 1, cv::Mat(), 5, {}, count)); // No image
+    opener.join();
+  }
+  EXPECT_EQ(callbacks.load(), kFrames + 2);
+
+  for (int i=0; i < kFrames; i++) {
+    ASSERT_EQ(results[i].wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    EXPECT_EQ(results[i].get().status, AsyncStatus::kDone) << i;
+  }
+  const auto no_descriptors = results[kFrames].get();
+  EXPECT_EQ(no_descriptors.status, AsyncStatus::kFailed);
+  EXPECT_EQ(no_descriptors.error, Status::kNoDescriptors);
+  const auto no_image = results[kFrames + 1].get();
+  EXPECT_EQ(no_image.status, AsyncStatus::kFailed);
+  EXPECT_EQ(no_image.error, Status::kEmptyImage);
+}
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,214 @@
+/**
+ * @file concurrent_store_test.cc
+ *
+ * @brief Tests of the concurrent hash store: snapshots and concurrent inserts
+ * and queries.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/concurrent_store.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr std::size_t kDim = 128;
+
+// A query close to a hash (the exact matches are discarded by the scan)
+std::vector<float> near(const std::vector<float> &hash) {
+  std::vector<float> out(hash);
+  for (auto &x : out) x += 0.01f;
+  return out;
+}
+
+std::set<uint> idSet(const Result<std::vector<Candidate>> &candidates) {
+  std::set<uint> out;
+  for (const auto &c : *candidates) out.insert(c.id);
+  return out;
+}
+
+}  // namespace
+
+// The erases and replacements made after a snapshot do not change it
+TEST(ConcurrentHashStore, SnapshotIsolation) {
+  const auto hashes = randomHashes(20, kDim, 1);
+  ConcurrentHashStore store(4);
+  for (std::size_t i=0; i < 10; i++) ASSERT_EQ(store.insert(static_cast<uint>(i), hashes[i]), Status::kOk);
+  const uint64_t before = store.snapshot();
+
+  ASSERT_TRUE(store.erase(3));
+  ASSERT_EQ(store.insert(5, hashes[15]), Status::kOk);    // Replacement
+  ASSERT_EQ(store.insert(10, hashes[10]), Status::kOk);   // New image
+  EXPECT_EQ(store.size(), 10u);
+  EXPECT_FALSE(store.contains(3));
+
+  // The old snapshot: image 3, the old hash of image 5, not image 10
+  const auto old_result = store.query(near(hashes[5]), 20, {}, before);
+  ASSERT_TRUE(old_result);
+  EXPECT_EQ(old_result->size(), 10u);
+  EXPECT_EQ(idSet(old_result), std::set<uint>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+  EXPECT_EQ((*old_result)[0].id, 5u);
+
+  // The current one: image 5 once, with its new hash
+  const auto new_result = store.query(near(hashes[15]), 20);
+  ASSERT_TRUE(new_result);
+  EXPECT_EQ(new_result->size(), 10u);
+  EXPECT_EQ(idSet(new_result), std::set<uint>({0, 1, 2, 4, 5, 6, 7, 8, 9, 10}));
+}
+
+// Queries running while an image is inserted and replaced again and again
+// always see it exactly once
+TEST(ConcurrentHashStore, ConcurrentInsertAndQuery) {
+  constexpr std::size_t kImages = 3000;
+  const auto hashes = randomHashes(kImages, kDim, 2);
+  ConcurrentHashStore store(64);
+  ASSERT_EQ(store.insert(0, hashes[0]), Status::kOk);
+
+  const auto query = near(hashes[0]);
+  std::atomic<bool> done{false};
+  std::atomic<std::size_t> failures{0};
+  std::vector<std::thread> readers;
+  for (int t=0; t < 3; t++) {
+    readers.emplace_back([&]() {
+      while (!done.load()) {
+        const auto result = store.query(query, static_cast<int>(kImages));
+        if (!result) {
+          failures++;
+          continue;
+        }
+        std::size_t zeros = 0;
+        std::set<uint> ids;
+        for (const auto &c : *result) {
+          if (!ids.insert(c.id).second) failures++;   // Returned twice
+          if (c.id == 0) zeros++;
+        }
+        if (zeros != 1) failures++;                   // Missing or duplicated
+      }
+    });
+  }
+
+  // No ASSERT before the readers are joined (a return would leave them running)
+  bool ok = true;
+  for (std::size_t i=1; i < kImages && ok; i++) {
+    ok =
+      store.insert(static_cast<uint>(i), hashes[i]) == Status::kOk &&
+      store.insert(0, hashes[i % 2 ? 0 : 1]) == Status::kOk;
+  }
+  done = true;
+  for (auto &reader : readers) reader.join();
+  EXPECT_TRUE(ok);
+  EXPECT_EQ(failures.load(), 0u);
+  EXPECT_EQ(store.size(), kImages);
+}
+
+// Compaction releases the erased and replaced rows and keeps the content
+TEST(ConcurrentHashStore, CompactReleasesDeadRows) {
+  const auto hashes = randomHashes(200, kDim, 3);
+  ConcurrentHashStore store(4);
+  for (uint id=0; id < 100; id++) ASSERT_EQ(store.insert(id, hashes[id]), Status::kOk);
+  for (uint id=0; id < 50; id++) ASSERT_EQ(store.insert(id, hashes[100 + id]), Status::kOk);
+  for (uint id=90; id < 100; id++) ASSERT_TRUE(store.erase(id));
+  EXPECT_EQ(store.size(), 90u);
+  EXPECT_EQ(store.rows(), 150u);
+  EXPECT_EQ(store.deadRows(), 60u);
+
+  const auto query = near(hashes[120]);
+  const auto before = store.query(query, 20);
+  ASSERT_TRUE(before);
+  const std::size_t bytes = store.bytes();
+  store.compact();
+  EXPECT_EQ(store.rows(), 90u);
+  EXPECT_EQ(store.deadRows(), 0u);
+  EXPECT_EQ(store.size(), 90u);
+  EXPECT_LT(store.bytes(), bytes);
+
+  const auto after = store.query(query, 20);
+  ASSERT_TRUE(after);
+  ASSERT_EQ(after->size(), before->size());
+  for (std::size_t i=0; i < after->size(); i++) {
+    EXPECT_EQ((*after)[i].id, (*before)[i].id);
+    EXPECT_EQ((*after)[i].score, (*before)[i].score);
+  }
+
+  // The compacted store is updated as before
+  ASSERT_EQ(store.insert(20, hashes[150]), Status::kOk);
+  ASSERT_TRUE(store.erase(21));
+  EXPECT_FALSE(store.erase(95));
+  EXPECT_EQ(store.size(), 89u);
+  EXPECT_EQ(store.deadRows(), 2u);
+  const auto updated = store.query(near(hashes[150]), 1);
+  ASSERT_TRUE(updated);
+  ASSERT_EQ(updated->size(), 1u);
+  EXPECT_EQ((*updated)[0].id, 20u);
+}
+
+// The rows erased after the oldest snapshot in use are kept
+TEST(ConcurrentHashStore, CompactKeepsOldestSnapshot) {
+  const auto hashes = randomHashes(10, kDim, 4);
+  ConcurrentHashStore store(4);
+  for (uint id=0; id < hashes.size(); id++) ASSERT_EQ(store.insert(id, hashes[id]), Status::kOk);
+  const uint64_t before = store.snapshot();
+  ASSERT_TRUE(store.erase(3));
+
+  store.compact(before);
+  EXPECT_EQ(store.deadRows(), 1u);
+  const auto old_result = store.query(near(hashes[3]), 20, {}, before);
+  ASSERT_TRUE(old_result);
+  EXPECT_EQ(idSet(old_result).count(3), 1u);
+  const auto new_result = store.query(near(hashes[3]), 20);
+  ASSERT_TRUE(new_result);
+  EXPECT_EQ(idSet(new_result).count(3), 0u);
+
+  store.compact();
+  EXPECT_EQ(store.deadRows(), 0u);
+  EXPECT_EQ(store.rows(), 9u);
+}
+
+// Queries running while the store is compacted again and again see every
+// image exactly once
+TEST(ConcurrentHashStore, CompactWhileQuerying) {
+  constexpr std::size_t kImages = 200;
+  const auto hashes = randomHashes(kImages + 1, kDim, 5);
+  ConcurrentHashStore store(16);
+  for (uint id=0; id < kImages; id++) ASSERT_EQ(store.insert(id, hashes[id]), Status::kOk);
+
+  const auto query = near(hashes[kImages]);
+  std::atomic<bool> done{false};
+  std::atomic<std::size_t> failures{0};
+  std::vector<std::thread> readers;
+  for (int t=0; t < 3; t++) {
+    readers.emplace_back([&]() {
+      while (!done.load()) {
+        const auto result = store.query(query, static_cast<int>(2*kImages));
+        if (!result || result->size() != kImages || idSet(result).size() != kImages) failures++;
+      }
+    });
+  }
+
+  bool ok = true;
+  for (std::size_t i=0; i < 2000 && ok; i++) {
+    const uint id = static_cast<uint>(i % kImages);
+    ok = store.insert(id, hashes[(id + i) % kImages]) == Status::kOk;
+    if (i % 100 == 99) store.compact();
+  }
+  done = true;
+  for (auto &reader : readers) reader.join();
+  EXPECT_TRUE(ok);
+  EXPECT_EQ(failures.load(), 0u);
+  EXPECT_EQ(store.size(), kImages);
+  EXPECT_LE(store.deadRows(), 100u);
+}
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,187 @@
+/**
+ * @file database_test.cc
+ *
+ * @brief Tests of the sharded database: the cross-shard merge and the checks
+ * of the attached shards.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/database.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr std::size_t kDim = 256;   // 2 projections of 128 columns
+
+std::shared_ptr<const Hash> testHash(const uint32_t &seed = Hash::kDefaultSeed, const int &desc_dim = 0) {
+  auto hash = std::make_shared<Hash>(2, 100, seed);
+  hash->setDescriptorDim(desc_dim);
+  return hash;
+}
+
+void expectSame(const std::vector<ShardCandidate> &a, const std::vector<ShardCandidate> &b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (std::size_t i=0; i < a.size(); i++) {
+    EXPECT_EQ(a[i].shard, b[i].shard) << i;
+    EXPECT_EQ(a[i].id, b[i].id) << i;
+    EXPECT_EQ(a[i].score, b[i].score) << i;
+  }
+}
+
+}  // namespace
+
+// The candidates of several shards are the global top-K of their exact
+// searches, with or without a thread pool splitting the shards
+TEST(Database, CrossShardMerge) {
+  const std::vector<std::string> names = {"robot_a", "robot_b", "robot_c"};
+  Database single(testHash());
+  Database parallel(testHash(), std::make_shared<ThreadPool>(4), 64);
+  std::map<std::string, std::unique_ptr<HashStore>> reference;
+  for (std::size_t s=0; s < names.size(); s++) {
+    ASSERT_TRUE(single.create(names[s]));
+    ASSERT_TRUE(parallel.create(names[s]));
+    reference[names[s]] = std::make_unique<HashStore>();
+    const auto hashes = randomHashes(300 + 100*s, kDim, static_cast<uint32_t>(s + 1));
+    for (uint id=0; id < hashes.size(); id++) {
+      ASSERT_EQ(single.insert(names[s], id, hashes[id]), Status::kOk);
+      ASSERT_EQ(parallel.insert(names[s], id, hashes[id]), Status::kOk);
+      ASSERT_TRUE(reference[names[s]]->insert(id, hashes[id]));
+    }
+  }
+  EXPECT_EQ(single.size(), 1200u);
+  EXPECT_EQ(single.size("robot_b"), 400u);
+  EXPECT_FALSE(single.create("robot_a"));
+
+  constexpr int kCandidates = 15;
+  IgnoreFilter ignore;
+  ignore.addRange(0, 50);
+  const auto queries = randomHashes(10, kDim, 10);
+  for (const auto &query : queries) {
+    std::vector<ShardCandidate> expected;
+    for (const auto &shard : reference) {
+      for (const auto &c : search(*shard.second, query, kCandidates, ScanParams(), ignore)) {
+        expected.push_back({shard.first, c.id, c.score});
+      }
+    }
+    std::sort(expected.begin(), expected.end(), [](const ShardCandidate &a, const ShardCandidate &b) {
+      if (a.score != b.score) return a.score < b.score;
+      if (a.shard != b.shard) return a.shard < b.shard;
+      return a.id < b.id;
+    });
+    expected.resize(kCandidates);
+
+    const auto candidates = single.query(query, kCandidates, {}, ignore);
+    ASSERT_TRUE(candidates);
+    expectSame(*candidates, expected);
+    const auto split = parallel.query(query, kCandidates, {}, ignore);
+    ASSERT_TRUE(split);
+    expectSame(*split, expected);
+    for (const auto &c : *candidates) EXPECT_GE(c.id, 50u);
+  }
+
+  // A selection of the shards
+  const auto selected = single.query(queries[0], 1000, {"robot_c", "robot_a", "robot_c"});
+  ASSERT_TRUE(selected);
+  EXPECT_EQ(selected->size(), 800u);
+  for (const auto &c : *selected) EXPECT_NE(c.shard, "robot_b");
+}
+
+// Equal scores are sorted by shard name and then by id
+TEST(Database, TieOrder) {
+  Database database(testHash());
+  const auto hashes = randomHashes(2, kDim, 20);
+  for (const std::string name : {"b", "a", "c"}) {
+    ASSERT_TRUE(database.create(name));
+    for (const uint id : {9u, 4u}) ASSERT_EQ(database.insert(name, id, hashes[0]), Status::kOk);
+    ASSERT_EQ(database.insert(name, 100, hashes[1]), Status::kOk);
+  }
+
+  std::vector<float> query(hashes[0]);
+  for (auto &x : query) x += 0.01f;
+  const auto candidates = database.query(query, 6);
+  ASSERT_TRUE(candidates);
+  ASSERT_EQ(candidates->size(), 6u);
+  const std::vector<std::pair<std::string, uint>> expected = {
+    {"a", 4}, {"a", 9}, {"b", 4}, {"b", 9}, {"c", 4}, {"c", 9}};
+  for (std::size_t i=0; i < expected.size(); i++) {
+    EXPECT_EQ((*candidates)[i].shard, expected[i].first) << i;
+    EXPECT_EQ((*candidates)[i].id, expected[i].second) << i;
+    EXPECT_EQ((*candidates)[i].score, (*candidates)[0].score) << i;
+  }
+}
+
+TEST(Database, QueryErrors) {
+  Database database(testHash());
+  ASSERT_TRUE(database.create("a"));
+  ASSERT_TRUE(database.create("empty"));
+  ASSERT_EQ(database.insert("a", 0, randomHashes(1, kDim, 30)[0]), Status::kOk);
+  EXPECT_EQ(database.insert("missing", 0, randomHashes(1, kDim, 30)[0]), Status::kUnknownShard);
+  EXPECT_EQ(database.insert("a", 1, randomHashes(1, kDim + 128, 31)[0]), Status::kSizeMismatch);
+
+  const auto query = randomHashes(1, kDim, 32)[0];
+  EXPECT_EQ(database.query(query, 5, {"missing"}).status(), Status::kUnknownShard);
+  EXPECT_EQ(database.query(randomHashes(1, kDim + 128, 33)[0], 5).status(), Status::kSizeMismatch);
+  EXPECT_EQ(database.query({}, 5).status(), Status::kSizeMismatch);
+  const auto empty = database.query(query, 5, {"empty"});
+  ASSERT_TRUE(empty);
+  EXPECT_TRUE(empty->empty());
+
+  EXPECT_TRUE(database.erase("a", 0));
+  EXPECT_FALSE(database.erase("a", 0));
+  EXPECT_TRUE(database.detach("a"));
+  EXPECT_FALSE(database.detach("a"));
+  EXPECT_EQ(database.shards(), std::vector<std::string>({"empty"}));
+}
+
+// A shard is only attached to a database with the same projection basis and
+// descriptor width
+TEST(Database, AttachChecksTheBasis) {
+  const auto hashes = randomHashes(100, kDim, 40);
+  Database source(testHash(1));
+  ASSERT_TRUE(source.create("session"));
+  for (uint id=0; id < hashes.size(); id++) ASSERT_EQ(source.insert("session", id, hashes[id]), Status::kOk);
+  const std::string file = tempFile("shard.bin");
+  ASSERT_TRUE(source.save("session", file));
+  EXPECT_FALSE(source.save("missing", file));
+
+  std::mt19937 rng(41);
+  for (const bool use_mmap : {false, true}) {
+    Database same(testHash(1));
+    ASSERT_TRUE(same.attach("old_session", file, use_mmap));
+    EXPECT_EQ(same.size("old_session"), hashes.size());
+    EXPECT_FALSE(same.attach("old_session", file, use_mmap));
+    const auto candidates = same.query(perturb(hashes[7], 0.05f, rng), 1);
+    ASSERT_TRUE(candidates);
+    ASSERT_EQ(candidates->size(), 1u);
+    EXPECT_EQ((*candidates)[0].id, 7u);
+  }
+
+  Database other_seed(testHash(2));
+  EXPECT_FALSE(other_seed.attach("old_session", file));
+  EXPECT_FALSE(other_seed.contains("old_session"));
+  Database other_width(testHash(1, 64));
+  EXPECT_FALSE(other_width.attach("old_session", file));
+  Database same_width(testHash(1, 128));
+  EXPECT_TRUE(same_width.attach("old_session", file));
+  EXPECT_FALSE(Database(testHash(1)).attach("missing", tempFile("missing.bin")));
+  std::remove(file.c_str());
+}
+
+}  // namespace test
+}  // namespace haloc
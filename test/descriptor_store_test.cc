@@ -0,0 +1,87 @@
+/**
+ * @file descriptor_store_test.cc
+ *
+ * @brief Tests of the side store of the descriptors.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/descriptor_store.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+// SIFT-like descriptors: integers in [0, 255]
+cv::Mat siftDescriptors(const int &rows, const uint64_t &seed) {
+  cv::Mat desc(rows, 128, CV_32F);
+  cv::RNG rng(seed);
+  for (int r=0; r < rows; r++) {
+    for (int c=0; c < desc.cols; c++) desc.at<float>(r, c) = static_cast<float>(rng.uniform(0, 256));
+  }
+  return desc;
+}
+
+double maxError(const cv::Mat &a, const cv::Mat &b) {
+  return cv::norm(a, b, cv::NORM_INF);
+}
+
+}  // namespace
+
+class DescriptorStoreEncodings : public ::testing::TestWithParam<DescriptorPrecision> {};
+
+TEST_P(DescriptorStoreEncodings, InsertGetErase) {
+  DescriptorStore store(GetParam());
+  const cv::Mat a = siftDescriptors(50, 1);
+  const cv::Mat b = siftDescriptors(20, 2);
+  std::vector<cv::KeyPoint> kps_a(a.rows);
+  for (int r=0; r < a.rows; r++) kps_a[r] = cv::KeyPoint(r, 2.0f*r, 1.0f, -1.0f, static_cast<float>(r));
+  ASSERT_TRUE(store.insert(1, a, kps_a));
+  ASSERT_TRUE(store.insert(2, b, {}));
+  EXPECT_EQ(store.size(), 2u);
+  EXPECT_EQ(store.cols(), 128);
+
+  // SIFT is lossless in every encoding (float16 holds the integers up to 2048)
+  cv::Mat desc;
+  std::vector<cv::KeyPoint> kps;
+  ASSERT_TRUE(store.get(1, desc, kps));
+  EXPECT_EQ(desc.type(), CV_32F);
+  EXPECT_EQ(maxError(desc, a), 0.0);
+  ASSERT_EQ(kps.size(), kps_a.size());
+  EXPECT_EQ(kps[10].pt, kps_a[10].pt);
+  EXPECT_EQ(kps[10].response, kps_a[10].response);
+  ASSERT_TRUE(store.get(2, desc, kps));
+  EXPECT_EQ(maxError(desc, b), 0.0);
+  EXPECT_TRUE(kps.empty());
+
+  // Another length is rejected, an erased image is gone
+  EXPECT_FALSE(store.insert(3, cv::Mat::ones(5, 64, CV_32F), {}));
+  EXPECT_FALSE(store.insert(3, cv::Mat(), {}));
+  EXPECT_TRUE(store.erase(1));
+  EXPECT_FALSE(store.erase(1));
+  EXPECT_FALSE(store.get(1, desc, kps));
+  EXPECT_EQ(store.size(), 1u);
+}
+
+INSTANTIATE_TEST_CASE_P(Encodings, DescriptorStoreEncodings,
+                        ::testing::Values(DescriptorPrecision::kFloat32, DescriptorPrecision::kFloat16,
+                                          DescriptorPrecision::kUInt8));
+
+TEST(DescriptorStore, CompactEncodingsUseLessMemory) {
+  DescriptorStore exact(DescriptorPrecision::kFloat32);
+  DescriptorStore half(DescriptorPrecision::kFloat16);
+  DescriptorStore bytes(DescriptorPrecision::kUInt8);
+  const cv::Mat desc = siftDescriptors(100, 3);
+  for (auto *store : {&exact, &half, &bytes}) ASSERT_TRUE(store->insert(0, desc, {}));
+  EXPECT_LT(half.bytes(), exact.bytes());
+  EXPECT_LT(bytes.bytes(), half.bytes());
+}
+
+}  // namespace test
+}  // namespace haloc
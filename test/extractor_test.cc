@@ -0,0 +1,144 @@
+/**
+ * @file extractor_test.cc
+ *
+ * @brief Tests of the descriptor extractors: unpacking of the binary
+ * descriptors and the AKAZE keypoint limit.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "libhaloc/extractor.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+cv::Mat randomBinary(const int &rows, const int &cols, const uint32_t &seed) {
+  cv::Mat binary(rows, cols, CV_8U);
+  cv::RNG rng(seed);
+  rng.fill(binary, cv::RNG::UNIFORM, 0, 256);
+  return binary;
+}
+
+// An image with many corners
+cv::Mat texturedImage() {
+  cv::Mat image(480, 640, CV_8U, cv::Scalar(0));
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<int> x(0, image.cols - 1), y(0, image.rows - 1), v(0, 255);
+  for (int i=0; i < 400; i++) {
+    const cv::Point p(x(rng), y(rng));
+    cv::rectangle(image, p, p + cv::Point(15, 15), cv::Scalar(v(rng)), cv::FILLED);
+  }
+  return image;
+}
+
+}  // namespace
+
+TEST(Extractor, UnpackFullBytes) {
+  const cv::Mat binary = randomBinary(5, 32, 1);
+  cv::Mat desc;
+  unpackBinaryDescriptors(binary, desc, -1.0, 1.0);
+  ASSERT_EQ(desc.cols, 256);
+  ASSERT_EQ(desc.rows, 5);
+  for (int r=0; r < binary.rows; r++) {
+    for (int c=0; c < 256; c++) {
+      const bool bit = (binary.at<uchar>(r, c/8) >> (7 - c%8)) & 1;
+      EXPECT_EQ(desc.at<float>(r, c), bit ? 1.0f : -1.0f);
+    }
+  }
+
+  // All the bits is the same as no limit
+  cv::Mat same;
+  unpackBinaryDescriptors(binary, same, -1.0, 1.0, 256);
+  EXPECT_EQ(cv::countNonZero(same != desc), 0);
+}
+
+TEST(Extractor, UnpackDropsPaddingBits) {
+  cv::Mat binary = randomBinary(4, 61, 2);
+  cv::Mat full, desc;
+  unpackBinaryDescriptors(binary, full, -1.0, 1.0);
+  unpackBinaryDescriptors(binary, desc, -1.0, 1.0, AkazeExtractor::kDescriptorBits);
+  ASSERT_EQ(desc.cols, 486);
+  ASSERT_EQ(descriptorDim(DescriptorType::kAkaze), 486);
+
+  // The full bytes are unchanged, the last one keeps its 6 low bits
+  EXPECT_EQ(cv::countNonZero(desc.colRange(0, 480) != full.colRange(0, 480)), 0);
+  EXPECT_EQ(cv::countNonZero(desc.colRange(480, 486) != full.colRange(482, 488)), 0);
+
+  // The padding bits do not change the descriptors
+  cv::Mat padded = binary.clone();
+  cv::Mat last = padded.col(60);
+  cv::bitwise_xor(last, cv::Scalar(0xC0), last);
+  cv::Mat desc_padded;
+  unpackBinaryDescriptors(padded, desc_padded, -1.0, 1.0, AkazeExtractor::kDescriptorBits);
+  EXPECT_EQ(cv::countNonZero(desc_padded != desc), 0);
+}
+
+TEST(Extractor, PrecomputedBinaryBits) {
+  PrecomputedExtractor extractor;
+  extractor.setBinary(randomBinary(10, 61, 4), {}, AkazeExtractor::kDescriptorBits);
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat desc;
+  extractor.compute(cv::Mat(), kps, desc);
+  EXPECT_EQ(desc.cols, 486);
+  EXPECT_EQ(desc.rows, 10);
+}
+
+// A ROI outside the image gives no descriptors, reported by the caller
+// instead of logged on every frame
+TEST(Extractor, ScaledRoiOutsideTheImage) {
+  auto precomputed = std::make_shared<PrecomputedExtractor>();
+  precomputed->set(cv::Mat(10, 128, CV_32F, cv::Scalar(1.0f)));
+  const cv::Mat image(480, 640, CV_8U, cv::Scalar(0));
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat desc;
+
+  ExtractionParams params;
+  params.roi = cv::Rect(700, 0, 100, 100);
+  ScaledExtractor outside(precomputed, params);
+  outside.compute(image, kps, desc);
+  EXPECT_TRUE(desc.empty());
+  EXPECT_TRUE(kps.empty());
+
+  params.roi = cv::Rect(600, 400, 100, 100);
+  ScaledExtractor inside(precomputed, params);
+  inside.compute(image, kps, desc);
+  EXPECT_EQ(desc.rows, 10);
+}
+
+TEST(Extractor, AkazeKeepsMaxDesc) {
+  const cv::Mat image = texturedImage();
+  constexpr int kMaxDesc = 50;
+  AkazeExtractor extractor(kMaxDesc);
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat desc;
+  extractor.compute(image, kps, desc);
+  ASSERT_FALSE(desc.empty());
+  EXPECT_LE(desc.rows, kMaxDesc);
+  EXPECT_EQ(desc.rows, static_cast<int>(kps.size()));
+  EXPECT_EQ(desc.cols, 486);
+  EXPECT_EQ(desc.type(), CV_32F);
+
+  // The strongest keypoints of the detector
+  std::vector<cv::KeyPoint> all;
+  cv::AKAZE::create()->detect(image, all);
+  ASSERT_GT(all.size(), static_cast<std::size_t>(kMaxDesc));
+  float weakest = kps[0].response;
+  for (const auto &kp : kps) weakest = std::min(weakest, kp.response);
+  int stronger = 0;
+  for (const auto &kp : all) stronger += kp.response > weakest;
+  EXPECT_LE(stronger, kMaxDesc);
+}
+
+}  // namespace test
+}  // namespace haloc
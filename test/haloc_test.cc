@@ -0,0 +1,393 @@
+/**
+ * @file haloc_test.cc
+ *
+ * @brief Tests of Haloc over synthetic hashes.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/haloc.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr std::size_t kDim = 256;
+
+/**
+ * @brief      Haloc with its hash-level API exposed, so the tests do not need
+ *             images. The descriptors are given with a PrecomputedExtractor.
+ */
+class TestHaloc : public Haloc {
+ public:
+  explicit TestHaloc(Config config) : Haloc(withExtractor(config)) {}
+
+  using Haloc::eraseHash;
+  using Haloc::getBestCandidates;
+  using Haloc::insertHash;
+  using Haloc::touchCandidates;
+
+ private:
+  static Config withExtractor(Config config) {
+    if (!config.extractor) config.extractor = std::make_shared<PrecomputedExtractor>();
+    return config;
+  }
+};
+
+Config hashConfig(const uint32_t &seed = Hash::kDefaultSeed) {
+  Config config;
+  config.num_proj = 2;
+  config.max_desc = 100;
+  config.seed = seed;
+  return config;
+}
+
+// Random SIFT-like descriptors
+cv::Mat randomDescriptors(const int &rows, const uint64_t &seed) {
+  cv::Mat desc(rows, 128, CV_32F);
+  cv::RNG rng(seed);
+  rng.fill(desc, cv::RNG::UNIFORM, 0.0f, 256.0f);
+  return desc;
+}
+
+void fill(TestHaloc &haloc, const std::vector<std::vector<float>> &hashes) {
+  for (std::size_t i=0; i < hashes.size(); i++) {
+    ASSERT_EQ(haloc.insertHash(static_cast<uint>(i), hashes[i]), Status::kOk);
+  }
+}
+
+}  // namespace
+
+// A database is only loaded by a detector with the same projection basis, and
+// a rejected file does not replace the current database
+TEST(Haloc, LoadChecksTheBasis) {
+  const auto hashes = randomHashes(100, kDim, 1);
+  TestHaloc source(hashConfig(1));
+  fill(source, hashes);
+  const std::string file = tempFile("haloc.bin");
+  ASSERT_TRUE(source.save(file));
+
+  TestHaloc same(hashConfig(1));
+  ASSERT_TRUE(same.load(file));
+  EXPECT_EQ(same.size(), hashes.size());
+
+  TestHaloc other(hashConfig(2));
+  fill(other, randomHashes(10, kDim, 2));
+  EXPECT_FALSE(other.load(file));
+  EXPECT_EQ(other.size(), 10u);
+  EXPECT_FALSE(other.getBestCandidates(hashes[0], 5).empty());
+  std::remove(file.c_str());
+}
+
+// A detector without a descriptor width (custom extractor, desc_dim = 0)
+// loads the databases of an identical detector and adopts their width
+TEST(Haloc, LoadAdoptsTheDescriptorWidth) {
+  Config config = hashConfig();
+  config.extractor = std::make_shared<PrecomputedExtractor>();
+  TestHaloc source(config);
+  std::vector<cv::Mat> descs;
+  for (int i=0; i < 20; i++) {
+    descs.push_back(randomDescriptors(30, i + 1));
+    ASSERT_EQ(source.insertDescriptors(i, descs.back()), Status::kOk);
+  }
+  const std::string file = tempFile("haloc_any_width.bin");
+  ASSERT_TRUE(source.save(file));
+
+  Config same_config = hashConfig();
+  same_config.extractor = std::make_shared<PrecomputedExtractor>();
+  TestHaloc same(same_config);
+  ASSERT_TRUE(same.load(file));
+  EXPECT_EQ(same.size(), descs.size());
+  const auto candidates = same.queryDescriptors(descs[3], 5);
+  ASSERT_TRUE(candidates);
+  const auto expected = source.queryDescriptors(descs[3], 5);
+  ASSERT_TRUE(expected);
+  EXPECT_EQ(ids(*candidates), ids(*expected));
+  EXPECT_EQ(same.insertDescriptors(100, cv::Mat(30, 64, CV_32F, cv::Scalar(1.0f))), Status::kSizeMismatch);
+
+  // A loaded database of another width is still rejected
+  Config wide_config = hashConfig();
+  wide_config.extractor = std::make_shared<PrecomputedExtractor>();
+  wide_config.desc_dim = 256;
+  TestHaloc wide(wide_config);
+  EXPECT_FALSE(wide.load(file));
+  std::remove(file.c_str());
+}
+
+// A full database evicts the oldest image (sliding window)
+TEST(Haloc, RetentionOldest) {
+  Config config = hashConfig();
+  config.max_entries = 5;
+  TestHaloc haloc(config);
+  const auto hashes = randomHashes(8, kDim, 3);
+  fill(haloc, hashes);
+  EXPECT_EQ(haloc.size(), 5u);
+  const auto candidates = haloc.getBestCandidates(hashes[7], 10);
+  std::vector<uint> found = ids(candidates);
+  std::sort(found.begin(), found.end());
+  EXPECT_EQ(found, std::vector<uint>({3, 4, 5, 6}));   // 7 is the query (distance 0)
+}
+
+// A full database evicts the image matched (or inserted) the longest ago
+TEST(Haloc, RetentionLeastRecentlyMatched) {
+  Config config = hashConfig();
+  config.max_entries = 3;
+  config.retention = RetentionPolicy::kLeastRecentlyMatched;
+  TestHaloc haloc(config);
+  const auto hashes = randomHashes(4, kDim, 4);
+  for (uint id=0; id < 3; id++) ASSERT_EQ(haloc.insertHash(id, hashes[id]), Status::kOk);
+
+  // Image 0 is matched, so image 1 is the one used the longest ago
+  const Candidate matched{0, 1.0f};
+  haloc.touchCandidates(&matched, 1);
+  ASSERT_EQ(haloc.insertHash(3, hashes[3]), Status::kOk);
+  EXPECT_EQ(haloc.size(), 3u);
+  EXPECT_FALSE(haloc.erase(1));
+  EXPECT_TRUE(haloc.erase(0));
+}
+
+// The decimation callback erases the images it returns, and the automatic
+// compactions keep the candidates
+TEST(Haloc, DecimateAndCompact) {
+  Config config = hashConfig();
+  config.compact_interval = 4;
+  config.decimate = [](const uint &id) {
+    return id % 2 == 1 ? std::vector<uint>({id - 1}) : std::vector<uint>();
+  };
+  TestHaloc haloc(config);
+  const auto hashes = randomHashes(40, kDim, 5);
+  fill(haloc, hashes);
+  EXPECT_EQ(haloc.size(), 20u);
+
+  std::mt19937 rng(6);
+  for (uint id=1; id < hashes.size(); id += 2) {
+    const auto candidates = haloc.getBestCandidates(perturb(hashes[id], 0.05f, rng), 20);
+    ASSERT_EQ(candidates.size(), 20u);
+    EXPECT_EQ(candidates[0].id, id);
+    for (const auto &c : candidates) EXPECT_EQ(c.id % 2, 1u);
+  }
+  haloc.compact();
+  EXPECT_EQ(haloc.size(), 20u);
+}
+
+// Rehashing the kept descriptors with another basis gives the database built
+// with that basis from the start
+TEST(Haloc, RebuildEqualsNewDatabase) {
+  constexpr int kImages = 50;
+  Config config = hashConfig();
+  config.keep_descriptors = true;
+  config.descriptor_precision = DescriptorPrecision::kFloat16;
+  TestHaloc haloc(config);
+  std::vector<cv::Mat> descs;
+  for (int i=0; i < kImages; i++) {
+    // Integer values, so the float16 descriptors are exact
+    cv::Mat desc = randomDescriptors(20 + i, i + 1);
+    desc.convertTo(desc, CV_8U);
+    desc.convertTo(desc, CV_32F);
+    descs.push_back(desc);
+    ASSERT_EQ(haloc.insertDescriptors(i, desc), Status::kOk);
+  }
+  ASSERT_EQ(haloc.rebuild(3, 80, 9), Status::kOk);
+
+  Config fresh_config = hashConfig(9);
+  fresh_config.num_proj = 3;
+  fresh_config.max_desc = 80;
+  TestHaloc fresh(fresh_config);
+  for (int i=0; i < kImages; i++) ASSERT_EQ(fresh.insertDescriptors(i, descs[i]), Status::kOk);
+
+  for (int q=0; q < kImages; q += 7) {
+    const auto rebuilt = haloc.queryDescriptors(descs[q], 10);
+    const auto expected = fresh.queryDescriptors(descs[q], 10);
+    ASSERT_TRUE(rebuilt);
+    ASSERT_TRUE(expected);
+    ASSERT_EQ(rebuilt->size(), expected->size());
+    for (size_t i=0; i < rebuilt->size(); i++) {
+      EXPECT_EQ((*rebuilt)[i].id, (*expected)[i].id);
+      EXPECT_EQ((*rebuilt)[i].score, (*expected)[i].score);
+    }
+  }
+
+  // An image inserted from its hash cannot be rehashed: the database is kept
+  ASSERT_EQ(haloc.insertHash(100, std::vector<float>(3*128, 0.5f)), Status::kOk);
+  EXPECT_EQ(haloc.rebuild(2, 100), Status::kMissingDescriptors);
+  EXPECT_EQ(haloc.size(), static_cast<size_t>(kImages) + 1);
+  EXPECT_TRUE(haloc.queryDescriptors(descs[0], 10));
+}
+
+// Invalid parameters are rejected before the database is modified
+TEST(Haloc, RebuildRejectsInvalidParameters) {
+  Config config = hashConfig();
+  config.keep_descriptors = true;
+  TestHaloc haloc(config);
+  std::vector<cv::Mat> descs;
+  for (int i=0; i < 10; i++) {
+    descs.push_back(randomDescriptors(20, i + 1));
+    ASSERT_EQ(haloc.insertDescriptors(i, descs.back()), Status::kOk);
+  }
+  const auto before = haloc.queryDescriptors(descs[0], 5);
+  ASSERT_TRUE(before);
+  EXPECT_EQ(haloc.rebuild(0, 100), Status::kInvalidArgument);
+  EXPECT_EQ(haloc.rebuild(2, 0), Status::kInvalidArgument);
+  EXPECT_EQ(haloc.rebuild(-1, -1), Status::kInvalidArgument);
+  EXPECT_EQ(haloc.size(), descs.size());
+  const auto after = haloc.queryDescriptors(descs[0], 5);
+  ASSERT_TRUE(after);
+  ASSERT_EQ(after->size(), before->size());
+  for (size_t i=0; i < after->size(); i++) {
+    EXPECT_EQ((*after)[i].id, (*before)[i].id);
+    EXPECT_EQ((*after)[i].score, (*before)[i].score);
+  }
+}
+
+// With a sliding window of ignored images, the detector with the temporal
+// cache returns the candidates of the one without it
+TEST(Haloc, TemporalCacheSlidingWindow) {
+  const auto hashes = randomHashes(300, kDim, 15);
+  TestHaloc uncached(hashConfig());
+  Config cached_config = hashConfig();
+  cached_config.temporal.enabled = true;
+  cached_config.temporal.epsilon = 0.5f;
+  TestHaloc cached(cached_config);
+  fill(uncached, hashes);
+  fill(cached, hashes);
+
+  std::mt19937 rng(16);
+  const auto place = perturb(hashes[120], 0.05f, rng);
+  for (uint frame=0; frame < 60; frame++) {
+    const auto hash = perturb(place, 0.001f, rng);
+    IgnoreFilter ignore;
+    ignore.addRange(frame + 100, frame + 200);
+    const auto expected = uncached.getBestCandidates(hash, 5, ignore);
+    const auto candidates = cached.getBestCandidates(hash, 5, ignore);
+    EXPECT_EQ(ids(candidates), ids(expected)) << frame;
+  }
+  EXPECT_GT(cached.temporalCache().hits(), 0u);
+}
+
+// The sign-bit hashes, re-ranked with the float distance, find the nearest
+// neighbors of the float scan
+TEST(Haloc, BinaryRecallAgainstFloat) {
+  constexpr std::size_t kImages = 3000;
+  constexpr std::size_t kQueries = 50;
+  constexpr int kCandidates = 5;
+  const auto hashes = randomHashes(kImages, kDim, 11);
+  TestHaloc exact(hashConfig());
+  Config binary_config = hashConfig();
+  binary_config.use_binary = true;
+  binary_config.binary_rerank = 8;
+  TestHaloc binary(binary_config);
+  fill(exact, hashes);
+  fill(binary, hashes);
+
+  std::mt19937 rng(12);
+  std::vector<std::vector<Candidate>> reference, results;
+  for (std::size_t q=0; q < kQueries; q++) {
+    const auto query = perturb(hashes[q*61 % kImages], 0.1f, rng);
+    reference.push_back(exact.getBestCandidates(query, kCandidates));
+    results.push_back(binary.getBestCandidates(query, kCandidates));
+    ASSERT_FALSE(results.back().empty());
+    EXPECT_EQ(results.back()[0].id, reference.back()[0].id);
+  }
+  EXPECT_GE(recall(reference, results), 0.8);
+}
+
+// The graph finds the nearest neighbors of the exact scan. When the ignored
+// images leave it fewer than K candidates, the exact scan answers the query
+TEST(Haloc, AnnFallsBackToTheExactScan) {
+  constexpr std::size_t kImages = 2000;
+  constexpr int kCandidates = 5;
+  const auto hashes = randomHashes(kImages, kDim, 17);
+  TestHaloc exact(hashConfig());
+  Config ann_config = hashConfig();
+  ann_config.use_ann = true;
+  ann_config.ann_min_size = 100;
+  TestHaloc ann(ann_config);
+  fill(exact, hashes);
+  fill(ann, hashes);
+
+  std::mt19937 rng(18);
+  std::vector<std::vector<Candidate>> reference, results;
+  for (std::size_t q=0; q < 50; q++) {
+    const auto query = perturb(hashes[q*41 % kImages], 0.1f, rng);
+    reference.push_back(exact.getBestCandidates(query, kCandidates));
+    results.push_back(ann.getBestCandidates(query, kCandidates));
+  }
+  EXPECT_GE(recall(reference, results), 0.9);
+
+  // Only the last images are visible: far from the query in the graph
+  IgnoreFilter ignore;
+  ignore.addRange(0, kImages - 10);
+  for (const uint q : {10u, 500u, 1500u}) {
+    const auto query = perturb(hashes[q], 0.05f, rng);
+    const auto expected = exact.getBestCandidates(query, kCandidates, ignore);
+    ASSERT_EQ(expected.size(), static_cast<std::size_t>(kCandidates));
+    const auto candidates = ann.getBestCandidates(query, kCandidates, ignore);
+    EXPECT_EQ(ids(candidates), ids(expected)) << q;
+  }
+}
+
+// A hash of another size is rejected before anything is stored, with or
+// without the float hashes
+TEST(Haloc, BinaryRejectsOtherSizes) {
+  for (const size_t rerank : {size_t(0), size_t(4)}) {
+    Config config = hashConfig();
+    config.use_binary = true;
+    config.binary_rerank = rerank;
+    TestHaloc haloc(config);
+    const auto hashes = randomHashes(10, kDim, 13);
+    fill(haloc, hashes);
+    EXPECT_EQ(haloc.insertHash(100, randomHashes(1, kDim + 128, 14)[0]), Status::kSizeMismatch);
+    EXPECT_EQ(haloc.size(), hashes.size());
+
+    // The erased images leave both stores
+    EXPECT_FALSE(haloc.eraseHash(100));
+    ASSERT_TRUE(haloc.eraseHash(3));
+    EXPECT_EQ(haloc.size(), hashes.size() - 1);
+    for (const auto &c : haloc.getBestCandidates(hashes[3], 10)) EXPECT_NE(c.id, 3u);
+  }
+}
+
+// The stats of an asynchronous call hold the extraction of the caller thread
+// and the scan of the pool thread
+TEST(Haloc, AsyncCallStats) {
+  if (!Stats::kEnabled) return;   // Built without HALOC_ENABLE_STATS
+  auto extractor = std::make_shared<PrecomputedExtractor>();
+  std::mutex mutex;
+  std::vector<CallStats> calls;
+  Config config = hashConfig();
+  config.extractor = extractor;
+  config.thread_pool = std::make_shared<ThreadPool>(2);
+  config.stats_callback = [&](const CallStats &call) {
+    std::lock_guard<std::mutex> lock(mutex);
+    calls.push_back(call);
+  };
+  TestHaloc haloc(config);
+  fill(haloc, randomHashes(500, kDim, 19));
+
+  for (const int num_kps : {60, 80}) {
+    extractor->set(randomDescriptors(num_kps, num_kps), std::vector<cv::KeyPoint>(num_kps));
+    ASSERT_TRUE(haloc.processAsync(1000 + num_kps, cv::Mat(), 5).get());
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_FALSE(calls.empty());
+    const CallStats &call = calls.back();
+    EXPECT_EQ(call.keypoints, static_cast<std::size_t>(num_kps));
+    EXPECT_GT(call.ns[static_cast<std::size_t>(Stage::kProjection)], 0u);
+    EXPECT_GT(call.ns[static_cast<std::size_t>(Stage::kScan)], 0u);
+    EXPECT_EQ(call.entries, haloc.size());
+  }
+}
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,287 @@
+/**
+ * @file hash_store_test.cc
+ *
+ * @brief Tests of the hash store: persistence, erase / compaction and the
+ * compact encodings.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/hash_store.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr std::size_t kDim = 200;
+
+void fill(HashStore &store, const std::vector<std::vector<float>> &hashes) {
+  for (std::size_t i=0; i < hashes.size(); i++) ASSERT_TRUE(store.insert(static_cast<uint>(i), hashes[i]));
+}
+
+// Same ids and rows, in the same order
+void expectSameRows(const HashStore &a, const HashStore &b) {
+  ASSERT_EQ(a.size(), b.size());
+  ASSERT_EQ(a.dim(), b.dim());
+  ASSERT_EQ(a.encoding(), b.encoding());
+  std::vector<float> row_a(a.stride()), row_b(b.stride());
+  for (std::size_t r=0; r < a.size(); r++) {
+    ASSERT_EQ(a.id(r), b.id(r));
+    a.decode(r, row_a.data());
+    b.decode(r, row_b.data());
+    ASSERT_EQ(row_a, row_b) << "row " << r;
+  }
+}
+
+HashStoreInfo testInfo() {
+  HashStoreInfo info;
+  info.num_proj = 2;
+  info.max_desc = 100;
+  info.desc_dim = 128;
+  info.seed = 7;
+  info.basis_hash = 0x1234;
+  return info;
+}
+
+}  // namespace
+
+class HashStoreRoundTrip : public ::testing::TestWithParam<HashPrecision> {};
+
+TEST_P(HashStoreRoundTrip, SaveLoadAndMap) {
+  HashStore store(GetParam(), 64);
+  fill(store, randomHashes(500, kDim, 1));
+  const HashStoreInfo info = testInfo();
+  const std::string file = tempFile("store.bin");
+  ASSERT_TRUE(store.save(file, info));
+
+  for (const bool use_mmap : {false, true}) {
+    HashStore loaded;
+    HashStoreInfo loaded_info;
+    ASSERT_TRUE(loaded.load(file, loaded_info, use_mmap));
+    EXPECT_EQ(loaded.isMapped(), use_mmap);
+    EXPECT_EQ(loaded_info.num_proj, info.num_proj);
+    EXPECT_EQ(loaded_info.max_desc, info.max_desc);
+    EXPECT_EQ(loaded_info.desc_dim, info.desc_dim);
+    EXPECT_EQ(loaded_info.seed, info.seed);
+    EXPECT_EQ(loaded_info.basis_hash, info.basis_hash);
+    expectSameRows(store, loaded);
+
+    // A mapped store is copied on the first write
+    const auto extra = randomHashes(1, kDim, 2)[0];
+    ASSERT_TRUE(loaded.insert(1000, extra));
+    EXPECT_FALSE(loaded.isMapped());
+    EXPECT_TRUE(loaded.contains(1000));
+    EXPECT_EQ(loaded.size(), store.size() + 1);
+  }
+  std::remove(file.c_str());
+}
+
+INSTANTIATE_TEST_CASE_P(Encodings, HashStoreRoundTrip,
+                        ::testing::Values(HashPrecision::kFloat32, HashPrecision::kFloat16, HashPrecision::kInt8));
+
+TEST(HashStore, ReadInfo) {
+  HashStore store;
+  fill(store, randomHashes(10, kDim, 3));
+  const std::string file = tempFile("info.bin");
+  ASSERT_TRUE(store.save(file, testInfo()));
+
+  HashStoreInfo info;
+  ASSERT_TRUE(HashStore::readInfo(file, info));
+  EXPECT_EQ(info.num_proj, testInfo().num_proj);
+  EXPECT_EQ(info.desc_dim, testInfo().desc_dim);
+  EXPECT_EQ(info.basis_hash, testInfo().basis_hash);
+  EXPECT_FALSE(HashStore::readInfo(tempFile("missing.bin"), info));
+  std::remove(file.c_str());
+}
+
+TEST(HashStore, FailedLoadKeepsContent) {
+  HashStore store;
+  fill(store, randomHashes(50, kDim, 4));
+  HashStore reference;
+  fill(reference, randomHashes(50, kDim, 4));
+
+  // Not a store
+  const std::string garbage = tempFile("garbage.bin");
+  std::ofstream(garbage) << "not a hash store";
+  HashStoreInfo info;
+  EXPECT_FALSE(store.load(garbage, info));
+  expectSameRows(reference, store);
+
+  // Truncated rows
+  HashStore other;
+  fill(other, randomHashes(100, kDim, 5));
+  const std::string truncated = tempFile("truncated.bin");
+  ASSERT_TRUE(other.save(truncated, testInfo()));
+  {
+    std::ifstream in(truncated, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream(truncated, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size()/2);
+  }
+  EXPECT_FALSE(store.load(truncated, info, false));
+  expectSameRows(reference, store);
+
+  std::remove(garbage.c_str());
+  std::remove(truncated.c_str());
+}
+
+TEST(HashStore, SaveOverMappedFile) {
+  HashStore store;
+  fill(store, randomHashes(300, kDim, 10));
+  const std::string file = tempFile("checkpoint.bin");
+  ASSERT_TRUE(store.save(file, testInfo()));
+
+  // A periodic checkpoint of a mapped store, without any insert
+  HashStore mapped;
+  HashStoreInfo info;
+  ASSERT_TRUE(mapped.load(file, info, true));
+  ASSERT_TRUE(mapped.isMapped());
+  ASSERT_TRUE(mapped.save(file, info));
+  expectSameRows(store, mapped);
+
+  HashStore reloaded;
+  ASSERT_TRUE(reloaded.load(file, info, false));
+  expectSameRows(store, reloaded);
+  EXPECT_FALSE(std::ifstream(file + ".tmp").good());
+  std::remove(file.c_str());
+}
+
+TEST(HashStore, RejectsCorruptHeaders) {
+  HashStore store;
+  fill(store, randomHashes(20, kDim, 11));
+  const std::string file = tempFile("corrupt.bin");
+  ASSERT_TRUE(store.save(file, testInfo()));
+  std::string bytes;
+  {
+    std::ifstream in(file, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  // Offsets of count and ids_offset in the header
+  constexpr std::size_t kCountOffset = 40;
+  constexpr std::size_t kIdsOffset = 64;
+  const auto patched = [&](const std::size_t &at, const uint64_t &value) {
+    std::string out(bytes);
+    std::memcpy(&out[at], &value, sizeof(value));
+    std::ofstream(file, std::ios::binary | std::ios::trunc).write(out.data(), out.size());
+  };
+  HashStoreInfo info;
+  ASSERT_TRUE(HashStore::readInfo(file, info));
+
+  // count*stride*4 wraps around to a small size
+  patched(kCountOffset, (uint64_t{1} << 62) + 1);
+  EXPECT_FALSE(HashStore::readInfo(file, info));
+  EXPECT_FALSE(store.load(file, info));
+
+  // Ids not aligned to 4 bytes
+  uint64_t ids_offset;
+  std::memcpy(&ids_offset, &bytes[kIdsOffset], sizeof(ids_offset));
+  patched(kIdsOffset, ids_offset + 2);
+  EXPECT_FALSE(HashStore::readInfo(file, info));
+  EXPECT_FALSE(store.load(file, info));
+  EXPECT_EQ(store.size(), 20u);
+  std::remove(file.c_str());
+}
+
+TEST(HashStore, RejectsOtherDimensions) {
+  HashStore store;
+  EXPECT_FALSE(store.insert(0, {}));
+  ASSERT_TRUE(store.insert(0, std::vector<float>(kDim, 0.5f)));
+  EXPECT_FALSE(store.insert(1, std::vector<float>(kDim + 1, 0.5f)));
+  EXPECT_EQ(store.size(), 1u);
+}
+
+TEST(HashStore, EraseAndCompact) {
+  const auto hashes = randomHashes(300, kDim, 9);
+  HashStore store;
+  fill(store, hashes);
+  ASSERT_TRUE(store.idsSorted());
+
+  // Erase every third image
+  for (uint id=0; id < hashes.size(); id += 3) ASSERT_TRUE(store.erase(id));
+  EXPECT_FALSE(store.erase(0));
+  EXPECT_EQ(store.size(), 200u);
+  for (uint id=0; id < hashes.size(); id++) {
+    EXPECT_EQ(store.contains(id), id % 3 != 0) << id;
+    const float *row = store.find(id);
+    if (id % 3 == 0) {
+      EXPECT_EQ(row, nullptr);
+    } else {
+      ASSERT_NE(row, nullptr);
+      EXPECT_TRUE(std::equal(hashes[id].begin(), hashes[id].end(), row)) << id;
+    }
+  }
+
+  // The erased images are never returned
+  const auto before = search(store, hashes[1], 20);
+  for (const auto &c : before) EXPECT_NE(c.id % 3, 0u);
+
+  // Compaction sorts the rows again and keeps the same hashes
+  store.compact();
+  EXPECT_TRUE(store.idsSorted());
+  EXPECT_EQ(store.size(), 200u);
+  for (std::size_t r=1; r < store.size(); r++) EXPECT_LT(store.id(r - 1), store.id(r));
+  for (uint id=1; id < hashes.size(); id += 3) {
+    const float *row = store.find(id);
+    ASSERT_NE(row, nullptr);
+    EXPECT_TRUE(std::equal(hashes[id].begin(), hashes[id].end(), row)) << id;
+  }
+  const auto after = search(store, hashes[1], 20);
+  EXPECT_EQ(ids(before), ids(after));
+}
+
+TEST(HashStore, ReplaceKeepsOneRow) {
+  const auto hashes = randomHashes(2, kDim, 6);
+  HashStore store;
+  ASSERT_TRUE(store.insert(5, hashes[0]));
+  ASSERT_TRUE(store.insert(5, hashes[1]));
+  EXPECT_EQ(store.size(), 1u);
+  const float *row = store.find(5);
+  ASSERT_NE(row, nullptr);
+  EXPECT_TRUE(std::equal(hashes[1].begin(), hashes[1].end(), row));
+}
+
+// The compact encodings find the nearest neighbors of the float32 store
+class QuantizedRecall : public ::testing::TestWithParam<HashPrecision> {};
+
+TEST_P(QuantizedRecall, AgainstFloat) {
+  constexpr std::size_t kImages = 2000;
+  constexpr std::size_t kQueries = 50;
+  constexpr std::size_t kCandidates = 10;
+  const auto hashes = randomHashes(kImages, kDim, 7);
+  HashStore exact;
+  HashStore quantized(GetParam());
+  fill(exact, hashes);
+  fill(quantized, hashes);
+  ASSERT_EQ(quantized.encoding(), GetParam());
+  EXPECT_LT(quantized.bytes(), exact.bytes());
+
+  std::mt19937 rng(8);
+  std::vector<std::vector<Candidate>> reference, results;
+  for (std::size_t q=0; q < kQueries; q++) {
+    const auto query = perturb(hashes[q*37 % kImages], 0.2f, rng);
+    reference.push_back(search(exact, query, kCandidates));
+    results.push_back(search(quantized, query, kCandidates));
+    ASSERT_FALSE(results.back().empty());
+    EXPECT_EQ(results.back()[0].id, reference.back()[0].id);
+  }
+  EXPECT_GE(recall(reference, results), GetParam() == HashPrecision::kFloat16 ? 0.95 : 0.8);
+}
+
+INSTANTIATE_TEST_CASE_P(Encodings, QuantizedRecall,
+                        ::testing::Values(HashPrecision::kFloat16, HashPrecision::kInt8));
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,75 @@
+/**
+ * @file hash_test.cc
+ *
+ * @brief Tests of the hash generation: the batches and the projection basis.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/hash.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr int kCols = 128;
+
+// Random SIFT-like descriptors
+cv::Mat randomDescriptors(const int &rows, const uint32_t &seed) {
+  cv::Mat desc(rows, kCols, CV_32F);
+  cv::RNG rng(seed);
+  rng.fill(desc, cv::RNG::UNIFORM, 0.0f, 0.2f);
+  return desc;
+}
+
+}  // namespace
+
+// The hash of an image does not depend on the other images of its batch
+TEST(Hash, BatchEqualsSingleImages) {
+  const Hash hash(3, 500);
+  std::vector<cv::Mat> descs;
+  for (const int rows : {500, 17, 260, 499, 1, 320, 900}) {
+    descs.push_back(randomDescriptors(rows, static_cast<uint32_t>(descs.size() + 1)));
+  }
+  descs.push_back(cv::Mat());
+
+  std::vector<std::vector<float>> batch;
+  const auto status = hash.calcHashBatch(descs, {}, batch);
+  ASSERT_EQ(batch.size(), descs.size());
+  for (size_t i=0; i < descs.size(); i++) {
+    std::vector<float> single;
+    EXPECT_EQ(status[i], hash.calcHash(descs[i], single)) << i;
+    EXPECT_EQ(batch[i], single) << i;   // Bitwise
+
+    // Alone in its batch
+    std::vector<std::vector<float>> alone;
+    hash.calcHashBatch({descs[i]}, {}, alone);
+    EXPECT_EQ(alone[0], single) << i;
+  }
+  EXPECT_EQ(status.back(), Status::kNoDescriptors);
+}
+
+// The basis only depends on the seed: the first vector is the normalized
+// output of mt19937, which is fixed by the standard (not the one of
+// std::uniform_real_distribution)
+TEST(Hash, BasisIsPortable) {
+  const Hash hash(2, 100);
+  ASSERT_EQ(hash.basis().rows(), 2);
+  ASSERT_EQ(hash.basis().cols(), 100);
+  const float expected[] = {0.1299389f, 0.0216069892f, 0.144463211f, 0.133174106f};
+  for (int k=0; k < 4; k++) EXPECT_NEAR(hash.basis()(0, k), expected[k], 1e-6) << k;
+
+  // The same seed gives the same basis, another seed another one
+  EXPECT_EQ(Hash(2, 100).basisFingerprint(), hash.basisFingerprint());
+  EXPECT_NE(Hash(2, 100, 7).basisFingerprint(), hash.basisFingerprint());
+}
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,119 @@
+/**
+ * @file hnsw_test.cc
+ *
+ * @brief Tests of the HNSW index: recall against the exact scan, filters and
+ * removed images.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/hnsw.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr std::size_t kDim = 128;
+constexpr std::size_t kImages = 3000;
+constexpr std::size_t kCandidates = 10;
+
+// A store with its graph
+struct Indexed {
+  explicit Indexed(const std::vector<std::vector<float>> &hashes, const HnswIndex::Params &params = {}) :
+    index(store, params) {
+    for (uint id=0; id < hashes.size(); id++) {
+      EXPECT_TRUE(store.insert(id, hashes[id]));
+      EXPECT_TRUE(index.add(id));
+    }
+  }
+
+  std::vector<Candidate> search(const std::vector<float> &hash, const std::size_t &k,
+                                const HnswIndex::Filter &filter = nullptr) const {
+    AlignedVector<float> prepared;
+    store.prepareQuery(hash, prepared);
+    return index.search(prepared.data(), k, filter);
+  }
+
+  HashStore store;
+  HnswIndex index;
+};
+
+}  // namespace
+
+// The graph finds most of the exact nearest neighbours, more with a larger
+// ef_search
+TEST(HnswIndex, RecallAgainstExactScan) {
+  const auto hashes = randomHashes(kImages, kDim, 1);
+  Indexed indexed(hashes);
+  EXPECT_EQ(indexed.index.size(), kImages);
+  EXPECT_FALSE(indexed.index.add(5));   // Already indexed
+  EXPECT_FALSE(indexed.index.add(kImages));   // Not in the store
+
+  std::mt19937 rng(2);
+  std::vector<std::vector<float>> queries;
+  std::vector<std::vector<Candidate>> reference;
+  for (std::size_t q=0; q < 50; q++) {
+    queries.push_back(perturb(hashes[q*53 % kImages], 0.1f, rng));
+    reference.push_back(search(indexed.store, queries.back(), kCandidates));
+  }
+
+  double previous = 0.0;
+  for (const std::size_t ef : {16, 64, 256}) {
+    indexed.index.setEfSearch(ef);
+    std::vector<std::vector<Candidate>> results;
+    for (const auto &query : queries) {
+      results.push_back(indexed.search(query, kCandidates));
+      EXPECT_EQ(results.back().size(), kCandidates);
+      for (std::size_t i=1; i < results.back().size(); i++) {
+        EXPECT_LE(results.back()[i - 1].score, results.back()[i].score);
+      }
+    }
+    const double r = recall(reference, results);
+    EXPECT_GE(r, previous - 0.02) << ef;
+    previous = r;
+  }
+  EXPECT_GE(previous, 0.95);
+}
+
+// The filtered and removed images are never returned. When the filter removes
+// most of the neighbours the graph returns fewer than K (Haloc then falls
+// back to the exact scan)
+TEST(HnswIndex, FilterAndRemove) {
+  const auto hashes = randomHashes(1000, kDim, 3);
+  Indexed indexed(hashes);
+  std::mt19937 rng(4);
+  const auto query = perturb(hashes[10], 0.05f, rng);
+
+  const auto all = indexed.search(query, kCandidates);
+  ASSERT_FALSE(all.empty());
+  EXPECT_EQ(all[0].id, 10u);
+
+  const auto odd = indexed.search(query, kCandidates, [](const uint &id) {return id % 2 == 1;});
+  EXPECT_FALSE(odd.empty());
+  for (const auto &c : odd) EXPECT_EQ(c.id % 2, 1u);
+
+  const auto few = indexed.search(query, kCandidates, [](const uint &id) {return id >= 995;});
+  EXPECT_LT(few.size(), kCandidates);
+  for (const auto &c : few) EXPECT_GE(c.id, 995u);
+
+  indexed.index.remove(10);
+  EXPECT_TRUE(indexed.index.contains(10));   // Still routes the searches
+  const auto removed = indexed.search(query, kCandidates);
+  EXPECT_EQ(removed.size(), kCandidates);
+  for (const auto &c : removed) EXPECT_NE(c.id, 10u);
+
+  indexed.index.clear();
+  EXPECT_EQ(indexed.index.size(), 0u);
+  EXPECT_TRUE(indexed.search(query, kCandidates).empty());
+}
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,147 @@
+/**
+ * @file ignore_filter_test.cc
+ *
+ * @brief Tests of the ignore filter: range merging, the row intervals of the
+ * scan and the bitset / predicate exclusions.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/ignore_filter.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+using Ranges = std::vector<IgnoreFilter::Range>;
+using Intervals = std::vector<std::pair<std::size_t, std::size_t>>;
+
+}  // namespace
+
+TEST(IgnoreFilter, MergesRanges) {
+  IgnoreFilter filter;
+  EXPECT_TRUE(filter.empty());
+  filter.addRange(10, 20).addRange(30, 40);
+  EXPECT_EQ(filter.ranges(), Ranges({{10, 20}, {30, 40}}));
+
+  // Adjacent and overlapping ranges are merged
+  filter.addRange(20, 25);
+  EXPECT_EQ(filter.ranges(), Ranges({{10, 25}, {30, 40}}));
+  filter.addRange(5, 12);
+  EXPECT_EQ(filter.ranges(), Ranges({{5, 25}, {30, 40}}));
+  filter.addRange(24, 31);
+  EXPECT_EQ(filter.ranges(), Ranges({{5, 40}}));
+  filter.addRange(0, 100);
+  EXPECT_EQ(filter.ranges(), Ranges({{0, 100}}));
+
+  // Empty ranges are ignored
+  filter.addRange(200, 200).addRange(300, 250);
+  EXPECT_EQ(filter.ranges(), Ranges({{0, 100}}));
+
+  // Ids in the middle, before and after
+  filter.addId(150).addId(102).addId(101);
+  EXPECT_EQ(filter.ranges(), Ranges({{0, 100}, {101, 103}, {150, 151}}));
+  filter.addId(100);
+  EXPECT_EQ(filter.ranges(), Ranges({{0, 103}, {150, 151}}));
+}
+
+TEST(IgnoreFilter, SetsAreRanges) {
+  const IgnoreFilter from_set(std::set<uint>({1, 2, 3, 7, 9, 10}));
+  EXPECT_EQ(from_set.ranges(), Ranges({{1, 4}, {7, 8}, {9, 11}}));
+  const IgnoreFilter from_list({10, 9, 3, 1, 2, 7});
+  EXPECT_EQ(from_list.ranges(), from_set.ranges());
+
+  // The largest id fits
+  const uint last = std::numeric_limits<uint>::max();
+  const IgnoreFilter largest({last});
+  EXPECT_TRUE(largest.ignored(last));
+  EXPECT_FALSE(largest.ignored(last - 1));
+}
+
+TEST(IgnoreFilter, Ignored) {
+  IgnoreFilter filter;
+  filter.addRange(10, 20).addId(25);
+  for (uint id=0; id < 40; id++) {
+    EXPECT_EQ(filter.ignored(id), (id >= 10 && id < 20) || id == 25) << id;
+  }
+
+  // Bitset and predicate
+  auto bits = std::make_shared<std::vector<uint64_t>>(2, 0);
+  (*bits)[1] |= uint64_t{1} << 3;   // Id 67
+  filter.setBitset(bits).setPredicate([](const uint &id) {return id == 90;});
+  EXPECT_TRUE(filter.hasTest());
+  EXPECT_TRUE(filter.ignored(67));
+  EXPECT_TRUE(filter.ignored(90));
+  EXPECT_FALSE(filter.ignored(68));
+  EXPECT_FALSE(filter.ignored(1000));   // Out of the bitset
+  EXPECT_TRUE(filter.ignoredByTest(67));
+  EXPECT_FALSE(filter.ignoredByTest(15));
+
+  // The bitset is shared with the caller
+  (*bits)[0] |= 1;
+  EXPECT_TRUE(filter.ignored(0));
+}
+
+TEST(IgnoreFilter, RowIntervals) {
+  // Sorted ids with gaps
+  const std::vector<uint> ids = {0, 1, 2, 5, 6, 7, 10, 11, 20, 30};
+  IgnoreFilter filter;
+  filter.addRange(2, 6).addRange(10, 12).addRange(25, 100);
+  Intervals rows;
+  filter.rowIntervals(ids.data(), 0, ids.size(), rows);
+  EXPECT_EQ(rows, Intervals({{0, 2}, {4, 6}, {8, 9}}));
+
+  // A block of the rows
+  filter.rowIntervals(ids.data(), 3, 8, rows);
+  EXPECT_EQ(rows, Intervals({{4, 6}}));
+
+  // Ranges before and after the rows, or covering all of them
+  IgnoreFilter outside;
+  outside.addRange(100, 200);
+  outside.rowIntervals(ids.data(), 0, ids.size(), rows);
+  EXPECT_EQ(rows, Intervals({{0, ids.size()}}));
+  IgnoreFilter all;
+  all.addRange(0, 1000);
+  all.rowIntervals(ids.data(), 0, ids.size(), rows);
+  EXPECT_TRUE(rows.empty());
+  IgnoreFilter none;
+  none.rowIntervals(ids.data(), 2, 5, rows);
+  EXPECT_EQ(rows, Intervals({{2, 5}}));
+}
+
+// The scan skips the ignored ranges: same candidates as testing every row
+TEST(IgnoreFilter, ScanSkipsRanges) {
+  const auto hashes = randomHashes(500, 128, 1);
+  HashStore store;
+  for (uint id=0; id < hashes.size(); id++) ASSERT_TRUE(store.insert(id, hashes[id]));
+  ASSERT_TRUE(store.idsSorted());
+
+  IgnoreFilter ranges;
+  ranges.addRange(0, 100).addRange(150, 300).addId(420);
+  IgnoreFilter predicate;
+  predicate.setPredicate([&ranges](const uint &id) {return ranges.ignored(id);});
+
+  std::mt19937 rng(2);
+  for (const uint q : {50u, 200u, 350u, 420u}) {
+    const auto query = perturb(hashes[q], 0.1f, rng);
+    const auto skipped = search(store, query, 20, ScanParams(), ranges);
+    const auto tested = search(store, query, 20, ScanParams(), predicate);
+    EXPECT_EQ(ids(skipped), ids(tested)) << q;
+    for (const auto &c : skipped) EXPECT_FALSE(ranges.ignored(c.id));
+  }
+}
+
+}  // namespace test
+}  // namespace haloc
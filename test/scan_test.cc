@@ -0,0 +1,81 @@
+/**
+ * @file scan_test.cc
+ *
+ * @brief Tests of the exact scan: the early abandon and the split of the rows
+ * do not change the selection nor its scores.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/hash_store.h"
+#include "libhaloc/scan.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr std::size_t kImages = 4000;
+constexpr std::size_t kCandidates = 10;
+
+// Selection of the rows [begin, end) split in chunks of the given size (as
+// the tasks of a parallel scan), merged in a single top-K
+std::vector<Candidate> scanChunks(const HashStore &store, const AlignedVector<float> &prepared,
+                                  const std::size_t &chunk, const ScanParams &params) {
+  TopK top_k(kCandidates);
+  for (std::size_t b=0; b < store.size(); b += chunk) {
+    TopK part(kCandidates);
+    scanRows(store, prepared.data(), 1, b, std::min(store.size(), b + chunk), {}, &part, params);
+    top_k.merge(part);
+  }
+  return top_k.sorted();
+}
+
+void expectSame(const std::vector<Candidate> &a, const std::vector<Candidate> &b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (std::size_t i=0; i < a.size(); i++) {
+    EXPECT_EQ(a[i].id, b[i].id) << i;
+    EXPECT_EQ(a[i].score, b[i].score) << i;   // Bitwise, not approximately
+  }
+}
+
+}  // namespace
+
+class ScanDeterminism : public ::testing::TestWithParam<std::size_t> {};
+
+TEST_P(ScanDeterminism, EarlyAbandonAndChunksKeepTheScores) {
+  const std::size_t dim = GetParam();
+  const auto hashes = randomHashes(kImages, dim, 1);
+  HashStore store;
+  for (std::size_t i=0; i < hashes.size(); i++) ASSERT_TRUE(store.insert(static_cast<uint>(i), hashes[i]));
+
+  ScanParams full;
+  full.early_abandon = false;
+  ScanParams natural;
+  natural.variance_order = false;
+  const ScanParams variance;
+
+  const auto queries = randomHashes(20, dim, 2);
+  for (const auto &query : queries) {
+    AlignedVector<float> prepared;
+    store.prepareQuery(query, prepared);
+    const auto reference = scanChunks(store, prepared, kImages, full);
+    for (const std::size_t chunk : {kImages, std::size_t(1000), std::size_t(777), std::size_t(300)}) {
+      expectSame(reference, scanChunks(store, prepared, chunk, full));
+      expectSame(reference, scanChunks(store, prepared, chunk, natural));
+      expectSame(reference, scanChunks(store, prepared, chunk, variance));
+    }
+  }
+}
+
+// A fixed-length kernel and the dynamic one
+INSTANTIATE_TEST_CASE_P(Dims, ScanDeterminism, ::testing::Values(std::size_t(256), std::size_t(200)));
+
+}  // namespace test
+}  // namespace haloc
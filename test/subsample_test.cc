@@ -0,0 +1,159 @@
+/**
+ * @file subsample_test.cc
+ *
+ * @brief Tests of the descriptor selection: the reservoir, top-response and
+ * spatial strategies are reproducible and select what they promise.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/subsample.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+SubsampleParams withStrategy(const SubsampleStrategy &strategy) {
+  SubsampleParams params;
+  params.strategy = strategy;
+  return params;
+}
+
+// Keypoints spread over a 640x480 image, with random responses
+std::vector<cv::KeyPoint> randomKeypoints(const int &n, const uint32_t &seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> x(0.0f, 640.0f), y(0.0f, 480.0f), response(0.0f, 1.0f);
+  std::vector<cv::KeyPoint> kps;
+  for (int i=0; i < n; i++) kps.emplace_back(x(rng), y(rng), 10.0f, -1.0f, response(rng));
+  return kps;
+}
+
+void expectValid(const std::vector<int> &indices, const int &num_rows, const int &max_rows) {
+  ASSERT_EQ(static_cast<int>(indices.size()), std::min(num_rows, max_rows));
+  for (std::size_t i=0; i < indices.size(); i++) {
+    EXPECT_GE(indices[i], 0);
+    EXPECT_LT(indices[i], num_rows);
+    if (i > 0) EXPECT_LT(indices[i - 1], indices[i]);   // Sorted, no repetitions
+  }
+}
+
+}  // namespace
+
+TEST(Subsample, SmallImagesKeepEverything) {
+  std::vector<int> indices;
+  for (const auto strategy : {SubsampleStrategy::kReservoir, SubsampleStrategy::kTopResponse,
+                              SubsampleStrategy::kSpatial}) {
+    subsampleDescriptors(30, 50, randomKeypoints(30, 1), withStrategy(strategy), 1, indices);
+    std::vector<int> all(30);
+    std::iota(all.begin(), all.end(), 0);
+    EXPECT_EQ(indices, all);
+  }
+  subsampleDescriptors(30, 0, {}, SubsampleParams(), 1, indices);
+  EXPECT_TRUE(indices.empty());
+  subsampleDescriptors(0, 10, {}, SubsampleParams(), 1, indices);
+  EXPECT_TRUE(indices.empty());
+}
+
+// The same seed gives the same sample, and every row is equally likely
+TEST(Subsample, ReservoirIsSeeded) {
+  constexpr int kRows = 100;
+  constexpr int kMax = 10;
+  const SubsampleParams params;
+  std::vector<int> first, second, other;
+  subsampleDescriptors(kRows, kMax, {}, params, 7, first);
+  subsampleDescriptors(kRows, kMax, {}, params, 7, second);
+  subsampleDescriptors(kRows, kMax, {}, params, 8, other);
+  expectValid(first, kRows, kMax);
+  EXPECT_EQ(first, second);
+  EXPECT_NE(first, other);
+
+  // Fixed output for a fixed seed, whatever the standard library
+  EXPECT_EQ(first, std::vector<int>({3, 13, 19, 21, 27, 36, 48, 55, 60, 89}));
+
+  constexpr int kSeeds = 2000;
+  std::vector<int> count(kRows, 0);
+  for (uint32_t seed=0; seed < kSeeds; seed++) {
+    subsampleDescriptors(kRows, kMax, {}, params, seed, other);
+    for (const int &i : other) count[i]++;
+  }
+  const int expected = kSeeds*kMax/kRows;
+  for (int i=0; i < kRows; i++) {
+    EXPECT_GT(count[i], expected/2) << i;
+    EXPECT_LT(count[i], expected*3/2) << i;
+  }
+}
+
+// The strongest keypoints, the lower index first on equal responses. Without
+// one keypoint per descriptor the selection is the reservoir one
+TEST(Subsample, TopResponse) {
+  constexpr int kMax = 20;
+  const auto params = withStrategy(SubsampleStrategy::kTopResponse);
+  const auto kps = randomKeypoints(200, 2);
+  std::vector<int> indices;
+  subsampleDescriptors(200, kMax, kps, params, 1, indices);
+  expectValid(indices, 200, kMax);
+
+  std::vector<float> responses;
+  for (const auto &kp : kps) responses.push_back(kp.response);
+  std::sort(responses.begin(), responses.end(), std::greater<float>());
+  for (const int &i : indices) EXPECT_GE(kps[i].response, responses[kMax - 1]) << i;
+
+  std::vector<cv::KeyPoint> ties(50, cv::KeyPoint(10.0f, 10.0f, 10.0f, -1.0f, 1.0f));
+  ties[40].response = 2.0f;
+  subsampleDescriptors(50, 5, ties, params, 1, indices);
+  EXPECT_EQ(indices, std::vector<int>({0, 1, 2, 3, 40}));
+
+  std::vector<int> reservoir;
+  subsampleDescriptors(201, kMax, kps, params, 3, indices);
+  subsampleDescriptors(201, kMax, {}, SubsampleParams(), 3, reservoir);
+  EXPECT_EQ(indices, reservoir);
+}
+
+// Every cell of the grid keeps its strongest keypoint, even when another
+// cell has all the strong ones
+TEST(Subsample, SpatialCoversTheGrid) {
+  SubsampleParams params = withStrategy(SubsampleStrategy::kSpatial);
+  params.grid_cols = 2;
+  params.grid_rows = 2;
+
+  // 20 strong keypoints in the top-left cell, two weak ones in the others
+  std::vector<cv::KeyPoint> kps;
+  for (int i=0; i < 20; i++) kps.emplace_back(i*1.5f, i*1.5f, 10.0f, -1.0f, 100.0f + i);
+  kps.emplace_back(70.0f, 10.0f, 10.0f, -1.0f, 1.0f);   // 20: top-right
+  kps.emplace_back(75.0f, 15.0f, 10.0f, -1.0f, 2.0f);   // 21: top-right, stronger
+  kps.emplace_back(10.0f, 70.0f, 10.0f, -1.0f, 1.0f);   // 22: bottom-left
+  kps.emplace_back(10.0f, 75.0f, 10.0f, -1.0f, 1.0f);   // 23: bottom-left, same response
+  kps.emplace_back(80.0f, 80.0f, 10.0f, -1.0f, 1.0f);   // 24: bottom-right
+  kps.emplace_back(70.0f, 70.0f, 10.0f, -1.0f, 0.5f);   // 25: bottom-right
+  const int n = static_cast<int>(kps.size());
+
+  std::vector<int> indices;
+  subsampleDescriptors(n, 4, kps, params, 1, indices);
+  EXPECT_EQ(indices, std::vector<int>({19, 21, 22, 24}));
+
+  // The second round takes the strongest of the second best of every cell
+  subsampleDescriptors(n, 5, kps, params, 1, indices);
+  EXPECT_EQ(indices, std::vector<int>({18, 19, 21, 22, 24}));
+
+  // Reproducible, also with other keypoints in between
+  const auto random = randomKeypoints(500, 4);
+  std::vector<int> first, second, other;
+  subsampleDescriptors(500, 50, random, params, 1, first);
+  subsampleDescriptors(n, 4, kps, params, 1, other);
+  subsampleDescriptors(500, 50, random, params, 2, second);
+  expectValid(first, 500, 50);
+  EXPECT_EQ(first, second);
+}
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,130 @@
+/**
+ * @file temporal_cache_test.cc
+ *
+ * @brief Tests of the temporal cache: the reused selections are the ones of
+ * the search.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "libhaloc/temporal_cache.h"
+#include "test_utils.h"
+
+namespace haloc {
+namespace test {
+
+namespace {
+
+constexpr std::size_t kDim = 256;
+constexpr std::size_t kCandidates = 5;
+
+TemporalParams reuseParams() {
+  TemporalParams params;
+  params.enabled = true;
+  params.epsilon = 0.5f;
+  return params;
+}
+
+// A query through the cache, as Haloc does with Config::temporal
+std::vector<Candidate> cachedQuery(TemporalCache &cache, const HashStore &store, const std::vector<float> &hash,
+                                   const IgnoreFilter &images_to_ignore) {
+  AlignedVector<float> prepared;
+  store.prepareQuery(hash, prepared);
+  std::vector<Candidate> out(kCandidates);
+  const std::size_t n = cache.reuse(store, prepared.data(), hash, images_to_ignore, Span<Candidate>(out));
+  if (n > 0) {
+    out.resize(n);
+    return out;
+  }
+  const auto searched = search(store, hash, cache.searchSize(kCandidates), ScanParams(), images_to_ignore);
+  cache.update(store, hash, images_to_ignore, searched.data(), searched.size(), cache.searchSize(kCandidates));
+  return std::vector<Candidate>(searched.begin(), searched.begin() + std::min(kCandidates, searched.size()));
+}
+
+void expectSame(const std::vector<Candidate> &cached, const std::vector<Candidate> &expected) {
+  ASSERT_EQ(cached.size(), expected.size());
+  for (std::size_t i=0; i < cached.size(); i++) {
+    EXPECT_EQ(cached[i].id, expected[i].id) << i;
+    EXPECT_FLOAT_EQ(cached[i].score, expected[i].score) << i;
+  }
+}
+
+}  // namespace
+
+// A robot standing still with a sliding window of ignored images: the images
+// leaving the window are found by the reused selections
+TEST(TemporalCache, SlidingWindowEqualsSearch) {
+  const auto hashes = randomHashes(300, kDim, 1);
+  HashStore store;
+  for (uint id=0; id < hashes.size(); id++) ASSERT_TRUE(store.insert(id, hashes[id]));
+
+  // Next to image 120, which is ignored by the first frames
+  std::mt19937 rng(2);
+  const auto place = perturb(hashes[120], 0.05f, rng);
+  TemporalCache cache(reuseParams());
+  for (uint frame=0; frame < 60; frame++) {
+    const auto hash = perturb(place, 0.001f, rng);
+    IgnoreFilter ignore;
+    ignore.addRange(frame + 100, frame + 200);
+    const auto expected = search(store, hash, kCandidates, ScanParams(), ignore);
+    expectSame(cachedQuery(cache, store, hash, ignore), expected);
+    if (frame > 20) {
+      ASSERT_FALSE(expected.empty());
+      EXPECT_EQ(expected[0].id, 120u) << frame;
+    }
+  }
+  EXPECT_GT(cache.hits(), 0u);
+}
+
+// A reused selection also scores the images appended since the search
+TEST(TemporalCache, AppendedRowsEqualSearch) {
+  const auto hashes = randomHashes(200, kDim, 3);
+  HashStore store;
+  for (uint id=0; id < 100; id++) ASSERT_TRUE(store.insert(id, hashes[id]));
+
+  std::mt19937 rng(4);
+  const auto place = perturb(hashes[150], 0.05f, rng);
+  TemporalCache cache(reuseParams());
+  for (uint id=100; id < hashes.size(); id++) {
+    const auto hash = perturb(place, 0.001f, rng);
+    const IgnoreFilter ignore({id - 1});
+    expectSame(cachedQuery(cache, store, hash, ignore), search(store, hash, kCandidates, ScanParams(), ignore));
+    ASSERT_TRUE(store.insert(id, hashes[id]));
+  }
+  EXPECT_GT(cache.hits(), 0u);
+}
+
+// What a bitset ignored may change between frames, so it is never reused
+TEST(TemporalCache, BitsetIsNotReused) {
+  const auto hashes = randomHashes(100, kDim, 5);
+  HashStore store;
+  for (uint id=0; id < hashes.size(); id++) ASSERT_TRUE(store.insert(id, hashes[id]));
+
+  auto bits = std::make_shared<std::vector<uint64_t>>(2, 0);
+  (*bits)[0] |= uint64_t{1} << 10;
+  IgnoreFilter ignore;
+  ignore.setBitset(bits);
+  std::mt19937 rng(6);
+  const auto hash = perturb(hashes[10], 0.05f, rng);
+  TemporalCache cache(reuseParams());
+  const auto first = cachedQuery(cache, store, hash, ignore);
+  ASSERT_FALSE(first.empty());
+  EXPECT_NE(first[0].id, 10u);
+
+  (*bits)[0] = 0;
+  const auto second = cachedQuery(cache, store, hash, ignore);
+  ASSERT_FALSE(second.empty());
+  EXPECT_EQ(second[0].id, 10u);
+  EXPECT_EQ(cache.hits(), 0u);
+}
+
+}  // namespace test
+}  // namespace haloc
@@ -0,0 +1,113 @@
+/**
+ * @file test_utils.h
+ *
+ * @brief Helpers shared by the unit tests: synthetic hashes, temporary files
+ * and exact searches.
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "libhaloc/hash_store.h"
+#include "libhaloc/ignore_filter.h"
+#include "libhaloc/scan.h"
+#include "libhaloc/top_k.h"
+
+namespace haloc {
+namespace test {
+
+/**
+ * @brief      Random hashes with elements in [0, 1] (the range of calcHash()).
+ *
+ * @param[in]  n     The number of hashes
+ * @param[in]  dim   The hash dimension
+ * @param[in]  seed  The seed
+ *
+ * @return     The hashes
+ */
+inline std::vector<std::vector<float>> randomHashes(const std::size_t &n, const std::size_t &dim,
+                                                    const uint32_t &seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> u(0.0f, 1.0f);
+  std::vector<std::vector<float>> hashes(n, std::vector<float>(dim));
+  for (auto &h : hashes) {
+    for (auto &x : h) x = u(rng);
+  }
+  return hashes;
+}
+
+/**
+ * @brief      A noisy copy of a hash (a revisited place).
+ *
+ * @param[in]  hash   The hash
+ * @param[in]  noise  The amplitude of the noise
+ * @param      rng    The generator
+ *
+ * @return     The noisy hash
+ */
+inline std::vector<float> perturb(const std::vector<float> &hash, const float &noise, std::mt19937 &rng) {
+  std::uniform_real_distribution<float> u(-noise, noise);
+  std::vector<float> out(hash);
+  for (auto &x : out) x += u(rng);
+  return out;
+}
+
+/**
+ * @brief      Unique name for a temporary file of a test.
+ *
+ * @param[in]  name  The base name
+ *
+ * @return     The path
+ */
+inline std::string tempFile(const std::string &name) {
+  return "/tmp/haloc_test_" + std::to_string(getpid()) + "_" + name;
+}
+
+/**
+ * @brief      Exact K nearest hashes of a store (one scanRows() over all the
+ *             rows).
+ *
+ * @param[in]  store             The store
+ * @param[in]  hash              The query hash
+ * @param[in]  k                 The number of candidates
+ * @param[in]  params            The scan parameters
+ * @param[in]  images_to_ignore  The images to ignore
+ *
+ * @return     The candidates (L2 distance), from best to worst
+ */
+inline std::vector<Candidate> search(const HashStore &store, const std::vector<float> &hash,
+                                     const std::size_t &k, const ScanParams &params = ScanParams(),
+                                     const IgnoreFilter &images_to_ignore = {}) {
+  AlignedVector<float> prepared;
+  store.prepareQuery(hash, prepared);
+  TopK top_k(k);
+  scanRows(store, prepared.data(), 1, 0, store.size(), images_to_ignore, &top_k, params);
+  auto candidates = top_k.sorted();
+  squaredToDistance(candidates.data(), candidates.size());
+  return candidates;
+}
+
+/**
+ * @brief      Ids of a list of candidates.
+ *
+ * @param[in]  candidates  The candidates
+ *
+ * @return     The ids, in the same order
+ */
+inline std::vector<uint> ids(const std::vector<Candidate> &candidates) {
+  std::vector<uint> out;
+  for (const auto &c : candidates) out.push_back(c.id);
+  return out;
+}
+
+}  // namespace test
+}  // namespace haloc
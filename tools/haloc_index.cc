@@ -0,0 +1,102 @@
+/**
+ * @file haloc_index.cc
+ *
+ * @brief Builds a hash database (the file read by Haloc::load()) from a
+ * directory of images or an image list, with haloc::BulkIndexer.
+ *
+ * Usage: haloc_index <images> <database> [options]
+ *   images       A directory (images sorted by name, ids from 0) or a list
+ *                file with one "path" or "id path" per line
+ *   database     The output database file
+ * Options:
+ *   --num_proj <n>     Projections (2)
+ *   --max_desc <n>     Maximum descriptors (1024)
+ *   --seed <n>         Seed of the projection basis
+ *   --descriptor <d>   Descriptors: sift, orb or akaze (sift)
+ *   --precision <p>    Store precision: f32, f16 or int8 (f32)
+ *   --width <w>        Images downscaled to this width before the extraction
+ *   --workers <n>      Decoding, extraction and hashing threads (all the cores)
+ *   --batch <n>        Images hashed by every matrix product (32)
+ *   --first_id <n>     Identifier of the first image of a directory (0)
+ *
+ * @author Pep Lluis Negre Carrasco
+ * @date 2018
+ */
+
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "libhaloc/bulk_indexer.h"
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <images> <database> [--num_proj n] [--max_desc n] [--seed n]"
+              << " [--descriptor sift|orb|akaze] [--precision f32|f16|int8] [--width w] [--workers n] [--batch n] [--first_id n]" << std::endl;
+    return 1;
+  }
+
+  haloc::Config config;
+  haloc::BulkIndexParams params;
+  uint first_id = 0;
+  for (int a=3; a < argc; a++) {
+    const std::string arg = argv[a];
+    const bool has_value = a + 1 < argc;
+    if (arg == "--num_proj" && has_value) {
+      config.num_proj = std::atoi(argv[++a]);
+    } else if (arg == "--max_desc" && has_value) {
+      config.max_desc = std::atoi(argv[++a]);
+    } else if (arg == "--seed" && has_value) {
+      config.seed = std::strtoul(argv[++a], nullptr, 10);
+    } else if (arg == "--descriptor" && has_value) {
+      const std::string d = argv[++a];
+      config.descriptor = d == "orb" ? haloc::DescriptorType::kOrb :
+                          d == "akaze" ? haloc::DescriptorType::kAkaze : haloc::DescriptorType::kSift;
+    } else if (arg == "--precision" && has_value) {
+      const std::string p = argv[++a];
+      config.store_precision = p == "f16" ? haloc::HashPrecision::kFloat16 :
+                               p == "int8" ? haloc::HashPrecision::kInt8 : haloc::HashPrecision::kFloat32;
+    } else if (arg == "--width" && has_value) {
+      config.extraction.target_width = std::atoi(argv[++a]);
+    } else if (arg == "--workers" && has_value) {
+      params.workers = std::atoi(argv[++a]);
+    } else if (arg == "--batch" && has_value) {
+      params.batch_size = std::atoi(argv[++a]);
+    } else if (arg == "--first_id" && has_value) {
+      first_id = std::strtoul(argv[++a], nullptr, 10);
+    } else {
+      std::cerr << "[haloc_index]: ERROR -> Unknown option " << arg << "." << std::endl;
+      return 1;
+    }
+  }
+
+  const std::string input = argv[1];
+  const auto entries = std::filesystem::is_directory(input) ?
+    haloc::BulkIndexer::listDirectory(input, first_id) : haloc::BulkIndexer::listFile(input);
+  if (entries.empty()) {
+    std::cerr << "[haloc_index]: ERROR -> No images in " << input << "." << std::endl;
+    return 1;
+  }
+
+  haloc::BulkIndexer indexer(config, params);
+  size_t reported = 0;
+  const auto report = indexer.index(entries, [&](const size_t &done, const size_t &total) {
+    // About every 1% of the images
+    if (done != total && done < reported + std::max<size_t>(1, total / 100)) return;
+    reported = done;
+    std::cerr << "\r" << done << " / " << total << " images" << std::flush;
+  });
+  std::cerr << std::endl;
+
+  for (const auto &f : report.failed) {
+    std::cerr << "[haloc_index]: WARNING -> Image " << f.first << ": " << haloc::statusMessage(f.second) << "." << std::endl;
+  }
+  std::cout << report.indexed << " images indexed, " << report.failed.size() << " failed, "
+            << std::fixed << std::setprecision(1) << report.seconds << " s ("
+            << report.indexed / std::max(report.seconds, 1e-9) << " images/s)" << std::endl;
+
+  if (!indexer.save(argv[2])) return 1;
+  return 0;
+}